@@ -0,0 +1,189 @@
+/************************************************************************
+*
+*	arena.c - Arena allocator and string interning
+*
+************************************************************************/
+
+#include <string.h>
+#include <malloc.h>
+#include "arena.h"
+
+#define ARENA_ALIGN        8
+#define STRTAB_MIN_SLOTS   1024
+
+/* chunk header; memory follows */
+typedef struct _arenaChunk {
+	struct _arenaChunk* next;
+	void*               align;
+}arenaChunk;
+
+/**
+* Initialize arena
+* \arg root Arena
+* \arg chunkSize Bytes obtained from malloc at once
+*/
+arena* arenaInit (arena* root, unsigned long chunkSize) {
+	root->chunks = 0;
+	root->cursor = 0;
+	root->limit = 0;
+	root->chunkSize = chunkSize;
+	root->used = 0;
+	root->reserved = 0;
+	return root;
+}
+
+/**
+* Allocates memory
+* \ret Pointer aligned to 8 bytes or 0 on error
+*/
+void* arenaAlloc (arena* root, unsigned long size) {
+
+	void* p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(unsigned long) (ARENA_ALIGN - 1);
+
+	if (!root->cursor || (unsigned long) (root->limit - root->cursor) < size) {
+
+		// large requests get a chunk of their own
+		unsigned long chunkSize = size > root->chunkSize ? size : root->chunkSize;
+		arenaChunk*   chunk = (arenaChunk*) malloc (sizeof (arenaChunk) + chunkSize);
+		if (!chunk)
+			return 0;
+		chunk->next = (arenaChunk*) root->chunks;
+		root->chunks = chunk;
+		root->cursor = (char*) (chunk + 1);
+		root->limit = root->cursor + chunkSize;
+		root->reserved += chunkSize;
+	}
+
+	p = root->cursor;
+	root->cursor += size;
+	root->used += size;
+	return p;
+}
+
+/**
+* Copies string into arena
+*/
+char* arenaStrdup (arena* root, const char* str) {
+
+	unsigned long length = (unsigned long) strlen (str) + 1;
+	char* p = (char*) arenaAlloc (root, length);
+	if (p)
+		memcpy (p, str, length);
+	return p;
+}
+
+/**
+*	returns bytes handed out by arena
+*/
+unsigned long arenaUsed (arena* root) {
+	return root->used;
+}
+
+/**
+*	frees all memory allocated from arena
+*/
+void arenaFree (arena* root) {
+
+	arenaChunk* chunk = (arenaChunk*) root->chunks;
+	while (chunk) {
+		arenaChunk* next = chunk->next;
+		free (chunk);
+		chunk = next;
+	}
+	arenaInit (root, root->chunkSize);
+}
+
+/* FNV-1a */
+static unsigned int strtabHash (const char* str) {
+	unsigned int hash = 2166136261u;
+	while (*str)
+		hash = (hash ^ (unsigned char) *str++) * 16777619u;
+	return hash;
+}
+
+static int strtabGrow (strtab* root) {
+
+	unsigned int  size = root->mask ? (root->mask + 1) * 2 : STRTAB_MIN_SLOTS;
+	const char**  slots = (const char**) calloc (size, sizeof (const char*));
+	unsigned int* hashes = (unsigned int*) malloc (size * sizeof (unsigned int));
+	unsigned int  i;
+
+	if (!slots || !hashes) {
+		free ((void*) slots);
+		free (hashes);
+		return 0;
+	}
+	for (i = 0; root->mask && i <= root->mask; i++) {
+		unsigned int j;
+		if (!root->slots[i])
+			continue;
+		for (j = root->hashes[i] & (size - 1); slots[j]; j = (j + 1) & (size - 1))
+			;
+		slots[j] = root->slots[i];
+		hashes[j] = root->hashes[i];
+	}
+	free ((void*) root->slots);
+	free (root->hashes);
+	root->slots = slots;
+	root->hashes = hashes;
+	root->mask = size - 1;
+	return 1;
+}
+
+/**
+* Initialize string table
+* \arg root String table
+* \arg heap Arena that stores the strings
+*/
+strtab* strtabInit (strtab* root, arena* heap) {
+	memset (root, 0, sizeof (strtab));
+	root->heap = heap;
+	return root;
+}
+
+/**
+* Returns the single stored copy of a string
+* \ret Interned string or 0 on error
+*/
+const char* strtabIntern (strtab* root, const char* str) {
+
+	unsigned int hash;
+	unsigned int i;
+	char*        copy;
+
+	if (!str)
+		return 0;
+
+	// keep the table at most half full
+	if ((root->count + 1) * 2 > root->mask + 1 && !strtabGrow (root))
+		return 0;
+
+	root->lookups++;
+	hash = strtabHash (str);
+	for (i = hash & root->mask; root->slots[i]; i = (i + 1) & root->mask) {
+		if (root->hashes[i] == hash && strcmp (root->slots[i], str) == 0) {
+			root->hits++;
+			return root->slots[i];
+		}
+	}
+
+	copy = arenaStrdup (root->heap, str);
+	if (!copy)
+		return 0;
+	root->slots[i] = copy;
+	root->hashes[i] = hash;
+	root->count++;
+	root->bytes += (unsigned long) strlen (copy) + 1;
+	return copy;
+}
+
+/**
+*	frees table; the strings are released with the arena
+*/
+void strtabFree (strtab* root) {
+	free ((void*) root->slots);
+	free (root->hashes);
+	strtabInit (root, root->heap);
+}
@@ -0,0 +1,62 @@
+/************************************************************************
+*
+*	arena.h - Arena allocator and string interning
+*
+************************************************************************/
+
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+/**
+*	bump allocator. Memory is carved from large chunks and is
+*	only released all at once by arenaFree.
+*/
+typedef struct _arena {
+	void*         chunks;
+	char*         cursor;
+	char*         limit;
+	unsigned long chunkSize;
+	unsigned long used;		/* bytes handed out */
+	unsigned long reserved;	/* bytes obtained from malloc */
+}arena;
+
+extern
+arena* arenaInit (arena* root, unsigned long chunkSize);
+
+extern
+void* arenaAlloc (arena* root, unsigned long size);
+
+extern
+char* arenaStrdup (arena* root, const char* str);
+
+extern
+unsigned long arenaUsed (arena* root);
+
+extern
+void arenaFree (arena* root);
+
+/**
+*	string intern table. Each distinct string is stored once in
+*	the arena; interning an existing string returns the stored copy.
+*/
+typedef struct _strtab {
+	arena*        heap;
+	const char**  slots;
+	unsigned int* hashes;
+	unsigned int  mask;
+	unsigned int  count;
+	unsigned long bytes;	/* bytes of unique strings */
+	unsigned long lookups;
+	unsigned long hits;
+}strtab;
+
+extern
+strtab* strtabInit (strtab* root, arena* heap);
+
+extern
+const char* strtabIntern (strtab* root, const char* str);
+
+extern
+void strtabFree (strtab* root);
+
+#endif
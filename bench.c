@@ -0,0 +1,436 @@
+/********************************************
+*
+*	bench.c - Debugger benchmarks
+*
+********************************************/
+
+/*
+	This component measures the debugger end to end against the target
+	of the current session: time from launch to the first stop, register
+	fetch latency, bulk memory read rate, breakpoint round trip, the cost
+	of a breakpoint that is hit but does not stop (the false path of a
+	conditional breakpoint), single step rate and the latency of stopping
+	every thread.
+
+	The benchmark runs on the session thread and drives the target
+	itself. Its own event procedure stands in for the front end while it
+	runs, so stops are not reported on the console. Breakpoint tests need
+	an address the target executes over and over; bench.sim is a
+	simulated reference target for them.
+
+	Results are written as JSON and may be compared with a stored
+	baseline; a result more than DBG_BENCH_TOLERANCE percent worse than
+	the baseline is reported as a regression.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_BENCH_RUN_MS    1000				/* longest wait for a stop, and length of timed runs */
+#define DBG_BENCH_READ_MAX  (64*1024*1024)		/* bytes read by the memory test */
+#define DBG_BENCH_READ_SIZE (64*1024)
+#define DBG_BENCH_TRAP_FLAG 0x100
+#define DBG_BENCH_TOLERANCE 10					/* percent */
+
+typedef enum _dbgBenchMetric {
+	DBG_BENCH_LAUNCH,
+	DBG_BENCH_REGISTERS,
+	DBG_BENCH_READ,
+	DBG_BENCH_BREAKPOINT,
+	DBG_BENCH_FALSE_PATH,
+	DBG_BENCH_STEP,
+	DBG_BENCH_BREAK_IN,
+	DBG_BENCH_SUSPEND_ALL,
+	DBG_BENCH_METRICS
+}dbgBenchMetric;
+
+static const struct {
+	const char* name;
+	BOOL        higherBetter;
+}_dbgBenchMetrics[DBG_BENCH_METRICS] = {
+	{"launch_ms",               FALSE},
+	{"register_fetch_ns",       FALSE},
+	{"memory_read_mb_s",        TRUE},
+	{"breakpoint_round_trip_us",FALSE},
+	{"false_path_ns",           FALSE},
+	{"single_step_per_s",       TRUE},
+	{"break_in_us",             FALSE},
+	{"suspend_all_us",          FALSE}
+};
+
+typedef struct _dbgBench {
+	double        results[DBG_BENCH_METRICS];
+	BOOL          measured[DBG_BENCH_METRICS];
+	unsigned long steps;		/* single steps left to take */
+	handle_t      stepThread;
+	vaddr_t       stop;			/* address of the last stop */
+	BOOL          exited;
+}dbgBench;
+
+/* the event procedure has no argument */
+static dbgBench* _bench = 0;
+
+/**
+*	Event procedure used while the benchmark drives the target
+*/
+static dbgSessionState DbgBenchEventProc (IN dbgSession* session, IN dbgEventDescr* descr) {
+	dbgBench* bench = _bench;
+
+	switch (descr->event) {
+		case DBG_EVENT_EXCEPTION:
+			/* keep stepping without a stop until the count runs out */
+			if (descr->u.exception.code == DBG_EXCEPTION_SINGLE_STEP && bench->steps && --bench->steps) {
+				dbgContext context;
+				if (DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext))) {
+					context.flags |= DBG_BENCH_TRAP_FLAG;
+					if (DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext)))
+						return DBG_STATE_CONTINUE;
+				}
+			}
+			bench->stop = descr->u.exception.address;
+			return DBG_STATE_SUSPEND;
+		case DBG_EVENT_EXITPROCESS:
+			bench->exited = TRUE;
+			return DBG_STATE_SUSPEND;
+		default:
+			return DBG_STATE_CONTINUE;
+	}
+}
+
+/**
+*	Stop the target if it runs
+*	\ret TRUE if the target is stopped
+*/
+static BOOL DbgBenchBreakIn (IN dbgSession* session) {
+	if (session->state != DBG_STATE_CONTINUE)
+		return TRUE;
+	if (!DbgProcessRequest (DBG_REQ_BREAK, session, 0, 0, 0))
+		return FALSE;
+	return DbgSessionRunToStop (session, DBG_BENCH_RUN_MS);
+}
+
+/**
+*	Remove a breakpoint set by the benchmark without reporting it
+*/
+static void DbgBenchRemove (IN dbgSession* session, IN vaddr_t address) {
+	dbgBreakpoint* breakpoint = DbgFindBreakpoint (session, address);
+	if (!breakpoint)
+		return;
+	DbgRemoveBreakpointInternal (session, breakpoint);
+	DbgBreakpointUnlink (session, breakpoint);
+	poolRelease (&session->process.breakPointPool, breakpoint);
+}
+
+static void DbgBenchRegisters (IN dbgSession* session, IN dbgBench* bench, IN unsigned long iterations) {
+	dbgContext         context;
+	unsigned long long start = DbgClockNow ();
+	unsigned long      i;
+
+	for (i = 0; i < iterations; i++) {
+		if (!DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) session->process.thread, &context, sizeof (dbgContext)))
+			return;
+	}
+	bench->results[DBG_BENCH_REGISTERS]  = (double) (DbgClockNow () - start) / iterations;
+	bench->measured[DBG_BENCH_REGISTERS] = TRUE;
+}
+
+static void DbgBenchRead (IN dbgSession* session, IN dbgBench* bench) {
+	unsigned char*     buffer = (unsigned char*) malloc (DBG_BENCH_READ_SIZE);
+	unsigned long long start  = DbgClockNow ();
+	unsigned long long total  = 0;
+	unsigned long long pass;
+
+	if (!buffer)
+		return;
+
+	/* walk the address space until enough was read; small targets are read more than once */
+	do {
+		dbgMemoryRegion region;
+		vaddr_t         address = 0;
+		pass = total;
+		while (total < DBG_BENCH_READ_MAX && DbgProcessRequest (DBG_REQ_QUERY, session, (void*) address, &region, sizeof (region))) {
+			unsigned long at;
+			if (!region.size || region.base + (unsigned long long) region.size > 0x100000000ULL)
+				break;
+			for (at = 0; region.readable && at < region.size && total < DBG_BENCH_READ_MAX; at += DBG_BENCH_READ_SIZE) {
+				size_t size = region.size - at < DBG_BENCH_READ_SIZE ? region.size - at : DBG_BENCH_READ_SIZE;
+				total += DbgProcessRequest (DBG_REQ_READ, session, (void*) (region.base + at), buffer, size);
+			}
+			address = region.base + region.size;
+			if (!address)
+				break;
+		}
+	}while (total > pass && total < DBG_BENCH_READ_MAX);
+
+	if (total) {
+		bench->results[DBG_BENCH_READ]  = (double) total / (1024.0 * 1024.0) / ((double) (DbgClockNow () - start) / 1e9);
+		bench->measured[DBG_BENCH_READ] = TRUE;
+	}
+	free (buffer);
+}
+
+static void DbgBenchBreakpoint (IN dbgSession* session, IN dbgBench* bench, IN vaddr_t address, IN unsigned long iterations) {
+	unsigned long long start = DbgClockNow ();
+	unsigned long      done  = 0;
+
+	DbgBenchRemove (session, address);
+	while (done < iterations && !bench->exited) {
+		/* a stop elsewhere leaves the last one armed; adding another would save its int3 */
+		if (!DbgFindBreakpoint (session, address)) {
+			dbgBreakpoint* breakpoint = DbgBreakpointAdd (session, address, DBG_BREAK_SOFT);
+			if (!breakpoint)
+				break;
+			/* a one shot breakpoint puts the original byte back when it is hit */
+			breakpoint->once = TRUE;
+		}
+		if (!DbgSessionRunToStop (session, DBG_BENCH_RUN_MS))
+			break;
+		if (bench->stop == address)
+			done++;
+	}
+	DbgBenchRemove (session, address);
+	if (done) {
+		bench->results[DBG_BENCH_BREAKPOINT]  = (double) (DbgClockNow () - start) / done / 1000.0;
+		bench->measured[DBG_BENCH_BREAKPOINT] = TRUE;
+	}
+}
+
+static void DbgBenchFalsePath (IN dbgSession* session, IN dbgBench* bench, IN vaddr_t address) {
+	dbgBreakpoint*     breakpoint = DbgBreakpointAdd (session, address, DBG_BREAK_SOFT);
+	unsigned long long start;
+	unsigned long long elapsed;
+	unsigned int       hits;
+
+	if (!breakpoint)
+		return;
+	breakpoint->count = TRUE;
+	start = DbgClockNow ();
+	DbgSessionRunToStop (session, DBG_BENCH_RUN_MS);
+	elapsed = DbgClockNow () - start;
+	hits    = breakpoint->hits;
+	DbgBenchBreakIn (session);
+	DbgBenchRemove (session, address);
+	if (hits) {
+		bench->results[DBG_BENCH_FALSE_PATH]  = (double) elapsed / hits;
+		bench->measured[DBG_BENCH_FALSE_PATH] = TRUE;
+	}
+}
+
+static void DbgBenchStep (IN dbgSession* session, IN dbgBench* bench, IN unsigned long iterations) {
+	dbgContext         context;
+	unsigned long long start;
+
+	bench->stepThread = session->process.thread;
+	if (!DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext)))
+		return;
+	context.flags |= DBG_BENCH_TRAP_FLAG;
+	if (!DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext)))
+		return;
+	bench->steps = iterations;
+	start = DbgClockNow ();
+	DbgSessionRunToStop (session, DBG_BENCH_RUN_MS);
+	if (bench->steps < iterations) {
+		bench->results[DBG_BENCH_STEP]  = (double) (iterations - bench->steps) / ((double) (DbgClockNow () - start) / 1e9);
+		bench->measured[DBG_BENCH_STEP] = TRUE;
+	}
+	bench->steps = 0;
+	DbgBenchBreakIn (session);
+
+	/* a step may still be pending if the run timed out */
+	if (DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext))) {
+		context.flags &= ~DBG_BENCH_TRAP_FLAG;
+		DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) bench->stepThread, &context, sizeof (dbgContext));
+	}
+}
+
+static void DbgBenchStopAll (IN dbgSession* session, IN dbgBench* bench, IN unsigned long iterations) {
+	unsigned long long elapsed = 0;
+	unsigned long      done    = 0;
+	unsigned long      i;
+
+	/* continue and break straight back in */
+	for (i = 0; i < iterations && !bench->exited; i++) {
+		unsigned long long start;
+		if (!DbgProcessRequest (DBG_REQ_CONTINUE, session, 0, 0, 0))
+			break;
+		start = DbgClockNow ();
+		if (!DbgBenchBreakIn (session))
+			break;
+		elapsed += DbgClockNow () - start;
+		done++;
+	}
+	if (done) {
+		bench->results[DBG_BENCH_BREAK_IN]  = (double) elapsed / done / 1000.0;
+		bench->measured[DBG_BENCH_BREAK_IN] = TRUE;
+	}
+
+	/* suspend and resume every thread */
+	elapsed = DbgClockNow ();
+	for (i = 0; i < iterations && !bench->exited; i++) {
+		ilistNode* cur;
+		for (cur = session->process.threadList.first; cur; cur = cur->next)
+			DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+		for (cur = session->process.threadList.first; cur; cur = cur->next)
+			DbgProcessRequest (DBG_REQ_RESUME, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+	}
+	if (i) {
+		bench->results[DBG_BENCH_SUSPEND_ALL]  = (double) (DbgClockNow () - elapsed) / i / 1000.0;
+		bench->measured[DBG_BENCH_SUSPEND_ALL] = TRUE;
+	}
+}
+
+/**
+*	Write results as JSON
+*/
+static BOOL DbgBenchWrite (IN dbgSession* session, IN dbgBench* bench, IN const char* path) {
+	FILE*        file;
+	unsigned int threads = ilistSize (&session->process.threadList);
+	BOOL         first = TRUE;
+	unsigned int i;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "w"))
+		file = 0;
+#else
+	file = fopen (path, "w");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	fprintf (file, "{\n  \"target\": \"");
+	for (i = 0; session->process.name[i]; i++) {
+		if (session->process.name[i] == '"' || session->process.name[i] == '\\')
+			fputc ('\\', file);
+		fputc (session->process.name[i], file);
+	}
+	fprintf (file, "\",\n  \"threads\": %u,\n  \"results\": {", threads);
+	for (i = 0; i < DBG_BENCH_METRICS; i++) {
+		if (!bench->measured[i])
+			continue;
+		fprintf (file, "%s\n    \"%s\": %.3f", first ? "" : ",", _dbgBenchMetrics[i].name, bench->results[i]);
+		first = FALSE;
+	}
+	fprintf (file, "\n  }\n}\n");
+	fclose (file);
+	DbgDisplayMessage ("Benchmark results written to %s", path);
+	return TRUE;
+}
+
+/**
+*	Compare results with a baseline written by DbgBenchWrite
+*	\ret Number of regressions or -1 if the baseline cannot be read
+*/
+static int DbgBenchCompare (IN dbgBench* bench, IN const char* path) {
+	FILE*        file;
+	char         text[4096];
+	size_t       length;
+	int          regressions = 0;
+	unsigned int i;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "r"))
+		file = 0;
+#else
+	file = fopen (path, "r");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return -1;
+	}
+	length = fread (text, 1, sizeof (text) - 1, file);
+	text[length] = 0;
+	fclose (file);
+
+	DbgDisplayMessage ("%-26s %14s %14s %8s", "", "baseline", "current", "change");
+	for (i = 0; i < DBG_BENCH_METRICS; i++) {
+		char   key[64];
+		char*  at;
+		double base;
+		double change;
+		BOOL   worse;
+
+#ifdef _MSC_VER
+		sprintf_s (key, sizeof (key), "\"%s\":", _dbgBenchMetrics[i].name);
+#else
+		sprintf (key, "\"%s\":", _dbgBenchMetrics[i].name);
+#endif
+		at = strstr (text, key);
+		if (!at || !bench->measured[i])
+			continue;
+		base = strtod (at + strlen (key), 0);
+		if (base <= 0)
+			continue;
+		change = (bench->results[i] - base) * 100.0 / base;
+		worse  = _dbgBenchMetrics[i].higherBetter ? change < -DBG_BENCH_TOLERANCE : change > DBG_BENCH_TOLERANCE;
+		if (worse)
+			regressions++;
+		DbgDisplayMessage ("%-26s %14.3f %14.3f %+7.1f%%%s", _dbgBenchMetrics[i].name, base, bench->results[i],
+			change, worse ? "  REGRESSION" : "");
+	}
+	return regressions;
+}
+
+/**
+*	Run the benchmarks. Must be called on the session thread.
+*	\param session Debug session
+*	\param address Address the target executes repeatedly, for the breakpoint tests; 0 skips them
+*	\param iterations Repetitions of the breakpoint, step and stop tests
+*	\param path JSON results file or 0
+*	\param baseline JSON results to compare with or 0
+*	\ret TRUE if the benchmarks ran without a regression, FALSE otherwise
+*/
+BOOL DbgBench (IN dbgSession* session, IN vaddr_t address, IN unsigned long iterations,
+               IN OPT const char* path, IN OPT const char* baseline) {
+	DbgSessionEventProc proc = session->proc;
+	dbgBench            bench;
+	unsigned int        i;
+	int                 regressions = 0;
+
+	if (session->type == DBG_SESSION_CORE) {
+		DbgDisplayError ("Benchmarks need a running target");
+		return FALSE;
+	}
+	memset (&bench, 0, sizeof (dbgBench));
+	_bench = &bench;
+	session->proc = DbgBenchEventProc;
+
+	if (session->stopped) {
+		bench.results[DBG_BENCH_LAUNCH]  = (double) (session->stopped - session->created) / 1e6;
+		bench.measured[DBG_BENCH_LAUNCH] = TRUE;
+	}
+	if (DbgBenchBreakIn (session)) {
+		DbgBenchRegisters (session, &bench, iterations * 10);
+		DbgBenchRead (session, &bench);
+		if (address && !bench.exited)
+			DbgBenchBreakpoint (session, &bench, address, iterations);
+		if (address && !bench.exited)
+			DbgBenchFalsePath (session, &bench, address);
+		if (!bench.exited)
+			DbgBenchStep (session, &bench, iterations * 10);
+		if (!bench.exited)
+			DbgBenchStopAll (session, &bench, iterations / 10 ? iterations / 10 : 1);
+	}
+	session->proc = proc;
+	_bench = 0;
+	if (bench.exited)
+		DbgDisplayError ("Target exited during the benchmark");
+
+	DbgDisplayMessage ("Benchmark of %s, %u threads", session->process.name, ilistSize (&session->process.threadList));
+	for (i = 0; i < DBG_BENCH_METRICS; i++) {
+		if (bench.measured[i])
+			DbgDisplayMessage ("  %-26s %14.3f", _dbgBenchMetrics[i].name, bench.results[i]);
+		else
+			DbgDisplayMessage ("  %-26s %14s", _dbgBenchMetrics[i].name, "-");
+	}
+	if (path && !DbgBenchWrite (session, &bench, path))
+		return FALSE;
+	if (baseline) {
+		regressions = DbgBenchCompare (&bench, baseline);
+		if (regressions > 0)
+			DbgDisplayError ("%i results regressed by more than %u%%", regressions, DBG_BENCH_TOLERANCE);
+	}
+	return regressions == 0 && !bench.exited;
+}
@@ -7,25 +7,40 @@
 /*
 	This component implements the breakpoint and watchpoint
 	services.
+
+	Breakpoints are looked up by address through an open addressed
+	index, so a trap costs the same with a hundred thousand breakpoints
+	set as with one. Counting breakpoints never stop the target: the
+	session thread counts the hit, puts the original byte back, single
+	steps the thread over it and re-arms the breakpoint on the step.
+
+	Breakpoints can be set by address, symbol name, source line or
+	regular expression. Many breakpoints at once are written in one pass
+	over the sorted addresses that reads and writes each code page once.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "defs.h"
 
+#define DBG_BREAK_INDEX_MIN 256		/* initial index slots */
+#define DBG_BREAK_TRAP_FLAG 0x100	/* eflags single step */
+#define DBG_BREAK_SCAN_PARALLEL 16384	/* fewest functions matched by a worker */
+#define DBG_BREAK_SCAN_WORKERS  64
+
 /* unique ID counters */
 static unsigned int _breakPointUniqueID = 0;
 static unsigned int _watchPointUniqueID = 0;
 
 BOOL DbgSetBreakpointHitCount (IN dbgSession* session, unsigned int hits) {
 
-	listNode*      current;
-	size_t         c;
+	ilistNode*     current;
 
-	current = session->process.breakPointList.first;
-	for (c=0; c<session->process.breakPointList.count; c++) {
-		dbgBreakpoint* breakpoint = (dbgBreakpoint*) current->data;
+	for (current = session->process.breakPointList.first; current; current = current->next) {
+		dbgBreakpoint* breakpoint = (dbgBreakpoint*) current;
 		breakpoint->hits = hits;
-		current = current->next;
 	}
 	return TRUE;
 }
@@ -43,59 +58,488 @@ BOOL DbgSetBreakpointInternal (IN dbgSession* session, dbgBreakpoint* in) {
 	return TRUE;
 }
 
-BOOL DbgSetBreakpoint (IN dbgSession* session, IN vaddr_t address, dbgBreakpoingType type) {
+static unsigned int DbgBreakpointHash (IN vaddr_t address) {
+	unsigned int hash = address * 2654435761u;
+	return hash ^ (hash >> 16);
+}
 
-	listNode*      current;
-	dbgBreakpoint  breakpoint;
-	size_t         c;
+/**
+*	Double the index, or create it
+*/
+static BOOL DbgBreakpointIndexGrow (IN dbgBreakpointIndex* index) {
+	unsigned int    size  = index->slots ? (index->mask + 1) * 2 : DBG_BREAK_INDEX_MIN;
+	dbgBreakpoint** slots = (dbgBreakpoint**) calloc (size, sizeof (dbgBreakpoint*));
+	unsigned int    i;
 
-	current = session->process.breakPointList.first;
-	for (c=0; c<session->process.breakPointList.count; c++) {
-		dbgBreakpoint* breakpoint = (dbgBreakpoint*) current->data;
-		if (breakpoint->address == address) {
-			DbgDisplayMessage ("Breakpoint at [0x%x] already set", address);
-			return FALSE;
+	if (!slots)
+		return FALSE;
+	for (i = 0; index->slots && i <= index->mask; i++) {
+		unsigned int slot;
+		if (!index->slots[i])
+			continue;
+		for (slot = DbgBreakpointHash (index->slots[i]->address) & (size - 1); slots[slot]; slot = (slot + 1) & (size - 1))
+			;
+		slots[slot] = index->slots[i];
+	}
+	free (index->slots);
+	index->slots = slots;
+	index->mask  = size - 1;
+	return TRUE;
+}
+
+/**
+*	Add breakpoint to the breakpoint list and index
+*	\param session Debug session
+*	\param breakpoint Breakpoint allocated from the breakpoint pool
+*	\ret TRUE on success, FALSE if out of memory
+*/
+BOOL DbgBreakpointLink (IN dbgSession* session, IN dbgBreakpoint* breakpoint) {
+	dbgBreakpointIndex* index = &session->process.breakPointIndex;
+	unsigned int        slot;
+
+	/* keep the load at one half so probe runs stay short */
+	if ((!index->slots || (index->count + 1) * 2 > index->mask + 1) && !DbgBreakpointIndexGrow (index))
+		return FALSE;
+	for (slot = DbgBreakpointHash (breakpoint->address) & index->mask; index->slots[slot]; slot = (slot + 1) & index->mask)
+		;
+	index->slots[slot] = breakpoint;
+	index->count++;
+	ilistAppend (&session->process.breakPointList, &breakpoint->node);
+	return TRUE;
+}
+
+/**
+*	Remove breakpoint from the breakpoint list and index
+*	\param session Debug session
+*	\param breakpoint Linked breakpoint; it is not released
+*/
+void DbgBreakpointUnlink (IN dbgSession* session, IN dbgBreakpoint* breakpoint) {
+	dbgBreakpointIndex* index = &session->process.breakPointIndex;
+	unsigned int        slot;
+	unsigned int        next;
+
+	ilistRemove (&session->process.breakPointList, &breakpoint->node);
+	if (!index->slots)
+		return;
+	for (slot = DbgBreakpointHash (breakpoint->address) & index->mask; index->slots[slot] != breakpoint; slot = (slot + 1) & index->mask)
+		if (!index->slots[slot])
+			return;
+
+	/* shift later entries of the probe run back so no lookup stops at the hole */
+	index->slots[slot] = 0;
+	index->count--;
+	for (next = (slot + 1) & index->mask; index->slots[next]; next = (next + 1) & index->mask) {
+		unsigned int home = DbgBreakpointHash (index->slots[next]->address) & index->mask;
+		if (((next - home) & index->mask) >= ((next - slot) & index->mask)) {
+			index->slots[slot] = index->slots[next];
+			index->slots[next] = 0;
+			slot = next;
 		}
-		current = current->next;
 	}
+}
+
+/**
+*	Release breakpoint index
+*	\param session Debug session
+*/
+void DbgBreakpointIndexFree (IN dbgSession* session) {
+	free (session->process.breakPointIndex.slots);
+	memset (&session->process.breakPointIndex, 0, sizeof (dbgBreakpointIndex));
+}
 
-	breakpoint.id      = _breakPointUniqueID++;
-	breakpoint.address = address;
-	breakpoint.once    = FALSE;
-	breakpoint.opcode  = 0;
-	breakpoint.set     = TRUE;
-	breakpoint.type    = type;
+/**
+*	Allocate, write and link a breakpoint without reporting it
+*	\param session Debug session
+*	\param address Breakpoint address
+*	\param type Breakpoint type
+*	\ret Breakpoint or 0 on error
+*/
+dbgBreakpoint* DbgBreakpointAdd (IN dbgSession* session, IN vaddr_t address, dbgBreakpoingType type) {
+
+	dbgBreakpoint* breakpoint;
+
+	breakpoint = (dbgBreakpoint*) poolAlloc (&session->process.breakPointPool);
+	if (!breakpoint)
+		return 0;
+
+	breakpoint->id      = _breakPointUniqueID++;
+	breakpoint->address = address;
+	breakpoint->once    = FALSE;
+	breakpoint->opcode  = 0;
+	breakpoint->set     = TRUE;
+	breakpoint->type    = type;
+	breakpoint->hits    = 0;
+	breakpoint->count   = FALSE;
+
+	if (!DbgSetBreakpointInternal(session, breakpoint)) {
+		poolRelease (&session->process.breakPointPool, breakpoint);
+		return 0;
+	}
+	if (!DbgBreakpointLink (session, breakpoint)) {
+		DbgRemoveBreakpointInternal (session, breakpoint);
+		poolRelease (&session->process.breakPointPool, breakpoint);
+		return 0;
+	}
+	return breakpoint;
+}
 
-	if (!DbgSetBreakpointInternal(session, &breakpoint)) {
+BOOL DbgSetBreakpoint (IN dbgSession* session, IN vaddr_t address, dbgBreakpoingType type) {
+
+	if (DbgFindBreakpoint (session, address)) {
+		DbgDisplayMessage ("Breakpoint at [0x%x] already set", address);
+		return FALSE;
+	}
+	if (!DbgBreakpointAdd (session, address, type)) {
 		DbgDisplayError ("Unable to set breakpoint at [0x%x]", address);
 		return FALSE;
 	}
+	DbgDisplayMessage ("Added breakpoint at [0x%x]", address);
+	return TRUE;
+}
 
-	if (listAddElement (&breakpoint, sizeof(dbgBreakpoint), &session->process.breakPointList)) {
-		DbgDisplayMessage ("Added breakpoint at [0x%x]", address);
-		return TRUE;
+static int DbgBreakpointCompareAddress (const void* a, const void* b) {
+	vaddr_t x = *(const vaddr_t*) a;
+	vaddr_t y = *(const vaddr_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* address of an item of a table sorted by its leading vaddr_t */
+static vaddr_t DbgBreakpointItem (IN const void* items, IN size_t stride, IN unsigned int index) {
+	return *(const vaddr_t*) ((const char*) items + (size_t) index * stride);
+}
+
+/**
+*	Arm software breakpoints on many addresses in one pass that reads and
+*	writes each code page once. Addresses that already have a breakpoint
+*	are skipped. If a page cannot be written, the breakpoints added to it
+*	are released again. Must be called on the session thread.
+*	\param session Debug session
+*	\param items Items sorted by address, each starting with its vaddr_t address
+*	\param count Number of items
+*	\param stride Size of an item
+*	\param once TRUE for one shot breakpoints; these are internal and take no ID
+*	\param counting TRUE for counting breakpoints
+*	\param failed Receives the number of addresses that could not be armed
+*	\param pages Receives the number of pages written
+*	\ret Number of breakpoints set
+*/
+unsigned long DbgBreakpointArm (IN dbgSession* session, IN const void* items, IN unsigned int count, IN size_t stride,
+                                IN BOOL once, IN BOOL counting, OUT OPT unsigned long* failed, OUT OPT unsigned long* pages) {
+	unsigned char page[DBG_MEMORY_PAGE];
+	unsigned long added   = 0;
+	unsigned long lost    = 0;
+	unsigned long written = 0;
+	unsigned int  i       = 0;
+
+	while (i < count) {
+		vaddr_t       base  = DbgBreakpointItem (items, stride, i) & ~(DBG_MEMORY_PAGE - 1);
+		BOOL          valid = DbgProcessRequest (DBG_REQ_READ, session, (void*) base, page, DBG_MEMORY_PAGE) == DBG_MEMORY_PAGE;
+		unsigned long fresh = 0;
+
+		for (; i < count && (DbgBreakpointItem (items, stride, i) & ~(DBG_MEMORY_PAGE - 1)) == base; i++) {
+			vaddr_t        address = DbgBreakpointItem (items, stride, i);
+			dbgBreakpoint* breakpoint;
+
+			if (i && DbgBreakpointItem (items, stride, i - 1) == address)
+				continue;
+			if (DbgFindBreakpoint (session, address))
+				continue;
+			breakpoint = valid ? (dbgBreakpoint*) poolAlloc (&session->process.breakPointPool) : 0;
+			if (!breakpoint) {
+				lost++;
+				continue;
+			}
+			breakpoint->id      = once ? 0 : _breakPointUniqueID++;
+			breakpoint->address = address;
+			breakpoint->once    = once;
+			breakpoint->count   = counting;
+			breakpoint->set     = TRUE;
+			breakpoint->type    = DBG_BREAK_SOFT;
+			breakpoint->hits    = 0;
+			breakpoint->opcode  = page[address - base];
+			if (!DbgBreakpointLink (session, breakpoint)) {
+				poolRelease (&session->process.breakPointPool, breakpoint);
+				lost++;
+				continue;
+			}
+			page[address - base] = 0xcc;
+			fresh++;
+		}
+		if (!fresh)
+			continue;
+		if (DbgProcessRequest (DBG_REQ_WRITE, session, (void*) base, page, DBG_MEMORY_PAGE) != DBG_MEMORY_PAGE) {
+			/* the breakpoints of this page were linked last */
+			unsigned long k;
+			for (k = 0; k < fresh; k++) {
+				dbgBreakpoint* breakpoint = (dbgBreakpoint*) session->process.breakPointList.last;
+				DbgBreakpointUnlink (session, breakpoint);
+				poolRelease (&session->process.breakPointPool, breakpoint);
+			}
+			lost += fresh;
+			continue;
+		}
+		DbgFlushInstructionCache (session, base, DBG_MEMORY_PAGE);
+		added += fresh;
+		written++;
 	}
-	return FALSE;
+	if (failed)
+		*failed = lost;
+	if (pages)
+		*pages = written;
+	return added;
 }
 
-BOOL DbgGetBreakpoint (IN dbgSession* session, IN vaddr_t address, OUT dbgBreakpoint* out) {
+/**
+*	Set breakpoints on many addresses at once; see DbgBreakpointArm.
+*	Must be called on the session thread.
+*	\param session Debug session
+*	\param addresses Addresses in any order; sorted in place
+*	\param count Number of addresses
+*	\param failed Receives the number of addresses that could not be written
+*	\ret Number of breakpoints set
+*/
+unsigned long DbgBreakpointAddBatch (IN dbgSession* session, IN OUT vaddr_t* addresses, IN unsigned int count,
+                                     OUT OPT unsigned long* failed) {
+	qsort (addresses, count, sizeof (vaddr_t), DbgBreakpointCompareAddress);
+	return DbgBreakpointArm (session, addresses, count, sizeof (vaddr_t), FALSE, FALSE, failed, 0);
+}
 
-	listNode*      current;
-	size_t         c;
+/**
+*	Parse a whole string as a number
+*	\param hex TRUE to read digits as hex without a 0x prefix
+*/
+static BOOL DbgBreakpointNumber (IN const char* text, IN BOOL hex, OUT vaddr_t* address) {
+	char*         end;
+	unsigned long value;
 
-	current = session->process.breakPointList.first;
-	for (c=0; c<session->process.breakPointList.count; c++) {
+	if (!*text)
+		return FALSE;
+	value = strtoul (text, &end, hex || (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) ? 16 : 10);
+	if (*end)
+		return FALSE;
+	*address = (vaddr_t) value;
+	return TRUE;
+}
 
-		dbgBreakpoint* breakpoint = (dbgBreakpoint*) current->data;
+/**
+*	Test whether a source file path ends with the given path at a directory
+*	boundary, ignoring case and the kind of slash
+*/
+static BOOL DbgBreakpointFileMatch (IN const char* path, IN const char* file, IN size_t length) {
+	size_t size = strlen (path);
+	size_t i;
 
-		/* if we found the breakpoint, copy it to out and return success. */
-		if (breakpoint->address == address) {
-			memcpy(out,breakpoint,sizeof(dbgBreakpoint));
-			return TRUE;
+	if (size < length)
+		return FALSE;
+	path += size - length;
+	for (i = 0; i < length; i++) {
+		char a = path[i] == '/' ? '\\' : (char) tolower ((unsigned char) path[i]);
+		char b = file[i] == '/' ? '\\' : (char) tolower ((unsigned char) file[i]);
+		if (a != b)
+			return FALSE;
+	}
+	return size == length || path[-1] == '\\' || path[-1] == '/';
+}
+
+/**
+*	Addresses of a source line: the rows of the first line at or after it
+*	that has code, in every source file whose path ends with the given one
+*	\ret Line found, or 0 if no file or line matches
+*/
+static unsigned int DbgBreakpointLines (IN dbgSession* session, IN const char* file, IN size_t length,
+                                        IN unsigned int line, OUT vector* addresses) {
+	ilistNode*   current;
+	unsigned int best = 0;
+	unsigned int i;
+
+	for (current = session->process.sourceFileList.first; current; current = current->next) {
+		dbgSourceFile* source = (dbgSourceFile*) current;
+		if (!DbgBreakpointFileMatch (source->name, file, length))
+			continue;
+		for (i = 0; i < vectorSize (&source->sourceLineList); i++) {
+			dbgSourceLine* row = (dbgSourceLine*) vectorAt (&source->sourceLineList, i);
+			if (row->lineNumber < line || (best && row->lineNumber > best))
+				continue;
+			if (row->lineNumber < best || !best) {
+				vectorClear (addresses);
+				best = row->lineNumber;
+			}
+			vectorAdd (addresses, &row->addr);
 		}
-		current = current->next;
 	}
+	return best;
+}
 
+/**
+*	Set a breakpoint on an address, a "file:line" source location or a
+*	symbol name, optionally prefixed by "module!". Decimal numbers and
+*	numbers with a 0x prefix are addresses; other hex digit strings are
+*	addresses only when no symbol has that name. A line without code
+*	moves to the next line that has some. Must be called on the session thread.
+*	\param session Debug session
+*	\param location Breakpoint location
+*	\ret TRUE if at least one breakpoint was set
+*/
+BOOL DbgSetBreakpointAt (IN dbgSession* session, IN const char* location) {
+	const char*   colon = strrchr (location, ':');
+	vaddr_t       address;
+	dbgSymbol     symbol;
+
+	if (DbgBreakpointNumber (location, FALSE, &address))
+		return DbgSetBreakpoint (session, address, DBG_BREAK_SOFT);
+
+	if (colon && colon != location && DbgBreakpointNumber (colon + 1, FALSE, &address)) {
+		vector        addresses;
+		unsigned int  line;
+		unsigned long added;
+		unsigned long failed;
+
+		vectorInit (&addresses, sizeof (vaddr_t));
+		line = DbgBreakpointLines (session, location, colon - location, (unsigned int) address, &addresses);
+		if (!line) {
+			DbgDisplayError ("No code at or after line %u of %.*s", (unsigned int) address, (int) (colon - location), location);
+			vectorFree (&addresses);
+			return FALSE;
+		}
+		added = DbgBreakpointAddBatch (session, (vaddr_t*) addresses.data, vectorSize (&addresses), &failed);
+		DbgDisplayMessage ("Added %lu breakpoints at line %u of %.*s, %lu failed",
+			added, line, (int) (colon - location), location, failed);
+		vectorFree (&addresses);
+		return added != 0;
+	}
+
+	if (DbgSymbolFromName (session, location, &symbol))
+		return DbgSetBreakpoint (session, symbol.addr, DBG_BREAK_SOFT);
+	if (DbgBreakpointNumber (location, TRUE, &address))
+		return DbgSetBreakpoint (session, address, DBG_BREAK_SOFT);
+	DbgDisplayError ("No symbol '%s'", location);
+	return FALSE;
+}
+
+typedef struct _dbgBreakpointScan {
+	const dbgRegex*   regex;
+	dbgFunctionEntry* functions;
+	unsigned int      count;
+	vector            matches;		/* vaddr_t */
+}dbgBreakpointScan;
+
+/**
+*	Match a range of the function table. Runs on a worker.
+*/
+static int DbgBreakpointScanEntry (void* arg) {
+	dbgBreakpointScan* scan = (dbgBreakpointScan*) arg;
+	unsigned int       i;
+
+	for (i = 0; i < scan->count; i++) {
+		if (DbgRegexMatch (scan->regex, scan->functions[i].name) && !vectorAdd (&scan->matches, &scan->functions[i].start))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+*	Set breakpoints on every function whose name matches a regular
+*	expression. The function table is split into ranges, one per
+*	processor, and matched in parallel; the breakpoints are then written
+*	in one batch. Must be called on the session thread.
+*	\param session Debug session
+*	\param pattern Regular expression, see regex.c
+*	\ret Number of breakpoints set
+*/
+unsigned long DbgSetBreakpointRegex (IN dbgSession* session, IN const char* pattern) {
+	unsigned long long start = DbgClockNow ();
+	dbgBreakpointScan  scans[DBG_BREAK_SCAN_WORKERS];
+	dbgWorker*         workers[DBG_BREAK_SCAN_WORKERS];
+	unsigned int       parts = DbgProcessorCount ();
+	dbgRegex*          regex;
+	vector*            table;
+	vector             matches;
+	unsigned int       count;
+	unsigned long      added;
+	unsigned long      failed;
+	BOOL               complete = TRUE;
+	unsigned int       i;
+
+	regex = DbgRegexCompile (pattern);
+	if (!regex)
+		return 0;
+	table = DbgSymbolizeFunctions (session);
+	if (!table) {
+		DbgDisplayError ("Unable to read the function table");
+		DbgRegexFree (regex);
+		return 0;
+	}
+	count = vectorSize (table);
+
+	/* contiguous ranges of the table; the first runs on this thread */
+	if (parts > DBG_BREAK_SCAN_WORKERS)
+		parts = DBG_BREAK_SCAN_WORKERS;
+	if (parts > count / DBG_BREAK_SCAN_PARALLEL)
+		parts = count / DBG_BREAK_SCAN_PARALLEL ? count / DBG_BREAK_SCAN_PARALLEL : 1;
+	for (i = 0; i < parts; i++) {
+		unsigned int first = (unsigned int) ((unsigned long long) count * i / parts);
+		scans[i].regex     = regex;
+		scans[i].functions = (dbgFunctionEntry*) table->data + first;
+		scans[i].count     = (unsigned int) ((unsigned long long) count * (i + 1) / parts) - first;
+		vectorInit (&scans[i].matches, sizeof (vaddr_t));
+		workers[i]         = i ? DbgWorkerCreate (DbgBreakpointScanEntry, &scans[i]) : 0;
+	}
+	complete = !DbgBreakpointScanEntry (&scans[0]);
+	for (i = 1; i < parts; i++) {
+		if (workers[i] ? DbgWorkerJoin (workers[i]) : DbgBreakpointScanEntry (&scans[i]))
+			complete = FALSE;
+	}
+
+	vectorInit (&matches, sizeof (vaddr_t));
+	for (i = 0; i < parts; i++) {
+		unsigned int j;
+		for (j = 0; complete && j < vectorSize (&scans[i].matches); j++)
+			complete = vectorAdd (&matches, vectorAt (&scans[i].matches, j)) != 0;
+		vectorFree (&scans[i].matches);
+	}
+	DbgRegexFree (regex);
+	if (!complete) {
+		DbgDisplayError ("Out of memory matching '%s'", pattern);
+		vectorFree (&matches);
+		return 0;
+	}
+
+	added = DbgBreakpointAddBatch (session, (vaddr_t*) matches.data, vectorSize (&matches), &failed);
+	DbgDisplayMessage ("%u functions match '%s': %lu breakpoints set, %lu failed, %.1f ms",
+		vectorSize (&matches), pattern, added, failed, (double) (DbgClockNow () - start) / 1000000.0);
+	vectorFree (&matches);
+	return added;
+}
+
+/**
+*	Locate breakpoint
+*	\param session Debug session
+*	\param address Breakpoint address
+*	\ret Breakpoint handle that may be passed to DbgRemoveBreakpoint or 0
+*/
+dbgBreakpoint* DbgFindBreakpoint (IN dbgSession* session, IN vaddr_t address) {
+
+	dbgBreakpointIndex* index = &session->process.breakPointIndex;
+	unsigned int        slot;
+
+	if (!index->slots)
+		return 0;
+	for (slot = DbgBreakpointHash (address) & index->mask; index->slots[slot]; slot = (slot + 1) & index->mask) {
+		if (index->slots[slot]->address == address)
+			return index->slots[slot];
+	}
+	return 0;
+}
+
+BOOL DbgGetBreakpoint (IN dbgSession* session, IN vaddr_t address, OUT dbgBreakpoint* out) {
+
+	dbgBreakpoint* breakpoint = DbgFindBreakpoint (session, address);
+
+	/* if we found the breakpoint, copy it to out and return success. */
+	if (breakpoint) {
+		memcpy(out,breakpoint,sizeof(dbgBreakpoint));
+		return TRUE;
+	}
 	return FALSE;
 }
 
@@ -110,36 +554,233 @@ BOOL DbgRemoveBreakpointInternal (IN dbgSession* session, IN dbgBreakpoint* brea
 		return FALSE; /* this should never happen. */
 
 	/* write back original byte and return success. */
-	DbgProcessRequest(DBG_REQ_WRITE,session,addr, (void*) breakpoint->opcode,1);
+	DbgProcessRequest(DBG_REQ_WRITE,session,addr, &breakpoint->opcode,1);
 	DbgFlushInstructionCache (session,addr,1);
 	return TRUE;
 }
 
+/**
+*	Remove breakpoint
+*	\param session Debug session
+*	\param breakpoint Breakpoint handle returned by DbgFindBreakpoint
+*	\ret TRUE if success, FALSE otherwise
+*/
 BOOL DbgRemoveBreakpoint (IN dbgSession* session, IN dbgBreakpoint* breakpoint) {
 
-	listNode*      current;
-	size_t         c;
+	if (!breakpoint)
+		return FALSE;
 
-	current = session->process.breakPointList.first;
-	for (c=0; c<session->process.breakPointList.count; c++) {
+	DbgRemoveBreakpointInternal (session, breakpoint);
+	DbgDisplayMessage ("Breakpoint at [0x%x] removed", breakpoint->address);
+	DbgBreakpointUnlink (session, breakpoint);
+	poolRelease (&session->process.breakPointPool, breakpoint);
+	return TRUE;
+}
 
-		dbgBreakpoint* breakpoint2 = (dbgBreakpoint*) current->data;
+BOOL DbgClearBreakpoints (IN dbgSession* session) {
+	return FALSE;
+}
 
-		/* if we found the breakpoint, remove it. */
-		if (breakpoint2 == breakpoint) {
-			DbgRemoveBreakpointInternal (session, breakpoint);
-			DbgDisplayMessage ("Breakpoint at [0x%x] removed", breakpoint->address);
-			listRemoveElement (c, &session->process.breakPointList);
-			return TRUE;
-		}
-		current = current->next;
+/*
+	Counting breakpoints
+*/
+
+static dbgThread* DbgBreakpointThread (IN dbgSession* session, IN tid_t tid) {
+	ilistNode* cur;
+	for (cur = session->process.threadList.first; cur; cur = cur->next) {
+		if (((dbgThread*) cur)->id == tid)
+			return (dbgThread*) cur;
 	}
+	return 0;
+}
 
-	return FALSE;
+/**
+*	Handle the trap of a counting or one shot breakpoint.
+*	A counting breakpoint is counted and the thread is stepped over it; a
+*	one shot breakpoint is removed for good. Must be called on the session thread.
+*	\param session Debug session
+*	\param tid Thread that hit the breakpoint
+*	\param address Breakpoint address
+*	\ret TRUE if the trap was absorbed and the target may continue
+*/
+BOOL DbgBreakpointTrap (IN dbgSession* session, IN tid_t tid, IN vaddr_t address) {
+	dbgBreakpoint*     breakpoint = DbgFindBreakpoint (session, address);
+	unsigned long long start      = DbgClockNow ();
+	dbgThread*         thread;
+	dbgContext         context;
+	BOOL               absorb;
+
+	if (!breakpoint || (!breakpoint->count && !breakpoint->once))
+		return FALSE;
+	thread = DbgBreakpointThread (session, tid);
+	if (!thread || !DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread->thread, &context, sizeof (dbgContext)))
+		return FALSE;
+
+	/* back up over the int3 and run the original instruction */
+	context.eip = address;
+	if (!breakpoint->once)
+		context.flags |= DBG_BREAK_TRAP_FLAG;
+	DbgProcessRequest (DBG_REQ_WRITE, session, (void*) address, &breakpoint->opcode, 1);
+	DbgFlushInstructionCache (session, address, 1);
+	if (!DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) thread->thread, &context, sizeof (dbgContext))) {
+		unsigned char bp = 0xcc;
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) address, &bp, 1);
+		DbgFlushInstructionCache (session, address, 1);
+		return FALSE;
+	}
+	breakpoint->hits++;
+
+	if (breakpoint->once) {
+		/* the original byte stays; later executions cost nothing */
+		if (session->coverage)
+			DbgCoverageHit (session, address);
+		absorb = breakpoint->count;
+		DbgBreakpointUnlink (session, breakpoint);
+		poolRelease (&session->process.breakPointPool, breakpoint);
+		return absorb;
+	}
+	thread->rearm     = address;
+	thread->trapStart = start;
+	return TRUE;
 }
 
-BOOL DbgClearBreakpoints (IN dbgSession* session) {
-	return FALSE;
+/**
+*	Re-arm the counting breakpoint a thread just stepped over.
+*	Must be called on the session thread.
+*	\param session Debug session
+*	\param tid Thread that single stepped
+*	\ret TRUE if the step belonged to a counting breakpoint
+*/
+BOOL DbgBreakpointStep (IN dbgSession* session, IN tid_t tid) {
+	dbgThread*         thread = DbgBreakpointThread (session, tid);
+	dbgBreakpoint*     breakpoint;
+	unsigned long long elapsed;
+
+	if (!thread || !thread->rearm)
+		return FALSE;
+	/* the breakpoint may have been removed while the thread stepped */
+	breakpoint = DbgFindBreakpoint (session, thread->rearm);
+	if (breakpoint) {
+		unsigned char bp = 0xcc;
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) breakpoint->address, &bp, 1);
+		DbgFlushInstructionCache (session, breakpoint->address, 1);
+	}
+	thread->rearm = 0;
+	elapsed = DbgClockNow () - thread->trapStart;
+	DbgStatsTime (DBG_TIMER_TRAP, elapsed);
+	session->process.breakPointIndex.trapTime += elapsed;
+	session->process.breakPointIndex.traps++;
+	return TRUE;
+}
+
+static BOOL DbgCountAddProc (IN void* arg, IN const char* name, IN vaddr_t address) {
+	/* an address that does not fit is counted as failed by the caller */
+	vectorAdd ((vector*) arg, &address);
+	return TRUE;
+}
+
+/**
+*	Set counting breakpoints on every function matching a pattern.
+*	The functions are collected first and armed in one pass over their
+*	pages. Must be called on the session thread.
+*	\param session Debug session
+*	\param pattern Function name with * and ? wildcards, optionally prefixed by "module!"
+*	\ret Number of breakpoints set
+*/
+unsigned long DbgCountBreakpoints (IN dbgSession* session, IN const char* pattern) {
+	unsigned long long start = DbgClockNow ();
+	vector             addresses;
+	unsigned long      added;
+	unsigned long      failed = 0;
+	unsigned int       found;
+
+	vectorInit (&addresses, sizeof (vaddr_t));
+	found = DbgSymbolEnumFunctions (session, pattern, DbgCountAddProc, &addresses);
+	/* functions can have several names; DbgBreakpointArm skips repeated addresses */
+	qsort (addresses.data, vectorSize (&addresses), sizeof (vaddr_t), DbgBreakpointCompareAddress);
+	added = DbgBreakpointArm (session, addresses.data, vectorSize (&addresses), sizeof (vaddr_t), FALSE, TRUE, &failed, 0);
+	failed += found - vectorSize (&addresses);
+	vectorFree (&addresses);
+	DbgDisplayMessage ("%u functions match '%s': %lu counting breakpoints set, %lu failed, %.1f ms",
+		found, pattern, added, failed, (double) (DbgClockNow () - start) / 1000000.0);
+	return added;
+}
+
+static int DbgCountCompare (const void* a, const void* b) {
+	unsigned int x = (*(const dbgBreakpoint* const*) a)->hits;
+	unsigned int y = (*(const dbgBreakpoint* const*) b)->hits;
+	return x > y ? -1 : x < y;
+}
+
+/**
+*	Display calls per function counted by counting breakpoints
+*	\param session Debug session
+*	\param top Number of functions to display
+*/
+void DbgCountReport (IN dbgSession* session, IN unsigned int top) {
+	dbgBreakpointIndex* index = &session->process.breakPointIndex;
+	vector              hit;
+	ilistNode*          cur;
+	unsigned long long  calls   = 0;
+	unsigned int        counted = 0;
+	double              mean    = index->traps ? (double) index->trapTime / index->traps : 0.0;
+	unsigned int        i;
+
+	vectorInit (&hit, sizeof (dbgBreakpoint*));
+	for (cur = session->process.breakPointList.first; cur; cur = cur->next) {
+		dbgBreakpoint* breakpoint = (dbgBreakpoint*) cur;
+		if (!breakpoint->count || breakpoint->once)
+			continue;
+		counted++;
+		if (!breakpoint->hits)
+			continue;
+		vectorAdd (&hit, &breakpoint);
+		calls += breakpoint->hits;
+	}
+	qsort (hit.data, vectorSize (&hit), sizeof (dbgBreakpoint*), DbgCountCompare);
+
+	DbgDisplayMessage ("     Calls  Trap ms (est)  Function");
+	for (i = 0; i < top && i < vectorSize (&hit); i++) {
+		dbgBreakpoint* breakpoint = *(dbgBreakpoint**) vectorAt (&hit, i);
+		char           name[128];
+		unsigned long  offset;
+		if (!DbgSymbolName (session, breakpoint->address, name, sizeof (name), &offset)) {
+#ifdef _MSC_VER
+			sprintf_s (name, sizeof (name), "0x%08x", breakpoint->address);
+#else
+			sprintf (name, "0x%08x", breakpoint->address);
+#endif
+		}
+		DbgDisplayMessage ("%10u  %13.1f  %s", breakpoint->hits, breakpoint->hits * mean / 1000000.0, name);
+	}
+	DbgDisplayMessage ("%llu calls in %u of %u counted functions; %.1f us per call in the trap path, %.1f ms total",
+		calls, vectorSize (&hit), counted, mean / 1000.0, (double) index->trapTime / 1000000.0);
+	vectorFree (&hit);
+}
+
+/**
+*	Remove all counting breakpoints.
+*	Must be called on the session thread.
+*	\param session Debug session
+*/
+void DbgCountClear (IN dbgSession* session) {
+	ilistNode*    cur  = session->process.breakPointList.first;
+	unsigned long done = 0;
+
+	while (cur) {
+		dbgBreakpoint* breakpoint = (dbgBreakpoint*) cur;
+		cur = cur->next;
+		if (!breakpoint->count || breakpoint->once)
+			continue;
+		/* fails harmlessly on a breakpoint that is being stepped over */
+		DbgRemoveBreakpointInternal (session, breakpoint);
+		DbgBreakpointUnlink (session, breakpoint);
+		poolRelease (&session->process.breakPointPool, breakpoint);
+		done++;
+	}
+	session->process.breakPointIndex.trapTime = 0;
+	session->process.breakPointIndex.traps    = 0;
+	DbgDisplayMessage ("%lu counting breakpoints removed", done);
 }
 
 /* not supported. */
@@ -0,0 +1,499 @@
+/********************************************
+*
+*	checkpoint.c - Checkpoints and reverse execution
+*
+********************************************/
+
+/*
+	This component implements checkpoints of a stopped target and
+	reverse execution on top of them.
+
+	A checkpoint copies every writable page of the target together with
+	the registers of every thread and the breakpoint table. Pages that
+	are unchanged since the previous checkpoint are shared with it, so a
+	checkpoint costs memory only for the pages the target wrote in the
+	meantime. Code and other read only memory is never copied.
+
+	Every stop of the target is recorded in the session history.
+	Reverse execution restores the newest checkpoint taken before the
+	wanted stop and lets the target run forward again, passing the stops
+	in between without reporting them.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_CHECKPOINT_BLOCK    (1024*1024)		/* bytes read from the target at once */
+#define DBG_CHECKPOINT_USER_END 0x80000000ULL	/* end of the user address space */
+#define DBG_CHECKPOINT_SLAB     256				/* pages per pool slab */
+
+typedef struct _dbgCheckpointPage {
+	unsigned long refs;				/* checkpoints sharing this page */
+	unsigned char data[DBG_MEMORY_PAGE];
+}dbgCheckpointPage;
+
+typedef struct _dbgCheckpointEntry {
+	vaddr_t            address;
+	dbgCheckpointPage* page;
+}dbgCheckpointEntry;
+
+typedef struct _dbgCheckpointThread {
+	tid_t      id;
+	dbgContext context;
+}dbgCheckpointThread;
+
+struct _dbgCheckpoint {
+	unsigned int       id;
+	unsigned int       position;	/* history position when taken */
+	BOOL               detached;	/* history it was taken on has been replaced */
+	vector             pages;		/* dbgCheckpointEntry sorted by address */
+	vector             threads;		/* dbgCheckpointThread */
+	vector             breakpoints;	/* dbgBreakpoint copies */
+	unsigned long      shared;		/* pages shared with the previous checkpoint */
+	unsigned long long elapsed;		/* time taken to create, ns */
+};
+
+/**
+*	Initialize session history
+*	\param session Debug session
+*/
+void DbgHistoryInit (IN dbgSession* session) {
+	dbgHistory* history = &session->history;
+
+	vectorInit (&history->checkpoints, sizeof (dbgCheckpoint*));
+	vectorInit (&history->stops, sizeof (dbgStop));
+	history->position = 0;
+	history->replay   = 0;
+	history->nextId   = 1;
+	poolInit (&history->pages, sizeof (dbgCheckpointPage), DBG_CHECKPOINT_SLAB);
+}
+
+/**
+*	Release a checkpoint and the pages only it references
+*/
+static void DbgCheckpointFree (IN dbgHistory* history, IN dbgCheckpoint* checkpoint) {
+	unsigned int i;
+
+	for (i = 0; i < vectorSize (&checkpoint->pages); i++) {
+		dbgCheckpointPage* page = ((dbgCheckpointEntry*) vectorAt (&checkpoint->pages, i))->page;
+		if (--page->refs == 0)
+			poolRelease (&history->pages, page);
+	}
+	vectorFree (&checkpoint->pages);
+	vectorFree (&checkpoint->threads);
+	vectorFree (&checkpoint->breakpoints);
+	free (checkpoint);
+}
+
+/**
+*	Release session history and all checkpoints
+*	\param session Debug session
+*/
+void DbgHistoryFree (IN dbgSession* session) {
+	dbgHistory*  history = &session->history;
+	unsigned int i;
+
+	for (i = 0; i < vectorSize (&history->checkpoints); i++)
+		DbgCheckpointFree (history, *(dbgCheckpoint**) vectorAt (&history->checkpoints, i));
+	vectorFree (&history->checkpoints);
+	vectorFree (&history->stops);
+	poolFree (&history->pages);
+}
+
+/**
+*	Record a stop of the target
+*
+*	Called by the session for every exception before it is reported.
+*	While replaying, stops are compared with the recorded history and
+*	passed silently until the wanted stop is reached.
+*
+*	\param session Debug session
+*	\param stop Exception that stopped the target
+*	\ret TRUE if the stop must not be reported and the target continues
+*/
+BOOL DbgHistoryStop (IN dbgSession* session, IN dbgExceptionDescr* stop) {
+	dbgHistory* history = &session->history;
+	dbgStop     record;
+
+	record.address = stop->address;
+	record.code    = stop->code;
+
+	if (history->replay) {
+		dbgStop* expected = history->position < vectorSize (&history->stops)
+			? (dbgStop*) vectorAt (&history->stops, history->position) : 0;
+		if (expected && expected->address == record.address && expected->code == record.code) {
+			if (++history->position < history->replay)
+				return TRUE;
+			history->replay = 0;
+			DbgDisplayMessage ("Replayed to stop %u", history->position);
+			return FALSE;
+		}
+		DbgDisplayError ("Replay diverged at stop %u; the target did not repeat its earlier execution",
+			history->position + 1);
+		history->replay = 0;
+	}
+
+	/* a new stop replaces whatever was recorded after this point */
+	if (vectorSize (&history->stops) > history->position) {
+		unsigned int i;
+		history->stops.count = history->position;
+		for (i = 0; i < vectorSize (&history->checkpoints); i++) {
+			dbgCheckpoint* checkpoint = *(dbgCheckpoint**) vectorAt (&history->checkpoints, i);
+			if (checkpoint->position > history->position)
+				checkpoint->detached = TRUE;
+		}
+	}
+	vectorAdd (&history->stops, &record);
+	history->position++;
+	return FALSE;
+}
+
+/**
+*	Suspend or resume every thread of the target
+*/
+static void DbgCheckpointSuspend (IN dbgSession* session, IN BOOL suspend) {
+	ilistNode* cur;
+	for (cur = session->process.threadList.first; cur; cur = cur->next)
+		DbgProcessRequest (suspend ? DBG_REQ_SUSPEND : DBG_REQ_RESUME, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+}
+
+/**
+*	Test if checkpoints can be used on the session
+*/
+static BOOL DbgCheckpointAllowed (IN dbgSession* session) {
+	if (session->type != DBG_SESSION_LIVE) {
+		DbgDisplayError ("Checkpoints need a live target");
+		return FALSE;
+	}
+	if (session->state != DBG_STATE_SUSPEND) {
+		DbgDisplayError ("Target is running");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Copy one region of writable memory into the checkpoint
+*	\param previous Cursor into the pages of the previous checkpoint
+*	\ret FALSE if out of memory
+*/
+static BOOL DbgCheckpointRegion (IN dbgSession* session, IN dbgCheckpoint* checkpoint, IN dbgCheckpoint* last,
+                                 IN OUT unsigned int* previous, IN unsigned char* buffer, IN vaddr_t base, IN unsigned long size) {
+	dbgHistory*   history = &session->history;
+	unsigned long offset;
+
+	for (offset = 0; offset < size; offset += DBG_CHECKPOINT_BLOCK) {
+		size_t       length = size - offset > DBG_CHECKPOINT_BLOCK ? DBG_CHECKPOINT_BLOCK : size - offset;
+		vaddr_t      at     = base + offset;
+		unsigned int page;
+
+		if (DbgProcessRequest (DBG_REQ_READ, session, (void*) at, buffer, length) != length)
+			continue;	/* region changed since it was queried */
+
+		for (page = 0; page < length / DBG_MEMORY_PAGE; page++) {
+			dbgCheckpointEntry entry;
+			dbgCheckpointEntry* old = 0;
+			unsigned char*      data = buffer + page * DBG_MEMORY_PAGE;
+
+			entry.address = at + page * DBG_MEMORY_PAGE;
+
+			/* both page lists are sorted; advance the cursor of the previous checkpoint */
+			if (last) {
+				while (*previous < vectorSize (&last->pages)
+					&& ((dbgCheckpointEntry*) vectorAt (&last->pages, *previous))->address < entry.address)
+					(*previous)++;
+				if (*previous < vectorSize (&last->pages)) {
+					old = (dbgCheckpointEntry*) vectorAt (&last->pages, *previous);
+					if (old->address != entry.address)
+						old = 0;
+				}
+			}
+
+			if (old && memcmp (old->page->data, data, DBG_MEMORY_PAGE) == 0) {
+				entry.page = old->page;
+				checkpoint->shared++;
+			}
+			else {
+				entry.page = (dbgCheckpointPage*) poolAlloc (&history->pages);
+				if (!entry.page)
+					return FALSE;
+				entry.page->refs = 0;
+				memcpy (entry.page->data, data, DBG_MEMORY_PAGE);
+			}
+			entry.page->refs++;
+			if (!vectorAdd (&checkpoint->pages, &entry)) {
+				if (--entry.page->refs == 0)
+					poolRelease (&history->pages, entry.page);
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+/**
+*	Create checkpoint of the stopped target
+*	\param session Debug session
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgCheckpointCreate (IN dbgSession* session) {
+	dbgHistory*        history = &session->history;
+	dbgCheckpoint*     checkpoint;
+	dbgCheckpoint*     last = 0;
+	unsigned int       previous = 0;
+	unsigned char*     buffer;
+	unsigned long long at;
+	unsigned long long start;
+	ilistNode*         cur;
+	BOOL               result = TRUE;
+
+	if (!DbgCheckpointAllowed (session))
+		return FALSE;
+
+	checkpoint = (dbgCheckpoint*) calloc (1, sizeof (dbgCheckpoint));
+	buffer     = (unsigned char*) malloc (DBG_CHECKPOINT_BLOCK);
+	if (!checkpoint || !buffer) {
+		free (checkpoint);
+		free (buffer);
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+	vectorInit (&checkpoint->pages,       sizeof (dbgCheckpointEntry));
+	vectorInit (&checkpoint->threads,     sizeof (dbgCheckpointThread));
+	vectorInit (&checkpoint->breakpoints, sizeof (dbgBreakpoint));
+	checkpoint->id       = history->nextId;
+	checkpoint->position = history->position;
+	if (vectorSize (&history->checkpoints))
+		last = *(dbgCheckpoint**) vectorAt (&history->checkpoints, vectorSize (&history->checkpoints) - 1);
+
+	start = DbgClockNow ();
+	DbgCheckpointSuspend (session, TRUE);
+
+	/* registers */
+	for (cur = session->process.threadList.first; cur; cur = cur->next) {
+		dbgThread*          thread = (dbgThread*) cur;
+		dbgCheckpointThread record;
+		record.id = thread->id;
+		if (DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread->thread, &record.context, sizeof (dbgContext)))
+			vectorAdd (&checkpoint->threads, &record);
+	}
+
+	/* breakpoints */
+	for (cur = session->process.breakPointList.first; cur; cur = cur->next)
+		vectorAdd (&checkpoint->breakpoints, cur);
+
+	/* writable memory */
+	for (at = 0; at < DBG_CHECKPOINT_USER_END && result; ) {
+		dbgMemoryRegion region;
+		if (!DbgProcessRequest (DBG_REQ_QUERY, session, (void*) (vaddr_t) at, &region, sizeof (region)))
+			break;
+		if (region.base + (unsigned long long) region.size <= at)
+			break;
+		if (region.readable && (region.protect & DBG_MEMORY_PROT_WRITE))
+			result = DbgCheckpointRegion (session, checkpoint, last, &previous, buffer, region.base, region.size);
+		at = region.base + (unsigned long long) region.size;
+	}
+
+	DbgCheckpointSuspend (session, FALSE);
+	checkpoint->elapsed = DbgClockNow () - start;
+	free (buffer);
+
+	if (!result || !vectorAdd (&history->checkpoints, &checkpoint)) {
+		DbgDisplayError ("Out of memory");
+		DbgCheckpointFree (history, checkpoint);
+		return FALSE;
+	}
+	history->nextId++;
+
+	{
+		unsigned long pages   = vectorSize (&checkpoint->pages);
+		double        seconds = (double) checkpoint->elapsed / 1000000000.0;
+		DbgDisplayMessage ("Checkpoint %u: %lu KB writable, %lu KB new, %lu threads, %.1f ms (%.1f MB/s)",
+			checkpoint->id, pages * (DBG_MEMORY_PAGE / 1024), (pages - checkpoint->shared) * (DBG_MEMORY_PAGE / 1024),
+			(unsigned long) vectorSize (&checkpoint->threads), seconds * 1000.0,
+			seconds > 0 ? (double) pages * DBG_MEMORY_PAGE / (1024.0 * 1024.0) / seconds : 0.0);
+	}
+	return TRUE;
+}
+
+/**
+*	Locate checkpoint by id
+*/
+static dbgCheckpoint* DbgCheckpointFind (IN dbgHistory* history, IN unsigned int id) {
+	unsigned int i;
+	for (i = 0; i < vectorSize (&history->checkpoints); i++) {
+		dbgCheckpoint* checkpoint = *(dbgCheckpoint**) vectorAt (&history->checkpoints, i);
+		if (checkpoint->id == id)
+			return checkpoint;
+	}
+	return 0;
+}
+
+/**
+*	Put the target back into the state of a checkpoint
+*/
+static BOOL DbgCheckpointApply (IN dbgSession* session, IN dbgCheckpoint* checkpoint) {
+	dbgProcess*        proc = &session->process;
+	unsigned char      current[DBG_MEMORY_PAGE];
+	unsigned long      written = 0;
+	unsigned long      failed  = 0;
+	unsigned long long start   = DbgClockNow ();
+	unsigned int       i;
+
+	DbgCheckpointSuspend (session, TRUE);
+
+	/* take out current breakpoints so their bytes do not end up in memory */
+	while (proc->breakPointList.first) {
+		dbgBreakpoint* breakpoint = (dbgBreakpoint*) proc->breakPointList.first;
+		DbgRemoveBreakpointInternal (session, breakpoint);
+		DbgBreakpointUnlink (session, breakpoint);
+		poolRelease (&proc->breakPointPool, breakpoint);
+	}
+
+	/* only pages that changed are written */
+	for (i = 0; i < vectorSize (&checkpoint->pages); i++) {
+		dbgCheckpointEntry* entry = (dbgCheckpointEntry*) vectorAt (&checkpoint->pages, i);
+		if (DbgProcessRequest (DBG_REQ_READ, session, (void*) entry->address, current, DBG_MEMORY_PAGE) == DBG_MEMORY_PAGE
+			&& memcmp (current, entry->page->data, DBG_MEMORY_PAGE) == 0)
+			continue;
+		if (DbgProcessRequest (DBG_REQ_WRITE, session, (void*) entry->address, entry->page->data, DBG_MEMORY_PAGE) == DBG_MEMORY_PAGE)
+			written++;
+		else
+			failed++;
+	}
+
+	/* registers */
+	for (i = 0; i < vectorSize (&checkpoint->threads); i++) {
+		dbgCheckpointThread* record = (dbgCheckpointThread*) vectorAt (&checkpoint->threads, i);
+		ilistNode*           cur;
+		for (cur = proc->threadList.first; cur; cur = cur->next) {
+			if (((dbgThread*) cur)->id == record->id)
+				break;
+		}
+		if (!cur || !DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) ((dbgThread*) cur)->thread,
+			&record->context, sizeof (dbgContext)))
+			DbgDisplayError ("Thread %u no longer exists; its registers were not restored", record->id);
+	}
+
+	/* breakpoints as they were */
+	for (i = 0; i < vectorSize (&checkpoint->breakpoints); i++) {
+		dbgBreakpoint* breakpoint = (dbgBreakpoint*) poolAlloc (&proc->breakPointPool);
+		unsigned char  bp = 0xcc;
+		if (!breakpoint)
+			break;
+		memcpy (breakpoint, vectorAt (&checkpoint->breakpoints, i), sizeof (dbgBreakpoint));
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) breakpoint->address, &bp, 1);
+		DbgFlushInstructionCache (session, breakpoint->address, 1);
+		DbgBreakpointLink (session, breakpoint);
+	}
+
+	session->history.position = checkpoint->position;
+	DbgCheckpointSuspend (session, FALSE);
+
+	DbgDisplayMessage ("Restored checkpoint %u: %lu KB written, %.1f ms", checkpoint->id,
+		written * (DBG_MEMORY_PAGE / 1024), (double) (DbgClockNow () - start) / 1000000.0);
+	if (failed)
+		DbgDisplayError ("%lu KB could not be written; memory was released since the checkpoint",
+			failed * (DBG_MEMORY_PAGE / 1024));
+	return TRUE;
+}
+
+/**
+*	Restore checkpoint
+*	\param session Debug session
+*	\param id Checkpoint id
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgCheckpointRestore (IN dbgSession* session, IN unsigned int id) {
+	dbgCheckpoint* checkpoint;
+
+	if (!DbgCheckpointAllowed (session))
+		return FALSE;
+	checkpoint = DbgCheckpointFind (&session->history, id);
+	if (!checkpoint) {
+		DbgDisplayError ("No checkpoint %u", id);
+		return FALSE;
+	}
+	session->history.replay = 0;
+	return DbgCheckpointApply (session, checkpoint);
+}
+
+/**
+*	Display checkpoints
+*	\param session Debug session
+*/
+void DbgCheckpointList (IN dbgSession* session) {
+	dbgHistory*  history = &session->history;
+	unsigned int i;
+
+	DbgDisplayMessage ("Id    Stop   Writable (KB)  New (KB)  Time (ms)");
+	for (i = 0; i < vectorSize (&history->checkpoints); i++) {
+		dbgCheckpoint* checkpoint = *(dbgCheckpoint**) vectorAt (&history->checkpoints, i);
+		unsigned long  pages      = vectorSize (&checkpoint->pages);
+		DbgDisplayMessage ("%-4u  %-5u  %13lu  %8lu  %9.1f%s", checkpoint->id, checkpoint->position,
+			pages * (DBG_MEMORY_PAGE / 1024), (pages - checkpoint->shared) * (DBG_MEMORY_PAGE / 1024),
+			(double) checkpoint->elapsed / 1000000.0, checkpoint->detached ? "  (other timeline)" : "");
+	}
+	DbgDisplayMessage ("Target is at stop %u of %u recorded", history->position, vectorSize (&history->stops));
+}
+
+/**
+*	Run backwards to an earlier stop
+*
+*	The newest checkpoint of the current timeline taken at or before the
+*	wanted stop is restored and the target runs forward until the stop
+*	is reached again.
+*
+*	\param session Debug session
+*	\param step TRUE to go back to the previous stop, FALSE to the previous breakpoint
+*	\ret TRUE if the target was restored, FALSE otherwise
+*/
+BOOL DbgReverse (IN dbgSession* session, IN BOOL step) {
+	dbgHistory*    history = &session->history;
+	dbgCheckpoint* best = 0;
+	unsigned int   target = 0;
+	unsigned int   i;
+
+	if (!DbgCheckpointAllowed (session))
+		return FALSE;
+
+	/* the target is at stop position-1; find the earlier stop wanted */
+	if (history->position >= 2) {
+		if (step)
+			target = history->position - 1;
+		else {
+			for (i = history->position - 1; i > 0; i--) {
+				if (((dbgStop*) vectorAt (&history->stops, i - 1))->code == DBG_EXCEPTION_BREAKPOINT) {
+					target = i;
+					break;
+				}
+			}
+		}
+	}
+	if (!target) {
+		DbgDisplayError ("No earlier stop recorded");
+		return FALSE;
+	}
+
+	for (i = 0; i < vectorSize (&history->checkpoints); i++) {
+		dbgCheckpoint* checkpoint = *(dbgCheckpoint**) vectorAt (&history->checkpoints, i);
+		if (!checkpoint->detached && checkpoint->position <= target && (!best || checkpoint->position > best->position))
+			best = checkpoint;
+	}
+	if (!best) {
+		DbgDisplayError ("No checkpoint before stop %u", target);
+		return FALSE;
+	}
+
+	if (!DbgCheckpointApply (session, best))
+		return FALSE;
+	if (best->position == target)
+		return TRUE;
+
+	/* replay forward; the session reports the target stop when it is reached */
+	DbgDisplayMessage ("Replaying %u stops from checkpoint %u", target - best->position, best->id);
+	history->replay = target;
+	session->state  = DBG_STATE_CONTINUE;
+	return TRUE;
+}
@@ -17,8 +17,12 @@
 #include "defs.h"
 #include "sys.h"
 
+#define DBG_CONSOLE_LINE     256
+#define DBG_CONSOLE_ARGS     (DBG_CONSOLE_LINE / 2)	/* every token of a full line */
+#define DBG_CONSOLE_COMMANDS 64
+
 typedef struct _dbgConsole {
-	char currentLine[32];
+	char currentLine[DBG_CONSOLE_LINE];
 }dbgConsole;
 dbgConsole _console;
 
@@ -29,11 +33,11 @@ typedef struct _dbgCommand {
 	char* descr;
 	DbgCommandProc proc;
 }dbgCommand;
-static dbgCommand _commandList[32];
+static dbgCommand _commandList[DBG_CONSOLE_COMMANDS];
 
 NDBG_API dbgCommand* NDBG_CALL DbgConsoleGet (char* name) {
 	int i;
-	for (i = 0; i<32; i++) {
+	for (i = 0; i<DBG_CONSOLE_COMMANDS; i++) {
 		if (!_commandList[i].cmd)
 			continue;
 		if (strcmp (_commandList[i].cmd,name)==0)
@@ -44,7 +48,7 @@ NDBG_API dbgCommand* NDBG_CALL DbgConsoleGet (char* name) {
 
 NDBG_API void NDBG_CALL DbgConsoleRegister (char* cmd, char* descr, DbgCommandProc proc) {
 	static int current = 0;
-	assert (current < 32);
+	assert (current < DBG_CONSOLE_COMMANDS);
 	if (DbgConsoleGet (cmd)) {
 		printf ("\n\rDbgConsoleRegister: double register");
 		exit (0);
@@ -62,6 +66,11 @@ NDBG_API size_t NDBG_CALL DbgConsoleGetArgs (IN char* line, IN char** argv, IN s
 		argv[argc++] = p2;
 		p2 = strtok(0, " \n");
 	}
+	/* never run a command with some of its arguments cut off */
+	if (p2) {
+		DbgDisplayError ("Too many arguments; at most %u are accepted", (unsigned int) count);
+		return 0;
+	}
 	return argc;
 }
 
@@ -87,7 +96,7 @@ int DbgConsoleHelp (IN int argc, IN char** argv) {
 
 	printf ("\n\nCommand\t| Description\n");
 	printf ("------------------------------\n");
-	for (c=0; c<32; c++) {
+	for (c=0; c<DBG_CONSOLE_COMMANDS; c++) {
 		if (_commandList[c].cmd) {
 			printf ("\n%s", _commandList[c].cmd);
 			printf ("\t| %s", _commandList[c].descr ? _commandList[c].descr : "<invalid>");
@@ -106,10 +115,9 @@ int DbgConsoleHelp (IN int argc, IN char** argv) {
 */
 BOOL DbgConsoleContinue (IN int argc, IN char** argv) {
 	dbgSession* session = DbgGetCurrentSession ();
-	/* call debugger API */
+	/* call debugger API; the session thread resumes the target and updates its state */
 	if (!DbgContinue (session))
 		return FALSE;
-	session->state = DBG_STATE_CONTINUE;
 	return TRUE;
 }
 
@@ -132,18 +140,47 @@ void DbgDisplayContext (dbgContext* context) {
 	printf ("FLAGS : 0x%x\n", context->flags);
 }
 
+static unsigned long DbgConsoleSetBreakpointProc (IN dbgSession* session, IN void* arg) {
+	return DbgSetBreakpointAt (session, (const char*) arg);
+}
+
 BOOL DbgConsoleSetBreakpoint (IN int argc, IN char** argv) {
-	vaddr_t address;
+	dbgSession* session = DbgGetCurrentSession ();
 
 	if (argc!=2) {
-		DbgDisplayError ("Syntax : b [address]");
+		DbgDisplayError ("Syntax : b [address | symbol | module!symbol | file:line]");
 		return FALSE;
 	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleSetBreakpointProc, argv[1]) != 0;
+}
 
-	address = (vaddr_t) strtol (argv[1], 0, 10);	
-	if (!address)
-		address = (vaddr_t) strtol (argv[1], 0, 16);	
-	return DbgSetBreakpoint (DbgGetCurrentSession(), address, DBG_BREAK_SOFT);
+static unsigned long DbgConsoleRegexBreakpointProc (IN dbgSession* session, IN void* arg) {
+	return DbgSetBreakpointRegex (session, (const char*) arg) != 0;
+}
+
+/**
+*	Implements console RB command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleRegexBreakpoint (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+
+	if (argc != 2) {
+		DbgDisplayError ("Syntax : rb regex");
+		DbgDisplayError ("         set breakpoints on every function whose name matches");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleRegexBreakpointProc, argv[1]) != 0;
 }
 
 BOOL DbgConsoleRegisters (IN int argc, IN char** argv) {
@@ -160,6 +197,784 @@ BOOL DbgConsoleSingleStep (IN int argc, IN char** argv) {
 	return FALSE;
 }
 
+static unsigned long DbgConsoleDebugOutProc (IN dbgSession* session, IN void* arg) {
+	char* path = (char*) arg;
+	if (!path) {
+		DbgDebugOutStats (session);
+		return TRUE;
+	}
+	return DbgDebugOutSetSink (session, path);
+}
+
+/**
+*	Implements console DBGOUT command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleDebugOut (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+
+	if (argc != 2) {
+		DbgDisplayError ("Syntax : dbgout [console | off | stats | file]");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	/* output state belongs to the session thread */
+	if (strcmp (argv[1], "stats") == 0)
+		return DbgSessionRun (session, DbgConsoleDebugOutProc, 0);
+	return DbgSessionRun (session, DbgConsoleDebugOutProc, argv[1]);
+}
+
+static unsigned long DbgConsoleModulesProc (IN dbgSession* session, IN void* arg) {
+	DbgSymbolMemoryStats (session);
+	return TRUE;
+}
+
+/**
+*	Implements console LM (list modules) command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleModules (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleModulesProc, 0);
+}
+
+/**
+*	Parse memory range operands
+*	\param address Address operand, hex
+*	\param length Optional length operand in bytes, hex
+*	\param size Output range size
+*	\ret Start address; 0 on error
+*/
+static vaddr_t DbgConsoleGetRange (IN char* address, IN OPT char* length, OUT size_t* size) {
+	vaddr_t start = (vaddr_t) strtoul (address, 0, 16);
+
+	*size = length ? (size_t) strtoul (length, 0, 16) : 0x80;
+	if (!start || !*size || (unsigned long long) start + *size > 0x100000000ULL) {
+		DbgDisplayError ("Invalid range");
+		return 0;
+	}
+	return start;
+}
+
+/**
+*	Display memory in units of the given size
+*	\param argc Argument count
+*	\param argv Argument list
+*	\param unit Bytes per unit
+*	\ret TRUE if success, FALSE on error
+*/
+static BOOL DbgConsoleDisplayMemory (IN int argc, IN char** argv, IN unsigned int unit) {
+	dbgSession* session = DbgGetCurrentSession ();
+	vaddr_t     address;
+	size_t      size;
+
+	if (argc < 2 || argc > 3) {
+		DbgDisplayError ("Syntax : %s address [length]", argv[0]);
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	address = DbgConsoleGetRange (argv[1], argc == 3 ? argv[2] : 0, &size);
+	if (!address)
+		return FALSE;
+	return DbgMemoryDisplay (session, address, size, unit);
+}
+
+BOOL DbgConsoleDisplayBytes (IN int argc, IN char** argv) {
+	return DbgConsoleDisplayMemory (argc, argv, 1);
+}
+
+BOOL DbgConsoleDisplayDwords (IN int argc, IN char** argv) {
+	return DbgConsoleDisplayMemory (argc, argv, 4);
+}
+
+BOOL DbgConsoleDisplayQwords (IN int argc, IN char** argv) {
+	return DbgConsoleDisplayMemory (argc, argv, 8);
+}
+
+/**
+*	Implements console MEM command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleMemory (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	vaddr_t     address;
+	size_t      size;
+
+	if (argc == 5 && strcmp (argv[1], "-f") == 0) {
+		if (!session) {
+			DbgDisplayError ("No session");
+			return FALSE;
+		}
+		address = DbgConsoleGetRange (argv[3], argv[4], &size);
+		if (!address)
+			return FALSE;
+		return DbgMemoryDumpFile (session, address, size, argv[2]);
+	}
+	if (argc < 2 || argc > 3 || argv[1][0] == '-') {
+		DbgDisplayError ("Syntax : mem address [length] | mem -f file address length");
+		return FALSE;
+	}
+	return DbgConsoleDisplayMemory (argc, argv, 1);
+}
+
+/**
+*	Implements console SEARCH command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleSearch (IN int argc, IN char** argv) {
+	static const char*   modes[] = {"-b", "-a", "-u", "-p"};
+	dbgSession*          session = DbgGetCurrentSession ();
+	unsigned long        limit   = 1000;
+	int                  mode;
+
+	for (mode = 0; mode < 4; mode++) {
+		if (argc > 1 && strcmp (argv[1], modes[mode]) == 0)
+			break;
+	}
+	if ((argc != 3 && argc != 4) || mode == 4) {
+		DbgDisplayError ("Syntax : search -b hex | -a ascii | -u unicode | -p pointer [limit]");
+		DbgDisplayError ("         hex digits may be '?' to match any nibble, e.g. 4d5a??00");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	if (argc == 4)
+		limit = strtoul (argv[3], 0, 10);
+	return DbgSearch (session, (dbgSearchMode) mode, argv[2], limit);
+}
+
+/**
+*	Implements console GCORE command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleCore (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	BOOL        skip    = argc == 3 && strcmp (argv[1], "-s") == 0;
+
+	if (argc != 2 && !skip) {
+		DbgDisplayError ("Syntax : gcore [-s] file");
+		DbgDisplayError ("         -s skips read only file mappings");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgCoreWrite (session, argv[argc - 1], skip);
+}
+
+static unsigned long DbgConsoleThreadsProc (IN dbgSession* session, IN void* arg) {
+	ilistNode* current;
+
+	DbgDisplayMessage ("Id        Eip         Esp         Ebp");
+	for (current = session->process.threadList.first; current; current = current->next) {
+		dbgThread* thread = (dbgThread*) current;
+		dbgContext context;
+		if (!DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread->thread, &context, sizeof (dbgContext))) {
+			DbgDisplayMessage ("%-8u  <unavailable>", thread->id);
+			continue;
+		}
+		DbgDisplayMessage ("%-8u  0x%08x  0x%08x  0x%08x", thread->id, context.eip, context.regs.esp, context.regs.ebp);
+	}
+	DbgSessionBatchStats (session);
+	return TRUE;
+}
+
+/**
+*	Implements console THREADS command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleThreads (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleThreadsProc, 0);
+}
+
+typedef struct _dbgConsoleBacktrace {
+	BOOL all;
+	BOOL dbghelp;
+}dbgConsoleBacktrace;
+
+static unsigned long DbgConsoleBacktraceProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleBacktrace* options = (dbgConsoleBacktrace*) arg;
+	return DbgBacktrace (session, options->all, options->dbghelp);
+}
+
+/**
+*	Implements console BT command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleBacktrace (IN int argc, IN char** argv) {
+	dbgSession*         session = DbgGetCurrentSession ();
+	dbgConsoleBacktrace options;
+	int                 i;
+
+	options.all     = FALSE;
+	options.dbghelp = FALSE;
+	for (i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-a") == 0)
+			options.all = TRUE;
+		else if (strcmp (argv[i], "-d") == 0)
+			options.dbghelp = TRUE;
+		else {
+			DbgDisplayError ("Syntax : bt [-a] [-d]");
+			DbgDisplayError ("         -a all threads, -d walk with the symbol handler");
+			return FALSE;
+		}
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleBacktraceProc, &options);
+}
+
+static unsigned long DbgConsoleCheckpointProc (IN dbgSession* session, IN void* arg) {
+	if (arg)
+		DbgCheckpointList (session);
+	else
+		return DbgCheckpointCreate (session);
+	return TRUE;
+}
+
+/**
+*	Implements console CHECKPOINT command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleCheckpoint (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	BOOL        list    = argc == 2 && strcmp (argv[1], "-l") == 0;
+
+	if (argc != 1 && !list) {
+		DbgDisplayError ("Syntax : checkpoint [-l]");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleCheckpointProc, list ? argv[1] : 0);
+}
+
+static unsigned long DbgConsoleRestartProc (IN dbgSession* session, IN void* arg) {
+	return DbgCheckpointRestore (session, *(unsigned int*) arg);
+}
+
+/**
+*	Implements console RESTART command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleRestart (IN int argc, IN char** argv) {
+	dbgSession*  session = DbgGetCurrentSession ();
+	unsigned int id;
+
+	if (argc != 2) {
+		DbgDisplayError ("Syntax : restart checkpoint");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	id = (unsigned int) strtoul (argv[1], 0, 10);
+	return DbgSessionRun (session, DbgConsoleRestartProc, &id);
+}
+
+static unsigned long DbgConsoleReverseProc (IN dbgSession* session, IN void* arg) {
+	return DbgReverse (session, arg != 0);
+}
+
+/**
+*	Implements console REVERSE-CONTINUE and REVERSE-STEP commands
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+static BOOL DbgConsoleReverse (IN int argc, IN char** argv, IN BOOL step) {
+	dbgSession* session = DbgGetCurrentSession ();
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleReverseProc, step ? session : 0);
+}
+
+BOOL DbgConsoleReverseContinue (IN int argc, IN char** argv) {
+	return DbgConsoleReverse (argc, argv, FALSE);
+}
+
+BOOL DbgConsoleReverseStep (IN int argc, IN char** argv) {
+	return DbgConsoleReverse (argc, argv, TRUE);
+}
+
+typedef struct _dbgConsoleProfile {
+	unsigned int rate;
+	unsigned int seconds;
+	unsigned int top;
+	const char*  path;
+}dbgConsoleProfile;
+
+static unsigned long DbgConsoleProfileStartProc (IN dbgSession* session, IN void* arg) {
+	return DbgProfileStart (session, ((dbgConsoleProfile*) arg)->rate);
+}
+
+static unsigned long DbgConsoleProfileStopProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleProfile* options = (dbgConsoleProfile*) arg;
+	return DbgProfileStop (session, options->path, options->top);
+}
+
+/**
+*	Implements console PROFILE command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleProfile (IN int argc, IN char** argv) {
+	dbgSession*       session = DbgGetCurrentSession ();
+	dbgConsoleProfile options;
+	int               i;
+
+	options.rate    = 100;
+	options.seconds = 10;
+	options.top     = 20;
+	options.path    = 0;
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp (argv[i], "-r") == 0)
+			options.rate = (unsigned int) strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-t") == 0)
+			options.seconds = (unsigned int) strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-n") == 0)
+			options.top = (unsigned int) strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-o") == 0)
+			options.path = argv[++i];
+		else {
+			DbgDisplayError ("Syntax : profile [-r rate] [-t seconds] [-n top] [-o file]");
+			DbgDisplayError ("         samples per second, run time, functions reported, folded stack output");
+			return FALSE;
+		}
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	if (!DbgSessionRun (session, DbgConsoleProfileStartProc, &options))
+		return FALSE;
+	DbgSleep (options.seconds * 1000);
+	return DbgSessionRun (session, DbgConsoleProfileStopProc, &options);
+}
+
+typedef struct _dbgConsoleCount {
+	const char*  pattern;	/* 0 to report */
+	BOOL         clear;
+	unsigned int top;
+}dbgConsoleCount;
+
+static unsigned long DbgConsoleCountProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleCount* options = (dbgConsoleCount*) arg;
+	if (options->clear)
+		DbgCountClear (session);
+	else if (options->pattern)
+		return DbgCountBreakpoints (session, options->pattern) != 0;
+	else
+		DbgCountReport (session, options->top);
+	return TRUE;
+}
+
+/**
+*	Implements console COUNT command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleCount (IN int argc, IN char** argv) {
+	dbgSession*     session = DbgGetCurrentSession ();
+	dbgConsoleCount options;
+
+	options.pattern = 0;
+	options.clear   = FALSE;
+	options.top     = 20;
+	if (argc == 2 && strcmp (argv[1], "-c") == 0)
+		options.clear = TRUE;
+	else if (argc == 2 && argv[1][0] != '-')
+		options.pattern = argv[1];
+	else if (argc == 3 && strcmp (argv[1], "-r") == 0)
+		options.top = (unsigned int) strtoul (argv[2], 0, 10);
+	else if (argc != 1 && !(argc == 2 && strcmp (argv[1], "-r") == 0)) {
+		DbgDisplayError ("Syntax : count [pattern | -r [top] | -c]");
+		DbgDisplayError ("         count calls to matching functions, report calls, clear");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleCountProc, &options);
+}
+
+typedef struct _dbgConsoleCoverage {
+	char**       modules;
+	unsigned int count;
+	BOOL         functions;
+	const char*  path;
+}dbgConsoleCoverage;
+
+static unsigned long DbgConsoleCoverageProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleCoverage* options = (dbgConsoleCoverage*) arg;
+	return DbgCoverageStart (session, options->modules, options->count, options->functions, options->path);
+}
+
+/**
+*	Implements console COVERAGE command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleCoverage (IN int argc, IN char** argv) {
+	dbgSession*        session = DbgGetCurrentSession ();
+	dbgConsoleCoverage options;
+	int                i;
+
+	options.functions = FALSE;
+	options.path      = "coverage.info";
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp (argv[i], "-f") == 0)
+			options.functions = TRUE;
+		else if (i + 1 < argc && strcmp (argv[i], "-o") == 0)
+			options.path = argv[++i];
+		else {
+			DbgDisplayError ("Syntax : coverage [-f] [-o file] [module ...]");
+			DbgDisplayError ("         -f function entries instead of lines, -o lcov output file");
+			return FALSE;
+		}
+	}
+	options.modules = argv + i;
+	options.count   = (unsigned int) (argc - i);
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleCoverageProc, &options);
+}
+
+typedef struct _dbgConsoleFuzz {
+	const char*   function;
+	const char*   directory;
+	unsigned long limit;
+	unsigned int  timeout;
+	size_t        capacity;
+}dbgConsoleFuzz;
+
+static unsigned long DbgConsoleFuzzProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleFuzz* options = (dbgConsoleFuzz*) arg;
+	dbgSymbol       symbol;
+	vaddr_t         entry;
+
+	if (DbgSymbolFromName (session, options->function, &symbol))
+		entry = symbol.addr;
+	else
+		entry = (vaddr_t) strtoul (options->function, 0, 16);
+	if (!entry) {
+		DbgDisplayError ("Unknown function '%s'", options->function);
+		return FALSE;
+	}
+	return DbgFuzzStart (session, entry, options->directory, options->limit, options->timeout, options->capacity);
+}
+
+/**
+*	Implements console FUZZ command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleFuzz (IN int argc, IN char** argv) {
+	dbgSession*    session = DbgGetCurrentSession ();
+	dbgConsoleFuzz options;
+	int            i;
+
+	options.limit    = 100000;
+	options.timeout  = 1000;
+	options.capacity = 4096;
+	for (i = 3; i < argc; i++) {
+		if (i + 1 < argc && strcmp (argv[i], "-n") == 0)
+			options.limit = strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-t") == 0)
+			options.timeout = (unsigned int) strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-s") == 0)
+			options.capacity = (size_t) strtoul (argv[++i], 0, 10);
+		else
+			break;
+	}
+	if (argc < 3 || i < argc || !options.limit || !options.capacity) {
+		DbgDisplayError ("Syntax : fuzz function corpus [-n runs] [-t ms] [-s bytes]");
+		DbgDisplayError ("         function is called as f (data, size) with inputs from the corpus directory");
+		return FALSE;
+	}
+	options.function  = argv[1];
+	options.directory = argv[2];
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleFuzzProc, &options);
+}
+
+typedef struct _dbgConsoleFilter {
+	const char*     name;		/* 0 to list */
+	dbgFilterAction first;
+	dbgFilterAction second;
+	int             pass;
+}dbgConsoleFilter;
+
+static unsigned long DbgConsoleFilterProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleFilter* options = (dbgConsoleFilter*) arg;
+	if (!options->name) {
+		DbgFilterList (session);
+		return TRUE;
+	}
+	if (!DbgFilterSet (session, options->name, options->first, options->second, options->pass)) {
+		DbgDisplayError ("Unknown exception '%s'; sx lists them", options->name);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Implements console SX command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleFilter (IN int argc, IN char** argv) {
+	dbgSession*      session = DbgGetCurrentSession ();
+	dbgConsoleFilter options;
+	int              i = 3;
+
+	options.name   = 0;
+	options.second = DBG_FILTER_STOP;
+	options.pass   = -1;
+	if (argc >= 3) {
+		options.name = argv[1];
+		if (!DbgFilterActionFromName (argv[2], &options.first))
+			i = argc + 1;
+		else if (i < argc && DbgFilterActionFromName (argv[i], &options.second))
+			i++;
+		if (i < argc && strcmp (argv[i], "pass") == 0)
+			options.pass = TRUE, i++;
+		else if (i < argc && strcmp (argv[i], "handled") == 0)
+			options.pass = FALSE, i++;
+	}
+	if (argc == 2 || (argc > 2 && i != argc)) {
+		DbgDisplayError ("Syntax : sx [exception|all first [second] [pass|handled]]");
+		DbgDisplayError ("         actions are stop, print or ignore; pass hands the exception to the target");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleFilterProc, &options);
+}
+
+static unsigned long DbgConsoleStatsProc (IN dbgSession* session, IN void* arg) {
+	if (arg)
+		return DbgStatsDump (session, (const char*) arg);
+	DbgStatsReport (session);
+	return TRUE;
+}
+
+/**
+*	Implements console STATS command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleStats (IN int argc, IN char** argv) {
+	dbgSession* session = DbgGetCurrentSession ();
+	const char* path    = 0;
+
+	if (argc == 3 && strcmp (argv[1], "-j") == 0)
+		path = argv[2];
+	else if (argc != 1) {
+		DbgDisplayError ("Syntax : stats [-j file]");
+		DbgDisplayError ("         display debugger counters or write them as JSON");
+		return FALSE;
+	}
+	/* the session owns the memory being measured */
+	if (session)
+		return DbgSessionRun (session, DbgConsoleStatsProc, (void*) path);
+	if (path)
+		return DbgStatsDump (0, path);
+	DbgStatsReport (0);
+	return TRUE;
+}
+
+typedef struct _dbgConsoleBench {
+	const char*   address;		/* 0 skips the breakpoint tests */
+	unsigned long iterations;
+	const char*   path;
+	const char*   baseline;
+}dbgConsoleBench;
+
+static unsigned long DbgConsoleBenchProc (IN dbgSession* session, IN void* arg) {
+	dbgConsoleBench* options = (dbgConsoleBench*) arg;
+	dbgSymbol        symbol;
+	vaddr_t          address = 0;
+
+	if (options->address) {
+		if (DbgSymbolFromName (session, options->address, &symbol))
+			address = symbol.addr;
+		else
+			address = (vaddr_t) strtoul (options->address, 0, 16);
+		if (!address) {
+			DbgDisplayError ("Unknown address '%s'", options->address);
+			return FALSE;
+		}
+	}
+	return DbgBench (session, address, options->iterations, options->path, options->baseline);
+}
+
+/**
+*	Implements console BENCH command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleBench (IN int argc, IN char** argv) {
+	dbgSession*     session = DbgGetCurrentSession ();
+	dbgConsoleBench options;
+	int             i = 1;
+
+	options.address    = 0;
+	options.iterations = 1000;
+	options.path       = 0;
+	options.baseline   = 0;
+	if (i < argc && argv[i][0] != '-')
+		options.address = argv[i++];
+	for (; i < argc; i++) {
+		if (i + 1 < argc && strcmp (argv[i], "-n") == 0)
+			options.iterations = strtoul (argv[++i], 0, 10);
+		else if (i + 1 < argc && strcmp (argv[i], "-j") == 0)
+			options.path = argv[++i];
+		else if (i + 1 < argc && strcmp (argv[i], "-c") == 0)
+			options.baseline = argv[++i];
+		else
+			break;
+	}
+	if (i < argc || !options.iterations) {
+		DbgDisplayError ("Syntax : bench [address] [-n iterations] [-j file] [-c baseline]");
+		DbgDisplayError ("         address is executed repeatedly by the target; -c compares with results saved by -j");
+		return FALSE;
+	}
+	if (!session) {
+		DbgDisplayError ("No session");
+		return FALSE;
+	}
+	return DbgSessionRun (session, DbgConsoleBenchProc, &options);
+}
+
+/**
+*	Implements console SYMBENCH command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleSymbench (IN int argc, IN char** argv) {
+	const char* path = 0;
+
+	if (argc >= 4 && argc <= 7 && strcmp (argv[1], "-g") == 0) {
+		unsigned long functions = strtoul (argv[3], 0, 10);
+		unsigned long files     = argc > 4 ? strtoul (argv[4], 0, 10) : (functions + 49) / 50;
+		unsigned int  rows      = argc > 5 ? (unsigned int) strtoul (argv[5], 0, 10) : 4;
+		unsigned int  modules   = argc > 6 ? (unsigned int) strtoul (argv[6], 0, 10) : 1;
+		return DbgSymbolFixtureWrite (argv[2], functions, files, rows, modules);
+	}
+	if (argc >= 3 && strcmp (argv[argc - 2], "-j") == 0) {
+		path  = argv[argc - 1];
+		argc -= 2;
+	}
+	if (argc >= 2 && argc <= 3 && strcmp (argv[1], "-s") == 0)
+		return DbgSymbolBenchSweep (argc == 3 ? argv[2] : ".", path);
+	if (argc >= 2 && argv[1][0] != '-')
+		return DbgSymbolBench ((const char**) argv + 1, argc - 1, path);
+	DbgDisplayError ("Syntax : symbench -g fixture functions [files [rows [modules]]]");
+	DbgDisplayError ("         symbench fixture... [-j file]");
+	DbgDisplayError ("         symbench -s [directory] [-j file]");
+	DbgDisplayError ("         generate a synthetic symbol table, or time loading and lookups of fixtures;");
+	DbgDisplayError ("         -s measures generated fixtures of 10 thousand to 10 million functions");
+	return FALSE;
+}
+
+/**
+*	Implements console LISTBENCH command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleListbench (IN int argc, IN char** argv) {
+	const char* path = 0;
+
+	if (argc >= 3 && strcmp (argv[argc - 2], "-j") == 0) {
+		path  = argv[argc - 1];
+		argc -= 2;
+	}
+	if (argc == 1)
+		return DbgListBench (0, path);
+	if (argc == 2 && argv[1][0] != '-')
+		return DbgListBench (strtoul (argv[1], 0, 10), path);
+	DbgDisplayError ("Syntax : listbench [records] [-j file]");
+	DbgDisplayError ("         compare list.c with the pool, intrusive list and vector on thread records");
+	return FALSE;
+}
+
+/**
+*	Implements console TRACE command
+*	\param argc Argument count
+*	\param argv Argument list
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgConsoleTrace (IN int argc, IN char** argv) {
+	if (argc == 2 && strcmp (argv[1], "-s") == 0)
+		return DbgTraceStop ();
+	if (argc == 2 && argv[1][0] != '-')
+		return DbgTraceStart (argv[1]);
+	DbgDisplayError ("Syntax : trace [file | -s]");
+	DbgDisplayError ("         record a Chrome trace written to file at exit, or stop and write it now");
+	return FALSE;
+}
+
 void DbgConsoleInterrupt (int sig) {
 	printf ("\nctrl+c triggered");
 //	signal (sig, SIG_IGN);
@@ -177,23 +992,46 @@ void DbgConsoleInit (void) {
 	DbgConsoleRegister ("attach","Attach session to process",   0);
 	DbgConsoleRegister ("detach","Detach session from process", 0);
 	DbgConsoleRegister ("q", "Quit", 0);
-	DbgConsoleRegister ("restart", "Restart session", 0);
+	DbgConsoleRegister ("restart", "Restore checkpoint", DbgConsoleRestart);
+	DbgConsoleRegister ("checkpoint", "Create or list checkpoints", DbgConsoleCheckpoint);
 
 	/* execution control */
 	DbgConsoleRegister ("c", "Continue",     DbgConsoleContinue);
 	DbgConsoleRegister ("s", "Single step",  DbgConsoleSingleStep);
+	DbgConsoleRegister ("reverse-continue", "Run back to the previous breakpoint", DbgConsoleReverseContinue);
+	DbgConsoleRegister ("reverse-step",     "Run back to the previous stop",       DbgConsoleReverseStep);
+	DbgConsoleRegister ("sx", "Exception policy and counters", DbgConsoleFilter);
 
 	/* breakpoints */
 	DbgConsoleRegister ("b",     "Set breakpoint",     DbgConsoleSetBreakpoint);
+	DbgConsoleRegister ("rb",    "Set breakpoints by regular expression", DbgConsoleRegexBreakpoint);
 	DbgConsoleRegister ("be",    "Breakpoint enable",  0);
 	DbgConsoleRegister ("bd",    "Breakpoint disable", 0);
 	DbgConsoleRegister ("bc",    "Breakpoint clear",   0);
+	DbgConsoleRegister ("count", "Count calls with counting breakpoints", DbgConsoleCount);
+	DbgConsoleRegister ("coverage", "Collect line or function coverage", DbgConsoleCoverage);
+	DbgConsoleRegister ("fuzz", "Fuzz a function from a snapshot", DbgConsoleFuzz);
 
 	/* trace enable */
 	DbgConsoleRegister ("t",    "Trace",  0);
 
 	DbgConsoleRegister ("r",     "Display registers", DbgConsoleRegisters);
-//	DbgConsoleRegister ("mem",   "Display memory", 0);
+	DbgConsoleRegister ("lm",    "List modules and symbol memory", DbgConsoleModules);
+	DbgConsoleRegister ("threads","List threads",      DbgConsoleThreads);
+	DbgConsoleRegister ("bt",    "Display stack backtrace", DbgConsoleBacktrace);
+	DbgConsoleRegister ("profile","Sample stacks of the running target", DbgConsoleProfile);
+	DbgConsoleRegister ("dbgout","Debug output destination and statistics", DbgConsoleDebugOut);
+	DbgConsoleRegister ("stats", "Debugger performance counters", DbgConsoleStats);
+	DbgConsoleRegister ("bench", "Benchmark the debugger against the target", DbgConsoleBench);
+	DbgConsoleRegister ("symbench", "Benchmark symbol loading and lookups", DbgConsoleSymbench);
+	DbgConsoleRegister ("listbench", "Benchmark the process containers", DbgConsoleListbench);
+	DbgConsoleRegister ("trace", "Record a timeline of the debugger", DbgConsoleTrace);
+	DbgConsoleRegister ("mem",   "Display memory or dump it to a file", DbgConsoleMemory);
+	DbgConsoleRegister ("db",    "Display bytes",  DbgConsoleDisplayBytes);
+	DbgConsoleRegister ("dd",    "Display dwords", DbgConsoleDisplayDwords);
+	DbgConsoleRegister ("dq",    "Display qwords", DbgConsoleDisplayQwords);
+	DbgConsoleRegister ("search","Search memory for a pattern", DbgConsoleSearch);
+	DbgConsoleRegister ("gcore", "Write ELF core file and continue", DbgConsoleCore);
 //	DbgConsoleRegister ("vb",    "View breakpoint", 0);
 
 	/* trap ctrl+c */
@@ -216,7 +1054,8 @@ void DbgConsoleSendEvent (dbgConsoleEvent code) {
 int DbgConsoleEntry (void) {
 
 	DbgConsoleInit ();
-	memset (_console.currentLine, 0, 32);
+	DbgTraceThread ("console");
+	memset (_console.currentLine, 0, DBG_CONSOLE_LINE);
 
 	printf ("\n\rType \"help\" for information and \"q\" to quit.\n");
 
@@ -225,14 +1064,15 @@ int DbgConsoleEntry (void) {
 		/* command argument list */
 		dbgCommand* command = 0;
 		size_t      argc    = 0;
-		char*       argv[5];
+		char*       argv[DBG_CONSOLE_ARGS];
 
 		/* display prompt and get line */
 		DbgDisplayMessage (0);
-		fgets (_console.currentLine, 32, stdin);
+		DbgDisplayFlush ();
+		fgets (_console.currentLine, DBG_CONSOLE_LINE, stdin);
 
 		/* convert line to argument list */
-		argc = DbgConsoleGetArgs (_console.currentLine, argv, 5);
+		argc = DbgConsoleGetArgs (_console.currentLine, argv, DBG_CONSOLE_ARGS);
 		if (argc==0)
 			continue; /* nothing was entered */
 
@@ -246,12 +1086,15 @@ int DbgConsoleEntry (void) {
 			if (strcmp (command->cmd, "q") == 0)
 				break;
 			/* run command */
-			if (command->proc)
+			if (command->proc) {
+				DbgTraceBegin ("console", command->cmd, (unsigned long) argc);
 				command->proc (argc, argv);
+				DbgTraceEnd ("console", command->cmd);
+			}
 		}
 
 		/* clear line and restart */
-		memset (_console.currentLine, 0, 32);
+		memset (_console.currentLine, 0, DBG_CONSOLE_LINE);
 	}
 
 	DbgSessionSendEvent (DbgGetCurrentSession(),DBG_SESSION_QUIT, DBG_SOURCE_COMMAND);
@@ -0,0 +1,543 @@
+/********************************************
+*
+*	core.c - Core file generation
+*
+********************************************/
+
+/*
+	This component writes an ELF core file of a live target so it can be
+	examined later while the process keeps running. The file holds a note
+	segment with the registers of every thread, the process name and the
+	files mapped into the process, followed by one load segment for every
+	readable region.
+
+	The target is suspended only while its registers and memory are copied
+	into staging blocks. A writer thread streams the blocks to the file and
+	seeks over pages that are all zero, leaving holes in a sparse file.
+	When the whole image fits in the staging budget, the target resumes
+	before the file is complete.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "elf.h"
+
+#if defined(__AVX2__)
+#define DBG_CORE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DBG_CORE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define DBG_CORE_BLOCK     (1024*1024)		/* bytes read from the target at once */
+#define DBG_CORE_BLOCKS    128				/* staging budget in blocks */
+#define DBG_CORE_WAIT_MS   10
+#define DBG_CORE_USER_END  0x80000000ULL	/* end of the user address space */
+#define DBG_CORE_NAME_MAX  260
+
+/*
+	Core file state shared between the session thread and the writer
+*/
+typedef struct _dbgCoreSegment {
+	vaddr_t       base;
+	unsigned long size;
+	unsigned int  protect;
+	BOOL          dump;			/* contents are written to the file */
+	const char*   file;			/* interned name of the mapped file or 0 */
+	unsigned int  offset;		/* file offset of the contents */
+}dbgCoreSegment;
+
+typedef struct _dbgCoreBlock {
+	unsigned long long offset;
+	size_t             length;
+	unsigned char*     data;
+}dbgCoreBlock;
+
+typedef struct _dbgCore {
+	FILE*              file;
+	BOOL               skipReadOnlyFiles;
+	queue              blocks;		/* dbgCoreBlock */
+	dbgNotify*         ready;		/* a block was queued */
+	dbgNotify*         space;		/* a block was written */
+	dbgAtomic          done;
+	BOOL               failed;
+	vector             segments;	/* dbgCoreSegment */
+	unsigned int       threads;
+	unsigned long long size;		/* file size */
+	unsigned long long dumped;		/* bytes copied from the target */
+	unsigned long long holes;		/* zero bytes left as holes */
+	unsigned long long skipped;		/* bytes of read only file mappings not copied */
+	unsigned long long stopped;		/* clock when the target was suspended and resumed */
+	unsigned long long resumed;
+}dbgCore;
+
+/**
+*	Test if a range of memory is all zero
+*/
+static BOOL DbgCoreZero (IN const unsigned char* data, IN size_t length) {
+	size_t i = 0;
+#if defined(DBG_CORE_AVX2)
+	__m256i acc = _mm256_setzero_si256 ();
+	for (; i + 32 <= length; i += 32)
+		acc = _mm256_or_si256 (acc, _mm256_loadu_si256 ((const __m256i*) (data + i)));
+	if (!_mm256_testz_si256 (acc, acc))
+		return FALSE;
+#elif defined(DBG_CORE_SSE2)
+	__m128i acc = _mm_setzero_si128 ();
+	for (; i + 16 <= length; i += 16)
+		acc = _mm_or_si128 (acc, _mm_loadu_si128 ((const __m128i*) (data + i)));
+	if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (acc, _mm_setzero_si128 ())) != 0xffff)
+		return FALSE;
+#endif
+	for (; i < length; i++) {
+		if (data[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Write block to the file; pages that are all zero are seeked over
+*	\param core Core file
+*	\param block Block to write
+*	\param position Current file position, updated
+*/
+static void DbgCoreWriteBlock (IN dbgCore* core, IN dbgCoreBlock* block, IN OUT unsigned long long* position) {
+	size_t at = 0;
+
+	while (at < block->length && !core->failed) {
+		size_t run = 0;
+
+		/* skip zero pages */
+		while (at < block->length) {
+			size_t page = block->length - at > DBG_MEMORY_PAGE ? DBG_MEMORY_PAGE : block->length - at;
+			if (!DbgCoreZero (block->data + at, page))
+				break;
+			core->holes += page;
+			at += page;
+		}
+		/* gather the following non zero pages into one write */
+		while (at + run < block->length) {
+			size_t page = block->length - at - run > DBG_MEMORY_PAGE ? DBG_MEMORY_PAGE : block->length - at - run;
+			if (DbgCoreZero (block->data + at + run, page))
+				break;
+			run += page;
+		}
+		if (!run)
+			break;
+		if (*position != block->offset + at && DbgFileSeek (core->file, block->offset + at)) {
+			core->failed = TRUE;
+			break;
+		}
+		if (fwrite (block->data + at, 1, run, core->file) != run) {
+			core->failed = TRUE;
+			break;
+		}
+		at        += run;
+		*position  = block->offset + at;
+	}
+}
+
+/**
+*	Core writer thread entry point
+*/
+static int DbgCoreWriter (void* arg) {
+	dbgCore*           core     = (dbgCore*) arg;
+	unsigned long long position = 0;
+	dbgCoreBlock       block;
+
+	while (TRUE) {
+		/* read the flag first; once it is set every block has been queued */
+		BOOL done = DbgAtomicLoad (&core->done);
+		if (queuePop (&core->blocks, &block)) {
+			DbgCoreWriteBlock (core, &block, &position);
+			free (block.data);
+			DbgNotifySignal (core->space);
+			continue;
+		}
+		if (done)
+			break;
+		DbgNotifyWait (core->ready, DBG_CORE_WAIT_MS);
+	}
+
+	/* a trailing hole still has to extend the file */
+	if (!core->failed && position < core->size) {
+		char zero = 0;
+		if (DbgFileSeek (core->file, core->size - 1) || fwrite (&zero, 1, 1, core->file) != 1)
+			core->failed = TRUE;
+	}
+	return 0;
+}
+
+/**
+*	Queue block for the writer, waiting while the staging budget is used up
+*/
+static void DbgCorePush (IN dbgCore* core, IN dbgCoreBlock* block) {
+	while (!queuePush (&core->blocks, block))
+		DbgNotifyWait (core->space, DBG_CORE_WAIT_MS);
+	DbgNotifySignal (core->ready);
+}
+
+/**
+*	Append an ELF note
+*	\param out Output position
+*	\param type Note type
+*	\param name Note owner
+*	\param desc Note contents
+*	\param size Size of contents
+*	\ret Output position after the note
+*/
+static unsigned char* DbgCoreNote (IN unsigned char* out, IN unsigned int type, IN const char* name,
+                                   IN const void* desc, IN unsigned int size) {
+	elf32Note note;
+	note.namesz = (unsigned int) strlen (name) + 1;
+	note.descsz = size;
+	note.type   = type;
+	memcpy (out, &note, sizeof (elf32Note));
+	out += sizeof (elf32Note);
+	memset (out, 0, (note.namesz + 3) & ~3);
+	memcpy (out, name, note.namesz);
+	out += (note.namesz + 3) & ~3;
+	memset (out, 0, (size + 3) & ~3);
+	memcpy (out, desc, size);
+	return out + ((size + 3) & ~3);
+}
+
+/**
+*	Size of an ELF note
+*/
+static unsigned int DbgCoreNoteSize (IN const char* name, IN unsigned int size) {
+	return sizeof (elf32Note) + (((unsigned int) strlen (name) + 1 + 3) & ~3) + ((size + 3) & ~3);
+}
+
+/**
+*	Build the mapping table from the regions of the target
+*/
+static void DbgCoreRegions (IN dbgSession* session, IN dbgCore* core) {
+	unsigned long long at = 0;
+	const char*        file = 0;
+	char               name[DBG_CORE_NAME_MAX];
+
+	while (at < DBG_CORE_USER_END) {
+		dbgMemoryRegion    region;
+		dbgCoreSegment     segment;
+		unsigned long long end;
+
+		if (!DbgProcessRequest (DBG_REQ_QUERY, session, (void*) (vaddr_t) at, &region, sizeof (region)))
+			break;
+		end = (unsigned long long) region.base + region.size;
+		if (end <= at)
+			break;
+		at = end;
+		if (!region.readable)
+			continue;
+
+		file = 0;
+		if (region.mapped) {
+			size_t length = DbgProcessRequest (DBG_REQ_MAPPEDNAME, session, (void*) region.base, name, sizeof (name) - 1);
+			name[length] = 0;
+			if (length)
+				file = strtabIntern (&session->process.strings, name);
+		}
+
+		segment.base    = region.base;
+		segment.size    = region.size;
+		segment.protect = region.protect;
+		segment.file    = file;
+		segment.offset  = 0;
+		segment.dump    = !(core->skipReadOnlyFiles && region.mapped && !(region.protect & DBG_MEMORY_PROT_WRITE));
+		vectorAdd (&core->segments, &segment);
+	}
+}
+
+/**
+*	Capture the target into the core file
+*
+*	Runs on the session thread. The target is suspended from the first
+*	register read until the last byte is staged.
+*
+*	\param session Debug session
+*	\param arg Core file
+*	\ret TRUE if success, FALSE otherwise
+*/
+static unsigned long DbgCoreCapture (IN dbgSession* session, IN void* arg) {
+	dbgCore*       core = (dbgCore*) arg;
+	dbgProcess*    proc = &session->process;
+	ilistNode*     cur;
+	elf32Header    header;
+	elf32Prpsinfo  info;
+	dbgCoreBlock   block;
+	unsigned char* out;
+	unsigned int   files = 0;
+	unsigned int   fileNames = 0;
+	unsigned int   notes;
+	unsigned int   segments;
+	unsigned int   i;
+	unsigned long long offset;
+	const char*    base;
+
+	/* stop the world */
+	core->stopped = DbgClockNow ();
+	for (cur = proc->threadList.first; cur; cur = cur->next)
+		DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+
+	DbgCoreRegions (session, core);
+	segments = vectorSize (&core->segments);
+
+	/* size of the notes */
+	for (cur = proc->threadList.first; cur; cur = cur->next)
+		core->threads++;
+	for (i = 0; i < segments; i++) {
+		dbgCoreSegment* segment = (dbgCoreSegment*) vectorAt (&core->segments, i);
+		if (segment->file) {
+			files++;
+			fileNames += (unsigned int) strlen (segment->file) + 1;
+		}
+	}
+	notes = core->threads * DbgCoreNoteSize ("CORE", sizeof (elf32Prstatus))
+		+ DbgCoreNoteSize ("CORE", sizeof (elf32Prpsinfo))
+		+ (files ? DbgCoreNoteSize ("CORE", 8 + files * 12 + fileNames) : 0);
+
+	/* contents start on a page after the headers and notes */
+	offset = sizeof (elf32Header) + (segments + 1) * sizeof (elf32Program) + notes;
+	offset = (offset + DBG_MEMORY_PAGE - 1) & ~((unsigned long long) DBG_MEMORY_PAGE - 1);
+	for (i = 0; i < segments; i++) {
+		dbgCoreSegment* segment = (dbgCoreSegment*) vectorAt (&core->segments, i);
+		segment->offset = (unsigned int) offset;
+		if (segment->dump)
+			offset += segment->size;
+		else
+			core->skipped += segment->size;
+	}
+	core->size = offset;
+
+	block.offset = 0;
+	block.length = sizeof (elf32Header) + (segments + 1) * sizeof (elf32Program) + notes;
+	block.data   = (unsigned char*) calloc (1, block.length);
+	if (!block.data) {
+		core->failed = TRUE;
+		goto resume;
+	}
+	out = block.data;
+
+	/* file header */
+	memset (&header, 0, sizeof (elf32Header));
+	memcpy (header.ident, "\x7f" "ELF", 4);
+	header.ident[4]  = 1;	/* 32 bit */
+	header.ident[5]  = 1;	/* little endian */
+	header.ident[6]  = 1;	/* version */
+	header.type      = ELF_ET_CORE;
+	header.machine   = ELF_EM_386;
+	header.version   = 1;
+	header.phoff     = sizeof (elf32Header);
+	header.ehsize    = sizeof (elf32Header);
+	header.phentsize = sizeof (elf32Program);
+	header.phnum     = (unsigned short) (segments + 1);
+	memcpy (out, &header, sizeof (elf32Header));
+	out += sizeof (elf32Header);
+
+	/* program headers */
+	{
+		elf32Program program;
+		memset (&program, 0, sizeof (elf32Program));
+		program.type   = ELF_PT_NOTE;
+		program.offset = sizeof (elf32Header) + (segments + 1) * sizeof (elf32Program);
+		program.filesz = notes;
+		memcpy (out, &program, sizeof (elf32Program));
+		out += sizeof (elf32Program);
+
+		for (i = 0; i < segments; i++) {
+			dbgCoreSegment* segment = (dbgCoreSegment*) vectorAt (&core->segments, i);
+			program.type   = ELF_PT_LOAD;
+			program.offset = segment->offset;
+			program.vaddr  = segment->base;
+			program.filesz = segment->dump ? segment->size : 0;
+			program.memsz  = segment->size;
+			program.flags  = (segment->protect & DBG_MEMORY_PROT_READ  ? ELF_PF_R : 0)
+			               | (segment->protect & DBG_MEMORY_PROT_WRITE ? ELF_PF_W : 0)
+			               | (segment->protect & DBG_MEMORY_PROT_EXEC  ? ELF_PF_X : 0);
+			program.align  = DBG_MEMORY_PAGE;
+			memcpy (out, &program, sizeof (elf32Program));
+			out += sizeof (elf32Program);
+		}
+	}
+
+	/* process information */
+	memset (&info, 0, sizeof (elf32Prpsinfo));
+	info.sname = 'R';
+	info.pid   = (int) proc->id.pid;
+	base = strrchr (proc->name, '\\');
+	base = base ? base + 1 : proc->name;
+#ifdef _MSC_VER
+	strncpy_s (info.fname, sizeof (info.fname), base, _TRUNCATE);
+	strncpy_s (info.psargs, sizeof (info.psargs), proc->name, _TRUNCATE);
+#else
+	strncpy (info.fname, base, sizeof (info.fname) - 1);
+	strncpy (info.psargs, proc->name, sizeof (info.psargs) - 1);
+#endif
+	out = DbgCoreNote (out, ELF_NT_PRPSINFO, "CORE", &info, sizeof (elf32Prpsinfo));
+
+	/* registers of every thread */
+	for (cur = proc->threadList.first; cur; cur = cur->next) {
+		dbgThread*    thread = (dbgThread*) cur;
+		dbgContext    context;
+		elf32Prstatus status;
+
+		memset (&status, 0, sizeof (elf32Prstatus));
+		status.pid  = (int) thread->id;
+		status.ppid = (int) proc->id.pid;
+		if (DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread->thread, &context, sizeof (dbgContext))) {
+			status.reg[ELF_REG_EBX]      = context.regs.ebx;
+			status.reg[ELF_REG_ECX]      = context.regs.ecx;
+			status.reg[ELF_REG_EDX]      = context.regs.edx;
+			status.reg[ELF_REG_ESI]      = context.regs.esi;
+			status.reg[ELF_REG_EDI]      = context.regs.edi;
+			status.reg[ELF_REG_EBP]      = context.regs.ebp;
+			status.reg[ELF_REG_EAX]      = context.regs.eax;
+			status.reg[ELF_REG_DS]       = context.sregs.ds;
+			status.reg[ELF_REG_ES]       = context.sregs.es;
+			status.reg[ELF_REG_FS]       = context.sregs.fs;
+			status.reg[ELF_REG_GS]       = context.sregs.gs;
+			status.reg[ELF_REG_ORIG_EAX] = 0xffffffff;
+			status.reg[ELF_REG_EIP]      = context.eip;
+			status.reg[ELF_REG_CS]       = context.sregs.cs;
+			status.reg[ELF_REG_EFLAGS]   = context.flags;
+			status.reg[ELF_REG_ESP]      = context.regs.esp;
+			status.reg[ELF_REG_SS]       = context.sregs.ss;
+		}
+		out = DbgCoreNote (out, ELF_NT_PRSTATUS, "CORE", &status, sizeof (elf32Prstatus));
+	}
+
+	/* mapped files: count, page size, start end offset triples, then names */
+	if (files) {
+		unsigned int*  desc = (unsigned int*) calloc (1, 8 + files * 12 + fileNames);
+		char*          name;
+		unsigned int   n = 0;
+		if (!desc) {
+			free (block.data);
+			core->failed = TRUE;
+			goto resume;
+		}
+		desc[0] = files;
+		desc[1] = DBG_MEMORY_PAGE;
+		name    = (char*) (desc + 2 + files * 3);
+		for (i = 0; i < segments; i++) {
+			dbgCoreSegment* segment = (dbgCoreSegment*) vectorAt (&core->segments, i);
+			if (!segment->file)
+				continue;
+			/* the file offset of a view is not known; 0 is recorded */
+			desc[2 + n*3]     = segment->base;
+			desc[2 + n*3 + 1] = segment->base + segment->size;
+			desc[2 + n*3 + 2] = 0;
+			memcpy (name, segment->file, strlen (segment->file) + 1);
+			name += strlen (segment->file) + 1;
+			n++;
+		}
+		out = DbgCoreNote (out, ELF_NT_FILE, "CORE", desc, 8 + files * 12 + fileNames);
+		free (desc);
+	}
+	DbgCorePush (core, &block);
+
+	/* contents */
+	for (i = 0; i < segments && !core->failed; i++) {
+		dbgCoreSegment* segment = (dbgCoreSegment*) vectorAt (&core->segments, i);
+		unsigned long   at;
+
+		if (!segment->dump)
+			continue;
+		for (at = 0; at < segment->size; at += (unsigned long) block.length) {
+			block.offset = (unsigned long long) segment->offset + at;
+			block.length = segment->size - at > DBG_CORE_BLOCK ? DBG_CORE_BLOCK : segment->size - at;
+			block.data   = (unsigned char*) malloc (block.length);
+			if (!block.data) {
+				core->failed = TRUE;
+				break;
+			}
+			core->dumped += DbgMemoryFetch (session, segment->base + at, block.data, block.length, 0);
+			DbgCorePush (core, &block);
+		}
+	}
+
+resume:
+	for (cur = proc->threadList.first; cur; cur = cur->next)
+		DbgProcessRequest (DBG_REQ_RESUME, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+	core->resumed = DbgClockNow ();
+	return !core->failed;
+}
+
+/**
+*	Write core file of the target
+*	\param session Debug session
+*	\param path Output file path
+*	\param skipReadOnlyFiles Do not copy read only file mappings; they can be read from the files
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgCoreWrite (IN dbgSession* session, IN const char* path, IN BOOL skipReadOnlyFiles) {
+	dbgCore*           core;
+	dbgWorker*         writer = 0;
+	unsigned long long start = DbgClockNow ();
+	double             seconds;
+	BOOL               result;
+
+	core = (dbgCore*) calloc (1, sizeof (dbgCore));
+	if (!core)
+		return FALSE;
+	core->skipReadOnlyFiles = skipReadOnlyFiles;
+	vectorInit (&core->segments, sizeof (dbgCoreSegment));
+
+#ifdef _MSC_VER
+	fopen_s (&core->file, path, "wb");
+#else
+	core->file = fopen (path, "wb");
+#endif
+	if (!core->file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		free (core);
+		return FALSE;
+	}
+	setvbuf (core->file, 0, _IONBF, 0);
+	DbgFileSetSparse (core->file);
+
+	core->ready = DbgNotifyCreate ();
+	core->space = DbgNotifyCreate ();
+	if (core->ready && core->space && queueInit (&core->blocks, sizeof (dbgCoreBlock), DBG_CORE_BLOCKS))
+		writer = DbgWorkerCreate (DbgCoreWriter, core);
+	if (!writer) {
+		DbgDisplayError ("Unable to start core writer");
+		core->failed = TRUE;
+	}
+	else {
+		DbgSessionRun (session, DbgCoreCapture, core);
+		DbgAtomicStore (&core->done, 1);
+		DbgNotifySignal (core->ready);
+		DbgWorkerJoin (writer);
+		queueFree (&core->blocks);
+	}
+
+	if (fclose (core->file))
+		core->failed = TRUE;
+	seconds = (double) (DbgClockNow () - start) / 1000000000.0;
+
+	if (core->failed)
+		DbgDisplayError ("Writing core file '%s' failed", path);
+	else {
+		DbgDisplayMessage ("Wrote '%s': %u threads, %u mappings, %llu KB", path, core->threads,
+			vectorSize (&core->segments), core->size / 1024);
+		DbgDisplayMessage ("%llu KB copied, %llu KB of zero pages left as holes, %llu KB of read only files skipped",
+			core->dumped / 1024, core->holes / 1024, core->skipped / 1024);
+		DbgDisplayMessage ("Target stopped for %.1f ms; core written in %.3f s",
+			(double) (core->resumed - core->stopped) / 1000000.0, seconds);
+	}
+
+	if (core->ready)
+		DbgNotifyFree (core->ready);
+	if (core->space)
+		DbgNotifyFree (core->space);
+	vectorFree (&core->segments);
+	result = !core->failed;
+	free (core);
+	return result;
+}
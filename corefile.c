@@ -0,0 +1,588 @@
+/********************************************
+*
+*	corefile.c - Core file session
+*
+********************************************/
+
+/*
+	This component implements the session backend for ELF core files.
+	Opening a core reads only the file header, program headers and notes.
+	The contents of the load segments are mapped into the debugger in
+	windows of DBG_COREFILE_WINDOW bytes as they are touched; the least
+	recently used idle windows are unmapped once more than
+	DBG_COREFILE_WINDOWS are mapped, so a core far larger than the
+	address space of the debugger can be read. Memory reads copy straight
+	out of a window and DBG_REQ_PEEK hands out pointers into one, which
+	keeps it mapped until DBG_REQ_UNPEEK, so pages are never staged
+	through a buffer.
+
+	Threads and their registers come from the NT_PRSTATUS notes and the
+	loaded modules from the NT_FILE note. Nothing in a core changes, so
+	requests are served in place on the calling thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "elf.h"
+
+#define DBG_COREFILE_USER_END 0x80000000ULL	/* end of the user address space */
+#define DBG_COREFILE_WINDOW   (64*1024*1024)	/* segment bytes mapped at a time */
+#define DBG_COREFILE_SLACK    (2*1024*1024)		/* extra bytes so peeks across a window boundary fit */
+#define DBG_COREFILE_WINDOWS  4					/* windows kept mapped */
+
+typedef struct _dbgCoreLoad {
+	vaddr_t            base;
+	unsigned long      memsz;
+	unsigned long      filesz;
+	unsigned long long offset;
+	unsigned int       flags;		/* ELF_PF_xxx */
+	const char*        file;		/* mapped file or 0 */
+}dbgCoreLoad;
+
+/* mapped part of a segment */
+typedef struct _dbgCoreWindow {
+	ilistNode          node;
+	const dbgCoreLoad* load;
+	unsigned long      at;			/* segment offset of the first byte */
+	unsigned long      length;
+	unsigned char*     data;
+	unsigned int       users;		/* reads and peeks in progress */
+	dbgFileView        view;
+}dbgCoreWindow;
+
+typedef struct _dbgCoreThread {
+	tid_t      id;
+	dbgContext context;
+}dbgCoreThread;
+
+typedef struct _dbgCoreModule {
+	vaddr_t     base;
+	const char* file;
+}dbgCoreModule;
+
+struct _dbgCoreFile {
+	dbgFileMap*        map;
+	unsigned long long size;
+	vector             loads;		/* dbgCoreLoad sorted by base */
+	vector             threads;		/* dbgCoreThread */
+	vector             modules;		/* dbgCoreModule */
+	vector             names;		/* char; file names from NT_FILE */
+	char               name[81];	/* process command line */
+	pid_t              pid;
+	pool               windowPool;
+	ilist              windows;		/* dbgCoreWindow, least recently used first */
+	dbgMutex*          lock;		/* serializes mapping of segment contents */
+};
+
+static int DbgCoreFileCompareLoad (const void* a, const void* b) {
+	const dbgCoreLoad* x = (const dbgCoreLoad*) a;
+	const dbgCoreLoad* y = (const dbgCoreLoad*) b;
+	return x->base < y->base ? -1 : x->base > y->base;
+}
+
+/**
+*	Locate segment containing an address, or the first one above it
+*	\param core Core file
+*	\param address Address
+*	\param above Output first segment above address if none contains it
+*	\ret Segment or 0
+*/
+static dbgCoreLoad* DbgCoreFileFind (IN dbgCoreFile* core, IN vaddr_t address, OUT OPT dbgCoreLoad** above) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (&core->loads);
+
+	while (low < high) {
+		unsigned int mid  = (low + high) / 2;
+		dbgCoreLoad* load = (dbgCoreLoad*) vectorAt (&core->loads, mid);
+		if (address < load->base)
+			high = mid;
+		else if (address - load->base >= load->memsz)
+			low = mid + 1;
+		else
+			return load;
+	}
+	if (above)
+		*above = low < vectorSize (&core->loads) ? (dbgCoreLoad*) vectorAt (&core->loads, low) : 0;
+	return 0;
+}
+
+/**
+*	Unmap idle windows, least recently used first, until at most the given number are mapped
+*/
+static void DbgCoreFileTrim (IN dbgCoreFile* core, IN unsigned int keep) {
+	ilistNode* current = core->windows.first;
+
+	while (current && ilistSize (&core->windows) > keep) {
+		dbgCoreWindow* window = (dbgCoreWindow*) current;
+		current = current->next;
+		if (window->users)
+			continue;
+		DbgFileMapUnview (&window->view);
+		ilistRemove (&core->windows, &window->node);
+		poolRelease (&core->windowPool, window);
+	}
+}
+
+/**
+*	Get contents of a segment, mapping the window that holds them if needed.
+*	The window stays mapped until DbgCoreFileRelease.
+*	\param core Core file
+*	\param load Segment
+*	\param at Segment offset
+*	\param size Number of bytes that must be in the window
+*	\param end Receives the segment offset where the window ends
+*	et Pointer to the byte at the offset or 0 on error
+*/
+static unsigned char* DbgCoreFileAcquire (IN dbgCoreFile* core, IN const dbgCoreLoad* load, IN unsigned long at,
+                                          IN unsigned long size, OUT OPT unsigned long* end) {
+	dbgCoreWindow* window = 0;
+	ilistNode*     current;
+	unsigned long  start;
+	unsigned long  length;
+	unsigned char* data;
+
+	DbgMutexLock (core->lock);
+	for (current = core->windows.last; current; current = current->prev) {
+		dbgCoreWindow* candidate = (dbgCoreWindow*) current;
+		if (candidate->load == load && at >= candidate->at && at - candidate->at + (unsigned long long) size <= candidate->length) {
+			window = candidate;
+			ilistRemove (&core->windows, &window->node);
+			break;
+		}
+	}
+	if (!window) {
+		start  = at - at % DBG_COREFILE_WINDOW;
+		length = load->filesz - start < DBG_COREFILE_WINDOW + DBG_COREFILE_SLACK ? load->filesz - start : DBG_COREFILE_WINDOW + DBG_COREFILE_SLACK;
+		window = at - start + (unsigned long long) size <= length ? (dbgCoreWindow*) poolAlloc (&core->windowPool) : 0;
+		if (!window) {
+			DbgMutexUnlock (core->lock);
+			return 0;
+		}
+		DbgCoreFileTrim (core, DBG_COREFILE_WINDOWS - 1);
+		window->data = (unsigned char*) DbgFileMapView (core->map, load->offset + start, length, &window->view);
+		if (!window->data) {
+			/* the address space is short; give up every idle window and try again */
+			DbgCoreFileTrim (core, 0);
+			window->data = (unsigned char*) DbgFileMapView (core->map, load->offset + start, length, &window->view);
+		}
+		if (!window->data) {
+			poolRelease (&core->windowPool, window);
+			DbgMutexUnlock (core->lock);
+			return 0;
+		}
+		window->load   = load;
+		window->at     = start;
+		window->length = length;
+		window->users  = 0;
+	}
+	/* most recently used last */
+	ilistAppend (&core->windows, &window->node);
+	window->users++;
+	data = window->data + (at - window->at);
+	if (end)
+		*end = window->at + window->length;
+	DbgMutexUnlock (core->lock);
+	return data;
+}
+
+/**
+*	Release the window of a pointer returned by DbgCoreFileAcquire
+*/
+static void DbgCoreFileRelease (IN dbgCoreFile* core, IN const void* data) {
+	ilistNode* current;
+
+	DbgMutexLock (core->lock);
+	for (current = core->windows.last; current; current = current->prev) {
+		dbgCoreWindow* window = (dbgCoreWindow*) current;
+		if ((const unsigned char*) data >= window->data && (const unsigned char*) data < window->data + window->length) {
+			window->users--;
+			break;
+		}
+	}
+	DbgMutexUnlock (core->lock);
+}
+
+/**
+*	Convert ELF register set to NDBG context
+*/
+static void DbgCoreFileContext (IN const elf32Prstatus* status, OUT dbgContext* context) {
+	memset (context, 0, sizeof (dbgContext));
+	context->eip       = status->reg[ELF_REG_EIP];
+	context->flags     = status->reg[ELF_REG_EFLAGS];
+	context->regs.eax  = status->reg[ELF_REG_EAX];
+	context->regs.ebx  = status->reg[ELF_REG_EBX];
+	context->regs.ecx  = status->reg[ELF_REG_ECX];
+	context->regs.edx  = status->reg[ELF_REG_EDX];
+	context->regs.esi  = status->reg[ELF_REG_ESI];
+	context->regs.edi  = status->reg[ELF_REG_EDI];
+	context->regs.ebp  = status->reg[ELF_REG_EBP];
+	context->regs.esp  = status->reg[ELF_REG_ESP];
+	context->sregs.cs  = (uint16_t) status->reg[ELF_REG_CS];
+	context->sregs.ds  = (uint16_t) status->reg[ELF_REG_DS];
+	context->sregs.es  = (uint16_t) status->reg[ELF_REG_ES];
+	context->sregs.fs  = (uint16_t) status->reg[ELF_REG_FS];
+	context->sregs.gs  = (uint16_t) status->reg[ELF_REG_GS];
+	context->sregs.ss  = (uint16_t) status->reg[ELF_REG_SS];
+}
+
+/**
+*	Parse the NT_FILE note; names are kept for DbgCoreFileAttach to intern
+*/
+static void DbgCoreFileFiles (IN dbgCoreFile* core, IN const unsigned char* desc, IN unsigned int size) {
+	const elf32FileNote*  note = (const elf32FileNote*) desc;
+	const elf32FileEntry* entry;
+	const char*           name;
+	const char*           end = (const char*) desc + size;
+	unsigned int          i;
+
+	if (size < sizeof (elf32FileNote) || note->count > (size - sizeof (elf32FileNote)) / sizeof (elf32FileEntry))
+		return;
+	entry = (const elf32FileEntry*) (note + 1);
+	name  = (const char*) (entry + note->count);
+
+	for (i = 0; i < note->count && name < end; i++) {
+		dbgCoreModule module;
+		/* remember where the name starts; the vector may move while it grows */
+		module.base = entry[i].start;
+		module.file = (const char*) (size_t) vectorSize (&core->names);
+		while (name < end && *name)
+			vectorAdd (&core->names, name++);
+		vectorAdd (&core->names, "");
+		name++;
+		vectorAdd (&core->modules, &module);
+	}
+}
+
+/**
+*	Parse a note segment
+*/
+static void DbgCoreFileNotes (IN dbgCoreFile* core, IN const unsigned char* notes, IN unsigned int size) {
+	unsigned int at = 0;
+
+	while (at + sizeof (elf32Note) <= size) {
+		const elf32Note*     note = (const elf32Note*) (notes + at);
+		const unsigned char* desc;
+		unsigned int         next;
+
+		next = at + sizeof (elf32Note) + ((note->namesz + 3) & ~3);
+		desc = notes + next;
+		if (next + note->descsz > size)
+			break;
+		next += (note->descsz + 3) & ~3;
+
+		switch (note->type) {
+			case ELF_NT_PRSTATUS:
+				if (note->descsz >= sizeof (elf32Prstatus)) {
+					const elf32Prstatus* status = (const elf32Prstatus*) desc;
+					dbgCoreThread        thread;
+					thread.id = (tid_t) status->pid;
+					DbgCoreFileContext (status, &thread.context);
+					vectorAdd (&core->threads, &thread);
+				}
+				break;
+			case ELF_NT_PRPSINFO:
+				if (note->descsz >= sizeof (elf32Prpsinfo)) {
+					const elf32Prpsinfo* info = (const elf32Prpsinfo*) desc;
+					memcpy (core->name, info->psargs, sizeof (info->psargs));
+					core->name[sizeof (info->psargs)] = 0;
+					core->pid = (pid_t) info->pid;
+				}
+				break;
+			case ELF_NT_FILE:
+				DbgCoreFileFiles (core, desc, note->descsz);
+				break;
+		}
+		at = next;
+	}
+}
+
+/**
+*	Open core file
+*
+*	Only the headers and notes are read here. Segment contents are
+*	mapped when first used.
+*
+*	\param path Core file path
+*	\ret Core file or 0 on error
+*/
+dbgCoreFile* DbgCoreFileOpen (IN const char* path) {
+	dbgCoreFile*        core;
+	dbgFileView         view;
+	const elf32Header*  header;
+	const elf32Program* program;
+	unsigned int        i;
+
+	core = (dbgCoreFile*) calloc (1, sizeof (dbgCoreFile));
+	if (!core)
+		return 0;
+	vectorInit (&core->loads,   sizeof (dbgCoreLoad));
+	vectorInit (&core->threads, sizeof (dbgCoreThread));
+	vectorInit (&core->modules, sizeof (dbgCoreModule));
+	vectorInit (&core->names,   1);
+	poolInit (&core->windowPool, sizeof (dbgCoreWindow), DBG_COREFILE_WINDOWS);
+	ilistInit (&core->windows);
+
+	core->map  = DbgFileMapOpen (path, &core->size);
+	core->lock = DbgMutexCreate ();
+	if (!core->map || !core->lock || core->size < sizeof (elf32Header)) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		DbgCoreFileClose (core);
+		return 0;
+	}
+
+	/* file header */
+	header = (const elf32Header*) DbgFileMapView (core->map, 0, sizeof (elf32Header), &view);
+	if (!header || memcmp (header->ident, "\x7f" "ELF", 4) || header->ident[4] != 1 || header->type != ELF_ET_CORE
+		|| header->machine != ELF_EM_386 || header->phentsize != sizeof (elf32Program)
+		|| header->phoff + (unsigned long long) header->phnum * sizeof (elf32Program) > core->size) {
+		DbgDisplayError ("'%s' is not an i386 ELF core file", path);
+		DbgFileMapUnview (&view);
+		DbgCoreFileClose (core);
+		return 0;
+	}
+	{
+		unsigned int phoff = header->phoff;
+		unsigned int phnum = header->phnum;
+		DbgFileMapUnview (&view);
+		program = (const elf32Program*) DbgFileMapView (core->map, phoff, phnum * sizeof (elf32Program), &view);
+		if (!program) {
+			DbgCoreFileClose (core);
+			return 0;
+		}
+		vectorReserve (&core->loads, phnum);
+
+		for (i = 0; i < phnum; i++) {
+			if (program[i].type == ELF_PT_LOAD && program[i].memsz) {
+				dbgCoreLoad load;
+				memset (&load, 0, sizeof (dbgCoreLoad));
+				load.base   = program[i].vaddr;
+				load.memsz  = program[i].memsz;
+				load.offset = program[i].offset;
+				load.flags  = program[i].flags;
+				/* contents past the end of the file are not available */
+				if (program[i].offset < core->size)
+					load.filesz = (unsigned long) (program[i].filesz < core->size - program[i].offset
+						? program[i].filesz : core->size - program[i].offset);
+				vectorAdd (&core->loads, &load);
+			}
+			else if (program[i].type == ELF_PT_NOTE && program[i].filesz
+				&& program[i].offset + (unsigned long long) program[i].filesz <= core->size) {
+				dbgFileView          noteView;
+				const unsigned char* notes = (const unsigned char*) DbgFileMapView (core->map, program[i].offset,
+					program[i].filesz, &noteView);
+				if (notes) {
+					DbgCoreFileNotes (core, notes, program[i].filesz);
+					DbgFileMapUnview (&noteView);
+				}
+			}
+		}
+		DbgFileMapUnview (&view);
+	}
+
+	qsort (core->loads.data, vectorSize (&core->loads), sizeof (dbgCoreLoad), DbgCoreFileCompareLoad);
+	if (!core->name[0]) {
+#ifdef _MSC_VER
+		strncpy_s (core->name, sizeof (core->name), path, _TRUNCATE);
+#else
+		strncpy (core->name, path, sizeof (core->name) - 1);
+#endif
+	}
+	return core;
+}
+
+/**
+*	Close core file and unmap all segments
+*/
+void DbgCoreFileClose (IN dbgCoreFile* core) {
+	ilistNode* current;
+
+	for (current = core->windows.first; current; current = current->next)
+		DbgFileMapUnview (&((dbgCoreWindow*) current)->view);
+	poolFree (&core->windowPool);
+	if (core->map)
+		DbgFileMapClose (core->map);
+	if (core->lock)
+		DbgMutexFree (core->lock);
+	vectorFree (&core->loads);
+	vectorFree (&core->threads);
+	vectorFree (&core->modules);
+	vectorFree (&core->names);
+	free (core);
+}
+
+char* DbgCoreFileName (IN dbgCoreFile* core) {
+	return core->name;
+}
+
+pid_t DbgCoreFilePid (IN dbgCoreFile* core) {
+	return core->pid;
+}
+
+/**
+*	Populate session from core file
+*
+*	Threads are added to the session thread list with handles that
+*	index the register sets of the core. Modules are recorded and
+*	their symbols loaded.
+*
+*	\param session Debug session
+*/
+void DbgCoreFileAttach (IN dbgSession* session) {
+	dbgCoreFile*  core = session->core;
+	dbgProcess*   proc = &session->process;
+	const char*   exe;
+	unsigned int  i;
+
+	for (i = 0; i < vectorSize (&core->threads); i++) {
+		dbgThread* thread = (dbgThread*) poolAlloc (&proc->threadPool);
+		if (!thread)
+			break;
+		thread->thread = (handle_t) (i + 1);
+		thread->id     = ((dbgCoreThread*) vectorAt (&core->threads, i))->id;
+		thread->entry  = 0;
+		thread->rearm  = 0;
+		ilistAppend (&proc->threadList, &thread->node);
+	}
+
+	/* mapped file names move to the session string table */
+	for (i = 0; i < vectorSize (&core->modules); i++) {
+		dbgCoreModule* module = (dbgCoreModule*) vectorAt (&core->modules, i);
+		dbgCoreLoad*   load;
+		module->file = strtabIntern (&proc->strings, core->names.data + (size_t) module->file);
+		load = DbgCoreFileFind (core, module->base, 0);
+		if (load)
+			load->file = module->file;
+	}
+	vectorFree (&core->names);
+
+	/* the executable is the module named in the process information */
+	exe = strrchr (proc->name, '\\');
+	exe = exe ? exe + 1 : proc->name;
+
+	DbgInitializePDB (proc);
+	for (i = 0; i < vectorSize (&core->modules); i++) {
+		dbgCoreModule* module = (dbgCoreModule*) vectorAt (&core->modules, i);
+		const char*    base   = strrchr (module->file, '\\');
+		const char*    ext    = strrchr (module->file, '.');
+		unsigned int   j;
+		BOOL           seen = FALSE;
+
+		/* every section of an image has an entry; load each image once */
+		for (j = 0; j < i && !seen; j++)
+			seen = ((dbgCoreModule*) vectorAt (&core->modules, j))->file == module->file;
+		if (seen || !ext || (_stricmp (ext, ".exe") && _stricmp (ext, ".dll")))
+			continue;
+		base = base ? base + 1 : module->file;
+		DbgSymbolLoadModule (session, module->file, module->base, _stricmp (base, exe) == 0);
+	}
+}
+
+/**
+*	Serve session request from the core file
+*	\param request Session request
+*	\param session Debug session
+*	\param addr Optional data address
+*	\param data Optional data buffer
+*	\param size Optional data buffer size
+*	\ret The number of bytes read OR TRUE on success, FALSE on failure depending on request
+*/
+unsigned long DbgCoreFileRequest (IN dbgProcessReq request, IN dbgSession* session,
+                                  IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size) {
+	dbgCoreFile* core    = session->core;
+	vaddr_t      address = (vaddr_t) addr;
+
+	switch (request) {
+		case DBG_REQ_READ: {
+			size_t done = 0;
+			while (done < size) {
+				dbgCoreLoad*   load = DbgCoreFileFind (core, address + (vaddr_t) done, 0);
+				unsigned char* contents;
+				unsigned long  at;
+				unsigned long  end;
+				size_t         run;
+				if (!load)
+					break;
+				at = address + (vaddr_t) done - load->base;
+				if (at >= load->filesz || !(contents = DbgCoreFileAcquire (core, load, at, 1, &end)))
+					break;
+				run = end - at < size - done ? end - at : size - done;
+				memcpy ((char*) data + done, contents, run);
+				DbgCoreFileRelease (core, contents);
+				done += run;
+			}
+			return (unsigned long) done;
+		}
+		case DBG_REQ_PEEK: {
+			dbgCoreLoad*   load = DbgCoreFileFind (core, address, 0);
+			unsigned char* contents;
+			*(void**) data = 0;
+			if (!load || address - load->base + (unsigned long long) size > load->filesz)
+				return 0;
+			if (!(contents = DbgCoreFileAcquire (core, load, address - load->base, (unsigned long) size, 0)))
+				return 0;
+			*(void**) data = contents;
+			return (unsigned long) size;
+		}
+		case DBG_REQ_UNPEEK:
+			DbgCoreFileRelease (core, data);
+			return TRUE;
+		case DBG_REQ_QUERY: {
+			dbgMemoryRegion* region = (dbgMemoryRegion*) data;
+			dbgCoreLoad*     above  = 0;
+			dbgCoreLoad*     load   = DbgCoreFileFind (core, address, &above);
+			memset (region, 0, sizeof (dbgMemoryRegion));
+			if (!load) {
+				/* gap up to the next segment */
+				region->base = address & ~(DBG_MEMORY_PAGE - 1);
+				region->size = (unsigned long) ((above ? above->base : DBG_COREFILE_USER_END) - region->base);
+				return region->size != 0;
+			}
+			/* the part of a segment that is in the file is readable, the rest is not */
+			if (address - load->base < load->filesz) {
+				region->base     = load->base;
+				region->size     = load->filesz;
+				region->readable = TRUE;
+			}
+			else {
+				region->base = load->base + load->filesz;
+				region->size = load->memsz - load->filesz;
+			}
+			region->mapped  = load->file != 0;
+			region->protect = (load->flags & ELF_PF_R ? DBG_MEMORY_PROT_READ  : 0)
+			                | (load->flags & ELF_PF_W ? DBG_MEMORY_PROT_WRITE : 0)
+			                | (load->flags & ELF_PF_X ? DBG_MEMORY_PROT_EXEC  : 0);
+			if (!region->readable)
+				region->protect &= ~DBG_MEMORY_PROT_READ;
+			return TRUE;
+		}
+		case DBG_REQ_MAPPEDNAME: {
+			dbgCoreLoad* load = DbgCoreFileFind (core, address, 0);
+			size_t       length;
+			if (!load || !load->file || !size)
+				return 0;
+			length = strlen (load->file);
+			if (length > size - 1)
+				length = size - 1;
+			memcpy (data, load->file, length);
+			((char*) data)[length] = 0;
+			return (unsigned long) length;
+		}
+		case DBG_REQ_GETCONTEXT: {
+			/* thread handles are 1 based indices; 0 selects the first thread */
+			unsigned int index = addr ? (unsigned int) address - 1 : 0;
+			if (index >= vectorSize (&core->threads))
+				return FALSE;
+			memcpy (data, &((dbgCoreThread*) vectorAt (&core->threads, index))->context, sizeof (dbgContext));
+			return TRUE;
+		}
+		case DBG_REQ_SUSPEND:
+		case DBG_REQ_RESUME:
+			/* nothing runs */
+			return TRUE;
+		default:
+			DbgDisplayError ("Request not supported by core file sessions");
+			return 0;
+	}
+}
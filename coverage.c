@@ -0,0 +1,416 @@
+/********************************************
+*
+*	coverage.c - Line and function coverage
+*
+********************************************/
+
+/*
+	This component records which lines or functions of selected modules
+	the target executes.
+
+	A one shot breakpoint is placed on every line table address, or on
+	every function entry, in one pass that reads and writes each code
+	page once. The first hit of a point sets its bit and restores the
+	original byte for good, so instrumented code runs at full speed once
+	it has been reached. When the target exits the bits are written out
+	per source file in lcov tracefile format.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_COVERAGE_NAME 260	/* longest module file name */
+
+typedef struct _dbgCoveragePoint {
+	vaddr_t      address;	/* first; see DbgBreakpointArm */
+	const char*  file;		/* interned; 0 if the address has no line */
+	unsigned int line;
+	const char*  function;	/* interned; function coverage only */
+}dbgCoveragePoint;
+
+struct _dbgCoverage {
+	vector             points;		/* dbgCoveragePoint sorted by address */
+	unsigned char*     hit;			/* one bit per point */
+	unsigned long      hits;
+	unsigned long      armed;
+	BOOL               functions;
+	char*              path;
+	unsigned long long started;
+};
+
+static int DbgCoverageCompareAddress (const void* a, const void* b) {
+	vaddr_t x = ((const dbgCoveragePoint*) a)->address;
+	vaddr_t y = ((const dbgCoveragePoint*) b)->address;
+	return x < y ? -1 : x > y;
+}
+
+/* file then line; points without a line go last */
+static int DbgCoverageCompareLine (const void* a, const void* b) {
+	const dbgCoveragePoint* x = *(const dbgCoveragePoint* const*) a;
+	const dbgCoveragePoint* y = *(const dbgCoveragePoint* const*) b;
+	int                     order;
+	if (!x->file || !y->file)
+		return (x->file == 0) - (y->file == 0);
+	order = x->file == y->file ? 0 : strcmp (x->file, y->file);
+	if (order)
+		return order;
+	return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/**
+*	Compare module file names ignoring directory, extension and case
+*/
+static BOOL DbgCoverageNameMatch (IN const char* path, IN const char* module) {
+	char        a[DBG_COVERAGE_NAME];
+	char        b[DBG_COVERAGE_NAME];
+	const char* file = strrchr (path, '\\');
+	char*       ext;
+
+	file = file ? file + 1 : path;
+	if (strlen (file) >= DBG_COVERAGE_NAME || strlen (module) >= DBG_COVERAGE_NAME)
+		return FALSE;
+#ifdef _MSC_VER
+	strcpy_s (a, sizeof (a), file);
+	strcpy_s (b, sizeof (b), module);
+#else
+	strcpy (a, file);
+	strcpy (b, module);
+#endif
+	if ((ext = strrchr (a, '.')) != 0)
+		*ext = 0;
+	if ((ext = strrchr (b, '.')) != 0)
+		*ext = 0;
+	return _stricmp (a, b) == 0;
+}
+
+/**
+*	Test if a module is selected
+*/
+static BOOL DbgCoverageModule (IN dbgSession* session, IN char** modules, IN unsigned int count, IN vaddr_t base) {
+	dbgSharedLibrary* library;
+	unsigned int      i;
+
+	if (!count)
+		return base == session->process.base;
+	library = DbgModuleFind (session, base);
+	for (i = 0; library && i < count; i++) {
+		if (DbgCoverageNameMatch (library->name, modules[i]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+*	Line table entries of the selected modules, sorted by address, one per address
+*/
+static void DbgCoverageLines (IN dbgSession* session, IN char** modules, IN unsigned int count, OUT vector* lines) {
+	ilistNode*   cur;
+	unsigned int i;
+	unsigned int kept;
+
+	for (cur = session->process.sourceFileList.first; cur; cur = cur->next) {
+		dbgSourceFile* file = (dbgSourceFile*) cur;
+		if (!DbgCoverageModule (session, modules, count, file->modbase))
+			continue;
+		for (i = 0; i < vectorSize (&file->sourceLineList); i++) {
+			dbgSourceLine*   line = (dbgSourceLine*) vectorAt (&file->sourceLineList, i);
+			dbgCoveragePoint point;
+			point.address  = line->addr;
+			point.file     = file->name;
+			point.line     = line->lineNumber;
+			point.function = 0;
+			vectorAdd (lines, &point);
+		}
+	}
+	qsort (lines->data, vectorSize (lines), sizeof (dbgCoveragePoint), DbgCoverageCompareAddress);
+	for (i = 0, kept = 0; i < vectorSize (lines); i++) {
+		if (kept && ((dbgCoveragePoint*) vectorAt (lines, kept - 1))->address == ((dbgCoveragePoint*) vectorAt (lines, i))->address)
+			continue;
+		memmove (vectorAt (lines, kept++), vectorAt (lines, i), sizeof (dbgCoveragePoint));
+	}
+	lines->count = kept;
+}
+
+typedef struct _dbgCoverageEnum {
+	dbgSession* session;
+	vector*     points;
+	vector*     lines;
+}dbgCoverageEnum;
+
+static BOOL DbgCoverageFunctionProc (IN void* arg, IN const char* name, IN vaddr_t address) {
+	dbgCoverageEnum* enumerate = (dbgCoverageEnum*) arg;
+	dbgCoveragePoint point;
+	dbgCoveragePoint* line;
+
+	point.address  = address;
+	point.file     = 0;
+	point.line     = 0;
+	point.function = strtabIntern (&enumerate->session->process.strings, name);
+	line = (dbgCoveragePoint*) bsearch (&point, enumerate->lines->data, vectorSize (enumerate->lines),
+		sizeof (dbgCoveragePoint), DbgCoverageCompareAddress);
+	if (line) {
+		point.file = line->file;
+		point.line = line->line;
+	}
+	vectorAdd (enumerate->points, &point);
+	return TRUE;
+}
+
+/**
+*	Function entries of the selected modules, sorted by address
+*/
+static void DbgCoverageFunctions (IN dbgSession* session, IN char** modules, IN unsigned int count,
+                                  IN vector* lines, OUT vector* points) {
+	dbgCoverageEnum enumerate;
+	char            mask[DBG_COVERAGE_NAME + 3];
+	unsigned int    i;
+	unsigned int    kept;
+
+	enumerate.session = session;
+	enumerate.points  = points;
+	enumerate.lines   = lines;
+	for (i = 0; i < (count ? count : 1); i++) {
+		const char* module = count ? modules[i] : session->process.name;
+		const char* file   = strrchr (module, '\\');
+		char*       ext;
+		file = file ? file + 1 : module;
+		if (strlen (file) >= DBG_COVERAGE_NAME)
+			continue;
+#ifdef _MSC_VER
+		strcpy_s (mask, sizeof (mask), file);
+#else
+		strcpy (mask, file);
+#endif
+		if ((ext = strrchr (mask, '.')) != 0)
+			*ext = 0;
+#ifdef _MSC_VER
+		strcat_s (mask, sizeof (mask), "!*");
+#else
+		strcat (mask, "!*");
+#endif
+		DbgSymbolEnumFunctions (session, mask, DbgCoverageFunctionProc, &enumerate);
+	}
+	qsort (points->data, vectorSize (points), sizeof (dbgCoveragePoint), DbgCoverageCompareAddress);
+	for (i = 0, kept = 0; i < vectorSize (points); i++) {
+		if (kept && ((dbgCoveragePoint*) vectorAt (points, kept - 1))->address == ((dbgCoveragePoint*) vectorAt (points, i))->address)
+			continue;
+		memmove (vectorAt (points, kept++), vectorAt (points, i), sizeof (dbgCoveragePoint));
+	}
+	points->count = kept;
+}
+
+/**
+*	Start collecting coverage
+*	\param session Debug session
+*	\param modules Module names; 0 count selects the process image
+*	\param count Number of modules
+*	\param functions TRUE for function entries, FALSE for line table addresses
+*	\param path lcov output file written when the target exits
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgCoverageStart (IN dbgSession* session, IN char** modules, IN unsigned int count,
+                       IN BOOL functions, IN const char* path) {
+	dbgCoverage*       coverage;
+	vector             lines;
+	unsigned long long start = DbgClockNow ();
+	unsigned long      pages;
+
+	if (session->type != DBG_SESSION_LIVE) {
+		DbgDisplayError ("Coverage needs a live target");
+		return FALSE;
+	}
+	if (session->coverage) {
+		DbgDisplayError ("Coverage is already being collected");
+		return FALSE;
+	}
+	coverage = (dbgCoverage*) calloc (1, sizeof (dbgCoverage));
+	if (!coverage)
+		return FALSE;
+	coverage->path = (char*) malloc (strlen (path) + 1);
+	if (!coverage->path) {
+		free (coverage);
+		return FALSE;
+	}
+#ifdef _MSC_VER
+	strcpy_s (coverage->path, strlen (path) + 1, path);
+#else
+	strcpy (coverage->path, path);
+#endif
+	coverage->functions = functions;
+	vectorInit (&coverage->points, sizeof (dbgCoveragePoint));
+	vectorInit (&lines, sizeof (dbgCoveragePoint));
+
+	DbgCoverageLines (session, modules, count, &lines);
+	if (functions) {
+		DbgCoverageFunctions (session, modules, count, &lines, &coverage->points);
+		vectorFree (&lines);
+	}
+	else
+		coverage->points = lines;
+
+	coverage->hit = (unsigned char*) calloc (vectorSize (&coverage->points) / 8 + 1, 1);
+	if (!coverage->hit || !vectorSize (&coverage->points)) {
+		DbgDisplayError (coverage->hit ? "No %s found in the selected modules" : "Out of memory",
+			functions ? "functions" : "line table entries");
+		vectorFree (&coverage->points);
+		free (coverage->hit);
+		free (coverage->path);
+		free (coverage);
+		return FALSE;
+	}
+	session->coverage = coverage;
+
+	/* points under an existing breakpoint are left alone */
+	coverage->armed = DbgBreakpointArm (session, coverage->points.data, vectorSize (&coverage->points),
+		sizeof (dbgCoveragePoint), TRUE, TRUE, 0, &pages);
+	coverage->started = DbgClockNow ();
+	DbgDisplayMessage ("%lu of %u %s armed in %lu pages, %.1f ms; %s is written when the target exits",
+		coverage->armed, vectorSize (&coverage->points), functions ? "functions" : "line addresses",
+		pages, (double) (coverage->started - start) / 1000000.0, coverage->path);
+	return TRUE;
+}
+
+/**
+*	Record the first hit of a coverage point
+*	\param session Debug session
+*	\param address Address of the one shot breakpoint
+*/
+void DbgCoverageHit (IN dbgSession* session, IN vaddr_t address) {
+	dbgCoverage*      coverage = session->coverage;
+	dbgCoveragePoint  key;
+	dbgCoveragePoint* point;
+	unsigned int      index;
+
+	key.address = address;
+	point = (dbgCoveragePoint*) bsearch (&key, coverage->points.data, vectorSize (&coverage->points),
+		sizeof (dbgCoveragePoint), DbgCoverageCompareAddress);
+	if (!point)
+		return;
+	index = (unsigned int) (point - (dbgCoveragePoint*) coverage->points.data);
+	if (!(coverage->hit[index / 8] & (1 << (index % 8)))) {
+		coverage->hit[index / 8] |= (unsigned char) (1 << (index % 8));
+		coverage->hits++;
+	}
+}
+
+/**
+*	Write one lcov record per source file
+*/
+static BOOL DbgCoverageWrite (IN dbgCoverage* coverage, OUT unsigned long* found, OUT unsigned long* covered) {
+	vector       order;
+	FILE*        file;
+	unsigned int i;
+	unsigned int first;
+
+	*found   = 0;
+	*covered = 0;
+#ifdef _MSC_VER
+	if (fopen_s (&file, coverage->path, "w"))
+		file = 0;
+#else
+	file = fopen (coverage->path, "w");
+#endif
+	if (!file)
+		return FALSE;
+
+	vectorInit (&order, sizeof (dbgCoveragePoint*));
+	for (i = 0; i < vectorSize (&coverage->points); i++) {
+		dbgCoveragePoint* point = (dbgCoveragePoint*) vectorAt (&coverage->points, i);
+		vectorAdd (&order, &point);
+	}
+	qsort (order.data, vectorSize (&order), sizeof (dbgCoveragePoint*), DbgCoverageCompareLine);
+
+	for (first = 0; first < vectorSize (&order); ) {
+		const char*   name  = (*(dbgCoveragePoint**) vectorAt (&order, first))->file;
+		unsigned long total = 0;
+		unsigned long hit   = 0;
+		unsigned int  last;
+
+		/* functions without line information have no file to report under */
+		if (!name)
+			break;
+		for (last = first; last < vectorSize (&order) && (*(dbgCoveragePoint**) vectorAt (&order, last))->file == name; last++)
+			;
+
+		fprintf (file, "TN:\nSF:%s\n", name);
+		for (i = first; i < last; i++) {
+			dbgCoveragePoint* point = *(dbgCoveragePoint**) vectorAt (&order, i);
+			unsigned int      index = (unsigned int) (point - (dbgCoveragePoint*) coverage->points.data);
+			BOOL              taken = (coverage->hit[index / 8] >> (index % 8)) & 1;
+
+			if (coverage->functions) {
+				fprintf (file, "FN:%u,%s\nFNDA:%u,%s\n", point->line, point->function, taken, point->function);
+				total++;
+				hit += taken;
+				continue;
+			}
+			/* a line is covered if any of its addresses ran */
+			while (i + 1 < last && (*(dbgCoveragePoint**) vectorAt (&order, i + 1))->line == point->line) {
+				dbgCoveragePoint* next = *(dbgCoveragePoint**) vectorAt (&order, ++i);
+				index  = (unsigned int) (next - (dbgCoveragePoint*) coverage->points.data);
+				taken |= (coverage->hit[index / 8] >> (index % 8)) & 1;
+			}
+			fprintf (file, "DA:%u,%u\n", point->line, taken);
+			total++;
+			hit += taken;
+		}
+		if (coverage->functions)
+			fprintf (file, "FNF:%lu\nFNH:%lu\n", total, hit);
+		else
+			fprintf (file, "LF:%lu\nLH:%lu\n", total, hit);
+		fprintf (file, "end_of_record\n");
+		*found   += total;
+		*covered += hit;
+		first = last;
+	}
+	vectorFree (&order);
+	fclose (file);
+	return TRUE;
+}
+
+/**
+*	Write coverage and stop collecting; called when the target exits
+*	\param session Debug session
+*/
+void DbgCoverageFinish (IN dbgSession* session) {
+	dbgCoverage*  coverage = session->coverage;
+	unsigned long found;
+	unsigned long covered;
+
+	if (!coverage)
+		return;
+	if (!DbgCoverageWrite (coverage, &found, &covered))
+		DbgDisplayError ("Unable to write coverage to '%s'", coverage->path);
+	else
+		DbgDisplayMessage ("Coverage: %lu of %lu %s (%.1f%%) in %.1f s; %lu points hit, written to %s",
+			covered, found, coverage->functions ? "functions" : "lines",
+			found ? 100.0 * covered / found : 0.0, (double) (DbgClockNow () - coverage->started) / 1000000000.0,
+			coverage->hits, coverage->path);
+	DbgCoverageFree (session);
+}
+
+/**
+*	Number of coverage points hit so far
+*	\param session Debug session
+*	\ret Hits, 0 when not collecting
+*/
+unsigned long DbgCoverageHits (IN dbgSession* session) {
+	return session->coverage ? session->coverage->hits : 0;
+}
+
+/**
+*	Release coverage state
+*	\param session Debug session
+*/
+void DbgCoverageFree (IN dbgSession* session) {
+	dbgCoverage* coverage = session->coverage;
+	if (!coverage)
+		return;
+	vectorFree (&coverage->points);
+	free (coverage->hit);
+	free (coverage->path);
+	free (coverage);
+	session->coverage = 0;
+}
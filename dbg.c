@@ -4,6 +4,7 @@
 
 ********************************************/
 
+#include <string.h>
 #include "defs.h"
 
 /**
@@ -52,7 +53,13 @@ dbgSessionState DbgEventProc (IN dbgSession* session, IN dbgEventDescr* descr) {
 			return DBG_STATE_SUSPEND;
 		}
 		case DBG_EVENT_PRINT: {
-			DbgDisplayDebugOut ("%s", descr->u.debugString.string);
+			/* batch of consecutive strings sent by the target */
+			char*        str = (char*) descr->u.debugString.string;
+			unsigned int c;
+			for (c = 0; c < descr->u.debugString.count; c++) {
+				DbgDisplayDebugOut ("%s", str);
+				str += strlen (str) + 1;
+			}
 			break;
 		}
 		case DBG_EVENT_CREATEPROCESS:
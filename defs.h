@@ -13,6 +13,11 @@
 */
 
 #include "list.h"
+#include "vector.h"
+#include "pool.h"
+#include "arena.h"
+#include "os.h"
+#include "queue.h"
 #include "sys.h"
 
 #define NDBG_NAME "ndbg"
@@ -68,13 +73,7 @@ typedef unsigned int  size_t;
 typedef unsigned int  index_t;
 typedef unsigned int  pdiff_t;
 
-/* mutual exclusion */
-#define dbgMutex CRITICAL_SECTION
-#define DbgMutexLock(mutex)    EnterCriticalSection(mutex)
-#define DbgMutexLockTry(mutex) TryEnterCriticalSection (mutex)
-#define DbgMutexUnlock(mutex)  LeaveCriticalSection(mutex)
-#define DbgMutexInit(mutex)    InitializeCriticalSection(mutex)
-#define DbgMutexFree(mutex)    DeleteCriticalSection(mutex)
+/* mutual exclusion, host threads and atomics are provided by os.h */
 
 /* command console */
 
@@ -101,8 +100,8 @@ typedef struct _dbgSession dbgSession;
 typedef enum _dbgProcessReq {
 	DBG_REQ_READ,
 	DBG_REQ_WRITE,
-	DBG_REQ_GETCONTEXT,
-	DBG_REQ_SETCONTEXT,
+	DBG_REQ_GETCONTEXT,	/* addr is a thread handle or 0 for the current thread */
+	DBG_REQ_SETCONTEXT,	/* data is a dbgContext; addr is a thread handle or 0 for the current thread */
 	DBG_REQ_CONTINUE,
 	DBG_REQ_BREAK,
 	DBG_REQ_STOP,
@@ -114,9 +113,32 @@ typedef enum _dbgProcessReq {
 	*/
 	DBG_REQ_READPHYS,
 	DBG_REQ_WRITEPHYS,
-	DBG_REQ_TRANSLATE	/* translates vaddr_t to paddr_t */
+	DBG_REQ_TRANSLATE,	/* translates vaddr_t to paddr_t */
+	DBG_REQ_QUERY,		/* describes the memory region containing addr */
+	DBG_REQ_MAPPEDNAME,	/* name of the file mapped at addr */
+	DBG_REQ_SUSPEND,	/* addr is a thread handle */
+	DBG_REQ_RESUME,
+	DBG_REQ_PEEK,		/* data receives a pointer to size bytes at addr; 0 if they are not mapped */
+	DBG_REQ_PROTECT,	/* data holds the new DBG_MEMORY_PROT_ flags of size bytes at addr and receives the old ones */
+	DBG_REQ_ALLOCATE,	/* data receives the address of size bytes of new read/write memory */
+	DBG_REQ_UNPEEK,		/* data is a pointer from DBG_REQ_PEEK that is no longer used */
+	DBG_REQ_COUNT
 }dbgProcessReq;
 
+/* memory region descriptor returned by DBG_REQ_QUERY */
+
+#define DBG_MEMORY_PROT_EXEC  1
+#define DBG_MEMORY_PROT_WRITE 2
+#define DBG_MEMORY_PROT_READ  4
+
+typedef struct _dbgMemoryRegion {
+	vaddr_t       base;
+	unsigned long size;
+	BOOL          readable;
+	BOOL          mapped;		/* backed by an image or mapped file */
+	unsigned int  protect;		/* DBG_MEMORY_PROT_xxx */
+}dbgMemoryRegion;
+
 /* exception management */
 
 typedef enum _dbgException {
@@ -148,7 +170,12 @@ typedef enum _dbgException {
 	DBG_EXCEPTION_FLT_INVALID_OP,
 	DBG_EXCEPTION_FLT_STACK_CHECK,
 	DBG_EXCEPTION_FLT_DENORMAL_OPERAND,
-	DBG_EXCEPTION_FLT_UNDERFLOW
+	DBG_EXCEPTION_FLT_UNDERFLOW,
+	/*
+		Raised by software (C++ throw, RaiseException) or not known
+	*/
+	DBG_EXCEPTION_SOFTWARE,
+	DBG_EXCEPTION_COUNT
 }dbgException;
 
 typedef enum dbgExceptionType {
@@ -163,8 +190,30 @@ typedef struct _dbgExceptionDescr {
 	dbgException     code;
 	dbgExceptionType type;
 	vaddr_t          address;
+	vaddr_t          data;		/* DBG_EXCEPTION_SEGMENT: address accessed */
+	BOOL             write;		/* DBG_EXCEPTION_SEGMENT: the access was a write */
+	unsigned long    native;	/* operating system exception code */
 }dbgExceptionDescr;
 
+/*
+	Exception policy. Each exception code has one rule per chance; the
+	session thread applies it before anything is formatted or the front
+	end is woken.
+*/
+
+typedef enum _dbgFilterAction {
+	DBG_FILTER_STOP,		/* report and stop the target */
+	DBG_FILTER_PRINT,		/* report and continue */
+	DBG_FILTER_IGNORE		/* continue silently */
+}dbgFilterAction;
+
+typedef struct _dbgExceptionFilter {
+	unsigned char action[2];	/* dbgFilterAction, indexed by first chance */
+	BOOL          pass;			/* hand the exception to the target's own handlers */
+	unsigned long events[2];	/* second chance, first chance */
+	unsigned long absorbed;		/* events that did not stop the target */
+}dbgExceptionFilter;
+
 typedef struct _dbgCreateThreadDescr {
 	vaddr_t      entry;
 }dbgCreateThreadDescr;
@@ -184,8 +233,9 @@ typedef struct _dbgCreateProcessDescr {
 }dbgCreateProcessDescr;
 
 typedef struct _dbgDebugStringDescr {
-	vaddr_t      string;
+	vaddr_t      string;	/* count 0 terminated strings stored back to back */
 	unsigned int length;
+	unsigned int count;
 }dbgDebugStringDescr;
 
 typedef struct _dbgQuitDescr {
@@ -227,9 +277,10 @@ typedef struct _dbgSourceLine {
 }dbgSourceLine;
 
 typedef struct _dbgSourceFile {
-	vaddr_t  modbase;
-	char*    name;
-	list     sourceLineList;
+	ilistNode   node;
+	vaddr_t     modbase;
+	const char* name;			/* interned */
+	vector      sourceLineList;	/* dbgSourceLine */
 }dbgSourceFile;
 
 /* symbol information */
@@ -266,9 +317,33 @@ typedef struct _dbgSymbol {
 	unsigned long long value;			// constants only
 	vaddr_t      addr;
 	int          reg;
-	char*        name;
+	const char*  name;			/* interned */
 }dbgSymbol;
 
+/* called for each function found by DbgSymbolEnumFunctions; return FALSE to stop */
+typedef BOOL (*DbgSymbolEnumProc) (IN void* arg, IN const char* name, IN vaddr_t address);
+
+/* function and line table entries for batch symbolization; see symbolize.c */
+typedef struct _dbgFunctionEntry {
+	vaddr_t       start;
+	unsigned long size;			/* 0 if unknown; the function ends at the next one */
+	const char*   name;			/* interned */
+}dbgFunctionEntry;
+
+typedef struct _dbgLineEntry {
+	vaddr_t      addr;
+	unsigned int line;
+	const char*  file;			/* interned */
+}dbgLineEntry;
+
+/* result of batch symbolization */
+typedef struct _dbgSymbolization {
+	const char*   function;		/* interned; 0 if unknown */
+	unsigned long offset;		/* from the start of the function */
+	const char*   file;			/* interned; 0 if unknown */
+	unsigned int  line;
+}dbgSymbolization;
+
 /* break points */
 
 typedef enum _dbgBreakpointType {
@@ -277,6 +352,7 @@ typedef enum _dbgBreakpointType {
 }dbgBreakpoingType;
 
 typedef struct _dbgBreakpoint {
+	ilistNode         node;
 	unsigned int      id;
 	BOOL              set;
 	BOOL              once;	   /* 1 time breakpoint. When hit, it should be removed */
@@ -284,8 +360,18 @@ typedef struct _dbgBreakpoint {
 	vaddr_t           address;
 	dbgBreakpoingType type;
 	unsigned int      hits;
+	BOOL              count;   /* counting breakpoint; hits are counted and the target resumes */
 }dbgBreakpoint;
 
+/* breakpoints by address; open addressed, see break.c */
+typedef struct _dbgBreakpointIndex {
+	dbgBreakpoint**    slots;
+	unsigned int       mask;
+	unsigned int       count;
+	unsigned long long trapTime;	/* ns from counting trap to re-arm */
+	unsigned long      traps;
+}dbgBreakpointIndex;
+
 /* watch points */
 
 typedef enum dbgWatchpointType {
@@ -295,6 +381,7 @@ typedef enum dbgWatchpointType {
 }dbgWatchpointType;
 
 typedef struct _dbgWatchpoint {
+	ilistNode         node;
 	unsigned int      id;
 	BOOL              set;
 	vaddr_t           address;
@@ -325,13 +412,20 @@ typedef enum _dbgSessionState {
 }dbgSessionState;
 
 typedef struct _dbgSharedLibrary {
-	char*   name;
-	vaddr_t base;
+	ilistNode     node;
+	const char*   name;		/* interned */
+	vaddr_t       base;
+	unsigned long size;		/* image size; 0 if unknown */
+	unsigned long memory;	/* session arena bytes used by its symbols */
 }dbgSharedLibrary;
 
 typedef struct _dbgThread {
+	ilistNode node;
 	handle_t thread;
+	tid_t    id;
 	vaddr_t  entry;
+	vaddr_t  rearm;		/* counting breakpoint to re-arm after a single step; 0 if none */
+	unsigned long long trapStart;	/* clock of the counting trap being re-armed */
 /*	void*    threadLocalBase; */
 }dbgThread;
 
@@ -341,28 +435,215 @@ typedef struct _dbgProcess {
 	handle_t process;
 	handle_t thread;
 	dbgPtid  id;
-	list     libraryList;
-	list     threadList;
-	list     sourceFileList;
-	list     breakPointList;
-	list     watchPointList;
+	/*
+		Session lifetime objects, names and line tables come from the
+		process arena and are released together when the session ends.
+		Names are interned so duplicate paths are stored once.
+	*/
+	arena    heap;
+	strtab   strings;
+	/* objects are allocated from the matching pool and linked in place */
+	ilist    libraryList;
+	ilist    threadList;
+	ilist    sourceFileList;
+	ilist    breakPointList;
+	ilist    watchPointList;
+	pool     libraryPool;
+	pool     threadPool;
+	pool     sourceFilePool;
+	pool     breakPointPool;
+	pool     watchPointPool;
+	dbgBreakpointIndex breakPointIndex;
+	vector   moduleIndex;	/* dbgSharedLibrary* sorted by base; see module.c */
+	vector   unwindPlans;	/* compiled unwind plans sorted by address; see unwind.c */
+	/* batch symbolization tables, built on first use; see symbolize.c */
+	BOOL     symbolTables;	/* functionTable and lineTable are built */
+	vector   functionTable;	/* dbgFunctionEntry sorted by start */
+	vector   lineTable;		/* dbgLineEntry sorted by address */
+	vector   symbolMisses;	/* vaddr_t sorted; addresses known to resolve to no function */
 }dbgProcess;
 
 /* debug event callback */
 typedef dbgSessionState (*DbgSessionEventProc) (IN dbgSession* session, IN dbgEventDescr* descr);
 
+/* procedure run on the session thread by DbgSessionRun */
+typedef unsigned long (*DbgSessionCommandProc) (IN dbgSession* session, IN void* arg);
+
+/*
+	Debug output capture. Strings sent by the target are read into one
+	reused batch buffer; consecutive strings are delivered together.
+*/
+
+#define DBG_DEBUGOUT_BATCH 65536	/* flush batch when it grows past this */
+
+typedef struct _dbgDebugOutThread {
+	tid_t              tid;
+	unsigned long      messages;
+	unsigned long long bytes;
+	unsigned long long first;		/* clock of first and last message */
+	unsigned long long last;
+}dbgDebugOutThread;
+
+typedef struct _dbgDebugOut {
+	char*              buffer;
+	size_t             capacity;
+	size_t             length;
+	unsigned int       count;
+	void*              sink;		/* FILE* stream or 0 for the console */
+	BOOL               quiet;
+	unsigned long      batches;
+	dbgDebugOutThread* threads;		/* open addressed by thread id */
+	unsigned int       threadMask;
+	unsigned int       threadCount;
+}dbgDebugOut;
+
+/*
+	Checkpoints and stop history. Every stop of the target is recorded so
+	that reverse execution can replay forward from a checkpoint to an
+	earlier stop without reporting the stops passed on the way.
+*/
+
+typedef struct _dbgStop {
+	vaddr_t      address;
+	dbgException code;
+}dbgStop;
+
+typedef struct _dbgCheckpoint dbgCheckpoint;
+
+typedef struct _dbgHistory {
+	vector       checkpoints;	/* dbgCheckpoint* in creation order */
+	vector       stops;			/* dbgStop of the current timeline */
+	unsigned int position;		/* stops seen; the target is at stop position-1 */
+	unsigned int replay;		/* pass stops silently until position reaches this; 0 if not replaying */
+	unsigned int nextId;
+	pool         pages;			/* dbgCheckpointPage shared between checkpoints */
+}dbgHistory;
+
+/*
+	Debug event batching. Events already pending when the session thread
+	wakes are handled together; when several threads stop in one batch
+	the first stop is reported as usual, the others are held suspended
+	and listed with it, and all of them run again on the next continue.
+*/
+
+#define DBG_BATCH_EVENTS  256		/* events handled before commands are served again */
+#define DBG_BATCH_BUCKETS 32		/* log2 microsecond latency histogram */
+
+typedef struct _dbgBatchStop {
+	tid_t        tid;
+	vaddr_t      address;
+	dbgException code;
+	int          firstChance;
+}dbgBatchStop;
+
+typedef struct _dbgEventBatch {
+	vector             stops;		/* dbgBatchStop: stops held back in the current batch */
+	vector             held;		/* handle_t: threads suspended at a held stop */
+	unsigned long      batches;
+	unsigned long      events;
+	unsigned long      largest;		/* most events in one batch */
+	unsigned long      latency[DBG_BATCH_BUCKETS];	/* batches by handling time */
+	unsigned long long worst;		/* ns */
+}dbgEventBatch;
+
+/*
+	Session commands. Other threads never touch the target or the session
+	state directly; they post commands to the session thread through a
+	bounded lock-free queue and optionally wait on a completion handle.
+*/
+
+typedef enum _dbgSessionCommandType {
+	DBG_COMMAND_REQUEST,
+	DBG_COMMAND_EVENT,
+	DBG_COMMAND_PROC
+}dbgSessionCommandType;
+
+typedef struct _dbgCompletion {
+	dbgNotify*    notify;
+	unsigned long result;
+}dbgCompletion;
+
+typedef struct _dbgSessionCommand {
+	dbgSessionCommandType type;
+	dbgProcessReq         request;
+	void*                 addr;
+	void*                 data;
+	size_t                size;
+	dbgSessionEvent       event;
+	dbgSessionEventSource source;
+	DbgSessionCommandProc proc;
+	void*                 arg;
+	dbgCompletion*        completion;	/* 0 if nobody waits for the result */
+}dbgSessionCommand;
+
+#define DBG_SESSION_QUEUE_SIZE 64
+
+typedef enum _dbgSessionType {
+	DBG_SESSION_LIVE,		/* Win32 debuggee */
+	DBG_SESSION_CORE,		/* ELF core file */
+	DBG_SESSION_SIM			/* scripted simulated target */
+}dbgSessionType;
+
+typedef struct _dbgCoreFile dbgCoreFile;
+typedef struct _dbgSimTarget dbgSimTarget;
+typedef struct _dbgProfile  dbgProfile;
+typedef struct _dbgCoverage dbgCoverage;
+typedef struct _dbgFuzz     dbgFuzz;
+
 typedef struct _dbgSession {
-	dbgSessionState     state;
+	dbgSessionType      type;
+	dbgCoreFile*        core;		/* DBG_SESSION_CORE only */
+	dbgSimTarget*       sim;		/* DBG_SESSION_SIM only */
+	dbgSessionState     state;		/* only written by the session thread */
 	dbgProcess          process;
 	DbgSessionEventProc proc;
+	unsigned long       owner;		/* session thread id */
+	queue               commands;
+	dbgNotify*          wake;
+	dbgDebugOut         debugOut;
+	dbgHistory          history;	/* only used by the session thread */
+	dbgProfile*         profile;	/* sampling profiler state; 0 unless profiling */
+	dbgCoverage*        coverage;	/* coverage state; 0 unless collecting */
+	dbgFuzz*            fuzz;		/* fuzzing state; 0 unless fuzzing */
+	dbgExceptionFilter  filters[DBG_EXCEPTION_COUNT];
+	BOOL                pass;		/* continue the current exception unhandled */
+	dbgEventBatch       batch;		/* only used by the session thread */
+	unsigned long long  created;	/* clock when the session was started and when the target first stopped */
+	unsigned long long  stopped;
 }dbgSession;
 
+/* direct mapped cache of target pages; unreadable pages are cached too */
+typedef struct _dbgReadCache {
+	dbgSession*    session;
+	vaddr_t*       tags;		/* page address of each line; DBG_READCACHE_EMPTY if unused */
+	unsigned char* valid;
+	unsigned char* data;
+	unsigned int   mask;
+	unsigned long  hits;
+	unsigned long  misses;
+}dbgReadCache;
+
+#define DBG_READCACHE_EMPTY 1
+
+/* frame layout of a function as described by its debug information */
+typedef struct _dbgUnwindInfo {
+	vaddr_t       start;
+	unsigned long size;
+	unsigned int  locals;		/* dwords of locals */
+	unsigned int  regs;			/* saved registers */
+	unsigned int  prolog;		/* bytes of prolog code */
+	BOOL          framePointer;	/* ebp holds the frame base after the prolog */
+}dbgUnwindInfo;
+
 /*
 	main.c
 	Main program services
 */
-extern void DbgDisplayMessage (const char* msg, ...);
-extern void DbgDisplayError   (const char* msg, ...);
+extern void DbgDisplayMessage  (const char* msg, ...);
+extern void DbgDisplayError    (const char* msg, ...);
+extern void DbgDisplayDebugOut (const char* msg, ...);
+extern void DbgDisplayFlush    (void);
+extern void DbgDisplayText     (const char* text, size_t length);
 
 /*
 	session.c
@@ -373,11 +654,21 @@ extern unsigned long DbgProcessRequest     (IN dbgProcessReq request, IN dbgSess
 extern dbgSession* DbgGetCurrentSession     (void);
 extern void        DbgSetCurrentSession     (IN dbgSession* session);
 extern void        DbgCreateSession         (IN char* path);
+extern BOOL        DbgCreateCoreSession     (IN char* path);
+extern BOOL        DbgCreateSimSession      (IN char* path);
 extern void        DbgRegisterEventProc     (IN dbgSession* session, IN DbgSessionEventProc proc);
 extern char*       DbgSessionGetProcessName (IN dbgSession* session);
 extern dbgPtid*    DbgSessionGetPtid        (IN dbgSession* session);
 extern void        DbgSessionSendEvent      (IN dbgSession* in, IN dbgSessionEvent request,
                                              IN dbgSessionEventSource source);
+extern BOOL        DbgSessionIsOwner        (IN dbgSession* session);
+extern unsigned long DbgSessionCall         (IN dbgSession* session, IN dbgSessionCommand* command);
+extern unsigned long DbgSessionRun          (IN dbgSession* session, IN DbgSessionCommandProc proc, IN void* arg);
+extern void        DbgSessionBatchStats     (IN dbgSession* session);
+extern BOOL        DbgSessionRunToStop      (IN dbgSession* session, IN unsigned int ms);
+extern dbgSession* DbgSessionNew            (IN char* command, IN pid_t pid, IN tid_t tid,
+                                             IN handle_t process, IN handle_t thread);
+extern void        DbgSessionDelete         (IN dbgSession* session);
 extern void DbgFlushInstructionCache (dbgSession* in, vaddr_t addr, uint32_t size);
 
 /*
@@ -386,8 +677,242 @@ extern void DbgFlushInstructionCache (dbgSession* in, vaddr_t addr, uint32_t siz
 */
 extern BOOL DbgSymbolFromName    (IN dbgSession* in, IN const char* name, OUT dbgSymbol* symbol);
 extern BOOL DbgSymbolFromAddress (IN dbgSession* in, IN vaddr_t address,  OUT dbgSymbol* symbol);
+extern BOOL DbgSymbolName        (IN dbgSession* in, IN vaddr_t address, OUT char* name, IN size_t size, OUT unsigned long* offset);
+extern BOOL DbgSymbolUnwindInfo  (IN dbgSession* in, IN vaddr_t pc, OUT dbgUnwindInfo* info);
+extern unsigned int DbgSymbolStackWalk (IN dbgSession* in, IN dbgReadCache* cache, IN handle_t thread,
+                                        IN const dbgContext* context, OUT vaddr_t* frames, IN unsigned int max);
 extern BOOL DbgSymbolEnumerate   (IN dbgSession* in);
+extern unsigned int DbgSymbolEnumFunctions (IN dbgSession* in, IN const char* pattern, IN DbgSymbolEnumProc proc, IN void* arg);
+extern BOOL DbgSymbolLoadModule  (IN dbgSession* in, IN const char* name, IN vaddr_t base, IN BOOL full);
 extern BOOL DbgSymbolFree        (IN dbgSession* in);
+extern void DbgSymbolMemoryStats (IN dbgSession* in);
+
+/*
+	symbolize.c
+	Batch symbolization. Must be called on the session thread.
+*/
+extern void DbgSymbolizeInit   (IN dbgSession* session);
+extern void DbgSymbolizeFlush  (IN dbgSession* session);
+extern void DbgSymbolizeFree   (IN dbgSession* session);
+extern vector* DbgSymbolizeFunctions (IN dbgSession* session);
+extern BOOL DbgSymbolizeBatch  (IN dbgSession* session, IN const vaddr_t* addresses, IN unsigned int count,
+                                OUT dbgSymbolization* out);
+extern BOOL DbgSymbolizeStream (IN const char* binary);
+
+/*
+	output.c
+	Debug output capture. Should ONLY be used by session manager or debug core
+*/
+extern BOOL            DbgDebugOutInit      (IN dbgSession* session);
+extern void            DbgDebugOutFree      (IN dbgSession* session);
+extern char*           DbgDebugOutReserve   (IN dbgSession* session, IN size_t length);
+extern void            DbgDebugOutCommit    (IN dbgSession* session, IN tid_t tid, IN size_t length);
+extern BOOL            DbgDebugOutFull      (IN dbgSession* session);
+extern dbgSessionState DbgDebugOutFlush     (IN dbgSession* session);
+extern BOOL            DbgDebugOutSetSink   (IN dbgSession* session, IN const char* path);
+extern void            DbgDebugOutStats     (IN dbgSession* session);
+
+/*
+	memory.c
+	Memory display and dump to file. Safe to call from any thread.
+*/
+#define DBG_MEMORY_PAGE 4096
+
+extern size_t DbgMemoryFetch    (IN dbgSession* session, IN vaddr_t address, OUT unsigned char* data,
+                                 IN size_t size, OUT OPT unsigned char* pageValid);
+extern BOOL   DbgReadCacheInit  (OUT dbgReadCache* cache, IN dbgSession* session, IN unsigned int lines);
+extern size_t DbgReadCacheRead  (IN dbgReadCache* cache, IN vaddr_t address, OUT void* data, IN size_t size);
+extern void   DbgReadCacheClear (IN dbgReadCache* cache);
+extern void   DbgReadCacheFree  (IN dbgReadCache* cache);
+extern BOOL   DbgMemoryDisplay  (IN dbgSession* session, IN vaddr_t address, IN size_t size, IN unsigned int unit);
+extern BOOL   DbgMemoryDumpFile (IN dbgSession* session, IN vaddr_t address, IN size_t size, IN const char* path);
+
+/*
+	core.c
+	Core file generation. Must not be called from the session thread.
+*/
+extern BOOL DbgCoreWrite (IN dbgSession* session, IN const char* path, IN BOOL skipReadOnlyFiles);
+
+/*
+	corefile.c
+	Core file session backend. Requests are served in place from any thread.
+*/
+extern dbgCoreFile*  DbgCoreFileOpen    (IN const char* path);
+extern void          DbgCoreFileClose   (IN dbgCoreFile* core);
+extern char*         DbgCoreFileName    (IN dbgCoreFile* core);
+extern pid_t         DbgCoreFilePid     (IN dbgCoreFile* core);
+extern void          DbgCoreFileAttach  (IN dbgSession* session);
+extern unsigned long DbgCoreFileRequest (IN dbgProcessReq request, IN dbgSession* session,
+                                         IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size);
+
+/*
+	sim.c
+	Simulated target session backend. Requests are served in place from
+	any thread; events are waited for and continued on the session thread.
+*/
+extern dbgSimTarget* DbgSimOpen      (IN const char* path);
+extern void          DbgSimClose     (IN dbgSimTarget* sim);
+extern char*         DbgSimName      (IN dbgSimTarget* sim);
+extern pid_t         DbgSimPid       (IN dbgSimTarget* sim);
+extern tid_t         DbgSimTid       (IN dbgSimTarget* sim);
+extern unsigned long DbgSimRequest   (IN dbgProcessReq request, IN dbgSession* session,
+                                      IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size);
+#ifdef _WINDOWS_
+extern BOOL          DbgSimWaitEvent (IN dbgSimTarget* sim, OUT DEBUG_EVENT* e, IN unsigned int ms);
+extern void          DbgSimContinue  (IN dbgSimTarget* sim, IN DWORD status);
+#endif
+
+/*
+	checkpoint.c
+	Checkpoints and reverse execution. Must be called on the session thread.
+*/
+extern void DbgHistoryInit        (IN dbgSession* session);
+extern void DbgHistoryFree        (IN dbgSession* session);
+extern BOOL DbgHistoryStop        (IN dbgSession* session, IN dbgExceptionDescr* stop);
+extern BOOL DbgCheckpointCreate   (IN dbgSession* session);
+extern BOOL DbgCheckpointRestore  (IN dbgSession* session, IN unsigned int id);
+extern void DbgCheckpointList     (IN dbgSession* session);
+extern BOOL DbgReverse            (IN dbgSession* session, IN BOOL step);
+
+/*
+	unwind.c
+	Stack unwinding. Must be called on the session thread.
+*/
+#define DBG_UNWIND_FRAMES 256
+
+typedef struct _dbgFrame {
+	vaddr_t pc;
+	vaddr_t sp;
+	vaddr_t fp;
+}dbgFrame;
+
+extern unsigned int DbgUnwind      (IN dbgSession* session, IN dbgReadCache* cache, IN const dbgContext* context,
+                                    OUT dbgFrame* frames, IN unsigned int max);
+extern void         DbgUnwindInit  (IN dbgSession* session);
+extern void         DbgUnwindFlush (IN dbgSession* session);
+extern BOOL         DbgBacktrace   (IN dbgSession* session, IN BOOL all, IN BOOL dbghelp);
+
+/*
+	profile.c
+	Sampling profiler. Must be called on the session thread.
+*/
+extern BOOL         DbgProfileStart (IN dbgSession* session, IN unsigned int rate);
+extern BOOL         DbgProfileStop  (IN dbgSession* session, IN OPT const char* path, IN unsigned int top);
+extern void         DbgProfileFree  (IN dbgSession* session);
+extern unsigned int DbgProfileWait  (IN dbgSession* session);
+extern void         DbgProfileTick  (IN dbgSession* session);
+
+/*
+	coverage.c
+	Line and function coverage. Must be called on the session thread.
+*/
+extern BOOL DbgCoverageStart  (IN dbgSession* session, IN char** modules, IN unsigned int count,
+                               IN BOOL functions, IN const char* path);
+extern void DbgCoverageHit    (IN dbgSession* session, IN vaddr_t address);
+extern void DbgCoverageFinish (IN dbgSession* session);
+extern void DbgCoverageFree   (IN dbgSession* session);
+extern unsigned long DbgCoverageHits (IN dbgSession* session);
+
+/*
+	fuzz.c
+	Snapshot fuzzing. Must be called on the session thread.
+*/
+extern BOOL DbgFuzzStart     (IN dbgSession* session, IN vaddr_t entry, IN const char* directory,
+                              IN unsigned long limit, IN unsigned int timeout, IN size_t capacity);
+extern BOOL DbgFuzzException (IN dbgSession* session, IN tid_t tid, IN dbgExceptionDescr* record);
+extern void DbgFuzzTick      (IN dbgSession* session);
+extern void DbgFuzzFree      (IN dbgSession* session);
+
+/*
+	filter.c
+	Exception policy table. Must be called on the session thread.
+*/
+extern void            DbgFilterInit   (IN dbgSession* session);
+extern dbgFilterAction DbgFilterApply  (IN dbgSession* session, IN tid_t tid, IN dbgExceptionDescr* record);
+extern BOOL            DbgFilterSet    (IN dbgSession* session, IN const char* name, IN dbgFilterAction first,
+                                        IN dbgFilterAction second, IN int pass);
+extern void            DbgFilterList   (IN dbgSession* session);
+extern BOOL            DbgFilterActionFromName (IN const char* name, OUT dbgFilterAction* action);
+extern const char*     DbgExceptionName (IN dbgException code);
+
+/*
+	stats.c
+	Performance counters. Safe to call from any thread.
+*/
+typedef enum _dbgStatCounter {
+	DBG_STAT_SYMBOL_MISSES,		/* symbol lookups that found nothing */
+	DBG_STAT_UNWIND_HITS,		/* unwind plans found compiled */
+	DBG_STAT_UNWIND_MISSES,
+	DBG_STAT_READ_CACHE_HITS,	/* page reads served by a read cache */
+	DBG_STAT_READ_CACHE_MISSES,
+	DBG_STAT_COUNT
+}dbgStatCounter;
+
+typedef enum _dbgStatTimer {
+	DBG_TIMER_EVENT,			/* handling of one debug event */
+	DBG_TIMER_STOP,				/* debug event to stop report */
+	DBG_TIMER_TRAP,				/* counting breakpoint trap to re-arm */
+	DBG_TIMER_SYMBOL,			/* one symbol lookup */
+	DBG_TIMER_COUNT
+}dbgStatTimer;
+
+extern void DbgStatsCount   (IN dbgStatCounter counter, IN unsigned long n);
+extern void DbgStatsTime    (IN dbgStatTimer timer, IN unsigned long long ns);
+extern void DbgStatsRequest (IN dbgProcessReq request, IN size_t bytes, IN unsigned long long ns);
+extern void DbgStatsReport  (IN OPT dbgSession* session);
+extern BOOL DbgStatsDump    (IN OPT dbgSession* session, IN const char* path);
+extern const char* DbgStatsRequestName (IN dbgProcessReq request);
+
+/*
+	trace.c
+	Timeline tracing. Safe to call from any thread. Category and name
+	must be static strings.
+*/
+extern dbgAtomic _dbgTraceOn;
+
+#define DbgTraceBegin(category,name,arg) do { if (_dbgTraceOn) DbgTraceRecord (category, name, 'B', arg); } while (0)
+#define DbgTraceEnd(category,name)       do { if (_dbgTraceOn) DbgTraceRecord (category, name, 'E', 0); } while (0)
+
+extern void DbgTraceRecord (IN const char* category, IN const char* name, IN char phase, IN unsigned long arg);
+extern void DbgTraceThread (IN const char* name);
+extern BOOL DbgTraceStart  (IN const char* path);
+extern BOOL DbgTraceStop   (void);
+extern void DbgTraceFinish (void);
+
+/*
+	bench.c
+	Debugger benchmarks. Must be called on the session thread.
+*/
+extern BOOL DbgBench (IN dbgSession* session, IN vaddr_t address, IN unsigned long iterations,
+                      IN OPT const char* path, IN OPT const char* baseline);
+
+/*
+	symbench.c
+	Symbol benchmarks on synthetic symbol tables. Only run while no session is open.
+*/
+extern BOOL DbgSymbolFixtureWrite (IN const char* path, IN unsigned long functions, IN unsigned long files,
+                                   IN unsigned int rows, IN unsigned int modules);
+extern BOOL DbgSymbolBench        (IN const char** fixtures, IN unsigned int count, IN OPT const char* path);
+extern BOOL DbgSymbolBenchSweep   (IN const char* directory, IN OPT const char* path);
+
+/*
+	listbench.c
+	Container benchmarks. Safe to call from any thread.
+*/
+extern BOOL DbgListBench (IN unsigned long count, IN OPT const char* path);
+
+/*
+	search.c
+	Memory search. Safe to call from any thread.
+*/
+typedef enum _dbgSearchMode {
+	DBG_SEARCH_BYTES,		/* hex digits, '?' matches any nibble */
+	DBG_SEARCH_ASCII,
+	DBG_SEARCH_UNICODE,		/* UTF-16LE */
+	DBG_SEARCH_POINTER		/* aligned dword */
+}dbgSearchMode;
+
+extern BOOL DbgSearch (IN dbgSession* session, IN dbgSearchMode mode, IN const char* pattern, IN unsigned long limit);
 
 /*
 	cmd.c
@@ -403,9 +928,20 @@ extern void DbgConsoleSendEvent (dbgConsoleEvent code);
 extern BOOL DbgInitializePDB                    (IN dbgProcess* proc);
 extern void DbgFreePDB                          (IN dbgProcess* proc);
 extern BOOL DbgLoadSymbolsPDB                   (IN dbgProcess* proc);
-extern BOOL DbgSymbolFromNamePDB                (IN const char* name, OUT dbgSymbol* sym);
-extern BOOL DbgSymbolFromAddressPDB             (IN vaddr_t address,  OUT dbgSymbol* sym);
+extern BOOL DbgSymbolFromNamePDB                (IN dbgProcess* proc, IN const char* name, OUT dbgSymbol* sym);
+extern BOOL DbgSymbolFromAddressPDB             (IN dbgProcess* proc, IN vaddr_t address,  OUT dbgSymbol* sym);
 extern unsigned long long DbgLoadSymbolTablePDB (IN char* name, IN vaddr_t base);
+extern BOOL DbgUnwindInfoPDB                    (IN dbgProcess* proc, IN vaddr_t pc, OUT dbgUnwindInfo* info);
+extern BOOL DbgSymbolNamePDB                    (IN vaddr_t address, OUT char* name, IN size_t size, OUT unsigned long* offset);
+extern unsigned int DbgEnumFunctionsPDB         (IN const char* mask, IN DbgSymbolEnumProc proc, IN void* arg);
+extern BOOL DbgFunctionTablePDB                 (IN dbgProcess* proc, OUT vector* table);
+extern unsigned int DbgStackWalkPDB             (IN dbgReadCache* cache, IN handle_t thread, IN const dbgContext* context,
+                                                 OUT vaddr_t* frames, IN unsigned int max);
+extern vaddr_t DbgLoadVirtualModulePDB          (IN const char* name, IN vaddr_t base, IN unsigned long size);
+extern void DbgUnloadModulePDB                  (IN vaddr_t base);
+extern BOOL DbgAddSymbolPDB                     (IN vaddr_t modbase, IN const char* name, IN vaddr_t address, IN unsigned long size);
+extern dbgSourceFile* DbgAddSourceFilePDB       (IN dbgProcess* proc, IN vaddr_t modbase, IN const char* name);
+extern BOOL DbgAddSourceLinePDB                 (IN dbgSourceFile* file, IN unsigned long line, IN vaddr_t address);
 
 /*
 	dbg.c
@@ -422,14 +958,56 @@ extern BOOL DbgStepOut                          (IN dbgSession* session);
 extern BOOL DbgContinueUntil                    (IN dbgSession* session, IN vaddr_t address);
 extern BOOL DbgSetNext                          (IN dbgSession* session, IN vaddr_t address);
 
+/*
+	module.c
+	Module map. Must be called on the session thread.
+*/
+extern void              DbgModuleInit        (IN dbgSession* session);
+extern void              DbgModuleFree        (IN dbgSession* session);
+extern dbgSharedLibrary* DbgModuleAdd         (IN dbgSession* session, IN OPT const char* name, IN vaddr_t base,
+                                               IN unsigned long size);
+extern void              DbgModuleRemove      (IN dbgSession* session, IN dbgSharedLibrary* module);
+extern dbgSharedLibrary* DbgModuleFind        (IN dbgSession* session, IN vaddr_t base);
+extern dbgSharedLibrary* DbgModuleFromAddress (IN dbgSession* session, IN vaddr_t address);
+extern unsigned long     DbgModuleImageSize   (IN dbgSession* session, IN vaddr_t base);
+
+/*
+	regex.c
+	Regular expressions for symbol names. Safe to call from any thread.
+*/
+typedef struct _dbgRegex dbgRegex;
+
+extern dbgRegex* DbgRegexCompile (IN const char* pattern);
+extern BOOL      DbgRegexMatch   (IN const dbgRegex* regex, IN const char* text);
+extern void      DbgRegexFree    (IN dbgRegex* regex);
+
 /*
 	break.c
 	Breakpoint and watchpoint management
 */
 extern BOOL DbgSetBreakpoint                    (IN dbgSession* session, IN vaddr_t address, dbgBreakpoingType type);
 extern BOOL DbgGetBreakpoint                    (IN dbgSession* session, IN vaddr_t address, OUT dbgBreakpoint* out);
+extern dbgBreakpoint* DbgFindBreakpoint         (IN dbgSession* session, IN vaddr_t address);
 extern BOOL DbgRemoveBreakpoint                 (IN dbgSession* session, IN dbgBreakpoint* breakpoint);
 extern BOOL DbgClearBreakpoints                 (IN dbgSession* session);
+extern BOOL DbgSetBreakpointInternal            (IN dbgSession* session, IN dbgBreakpoint* breakpoint);
+extern BOOL DbgRemoveBreakpointInternal         (IN dbgSession* session, IN dbgBreakpoint* breakpoint);
+extern dbgBreakpoint* DbgBreakpointAdd          (IN dbgSession* session, IN vaddr_t address, dbgBreakpoingType type);
+extern BOOL DbgBreakpointLink                   (IN dbgSession* session, IN dbgBreakpoint* breakpoint);
+extern void DbgBreakpointUnlink                 (IN dbgSession* session, IN dbgBreakpoint* breakpoint);
+extern void DbgBreakpointIndexFree              (IN dbgSession* session);
+extern BOOL DbgBreakpointTrap                   (IN dbgSession* session, IN tid_t tid, IN vaddr_t address);
+extern BOOL DbgBreakpointStep                   (IN dbgSession* session, IN tid_t tid);
+extern unsigned long DbgBreakpointArm           (IN dbgSession* session, IN const void* items, IN unsigned int count,
+                                                 IN size_t stride, IN BOOL once, IN BOOL counting,
+                                                 OUT OPT unsigned long* failed, OUT OPT unsigned long* pages);
+extern unsigned long DbgBreakpointAddBatch      (IN dbgSession* session, IN OUT vaddr_t* addresses, IN unsigned int count,
+                                                 OUT OPT unsigned long* failed);
+extern BOOL DbgSetBreakpointAt                  (IN dbgSession* session, IN const char* location);
+extern unsigned long DbgSetBreakpointRegex      (IN dbgSession* session, IN const char* pattern);
+extern unsigned long DbgCountBreakpoints        (IN dbgSession* session, IN const char* pattern);
+extern void DbgCountReport                      (IN dbgSession* session, IN unsigned int top);
+extern void DbgCountClear                       (IN dbgSession* session);
 extern BOOL DbgSetWatchpoint                    (IN dbgSession* session, IN vaddr_t address,
 												 IN dbgWatchpointType type, IN unsigned long value);
 extern BOOL DbgGetWatchpoint                    (IN dbgSession* session, IN vaddr_t address, OUT dbgWatchpoint* out);
@@ -0,0 +1,112 @@
+/********************************************
+*
+*	elf.h - ELF core file structures
+*
+********************************************/
+
+#ifndef ELF_H
+#define ELF_H
+
+/*
+	Structures of 32 bit ELF core files as written by Linux for i386.
+	Used to write core files of live targets and to open them later.
+*/
+
+#define ELF_ET_CORE     4
+#define ELF_EM_386      3
+#define ELF_PT_LOAD     1
+#define ELF_PT_NOTE     4
+#define ELF_PF_X        1
+#define ELF_PF_W        2
+#define ELF_PF_R        4
+#define ELF_NT_PRSTATUS 1
+#define ELF_NT_PRPSINFO 3
+#define ELF_NT_FILE     0x46494c45
+
+typedef struct _elf32Header {
+	unsigned char  ident[16];
+	unsigned short type;
+	unsigned short machine;
+	unsigned int   version;
+	unsigned int   entry;
+	unsigned int   phoff;
+	unsigned int   shoff;
+	unsigned int   flags;
+	unsigned short ehsize;
+	unsigned short phentsize;
+	unsigned short phnum;
+	unsigned short shentsize;
+	unsigned short shnum;
+	unsigned short shstrndx;
+}elf32Header;
+
+typedef struct _elf32Program {
+	unsigned int type;
+	unsigned int offset;
+	unsigned int vaddr;
+	unsigned int paddr;
+	unsigned int filesz;
+	unsigned int memsz;
+	unsigned int flags;
+	unsigned int align;
+}elf32Program;
+
+typedef struct _elf32Note {
+	unsigned int namesz;
+	unsigned int descsz;
+	unsigned int type;
+}elf32Note;
+
+/* register order of elf_gregset_t */
+typedef enum _elf32Reg {
+	ELF_REG_EBX, ELF_REG_ECX, ELF_REG_EDX, ELF_REG_ESI, ELF_REG_EDI, ELF_REG_EBP, ELF_REG_EAX,
+	ELF_REG_DS, ELF_REG_ES, ELF_REG_FS, ELF_REG_GS, ELF_REG_ORIG_EAX, ELF_REG_EIP, ELF_REG_CS,
+	ELF_REG_EFLAGS, ELF_REG_ESP, ELF_REG_SS, ELF_REG_COUNT
+}elf32Reg;
+
+typedef struct _elf32Prstatus {
+	int            signo;
+	int            code;
+	int            error;
+	short          cursig;
+	short          pad;
+	unsigned int   sigpend;
+	unsigned int   sighold;
+	int            pid;
+	int            ppid;
+	int            pgrp;
+	int            sid;
+	unsigned int   times[8];
+	unsigned int   reg[ELF_REG_COUNT];
+	int            fpvalid;
+}elf32Prstatus;
+
+typedef struct _elf32Prpsinfo {
+	char           state;
+	char           sname;
+	char           zomb;
+	char           nice;
+	unsigned int   flag;
+	unsigned short uid;
+	unsigned short gid;
+	int            pid;
+	int            ppid;
+	int            pgrp;
+	int            sid;
+	char           fname[16];
+	char           psargs[80];
+}elf32Prpsinfo;
+
+/* contents of an ELF_NT_FILE note: header, then count entries, then count names */
+typedef struct _elf32FileNote {
+	unsigned int count;
+	unsigned int pageSize;
+}elf32FileNote;
+
+typedef struct _elf32FileEntry {
+	unsigned int start;
+	unsigned int end;
+	unsigned int offset;	/* in pages */
+}elf32FileEntry;
+
+#endif
@@ -0,0 +1,145 @@
+/********************************************
+*
+*	filter.c - Exception policy table
+*
+********************************************/
+
+/*
+	This component decides what happens to exceptions raised by the
+	target before the front end sees them.
+
+	Every exception code has a rule for its first and second chance:
+	stop the target, print a line and continue, or continue silently.
+	The rule also says whether the exception is handed back to the
+	target's own handlers or dismissed as handled. Targets that raise
+	exceptions as part of normal operation (JIT compilers, garbage
+	collector write barriers, C++ exceptions) run at full speed when
+	their first chance exceptions are ignored and passed.
+
+	Breakpoint and single step exceptions belong to the debugger and are
+	never passed by default.
+*/
+
+#include <string.h>
+#include "defs.h"
+
+static const char* _dbgExceptionNames[DBG_EXCEPTION_COUNT] = {
+	"divide", "step", "nmi", "break", "overflow", "bounds", "opcode",
+	"nocop", "double", "tss", "access", "stack", "gpf", "page", "cop",
+	"align", "fdivide", "foverflow", "finexact", "finvalid", "fstack",
+	"fdenormal", "funderflow", "software"
+};
+
+static const char* _dbgFilterActions[] = {"stop", "print", "ignore"};
+
+/**
+*	Short name of an exception code
+*	\param code Exception code
+*	\ret Name
+*/
+const char* DbgExceptionName (IN dbgException code) {
+	return code < DBG_EXCEPTION_COUNT ? _dbgExceptionNames[code] : "unknown";
+}
+
+/**
+*	Install default rules
+*	\param session Debug session
+*/
+void DbgFilterInit (IN dbgSession* session) {
+	unsigned int i;
+
+	memset (session->filters, 0, sizeof (session->filters));
+	for (i = 0; i < DBG_EXCEPTION_COUNT; i++) {
+		session->filters[i].action[0] = DBG_FILTER_STOP;
+		session->filters[i].action[1] = DBG_FILTER_STOP;
+		session->filters[i].pass      = TRUE;
+	}
+	session->filters[DBG_EXCEPTION_BREAKPOINT].pass  = FALSE;
+	session->filters[DBG_EXCEPTION_SINGLE_STEP].pass = FALSE;
+
+	/* thrown and caught all the time by C++ and managed code */
+	session->filters[DBG_EXCEPTION_SOFTWARE].action[1] = DBG_FILTER_PRINT;
+	session->pass = FALSE;
+}
+
+/**
+*	Apply the rule of an exception
+*	\param session Debug session
+*	\param tid Thread that raised the exception
+*	\param record Exception
+*	\ret Action taken; the target is only to be stopped for DBG_FILTER_STOP
+*/
+dbgFilterAction DbgFilterApply (IN dbgSession* session, IN tid_t tid, IN dbgExceptionDescr* record) {
+	dbgExceptionFilter* filter = &session->filters[record->code < DBG_EXCEPTION_COUNT ? record->code : DBG_EXCEPTION_SOFTWARE];
+	int                 chance = record->firstChance ? 1 : 0;
+	dbgFilterAction     action = (dbgFilterAction) filter->action[chance];
+
+	filter->events[chance]++;
+	session->pass = filter->pass;
+	if (action == DBG_FILTER_STOP)
+		return action;
+	filter->absorbed++;
+	if (action == DBG_FILTER_PRINT)
+		DbgDisplayMessage ("%s chance %s exception (0x%08lx) at 0x%08x in thread %u",
+			chance ? "First" : "Second", DbgExceptionName (record->code), record->native, record->address, tid);
+	return action;
+}
+
+/**
+*	Parse an action name
+*	\param name "stop", "print" or "ignore"
+*	\param action Output action
+*	\ret TRUE if the name is valid
+*/
+BOOL DbgFilterActionFromName (IN const char* name, OUT dbgFilterAction* action) {
+	unsigned int i;
+	for (i = 0; i < sizeof (_dbgFilterActions) / sizeof (_dbgFilterActions[0]); i++) {
+		if (strcmp (name, _dbgFilterActions[i]) == 0) {
+			*action = (dbgFilterAction) i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+*	Change the rule of one exception or of all of them
+*	\param session Debug session
+*	\param name Exception name or "all"
+*	\param first First chance action
+*	\param second Second chance action
+*	\param pass TRUE to hand the exception to the target, FALSE to dismiss it, -1 to keep the current setting
+*	\ret TRUE if success, FALSE if the name is unknown
+*/
+BOOL DbgFilterSet (IN dbgSession* session, IN const char* name, IN dbgFilterAction first,
+                   IN dbgFilterAction second, IN int pass) {
+	unsigned int i;
+	BOOL         found = FALSE;
+
+	for (i = 0; i < DBG_EXCEPTION_COUNT; i++) {
+		if (strcmp (name, "all") != 0 && strcmp (name, _dbgExceptionNames[i]) != 0)
+			continue;
+		session->filters[i].action[1] = (unsigned char) first;
+		session->filters[i].action[0] = (unsigned char) second;
+		if (pass >= 0)
+			session->filters[i].pass = pass;
+		found = TRUE;
+	}
+	return found;
+}
+
+/**
+*	Display rules and how many events each one saw
+*	\param session Debug session
+*/
+void DbgFilterList (IN dbgSession* session) {
+	unsigned int i;
+
+	DbgDisplayMessage ("%-11s %-7s %-7s %-8s %10s %10s %10s", "exception", "first", "second", "target", "first", "second", "absorbed");
+	for (i = 0; i < DBG_EXCEPTION_COUNT; i++) {
+		dbgExceptionFilter* filter = &session->filters[i];
+		DbgDisplayMessage ("%-11s %-7s %-7s %-8s %10lu %10lu %10lu", _dbgExceptionNames[i],
+			_dbgFilterActions[filter->action[1]], _dbgFilterActions[filter->action[0]],
+			filter->pass ? "pass" : "handled", filter->events[1], filter->events[0], filter->absorbed);
+	}
+}
@@ -0,0 +1,628 @@
+/********************************************
+*
+*	fuzz.c - Snapshot fuzzing
+*
+********************************************/
+
+/*
+	This component fuzzes one function of a live target in place.
+
+	The target runs until it enters the function. Its registers and
+	writable memory are then captured once and every writable page is
+	made read only. Each run writes a new input into a buffer allocated
+	in the target, points the function arguments at it and resumes the
+	thread at the function entry. The first write to a protected page
+	faults into the debugger, which marks the page dirty and gives its
+	write access back. When the function returns, crashes or times out,
+	only the dirty pages are copied back from the snapshot and protected
+	again, so a run costs the pages it touched rather than the whole
+	address space.
+
+	The stack of the fuzzed thread is never protected; the pages at and
+	above the entry stack pointer are copied back after every run.
+
+	Inputs that reach new coverage points (see coverage.c) are added to
+	the corpus; crashing and hanging inputs are written to the corpus
+	directory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_FUZZ_READ_BLOCK (1024*1024)		/* bytes read from the target at once */
+#define DBG_FUZZ_USER_END   0x80000000ULL	/* end of the user address space */
+#define DBG_FUZZ_REPORT_NS  5000000000ULL	/* progress line interval */
+#define DBG_FUZZ_PATH       512
+
+typedef enum _dbgFuzzState {
+	DBG_FUZZ_ARMING,		/* waiting for the target to enter the function */
+	DBG_FUZZ_RUNNING
+}dbgFuzzState;
+
+typedef enum _dbgFuzzOutcome {
+	DBG_FUZZ_RETURNED,
+	DBG_FUZZ_CRASHED,
+	DBG_FUZZ_HUNG
+}dbgFuzzOutcome;
+
+typedef struct _dbgFuzzPage {
+	vaddr_t      address;
+	unsigned int protect;		/* original DBG_MEMORY_PROT_ flags */
+	BOOL         dirty;			/* writable since the last restore */
+	BOOL         stack;			/* never protected; restored after every run */
+}dbgFuzzPage;
+
+typedef struct _dbgFuzzInput {
+	size_t offset;				/* into bytes */
+	size_t size;
+}dbgFuzzInput;
+
+struct _dbgFuzz {
+	dbgFuzzState       state;
+	vaddr_t            entry;
+	vaddr_t            ret;			/* return address of the captured call */
+	tid_t              tid;
+	handle_t           thread;
+	dbgContext         context;		/* registers at the function entry */
+	vector             pages;		/* dbgFuzzPage sorted by address */
+	vector             snapshot;	/* page contents, same order as pages */
+	vector             dirty;		/* unsigned int: pages written during the run */
+	vaddr_t            buffer;		/* input buffer in the target */
+	size_t             capacity;
+	vector             corpus;		/* dbgFuzzInput */
+	vector             bytes;		/* char: corpus contents */
+	unsigned char*     input;
+	size_t             size;
+	unsigned int       next;		/* loaded inputs run unmodified so far */
+	unsigned int       seed;
+	char*              directory;
+	unsigned int       initial;		/* corpus entries loaded */
+	unsigned long      execs;
+	unsigned long      limit;
+	unsigned long      crashes;
+	unsigned long      hangs;
+	unsigned long      novel;
+	unsigned long      faults;		/* write faults on protected pages */
+	unsigned long      restored;	/* pages copied back */
+	unsigned long      hits;		/* coverage points hit before the run */
+	unsigned long long timeout;		/* ns */
+	unsigned long long started;
+	unsigned long long runStart;
+	unsigned long long reported;
+};
+
+static unsigned int DbgFuzzRandom (IN dbgFuzz* fuzz) {
+	fuzz->seed ^= fuzz->seed << 13;
+	fuzz->seed ^= fuzz->seed >> 17;
+	fuzz->seed ^= fuzz->seed << 5;
+	return fuzz->seed;
+}
+
+/**
+*	Add input to the corpus
+*/
+static BOOL DbgFuzzAdd (IN dbgFuzz* fuzz, IN const unsigned char* data, IN size_t size) {
+	dbgFuzzInput input;
+	size_t       i;
+
+	input.offset = vectorSize (&fuzz->bytes);
+	input.size   = size;
+	if (!vectorReserve (&fuzz->bytes, input.offset + size))
+		return FALSE;
+	for (i = 0; i < size; i++)
+		vectorAdd (&fuzz->bytes, &data[i]);
+	return vectorAdd (&fuzz->corpus, &input) != 0;
+}
+
+/**
+*	Directory callback loading one corpus file
+*/
+static int DbgFuzzLoad (IN void* arg, IN const char* path) {
+	dbgFuzz* fuzz = (dbgFuzz*) arg;
+	FILE*    file;
+	size_t   size;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "rb"))
+		file = 0;
+#else
+	file = fopen (path, "rb");
+#endif
+	if (!file)
+		return 1;
+	size = fread (fuzz->input, 1, fuzz->capacity, file);
+	fclose (file);
+	DbgFuzzAdd (fuzz, fuzz->input, size);
+	return 1;
+}
+
+/**
+*	Write current input to the corpus directory
+*/
+static void DbgFuzzSave (IN dbgFuzz* fuzz, IN const char* kind) {
+	char  path[DBG_FUZZ_PATH];
+	FILE* file;
+
+	if (strlen (fuzz->directory) + 32 > sizeof (path))
+		return;
+#ifdef _MSC_VER
+	sprintf_s (path, sizeof (path), "%s/%s-%06lu", fuzz->directory, kind, fuzz->execs);
+#else
+	sprintf (path, "%s/%s-%06lu", fuzz->directory, kind, fuzz->execs);
+#endif
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "wb"))
+		file = 0;
+#else
+	file = fopen (path, "wb");
+#endif
+	if (!file)
+		return;
+	fwrite (fuzz->input, 1, fuzz->size, file);
+	fclose (file);
+}
+
+/**
+*	Choose the next input: every corpus entry once as is, then mutations
+*/
+static void DbgFuzzNextInput (IN dbgFuzz* fuzz) {
+	static const unsigned char interesting[] = {0x00, 0x01, 0x7f, 0x80, 0xff};
+	dbgFuzzInput* base;
+	unsigned int  rounds;
+
+	if (fuzz->next < fuzz->initial) {
+		base = (dbgFuzzInput*) vectorAt (&fuzz->corpus, fuzz->next++);
+		memcpy (fuzz->input, vectorAt (&fuzz->bytes, base->offset), base->size);
+		fuzz->size = base->size;
+		return;
+	}
+	base = (dbgFuzzInput*) vectorAt (&fuzz->corpus, DbgFuzzRandom (fuzz) % vectorSize (&fuzz->corpus));
+	memcpy (fuzz->input, vectorAt (&fuzz->bytes, base->offset), base->size);
+	fuzz->size = base->size;
+
+	for (rounds = 1 + DbgFuzzRandom (fuzz) % 4; rounds; rounds--) {
+		unsigned int r  = DbgFuzzRandom (fuzz);
+		size_t       at = fuzz->size ? (r >> 8) % fuzz->size : 0;
+		switch (r % 5) {
+			case 0:
+				if (fuzz->size)
+					fuzz->input[at] ^= (unsigned char) (1 << ((r >> 4) & 7));
+				break;
+			case 1:
+				if (fuzz->size)
+					fuzz->input[at] = (unsigned char) DbgFuzzRandom (fuzz);
+				break;
+			case 2:
+				if (fuzz->size)
+					fuzz->input[at] = interesting[(r >> 4) % sizeof (interesting)];
+				break;
+			case 3:
+				if (fuzz->size < fuzz->capacity) {
+					memmove (fuzz->input + at + 1, fuzz->input + at, fuzz->size - at);
+					fuzz->input[at] = (unsigned char) DbgFuzzRandom (fuzz);
+					fuzz->size++;
+				}
+				break;
+			case 4:
+				if (fuzz->size > 1) {
+					memmove (fuzz->input + at, fuzz->input + at + 1, fuzz->size - at - 1);
+					fuzz->size--;
+				}
+				break;
+		}
+	}
+}
+
+/**
+*	Locate tracked page
+*	\ret Page index or -1
+*/
+static int DbgFuzzPageFind (IN dbgFuzz* fuzz, IN vaddr_t address) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (&fuzz->pages);
+	address &= ~(DBG_MEMORY_PAGE - 1);
+	while (low < high) {
+		unsigned int mid  = (low + high) / 2;
+		vaddr_t      page = ((dbgFuzzPage*) vectorAt (&fuzz->pages, mid))->address;
+		if (page == address)
+			return (int) mid;
+		if (page < address)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return -1;
+}
+
+/**
+*	Change protection of consecutive tracked pages with equal flags
+*	\param original TRUE to give the pages their own protection back, FALSE to make them read only
+*/
+static void DbgFuzzProtect (IN dbgSession* session, IN dbgFuzz* fuzz, IN unsigned int first, IN unsigned int count, IN BOOL original) {
+	dbgFuzzPage* page    = (dbgFuzzPage*) vectorAt (&fuzz->pages, first);
+	unsigned int protect = original ? page->protect : page->protect & ~DBG_MEMORY_PROT_WRITE;
+	DbgProcessRequest (DBG_REQ_PROTECT, session, (void*) page->address, &protect, (size_t) count * DBG_MEMORY_PAGE);
+}
+
+/**
+*	Protect or unprotect every tracked page, one request per run of pages
+*/
+static void DbgFuzzProtectAll (IN dbgSession* session, IN dbgFuzz* fuzz, IN BOOL original) {
+	unsigned int first = 0;
+	unsigned int i;
+
+	for (i = 1; i <= vectorSize (&fuzz->pages); i++) {
+		dbgFuzzPage* start = (dbgFuzzPage*) vectorAt (&fuzz->pages, first);
+		dbgFuzzPage* page  = i < vectorSize (&fuzz->pages) ? (dbgFuzzPage*) vectorAt (&fuzz->pages, i) : 0;
+		if (page && !page->stack && !start->stack && page->protect == start->protect
+			&& page->address == start->address + (i - first) * DBG_MEMORY_PAGE)
+			continue;
+		if (!start->stack)
+			DbgFuzzProtect (session, fuzz, first, i - first, original);
+		first = i;
+	}
+}
+
+/**
+*	Capture the writable memory of the target
+*	\param esp Stack pointer at the function entry
+*/
+static BOOL DbgFuzzSnapshot (IN dbgSession* session, IN dbgFuzz* fuzz, IN vaddr_t esp) {
+	unsigned char*     block = (unsigned char*) malloc (DBG_FUZZ_READ_BLOCK);
+	unsigned long long at;
+	vaddr_t            top = esp & ~(DBG_MEMORY_PAGE - 1);
+
+	if (!block)
+		return FALSE;
+	for (at = 0; at < DBG_FUZZ_USER_END; ) {
+		dbgMemoryRegion region;
+		unsigned long   offset;
+		if (!DbgProcessRequest (DBG_REQ_QUERY, session, (void*) (vaddr_t) at, &region, sizeof (region)))
+			break;
+		if (region.base + (unsigned long long) region.size <= at)
+			break;
+		at = region.base + (unsigned long long) region.size;
+		if (!region.readable || !(region.protect & DBG_MEMORY_PROT_WRITE))
+			continue;
+
+		for (offset = 0; offset < region.size; offset += DBG_FUZZ_READ_BLOCK) {
+			size_t       length = region.size - offset > DBG_FUZZ_READ_BLOCK ? DBG_FUZZ_READ_BLOCK : region.size - offset;
+			vaddr_t      base   = region.base + offset;
+			unsigned int page;
+			BOOL         stack  = esp >= region.base && esp - region.base < region.size;
+
+			if (DbgProcessRequest (DBG_REQ_READ, session, (void*) base, block, length) != length)
+				continue;
+			for (page = 0; page < length / DBG_MEMORY_PAGE; page++) {
+				dbgFuzzPage record;
+				record.address = base + page * DBG_MEMORY_PAGE;
+				record.protect = region.protect;
+				record.dirty   = FALSE;
+				record.stack   = stack;
+				/* stack below the entry stack pointer is scratch; the input buffer is rewritten before every run */
+				if ((stack && record.address < top) || (record.address >= fuzz->buffer && record.address - fuzz->buffer < fuzz->capacity))
+					continue;
+				if (!vectorAdd (&fuzz->pages, &record) || !vectorAdd (&fuzz->snapshot, block + page * DBG_MEMORY_PAGE)) {
+					free (block);
+					return FALSE;
+				}
+			}
+		}
+	}
+	free (block);
+	DbgFuzzProtectAll (session, fuzz, FALSE);
+	return TRUE;
+}
+
+/**
+*	Copy dirty and stack pages back from the snapshot
+*/
+static void DbgFuzzRestore (IN dbgSession* session, IN dbgFuzz* fuzz) {
+	unsigned int i;
+
+	for (i = 0; i < vectorSize (&fuzz->dirty); i++) {
+		unsigned int index = *(unsigned int*) vectorAt (&fuzz->dirty, i);
+		dbgFuzzPage* page  = (dbgFuzzPage*) vectorAt (&fuzz->pages, index);
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) page->address, vectorAt (&fuzz->snapshot, index), DBG_MEMORY_PAGE);
+		DbgFuzzProtect (session, fuzz, index, 1, FALSE);
+		page->dirty = FALSE;
+	}
+	fuzz->restored += vectorSize (&fuzz->dirty);
+	vectorClear (&fuzz->dirty);
+
+	for (i = 0; i < vectorSize (&fuzz->pages); i++) {
+		dbgFuzzPage* page = (dbgFuzzPage*) vectorAt (&fuzz->pages, i);
+		if (!page->stack)
+			continue;
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) page->address, vectorAt (&fuzz->snapshot, i), DBG_MEMORY_PAGE);
+		fuzz->restored++;
+	}
+}
+
+/**
+*	Start a run at the function entry with the next input
+*/
+static BOOL DbgFuzzRun (IN dbgSession* session, IN dbgFuzz* fuzz) {
+	dbgContext context = fuzz->context;
+	vaddr_t    args[2];
+
+	DbgFuzzNextInput (fuzz);
+	if (fuzz->size)
+		DbgProcessRequest (DBG_REQ_WRITE, session, (void*) fuzz->buffer, fuzz->input, fuzz->size);
+
+	/* cdecl (data, size) above the return address */
+	args[0] = fuzz->buffer;
+	args[1] = (vaddr_t) fuzz->size;
+	DbgProcessRequest (DBG_REQ_WRITE, session, (void*) (context.regs.esp + 4), args, sizeof (args));
+
+	fuzz->hits     = DbgCoverageHits (session);
+	fuzz->runStart = DbgClockNow ();
+	return DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) fuzz->thread, &context, sizeof (dbgContext)) != 0;
+}
+
+/**
+*	Display progress
+*/
+static void DbgFuzzProgress (IN dbgFuzz* fuzz, IN unsigned long long now) {
+	double seconds = (double) (now - fuzz->started) / 1000000000.0;
+	DbgDisplayMessage ("%lu execs, %.0f/s, corpus %u (+%lu), %lu crashes, %lu hangs, %.1f pages restored per exec",
+		fuzz->execs, seconds > 0 ? fuzz->execs / seconds : 0.0, vectorSize (&fuzz->corpus), fuzz->novel,
+		fuzz->crashes, fuzz->hangs, fuzz->execs ? (double) fuzz->restored / fuzz->execs : 0.0);
+	fuzz->reported = now;
+}
+
+/**
+*	End fuzzing; the target is left stopped at the function entry
+*/
+static void DbgFuzzStop (IN dbgSession* session, IN dbgFuzz* fuzz) {
+	dbgBreakpoint* breakpoint;
+
+	DbgFuzzRestore (session, fuzz);
+	DbgFuzzProtectAll (session, fuzz, TRUE);
+	DbgProcessRequest (DBG_REQ_SETCONTEXT, session, (void*) fuzz->thread, &fuzz->context, sizeof (dbgContext));
+	breakpoint = DbgFindBreakpoint (session, fuzz->ret);
+	if (breakpoint)
+		DbgRemoveBreakpoint (session, breakpoint);
+
+	DbgFuzzProgress (fuzz, DbgClockNow ());
+	DbgDisplayMessage ("Fuzzing stopped: %u pages (%lu KB) tracked, %lu write faults, %lu inputs written to %s",
+		vectorSize (&fuzz->pages), (unsigned long) vectorSize (&fuzz->pages) * (DBG_MEMORY_PAGE / 1024),
+		fuzz->faults, fuzz->novel + fuzz->crashes + fuzz->hangs, fuzz->directory);
+	session->state = DBG_STATE_SUSPEND;
+	DbgFuzzFree (session);
+}
+
+/**
+*	Finish a run and start the next one
+*/
+static void DbgFuzzDone (IN dbgSession* session, IN dbgFuzz* fuzz, IN dbgFuzzOutcome outcome) {
+	unsigned long long now;
+
+	fuzz->execs++;
+	if (outcome == DBG_FUZZ_CRASHED) {
+		fuzz->crashes++;
+		DbgFuzzSave (fuzz, "crash");
+	}
+	else if (outcome == DBG_FUZZ_HUNG) {
+		fuzz->hangs++;
+		DbgFuzzSave (fuzz, "hang");
+	}
+	else if (DbgCoverageHits (session) > fuzz->hits && fuzz->execs > fuzz->initial) {
+		fuzz->novel++;
+		DbgFuzzAdd (fuzz, fuzz->input, fuzz->size);
+		DbgFuzzSave (fuzz, "cov");
+	}
+	DbgFuzzRestore (session, fuzz);
+
+	now = DbgClockNow ();
+	if (now - fuzz->reported > DBG_FUZZ_REPORT_NS)
+		DbgFuzzProgress (fuzz, now);
+	if (fuzz->execs >= fuzz->limit || !DbgFuzzRun (session, fuzz))
+		DbgFuzzStop (session, fuzz);
+}
+
+/**
+*	Capture the target at the function entry and start the first run
+*/
+static BOOL DbgFuzzArm (IN dbgSession* session, IN dbgFuzz* fuzz, IN tid_t tid) {
+	ilistNode* cur;
+
+	for (cur = session->process.threadList.first; cur; cur = cur->next) {
+		if (((dbgThread*) cur)->id == tid)
+			break;
+	}
+	if (!cur || !DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) ((dbgThread*) cur)->thread, &fuzz->context, sizeof (dbgContext)))
+		return FALSE;
+	fuzz->tid    = tid;
+	fuzz->thread = ((dbgThread*) cur)->thread;
+	if (DbgProcessRequest (DBG_REQ_READ, session, (void*) fuzz->context.regs.esp, &fuzz->ret, sizeof (vaddr_t)) != sizeof (vaddr_t))
+		return FALSE;
+	if (!DbgProcessRequest (DBG_REQ_ALLOCATE, session, 0, &fuzz->buffer, fuzz->capacity))
+		return FALSE;
+	if (!DbgSetBreakpoint (session, fuzz->ret, DBG_BREAK_SOFT))
+		return FALSE;
+	if (!DbgFuzzSnapshot (session, fuzz, fuzz->context.regs.esp)) {
+		DbgFuzzProtectAll (session, fuzz, TRUE);
+		return FALSE;
+	}
+	DbgDisplayMessage ("Fuzzing 0x%08x from thread %u: %u writable pages captured, returns to 0x%08x",
+		fuzz->entry, tid, vectorSize (&fuzz->pages), fuzz->ret);
+	fuzz->state    = DBG_FUZZ_RUNNING;
+	fuzz->started  = DbgClockNow ();
+	fuzz->reported = fuzz->started;
+	return DbgFuzzRun (session, fuzz);
+}
+
+/**
+*	Handle an exception while fuzzing. Must be called on the session thread.
+*	\param session Debug session
+*	\param tid Thread that raised the exception
+*	\param record Exception
+*	\ret TRUE if the exception was absorbed and the target may continue
+*/
+BOOL DbgFuzzException (IN dbgSession* session, IN tid_t tid, IN dbgExceptionDescr* record) {
+	dbgFuzz* fuzz = session->fuzz;
+	int      index;
+
+	if (fuzz->state == DBG_FUZZ_ARMING) {
+		if (record->code != DBG_EXCEPTION_BREAKPOINT || record->address != fuzz->entry)
+			return FALSE;
+		if (!DbgFuzzArm (session, fuzz, tid)) {
+			DbgDisplayError ("Unable to capture the target at 0x%08x", fuzz->entry);
+			DbgFuzzFree (session);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/* first write to a captured page since the last restore, from any thread */
+	if (record->code == DBG_EXCEPTION_SEGMENT && record->write && record->firstChance
+		&& (index = DbgFuzzPageFind (fuzz, record->data)) >= 0) {
+		dbgFuzzPage* page = (dbgFuzzPage*) vectorAt (&fuzz->pages, index);
+		if (!page->dirty && !page->stack) {
+			unsigned int i = (unsigned int) index;
+			DbgFuzzProtect (session, fuzz, i, 1, TRUE);
+			page->dirty = TRUE;
+			vectorAdd (&fuzz->dirty, &i);
+			fuzz->faults++;
+			return TRUE;
+		}
+	}
+	if (tid != fuzz->tid)
+		return FALSE;
+
+	switch (record->code) {
+		case DBG_EXCEPTION_BREAKPOINT:
+			if (record->address != fuzz->ret)
+				return FALSE;
+			DbgFuzzDone (session, fuzz, DBG_FUZZ_RETURNED);
+			return TRUE;
+		case DBG_EXCEPTION_SEGMENT:
+		case DBG_EXCEPTION_BOUNDS:
+		case DBG_EXCEPTION_INVALID_OPCODE:
+		case DBG_EXCEPTION_INT_DIVIDE:
+		case DBG_EXCEPTION_STACK:
+		case DBG_EXCEPTION_GPF:
+			DbgFuzzDone (session, fuzz, DBG_FUZZ_CRASHED);
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+*	Abandon a run that exceeded the timeout. Called by the session loop.
+*	\param session Debug session
+*/
+void DbgFuzzTick (IN dbgSession* session) {
+	dbgFuzz* fuzz = session->fuzz;
+	handle_t thread;
+
+	if (fuzz->state != DBG_FUZZ_RUNNING || DbgClockNow () - fuzz->runStart < fuzz->timeout)
+		return;
+	thread = fuzz->thread;
+	DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) thread, 0, 0);
+	DbgFuzzDone (session, fuzz, DBG_FUZZ_HUNG);
+	DbgProcessRequest (DBG_REQ_RESUME, session, (void*) thread, 0, 0);
+}
+
+/**
+*	Start fuzzing a function. Must be called on the session thread.
+*	\param session Debug session
+*	\param entry Function entry; called as f (const void* data, size_t size)
+*	\param directory Corpus directory; new inputs, crashes and hangs are written to it
+*	\param limit Number of runs
+*	\param timeout Milliseconds before a run counts as hung
+*	\param capacity Largest input in bytes
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgFuzzStart (IN dbgSession* session, IN vaddr_t entry, IN const char* directory,
+                   IN unsigned long limit, IN unsigned int timeout, IN size_t capacity) {
+	dbgFuzz*       fuzz;
+	dbgBreakpoint* breakpoint;
+	int            files;
+
+	if (session->type != DBG_SESSION_LIVE) {
+		DbgDisplayError ("Fuzzing needs a live target");
+		return FALSE;
+	}
+	if (session->fuzz) {
+		DbgDisplayError ("Already fuzzing");
+		return FALSE;
+	}
+	if (DbgFindBreakpoint (session, entry)) {
+		DbgDisplayError ("Remove the breakpoint at 0x%08x first", entry);
+		return FALSE;
+	}
+	fuzz = (dbgFuzz*) calloc (1, sizeof (dbgFuzz));
+	if (!fuzz)
+		return FALSE;
+	session->fuzz = fuzz;
+	vectorInit (&fuzz->pages,    sizeof (dbgFuzzPage));
+	vectorInit (&fuzz->snapshot, DBG_MEMORY_PAGE);
+	vectorInit (&fuzz->dirty,    sizeof (unsigned int));
+	vectorInit (&fuzz->corpus,   sizeof (dbgFuzzInput));
+	vectorInit (&fuzz->bytes,    sizeof (char));
+	fuzz->entry     = entry;
+	fuzz->limit     = limit;
+	fuzz->timeout   = (unsigned long long) timeout * 1000000;
+	fuzz->capacity  = capacity;
+	fuzz->seed      = (unsigned int) DbgClockNow () | 1;
+	fuzz->input     = (unsigned char*) malloc (capacity);
+	fuzz->directory = (char*) malloc (strlen (directory) + 1);
+	if (!fuzz->input || !fuzz->directory) {
+		DbgFuzzFree (session);
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+#ifdef _MSC_VER
+	strcpy_s (fuzz->directory, strlen (directory) + 1, directory);
+#else
+	strcpy (fuzz->directory, directory);
+#endif
+
+	files = DbgDirectoryEnum (directory, DbgFuzzLoad, fuzz);
+	if (files < 0) {
+		DbgDisplayError ("Unable to read corpus directory '%s'", directory);
+		DbgFuzzFree (session);
+		return FALSE;
+	}
+	if (!vectorSize (&fuzz->corpus)) {
+		unsigned char zero = 0;
+		DbgFuzzAdd (fuzz, &zero, 1);
+	}
+	fuzz->initial = vectorSize (&fuzz->corpus);
+
+	/* run to the function; the one shot breakpoint leaves eip on the entry */
+	if (!DbgSetBreakpoint (session, entry, DBG_BREAK_SOFT)) {
+		DbgFuzzFree (session);
+		return FALSE;
+	}
+	breakpoint = DbgFindBreakpoint (session, entry);
+	breakpoint->once = TRUE;
+	DbgDisplayMessage ("%u corpus inputs loaded; running to 0x%08x", fuzz->initial, entry);
+	if (session->state != DBG_STATE_CONTINUE)
+		DbgProcessRequest (DBG_REQ_CONTINUE, session, 0, 0, 0);
+	return TRUE;
+}
+
+/**
+*	Release fuzzing state
+*	\param session Debug session
+*/
+void DbgFuzzFree (IN dbgSession* session) {
+	dbgFuzz* fuzz = session->fuzz;
+	if (!fuzz)
+		return;
+	vectorFree (&fuzz->pages);
+	vectorFree (&fuzz->snapshot);
+	vectorFree (&fuzz->dirty);
+	vectorFree (&fuzz->corpus);
+	vectorFree (&fuzz->bytes);
+	free (fuzz->input);
+	free (fuzz->directory);
+	free (fuzz);
+	session->fuzz = 0;
+}
@@ -101,6 +101,7 @@ listNode* listRemoveElement (unsigned int num, list* root) {
 			node = node->next;
 		node->next->prev = node->prev;
 		node->prev->next = node->next;
+		free (node);
 		root->count--;
 		return node;
 	}
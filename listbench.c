@@ -0,0 +1,289 @@
+/********************************************
+*
+*	listbench.c - Container benchmarks
+*
+********************************************/
+
+/*
+	This component compares the containers that hold process objects:
+	list.c, which the process used to keep its threads, libraries and
+	breakpoints on, the pool allocator with an intrusive list, which it
+	uses now, and the vector.
+
+	Each container holds thread records and goes through what the
+	session does to them: append one record per create event, walk all
+	of them, remove records by thread id as exit events come in, and
+	free what is left when the session ends. A removal finds the record
+	by walking, the way the event handlers do, so the list pays for the
+	second walk listRemoveElement makes to its index and the vector for
+	moving the records above it.
+
+	Results are the mean nanoseconds per record of each step.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_LISTBENCH_COUNT   100000	/* records when no count is given */
+#define DBG_LISTBENCH_REMOVES 1000		/* records removed by id */
+#define DBG_LISTBENCH_PASSES  10		/* walks over all records */
+
+typedef enum _dbgListbenchMetric {
+	DBG_LISTBENCH_APPEND,
+	DBG_LISTBENCH_ITERATE,
+	DBG_LISTBENCH_REMOVE,
+	DBG_LISTBENCH_FREE,
+	DBG_LISTBENCH_METRICS
+}dbgListbenchMetric;
+
+static const char* _dbgListbenchMetrics[DBG_LISTBENCH_METRICS] = {
+	"append_ns",
+	"iterate_ns",
+	"remove_ns",
+	"free_ns"
+};
+
+typedef enum _dbgListbenchContainer {
+	DBG_LISTBENCH_LIST,
+	DBG_LISTBENCH_POOL,
+	DBG_LISTBENCH_VECTOR,
+	DBG_LISTBENCH_CONTAINERS
+}dbgListbenchContainer;
+
+static const char* _dbgListbenchContainers[DBG_LISTBENCH_CONTAINERS] = {
+	"list",
+	"pool_ilist",
+	"vector"
+};
+
+/**
+*	Thread id of the k-th removal. Ids are spread over the records and
+*	visited out of order, so removals hit the front, middle and back.
+*/
+static tid_t DbgListbenchVictim (IN unsigned long count, IN unsigned long removes, IN unsigned long k) {
+	return (tid_t) (((k * 7919) % removes) * (count / removes));
+}
+
+/**
+*	Fill a thread record
+*/
+static void DbgListbenchThread (OUT dbgThread* thread, IN unsigned long id) {
+	memset (thread, 0, sizeof (dbgThread));
+	thread->id    = (tid_t) id;
+	thread->entry = (vaddr_t) (0x401000 + id * 16);
+}
+
+/**
+*	Measure list.c
+*/
+static unsigned long DbgListbenchList (IN unsigned long count, IN unsigned long removes, OUT double* results) {
+	list               root;
+	listNode*          current;
+	dbgThread          thread;
+	unsigned long long start;
+	unsigned long      sum = 0;
+	unsigned long      i;
+	unsigned int       c;
+
+	listInit (&root);
+	start = DbgClockNow ();
+	for (i = 0; i < count; i++) {
+		DbgListbenchThread (&thread, i);
+		listAddElement (&thread, sizeof (dbgThread), &root);
+	}
+	results[DBG_LISTBENCH_APPEND] = (double) (DbgClockNow () - start) / count;
+
+	start = DbgClockNow ();
+	for (i = 0; i < DBG_LISTBENCH_PASSES; i++) {
+		for (current = root.first; current; current = current->next)
+			sum += ((dbgThread*) current->data)->entry;
+	}
+	results[DBG_LISTBENCH_ITERATE] = (double) (DbgClockNow () - start) / ((double) count * DBG_LISTBENCH_PASSES);
+
+	start = DbgClockNow ();
+	for (i = 0; i < removes; i++) {
+		tid_t id = DbgListbenchVictim (count, removes, i);
+		for (c = 0, current = root.first; current; c++, current = current->next) {
+			if (((dbgThread*) current->data)->id == id) {
+				free (current->data);
+				listRemoveElement (c, &root);
+				break;
+			}
+		}
+	}
+	results[DBG_LISTBENCH_REMOVE] = (double) (DbgClockNow () - start) / removes;
+
+	start = DbgClockNow ();
+	listFreeAll (&root);
+	results[DBG_LISTBENCH_FREE] = (double) (DbgClockNow () - start) / (count - removes);
+	return sum;
+}
+
+/**
+*	Measure the pool allocator with an intrusive list
+*/
+static unsigned long DbgListbenchPool (IN unsigned long count, IN unsigned long removes, OUT double* results) {
+	pool               objects;
+	ilist              root;
+	ilistNode*         current;
+	unsigned long long start;
+	unsigned long      sum = 0;
+	unsigned long      i;
+
+	poolInit (&objects, sizeof (dbgThread), 64);
+	ilistInit (&root);
+	start = DbgClockNow ();
+	for (i = 0; i < count; i++) {
+		dbgThread* thread = (dbgThread*) poolAlloc (&objects);
+		DbgListbenchThread (thread, i);
+		ilistAppend (&root, &thread->node);
+	}
+	results[DBG_LISTBENCH_APPEND] = (double) (DbgClockNow () - start) / count;
+
+	start = DbgClockNow ();
+	for (i = 0; i < DBG_LISTBENCH_PASSES; i++) {
+		for (current = root.first; current; current = current->next)
+			sum += ((dbgThread*) current)->entry;
+	}
+	results[DBG_LISTBENCH_ITERATE] = (double) (DbgClockNow () - start) / ((double) count * DBG_LISTBENCH_PASSES);
+
+	start = DbgClockNow ();
+	for (i = 0; i < removes; i++) {
+		tid_t id = DbgListbenchVictim (count, removes, i);
+		for (current = root.first; current; current = current->next) {
+			if (((dbgThread*) current)->id == id) {
+				ilistRemove (&root, current);
+				poolRelease (&objects, current);
+				break;
+			}
+		}
+	}
+	results[DBG_LISTBENCH_REMOVE] = (double) (DbgClockNow () - start) / removes;
+
+	start = DbgClockNow ();
+	poolFree (&objects);
+	ilistInit (&root);
+	results[DBG_LISTBENCH_FREE] = (double) (DbgClockNow () - start) / (count - removes);
+	return sum;
+}
+
+/**
+*	Measure the vector
+*/
+static unsigned long DbgListbenchVector (IN unsigned long count, IN unsigned long removes, OUT double* results) {
+	vector             root;
+	dbgThread          thread;
+	unsigned long long start;
+	unsigned long      sum = 0;
+	unsigned long      i;
+	unsigned int       c;
+
+	vectorInit (&root, sizeof (dbgThread));
+	start = DbgClockNow ();
+	for (i = 0; i < count; i++) {
+		DbgListbenchThread (&thread, i);
+		vectorAdd (&root, &thread);
+	}
+	results[DBG_LISTBENCH_APPEND] = (double) (DbgClockNow () - start) / count;
+
+	start = DbgClockNow ();
+	for (i = 0; i < DBG_LISTBENCH_PASSES; i++) {
+		for (c = 0; c < vectorSize (&root); c++)
+			sum += ((dbgThread*) vectorAt (&root, c))->entry;
+	}
+	results[DBG_LISTBENCH_ITERATE] = (double) (DbgClockNow () - start) / ((double) count * DBG_LISTBENCH_PASSES);
+
+	start = DbgClockNow ();
+	for (i = 0; i < removes; i++) {
+		tid_t id = DbgListbenchVictim (count, removes, i);
+		for (c = 0; c < vectorSize (&root); c++) {
+			if (((dbgThread*) vectorAt (&root, c))->id == id) {
+				vectorRemove (c, &root);
+				break;
+			}
+		}
+	}
+	results[DBG_LISTBENCH_REMOVE] = (double) (DbgClockNow () - start) / removes;
+
+	start = DbgClockNow ();
+	vectorFree (&root);
+	results[DBG_LISTBENCH_FREE] = (double) (DbgClockNow () - start) / (count - removes);
+	return sum;
+}
+
+/**
+*	Write results as JSON
+*/
+static BOOL DbgListbenchWrite (IN const char* path, IN unsigned long count, IN unsigned long removes,
+							   IN double results[DBG_LISTBENCH_CONTAINERS][DBG_LISTBENCH_METRICS]) {
+	FILE*        file;
+	unsigned int c;
+	unsigned int i;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "w"))
+		file = 0;
+#else
+	file = fopen (path, "w");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	fprintf (file, "{\n  \"records\": %lu,\n  \"removes\": %lu,\n  \"containers\": {", count, removes);
+	for (c = 0; c < DBG_LISTBENCH_CONTAINERS; c++) {
+		fprintf (file, "%s\n    \"%s\": {", c ? "," : "", _dbgListbenchContainers[c]);
+		for (i = 0; i < DBG_LISTBENCH_METRICS; i++)
+			fprintf (file, "%s\n      \"%s\": %.3f", i ? "," : "", _dbgListbenchMetrics[i], results[c][i]);
+		fprintf (file, "\n    }");
+	}
+	fprintf (file, "\n  }\n}\n");
+	fclose (file);
+	DbgDisplayMessage ("Container benchmark results written to %s", path);
+	return TRUE;
+}
+
+/**
+*	Compare list.c with the pool, intrusive list and vector
+*	\param count Number of records or 0 for the default
+*	\param path JSON results file or 0
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgListBench (IN unsigned long count, IN OPT const char* path) {
+	double        results[DBG_LISTBENCH_CONTAINERS][DBG_LISTBENCH_METRICS];
+	unsigned long removes;
+	unsigned long sums[DBG_LISTBENCH_CONTAINERS];
+	unsigned int  i;
+
+	if (!count)
+		count = DBG_LISTBENCH_COUNT;
+	removes = count / 2 < DBG_LISTBENCH_REMOVES ? count / 2 : DBG_LISTBENCH_REMOVES;
+	if (!removes) {
+		DbgDisplayError ("At least 2 records are needed");
+		return FALSE;
+	}
+
+	DbgTraceBegin ("containers", "benchmark", count);
+	sums[DBG_LISTBENCH_LIST]   = DbgListbenchList   (count, removes, results[DBG_LISTBENCH_LIST]);
+	sums[DBG_LISTBENCH_POOL]   = DbgListbenchPool   (count, removes, results[DBG_LISTBENCH_POOL]);
+	sums[DBG_LISTBENCH_VECTOR] = DbgListbenchVector (count, removes, results[DBG_LISTBENCH_VECTOR]);
+	DbgTraceEnd ("containers", "benchmark");
+
+	/* every container must have walked the same records */
+	if (sums[DBG_LISTBENCH_POOL] != sums[DBG_LISTBENCH_LIST] || sums[DBG_LISTBENCH_VECTOR] != sums[DBG_LISTBENCH_LIST]) {
+		DbgDisplayError ("Containers disagree on their contents");
+		return FALSE;
+	}
+
+	DbgDisplayMessage ("Containers of %lu thread records, %lu removed by id", count, removes);
+	DbgDisplayMessage ("  %-12s %12s %12s %12s", "", _dbgListbenchContainers[0], _dbgListbenchContainers[1], _dbgListbenchContainers[2]);
+	for (i = 0; i < DBG_LISTBENCH_METRICS; i++) {
+		DbgDisplayMessage ("  %-12s %12.3f %12.3f %12.3f", _dbgListbenchMetrics[i],
+			results[0][i], results[1][i], results[2][i]);
+	}
+	if (path)
+		return DbgListbenchWrite (path, count, removes, results);
+	return TRUE;
+}
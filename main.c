@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <crtdbg.h>
 
 /* win32 specific? */
@@ -24,78 +25,322 @@
 
 #include "defs.h"
 
-CRITICAL_SECTION _dbgDisplayMutex;
-
-void DbgDisplayDebugOut (const char* msg, ...) {
-	va_list args;
+/*
+	Console output
+
+	Display services format the message on the calling thread and post it
+	to a bounded lock-free ring. A dedicated writer thread drains the ring
+	and coalesces records into large writes, so the session thread never
+	blocks on terminal I/O. A message longer than one record takes several
+	consecutive records that are reserved together, so messages posted by
+	different threads never interleave. When the ring has no room for a
+	whole message it is dropped and counted instead of blocking the caller.
+*/
 
-	EnterCriticalSection (&_dbgDisplayMutex);
+#define DBG_DISPLAY_CHUNK   248		/* text bytes per ring record */
+#define DBG_DISPLAY_RING    4096	/* ring records */
+#define DBG_DISPLAY_MAX     4096	/* longest formatted message */
+#define DBG_DISPLAY_BUFFER  65536	/* writer output buffer */
+#define DBG_DISPLAY_IDLE_MS 100
+#define DBG_PIPE_POLL_MS    50
+
+typedef enum _dbgDisplayKind {
+	DBG_DISPLAY_MESSAGE,
+	DBG_DISPLAY_ERROR,
+	DBG_DISPLAY_DEBUGOUT
+}dbgDisplayKind;
+
+typedef enum _dbgDisplayColor {
+	DBG_COLOR_PREFIX,
+	DBG_COLOR_MESSAGE,
+	DBG_COLOR_ERROR,
+	DBG_COLOR_DEBUGOUT,
+	DBG_COLOR_DEFAULT
+}dbgDisplayColor;
+
+typedef struct _dbgDisplayRecord {
+	unsigned char  kind;
+	unsigned char  first;	/* first chunk of a message; writer emits the prefix */
+	unsigned short length;
+	char           text[DBG_DISPLAY_CHUNK];
+}dbgDisplayRecord;
+
+typedef struct _dbgDisplay {
+	queue      ring;
+	dbgWorker* writer;
+	dbgNotify* wake;
+	dbgMutex*  mutex;		/* serializes writes to the stream */
+	BOOL       color;		/* output is a console */
+	BOOL       ansi;		/* colors are written inline as escape sequences */
+	dbgAtomic  idle;
+	dbgAtomic  quit;
+	dbgAtomic  posted;
+	dbgAtomic  written;
+	dbgAtomic  dropped;
+	FILE*      stream;		/* stdout unless set before DbgDisplayInit */
+	char       out[DBG_DISPLAY_BUFFER];
+	size_t     length;
+}dbgDisplay;
+
+static dbgDisplay _display;
+
+static const char* _displayColorAnsi[] = {
+	"\x1b[92m", "\x1b[32m", "\x1b[91m", "\x1b[93m", "\x1b[0m"
+};
 
 #ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_GREEN|FOREGROUND_INTENSITY);
-#endif
-	printf ("\n("NDBG_NAME") ");
-#ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_INTENSITY);
+static const WORD _displayColorWin32[] = {
+	FOREGROUND_GREEN|FOREGROUND_INTENSITY,
+	FOREGROUND_GREEN,
+	FOREGROUND_RED|FOREGROUND_INTENSITY,
+	FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_INTENSITY,
+	FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE
+};
 #endif
-	if(msg) {
-		va_start (args, msg);
-		vprintf (msg, args);
-		va_end (args);
+
+static const dbgDisplayColor _displayKindColor[] = {
+	DBG_COLOR_MESSAGE, DBG_COLOR_ERROR, DBG_COLOR_DEBUGOUT
+};
+
+static void DbgDisplayWrite (void) {
+	if (_display.length) {
+		fwrite (_display.out, 1, _display.length, _display.stream);
+		_display.length = 0;
+	}
+	fflush (_display.stream);
+}
+
+static void DbgDisplayAppend (const char* text, size_t length) {
+	if (_display.length + length > DBG_DISPLAY_BUFFER)
+		DbgDisplayWrite ();
+	memcpy (_display.out + _display.length, text, length);
+	_display.length += length;
+}
+
+static void DbgDisplaySetColor (dbgDisplayColor color) {
+	if (!_display.color)
+		return;
+	if (_display.ansi) {
+		DbgDisplayAppend (_displayColorAnsi[color], strlen (_displayColorAnsi[color]));
+		return;
 	}
 #ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE),FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE);
+	/* legacy console: attribute changes are not part of the stream */
+	DbgDisplayWrite ();
+	SetConsoleTextAttribute (GetStdHandle (_display.stream == stderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE),
+		_displayColorWin32[color]);
 #endif
+}
 
-	LeaveCriticalSection (&_dbgDisplayMutex);
+static void DbgDisplayRender (dbgDisplayRecord* record) {
+	if (record->first) {
+		DbgDisplaySetColor (DBG_COLOR_PREFIX);
+		if (record->kind == DBG_DISPLAY_ERROR)
+			DbgDisplayAppend ("\n\r("NDBG_NAME") ", sizeof ("\n\r("NDBG_NAME") ") - 1);
+		else
+			DbgDisplayAppend ("\n("NDBG_NAME") ", sizeof ("\n("NDBG_NAME") ") - 1);
+	}
+	DbgDisplaySetColor (_displayKindColor[record->kind]);
+	DbgDisplayAppend (record->text, record->length);
+	DbgDisplaySetColor (DBG_COLOR_DEFAULT);
 }
 
-void DbgDisplayError (const char* msg, ...) {
-	va_list args;
+/**
+*	Display writer thread entry point
+*/
+static int DbgDisplayWriterEntry (void* arg) {
+	dbgDisplayRecord record;
+	long             reported = 0;
+	long             count;
+
+	DbgTraceThread ("display");
+	while (TRUE) {
+
+		/*
+			Drain everything available into one write. DbgDisplayText
+			writes blocks under the same lock, so they are never split.
+		*/
+		DbgMutexLock (_display.mutex);
+		count = 0;
+		while (queuePop (&_display.ring, &record)) {
+			DbgDisplayRender (&record);
+			count++;
+		}
+		if (DbgAtomicLoad (&_display.dropped) != reported) {
+			char msg[64];
+			long dropped = DbgAtomicLoad (&_display.dropped);
+#ifdef _MSC_VER
+			int  length = sprintf_s (msg, sizeof (msg), "\n("NDBG_NAME") *** %li messages dropped", dropped - reported);
+#else
+			int  length = sprintf (msg, "\n("NDBG_NAME") *** %li messages dropped", dropped - reported);
+#endif
+			DbgDisplaySetColor (DBG_COLOR_ERROR);
+			DbgDisplayAppend (msg, length);
+			DbgDisplaySetColor (DBG_COLOR_DEFAULT);
+			reported = dropped;
+		}
+		if (count)
+			DbgDisplayWrite ();
+		DbgMutexUnlock (_display.mutex);
+		if (count) {
+			DbgAtomicAdd (&_display.written, count);
+			continue;
+		}
 
-	EnterCriticalSection (&_dbgDisplayMutex);
+		if (DbgAtomicLoad (&_display.quit))
+			break;
 
-#ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_GREEN|FOREGROUND_INTENSITY);
-#endif
-	printf ("\n\r("NDBG_NAME") ");
-#ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED|FOREGROUND_INTENSITY);
-#endif
-	if(msg) {
-		va_start (args, msg);
-		vprintf (msg, args);
-		va_end (args);
+		/* ring is empty; re-check after announcing we are idle so no post is missed */
+		DbgAtomicStore (&_display.idle, 1);
+		if (queueEmpty (&_display.ring))
+			DbgNotifyWait (_display.wake, DBG_DISPLAY_IDLE_MS);
+		DbgAtomicStore (&_display.idle, 0);
 	}
-#ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE),FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE);
+	return 0;
+}
+
+/**
+*	Format message and post it to the display ring
+*	\param kind Message kind
+*	\param msg Format string or 0 to display the prompt only
+*	\param args Format arguments
+*/
+static void DbgDisplayPost (dbgDisplayKind kind, const char* msg, va_list args) {
+	dbgDisplayRecord records[(DBG_DISPLAY_MAX + DBG_DISPLAY_CHUNK - 1) / DBG_DISPLAY_CHUNK];
+	char             text[DBG_DISPLAY_MAX];
+	unsigned int     count  = 0;
+	unsigned int     i;
+	int              length = 0;
+	int              offset = 0;
+
+	if (msg) {
+#ifdef _MSC_VER
+		length = _vsnprintf_s (text, DBG_DISPLAY_MAX, _TRUNCATE, msg, args);
+#else
+		/* both leave room for the terminator; a truncated message reports -1 or its full length */
+		length = vsnprintf (text, DBG_DISPLAY_MAX, msg, args);
 #endif
+		if (length < 0 || length > DBG_DISPLAY_MAX - 1)
+			length = DBG_DISPLAY_MAX - 1;
+	}
+
+	do {
+		dbgDisplayRecord* record = &records[count++];
+		record->kind   = (unsigned char) kind;
+		record->first  = offset == 0;
+		record->length = (unsigned short) (length - offset > DBG_DISPLAY_CHUNK ? DBG_DISPLAY_CHUNK : length - offset);
+		memcpy (record->text, text + offset, record->length);
+		offset += record->length;
+	} while (offset < length);
+
+	/* no writer thread; write synchronously */
+	if (!_display.writer) {
+		DbgMutexLock (_display.mutex);
+		for (i = 0; i < count; i++)
+			DbgDisplayRender (&records[i]);
+		DbgDisplayWrite ();
+		DbgMutexUnlock (_display.mutex);
+		return;
+	}
+
+	/* all records of a message or none */
+	if (!queuePushMany (&_display.ring, records, count)) {
+		DbgAtomicInc (&_display.dropped);
+		return;
+	}
+	DbgAtomicAdd (&_display.posted, (long) count);
+	if (DbgAtomicLoad (&_display.idle))
+		DbgNotifySignal (_display.wake);
+}
 
-	LeaveCriticalSection (&_dbgDisplayMutex);
+void DbgDisplayDebugOut (const char* msg, ...) {
+	va_list args;
+	va_start (args, msg);
+	DbgDisplayPost (DBG_DISPLAY_DEBUGOUT, msg, args);
+	va_end (args);
+}
+
+void DbgDisplayError (const char* msg, ...) {
+	va_list args;
+	va_start (args, msg);
+	DbgDisplayPost (DBG_DISPLAY_ERROR, msg, args);
+	va_end (args);
 }
 
 void DbgDisplayMessage (const char* msg, ...) {
 	va_list args;
+	va_start (args, msg);
+	DbgDisplayPost (DBG_DISPLAY_MESSAGE, msg, args);
+	va_end (args);
+}
 
-	EnterCriticalSection (&_dbgDisplayMutex);
+/**
+*	Wait until everything posted so far has been written
+*/
+void DbgDisplayFlush (void) {
+	long target;
+	if (!_display.writer)
+		return;
+	target = DbgAtomicLoad (&_display.posted);
+	while ((long) (DbgAtomicLoad (&_display.written) - target) < 0) {
+		DbgNotifySignal (_display.wake);
+		DbgSleep (1);
+	}
+}
 
+/**
+*	Write a preformatted block of text
+*
+*	Blocks such as memory dumps would overrun the ring, so everything
+*	posted so far is written first and the block follows in one write.
+*/
+void DbgDisplayText (const char* text, size_t length) {
+	DbgDisplayFlush ();
+	DbgMutexLock (_display.mutex);
+	fwrite (text, 1, length, _display.stream);
+	fflush (_display.stream);
+	DbgMutexUnlock (_display.mutex);
+}
+
+/**
+*	Initialize display services and start the writer thread
+*/
+void DbgDisplayInit (void) {
 #ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_GREEN|FOREGROUND_INTENSITY);
-#endif
-	printf ("\n("NDBG_NAME") ");
-#ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE),FOREGROUND_GREEN);
+	DWORD mode = 0;
+	HANDLE out;
 #endif
-	if(msg) {
-		va_start (args, msg);
-		vprintf (msg, args);
-		va_end (args);
-	}
+	if (!_display.stream)
+		_display.stream = stdout;
 #ifdef _WIN32
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE),FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE);
+	out = GetStdHandle (_display.stream == stderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE);
+	/* redirected output gets no colors; ENABLE_VIRTUAL_TERMINAL_PROCESSING allows inline colors */
+	_display.color = GetConsoleMode (out, &mode);
+	_display.ansi  = _display.color && SetConsoleMode (out, mode | 0x0004);
+#else
+	_display.color = TRUE;
+	_display.ansi  = TRUE;
 #endif
+	_display.mutex = DbgMutexCreate ();
+	_display.wake  = DbgNotifyCreate ();
+	if (!_display.wake || !queueInit (&_display.ring, sizeof (dbgDisplayRecord), DBG_DISPLAY_RING))
+		return;
+	_display.writer = DbgWorkerCreate (DbgDisplayWriterEntry, 0);
+}
 
-	LeaveCriticalSection (&_dbgDisplayMutex);
+/**
+*	Write remaining output and stop the writer thread
+*/
+void DbgDisplayShutdown (void) {
+	if (_display.writer) {
+		DbgAtomicStore (&_display.quit, 1);
+		DbgNotifySignal (_display.wake);
+		DbgWorkerJoin (_display.writer);
+		_display.writer = 0;
+	}
+	queueFree (&_display.ring);
+	DbgNotifyFree (_display.wake);
+	DbgMutexFree (_display.mutex);
 }
 
 void DbgInfo (void) {
@@ -104,7 +349,33 @@ void DbgInfo (void) {
 }
 
 void DbgParseCommandLine (int argc, char** argv) {
-	if (argv[1]) {
+	/* -t file traces the whole run, symbol loading included */
+	if (argc >= 3 && strcmp (argv[1], "-t") == 0) {
+		DbgTraceStart (argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc == 3 && strcmp (argv[1], "-c") == 0) {
+		/* open core file argv[2]; there is no program to run */
+		dbgSession* session = 0;
+		if (!DbgCreateCoreSession (argv[2]))
+			return;
+		do {
+			session = DbgGetCurrentSession ();
+		}while (session == 0);
+		DbgInitialize (session);
+	}
+	else if (argc == 3 && strcmp (argv[1], "-s") == 0) {
+		/* run the simulated target scripted in argv[2] */
+		dbgSession* session = 0;
+		if (!DbgCreateSimSession (argv[2]))
+			return;
+		do {
+			session = DbgGetCurrentSession ();
+		}while (session == 0);
+		DbgInitialize (session);
+	}
+	else if (argv[1]) {
 		/* create new session with argv[1] program file */
 		dbgSession* session = 0;
 		DbgCreateSession (argv[1]);
@@ -129,6 +400,7 @@ FILE* DbgOpenPipe (char* name) {
 FILE* pipe = 0;
 int init=0;
 char in[32];
+static dbgAtomic pipeQuit = 0;
 
 int __stdcall ReadPipeThreadEntry (char* command) {
 	init=1;
@@ -137,12 +409,47 @@ int __stdcall ReadPipeThreadEntry (char* command) {
 	return 0;
 }
 
+/**
+*	Echo what clients write to the ndbg pipe until the debugger quits
+*	\param arg Pipe handle
+*/
+static int DbgPipeReaderEntry (void* arg) {
+	HANDLE pipe = (HANDLE) arg;
+	DWORD  numWritten;
+
+	/* reads 1 byte at a time */
+	while (!DbgAtomicLoad (&pipeQuit)) {
+		DWORD bytesAvailable = 0;
+		PeekNamedPipe(pipe, NULL, 0, NULL, &bytesAvailable, NULL);
+		if (bytesAvailable>0) {
+			/* leave room for the terminator */
+			if (ReadFile(pipe, in, sizeof (in) - 1, &numWritten, NULL)) {
+				in[numWritten] = 0;
+				DbgDisplayMessage ("%s", in);
+			}
+		}
+		else
+			DbgSleep (DBG_PIPE_POLL_MS);
+	}
+	return 0;
+}
+
 int main (int argc, char** argv) {
 
-	DWORD numWritten;
 	int i=0;
 	HANDLE pipe;
-	InitializeCriticalSection(&_dbgDisplayMutex);
+	dbgWorker* pipeReader;
+
+	/* ndbg symbolize <binary> writes results to stdout and messages to stderr */
+	if (argc == 3 && strcmp (argv[1], "symbolize") == 0) {
+		int code;
+		_display.stream = stderr;
+		DbgDisplayInit ();
+		code = DbgSymbolizeStream (argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+		DbgDisplayShutdown ();
+		return code;
+	}
+	DbgDisplayInit ();
 
 	memset(in,0,32);
 
@@ -161,18 +468,8 @@ int main (int argc, char** argv) {
 	if (pipe == INVALID_HANDLE_VALUE)
 		perror("Error");
 
-	/* reads 1 byte at a time */
-
-	while (TRUE)
-	{
-		DWORD bytesAvailable;
-		PeekNamedPipe(pipe, NULL, 0, NULL, &bytesAvailable, NULL);
-		if (bytesAvailable>0) {
-			ReadFile(pipe, in,32, &numWritten, NULL);
-			printf ("\n\r%s", in);
-			memset(in,0,32);
-		}
-	}
+	/* the pipe is read on its own thread so the console starts */
+	pipeReader = pipe != INVALID_HANDLE_VALUE ? DbgWorkerCreate (DbgPipeReaderEntry, pipe) : 0;
 
 	DbgInfo ();
 	printf ("\n");
@@ -181,7 +478,12 @@ int main (int argc, char** argv) {
 	DbgParseCommandLine (argc, argv);
 	DbgConsoleEntry ();
 
-	DeleteCriticalSection(&_dbgDisplayMutex);
+	DbgTraceFinish ();
+	if (pipeReader) {
+		DbgAtomicStore (&pipeQuit, 1);
+		DbgWorkerJoin (pipeReader);
+	}
+	DbgDisplayShutdown ();
 
 	_CrtDumpMemoryLeaks();
 	return EXIT_SUCCESS;
@@ -0,0 +1,474 @@
+/********************************************
+*
+*	memory.c - Memory display
+*
+********************************************/
+
+/*
+	This component implements memory display and dump to file. A range is
+	fetched region by region with one bulk read per readable run, so pages
+	that cannot be read are skipped instead of failing the whole request.
+	Lines are rendered into one output buffer that is written at once; hex
+	digits and the ASCII column are produced 16 bytes at a time with SSE2
+	when the compiler targets it.
+
+	Dump to file overlaps reading and writing: the caller fills one buffer
+	while a worker thread writes the other.
+
+	The read cache serves many small reads of the same pages, such as the
+	stack reads of an unwinder, from whole pages fetched once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DBG_MEMORY_SSE2
+#include <emmintrin.h>
+#endif
+
+#define DBG_MEMORY_LINE        16				/* bytes per display line */
+#define DBG_MEMORY_LINE_TEXT   80				/* longest rendered line */
+#define DBG_MEMORY_DISPLAY_MAX (1024*1024)		/* largest range displayed */
+#define DBG_MEMORY_CHUNK       (4*1024*1024)	/* dump to file read size */
+
+/* byte states of a partial line */
+#define DBG_MEMORY_ABSENT     0
+#define DBG_MEMORY_VALID      1
+#define DBG_MEMORY_UNREADABLE 2
+
+static const char _memoryHexDigits[] = "0123456789abcdef";
+
+/**
+*	Read a range, skipping unreadable regions
+*
+*	Unreadable bytes are returned as 0. If pageValid is given, one entry
+*	per page touched by the range is set to TRUE if the page was read.
+*
+*	\param session Debug session
+*	\param address Start address
+*	\param data Output buffer of size bytes
+*	\param size Bytes to read
+*	\param pageValid Optional page map
+*	\ret Bytes that were read from the target
+*/
+size_t DbgMemoryFetch (IN dbgSession* session, IN vaddr_t address, OUT unsigned char* data,
+                       IN size_t size, OUT OPT unsigned char* pageValid) {
+	size_t offset = 0;
+	size_t read   = 0;
+
+	while (offset < size) {
+		vaddr_t         at = address + (vaddr_t) offset;
+		dbgMemoryRegion region;
+		size_t          run;
+		BOOL            readable = FALSE;
+
+		if (DbgProcessRequest (DBG_REQ_QUERY, session, (void*) at, &region, sizeof (region))) {
+			unsigned long long end = (unsigned long long) region.base + region.size;
+			run      = end > at ? (size_t) (end - at) : 0;
+			readable = region.readable;
+		}
+		else {
+			/* outside the user address space; nothing further is readable */
+			run = size - offset;
+		}
+		if (run == 0)
+			run = DBG_MEMORY_PAGE - (at & (DBG_MEMORY_PAGE - 1));
+		if (run > size - offset)
+			run = size - offset;
+
+		if (readable && DbgProcessRequest (DBG_REQ_READ, session, (void*) at, data + offset, run) == run)
+			read += run;
+		else
+			readable = FALSE;
+
+		if (!readable)
+			memset (data + offset, 0, run);
+		if (pageValid) {
+			size_t first = (at / DBG_MEMORY_PAGE) - (address / DBG_MEMORY_PAGE);
+			size_t last  = ((at + run - 1) / DBG_MEMORY_PAGE) - (address / DBG_MEMORY_PAGE);
+			memset (pageValid + first, readable, last - first + 1);
+		}
+		offset += run;
+	}
+	return read;
+}
+
+/**
+*	Initialize read cache
+*	\param cache Read cache
+*	\param session Debug session
+*	\param lines Number of cached pages; must be a power of 2
+*	\ret TRUE on success, FALSE if out of memory
+*/
+BOOL DbgReadCacheInit (OUT dbgReadCache* cache, IN dbgSession* session, IN unsigned int lines) {
+	unsigned int i;
+
+	cache->session = session;
+	cache->mask    = lines - 1;
+	cache->hits    = 0;
+	cache->misses  = 0;
+	cache->tags    = (vaddr_t*) malloc (lines * sizeof (vaddr_t));
+	cache->valid   = (unsigned char*) malloc (lines);
+	cache->data    = (unsigned char*) malloc ((size_t) lines * DBG_MEMORY_PAGE);
+	if (!cache->tags || !cache->valid || !cache->data) {
+		DbgReadCacheFree (cache);
+		return FALSE;
+	}
+	for (i = 0; i < lines; i++)
+		cache->tags[i] = DBG_READCACHE_EMPTY;
+	return TRUE;
+}
+
+/**
+*	Read through the cache
+*	\param cache Read cache
+*	\param address Start address
+*	\param data Output buffer
+*	\param size Bytes to read
+*	\ret Bytes read; reading stops at the first unreadable page
+*/
+size_t DbgReadCacheRead (IN dbgReadCache* cache, IN vaddr_t address, OUT void* data, IN size_t size) {
+	size_t done = 0;
+
+	while (done < size) {
+		vaddr_t      at     = address + (vaddr_t) done;
+		vaddr_t      page   = at & ~(DBG_MEMORY_PAGE - 1);
+		unsigned int line   = (page / DBG_MEMORY_PAGE) & cache->mask;
+		size_t       offset = at - page;
+		size_t       run    = DBG_MEMORY_PAGE - offset;
+
+		if (cache->tags[line] == page)
+			cache->hits++;
+		else {
+			cache->misses++;
+			cache->tags[line] = page;
+			DbgMemoryFetch (cache->session, page, cache->data + (size_t) line * DBG_MEMORY_PAGE, DBG_MEMORY_PAGE, &cache->valid[line]);
+		}
+		if (!cache->valid[line])
+			break;
+		if (run > size - done)
+			run = size - done;
+		memcpy ((unsigned char*) data + done, cache->data + (size_t) line * DBG_MEMORY_PAGE + offset, run);
+		done += run;
+	}
+	return done;
+}
+
+/**
+*	Forget cached pages, for when target memory may have changed
+*	\param cache Read cache
+*/
+void DbgReadCacheClear (IN dbgReadCache* cache) {
+	unsigned int i;
+	for (i = 0; i <= cache->mask; i++)
+		cache->tags[i] = DBG_READCACHE_EMPTY;
+}
+
+/**
+*	Release read cache
+*	\param cache Read cache
+*/
+void DbgReadCacheFree (IN dbgReadCache* cache) {
+	DbgStatsCount (DBG_STAT_READ_CACHE_HITS,   cache->hits);
+	DbgStatsCount (DBG_STAT_READ_CACHE_MISSES, cache->misses);
+	cache->hits   = 0;
+	cache->misses = 0;
+	free (cache->tags);
+	free (cache->valid);
+	free (cache->data);
+	cache->tags  = 0;
+	cache->valid = 0;
+	cache->data  = 0;
+}
+
+/**
+*	Convert 16 bytes to 32 hex digits, high nibble first
+*/
+static void DbgMemoryHex16 (IN const unsigned char* in, OUT char* out) {
+#ifdef DBG_MEMORY_SSE2
+	__m128i bytes = _mm_loadu_si128 ((const __m128i*) in);
+	__m128i mask  = _mm_set1_epi8 (0x0f);
+	__m128i nine  = _mm_set1_epi8 (9);
+	__m128i zero  = _mm_set1_epi8 ('0');
+	__m128i alpha = _mm_set1_epi8 ('a' - '0' - 10);
+	__m128i hi    = _mm_and_si128 (_mm_srli_epi16 (bytes, 4), mask);
+	__m128i lo    = _mm_and_si128 (bytes, mask);
+
+	/* '0' + n, plus the distance to 'a' for digits above 9 */
+	hi = _mm_add_epi8 (_mm_add_epi8 (hi, zero), _mm_and_si128 (_mm_cmpgt_epi8 (hi, nine), alpha));
+	lo = _mm_add_epi8 (_mm_add_epi8 (lo, zero), _mm_and_si128 (_mm_cmpgt_epi8 (lo, nine), alpha));
+	_mm_storeu_si128 ((__m128i*) out,        _mm_unpacklo_epi8 (hi, lo));
+	_mm_storeu_si128 ((__m128i*) (out + 16), _mm_unpackhi_epi8 (hi, lo));
+#else
+	int i;
+	for (i = 0; i < 16; i++) {
+		out[i*2]     = _memoryHexDigits[in[i] >> 4];
+		out[i*2 + 1] = _memoryHexDigits[in[i] & 0x0f];
+	}
+#endif
+}
+
+/**
+*	Convert 16 bytes to printable characters, '.' for the rest
+*/
+static void DbgMemoryAscii16 (IN const unsigned char* in, OUT char* out) {
+#ifdef DBG_MEMORY_SSE2
+	__m128i bytes     = _mm_loadu_si128 ((const __m128i*) in);
+	/* signed compares; bytes above 0x7f are negative and fail the first test */
+	__m128i printable = _mm_and_si128 (_mm_cmpgt_epi8 (bytes, _mm_set1_epi8 (0x1f)),
+	                                   _mm_cmplt_epi8 (bytes, _mm_set1_epi8 (0x7f)));
+	_mm_storeu_si128 ((__m128i*) out, _mm_or_si128 (_mm_and_si128 (printable, bytes),
+	                                                _mm_andnot_si128 (printable, _mm_set1_epi8 ('.'))));
+#else
+	int i;
+	for (i = 0; i < 16; i++)
+		out[i] = in[i] > 0x1f && in[i] < 0x7f ? (char) in[i] : '.';
+#endif
+}
+
+/**
+*	Render one display line
+*	\param out Output position
+*	\param address Address of the line
+*	\param data 16 bytes
+*	\param state Optional state of each byte for partial lines
+*	\param unit Bytes per unit, 1, 4 or 8
+*	\ret Output position after the line
+*/
+static char* DbgMemoryLine (IN char* out, IN vaddr_t address, IN const unsigned char* data,
+                            IN OPT const unsigned char* state, IN unsigned int unit) {
+	char         hex[32];
+	char         ascii[16];
+	unsigned int i;
+	int          shift;
+
+	DbgMemoryHex16 (data, hex);
+	if (unit == 1)
+		DbgMemoryAscii16 (data, ascii);
+	if (state) {
+		for (i = 0; i < 16; i++) {
+			if (state[i] == DBG_MEMORY_VALID)
+				continue;
+			hex[i*2] = hex[i*2 + 1] = state[i] == DBG_MEMORY_ABSENT ? ' ' : '?';
+			ascii[i]                = state[i] == DBG_MEMORY_ABSENT ? ' ' : '?';
+		}
+	}
+
+	*out++ = '\n';
+	for (shift = 28; shift >= 0; shift -= 4)
+		*out++ = _memoryHexDigits[(address >> shift) & 0x0f];
+	*out++ = ' ';
+	*out++ = ' ';
+
+	/* units are little endian; the most significant byte is displayed first */
+	for (i = 0; i < 16; i += unit) {
+		unsigned int b = unit;
+		while (b--) {
+			*out++ = hex[(i + b)*2];
+			*out++ = hex[(i + b)*2 + 1];
+		}
+		*out++ = unit == 1 && i == 7 && (!state || state[8] != DBG_MEMORY_ABSENT) ? '-' : ' ';
+	}
+	if (unit == 1) {
+		*out++ = ' ';
+		memcpy (out, ascii, 16);
+		out += 16;
+	}
+	return out;
+}
+
+/**
+*	Display memory range
+*	\param session Debug session
+*	\param address Start address
+*	\param size Bytes to display
+*	\param unit Bytes per unit, 1, 4 or 8
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgMemoryDisplay (IN dbgSession* session, IN vaddr_t address, IN size_t size, IN unsigned int unit) {
+	unsigned char* data;
+	unsigned char* pageValid;
+	char*          text;
+	char*          out;
+	size_t         pages;
+	size_t         offset;
+
+	if (!size)
+		return TRUE;
+	if (size > DBG_MEMORY_DISPLAY_MAX) {
+		DbgDisplayError ("Range too large to display; use mem -f to dump it to a file");
+		return FALSE;
+	}
+
+	pages     = (address + size - 1) / DBG_MEMORY_PAGE - address / DBG_MEMORY_PAGE + 1;
+	data      = (unsigned char*) malloc (size + DBG_MEMORY_LINE);
+	pageValid = (unsigned char*) malloc (pages);
+	text      = (char*) malloc ((size / DBG_MEMORY_LINE + 1) * DBG_MEMORY_LINE_TEXT);
+	if (!data || !pageValid || !text) {
+		free (data);
+		free (pageValid);
+		free (text);
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+
+	DbgMemoryFetch (session, address, data, size, pageValid);
+
+	out = text;
+	for (offset = 0; offset < size; offset += DBG_MEMORY_LINE) {
+		vaddr_t line  = address + (vaddr_t) offset;
+		size_t  first = line / DBG_MEMORY_PAGE - address / DBG_MEMORY_PAGE;
+		size_t  last  = (line + DBG_MEMORY_LINE - 1) / DBG_MEMORY_PAGE - address / DBG_MEMORY_PAGE;
+
+		if (offset + DBG_MEMORY_LINE <= size && pageValid[first] && pageValid[last]) {
+			out = DbgMemoryLine (out, line, data + offset, 0, unit);
+		}
+		else {
+			/* partial or unreadable line */
+			unsigned char bytes[DBG_MEMORY_LINE];
+			unsigned char state[DBG_MEMORY_LINE];
+			unsigned int  i;
+			for (i = 0; i < DBG_MEMORY_LINE; i++) {
+				if (offset + i >= size) {
+					bytes[i] = 0;
+					state[i] = DBG_MEMORY_ABSENT;
+					continue;
+				}
+				bytes[i] = data[offset + i];
+				state[i] = pageValid[(line + i) / DBG_MEMORY_PAGE - address / DBG_MEMORY_PAGE]
+					? DBG_MEMORY_VALID : DBG_MEMORY_UNREADABLE;
+			}
+			out = DbgMemoryLine (out, line, bytes, state, unit);
+		}
+	}
+	DbgDisplayText (text, out - text);
+
+	free (data);
+	free (pageValid);
+	free (text);
+	return TRUE;
+}
+
+/*
+	Dump to file state shared with the writer thread
+*/
+typedef struct _dbgMemoryDump {
+	FILE*          file;
+	unsigned char* buffer[2];
+	size_t         length[2];
+	int            current;		/* buffer handed to the writer */
+	BOOL           quit;
+	BOOL           failed;
+	dbgNotify*     filled;
+	dbgNotify*     drained;
+}dbgMemoryDump;
+
+/**
+*	Dump writer thread entry point
+*/
+static int DbgMemoryDumpWriter (void* arg) {
+	dbgMemoryDump* dump = (dbgMemoryDump*) arg;
+
+	while (TRUE) {
+		DbgNotifyWait (dump->filled, DBG_WAIT_INFINITE);
+		if (dump->quit)
+			break;
+		if (!dump->failed && fwrite (dump->buffer[dump->current], 1, dump->length[dump->current], dump->file)
+			!= dump->length[dump->current])
+			dump->failed = TRUE;
+		DbgNotifySignal (dump->drained);
+	}
+	return 0;
+}
+
+/**
+*	Dump memory range to a file
+*
+*	Unreadable pages are written as zeros so file offsets match addresses.
+*
+*	\param session Debug session
+*	\param address Start address
+*	\param size Bytes to dump
+*	\param path Output file path
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgMemoryDumpFile (IN dbgSession* session, IN vaddr_t address, IN size_t size, IN const char* path) {
+	dbgMemoryDump      dump;
+	dbgWorker*         writer;
+	unsigned long long start;
+	double             seconds;
+	size_t             offset;
+	size_t             read = 0;
+	int                k    = 0;
+
+	memset (&dump, 0, sizeof (dbgMemoryDump));
+#ifdef _MSC_VER
+	fopen_s (&dump.file, path, "wb");
+#else
+	dump.file = fopen (path, "wb");
+#endif
+	if (!dump.file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	/* buffers are large; stdio buffering would only add a copy */
+	setvbuf (dump.file, 0, _IONBF, 0);
+
+	dump.buffer[0] = (unsigned char*) malloc (DBG_MEMORY_CHUNK);
+	dump.buffer[1] = (unsigned char*) malloc (DBG_MEMORY_CHUNK);
+	dump.filled    = DbgNotifyCreate ();
+	dump.drained   = DbgNotifyCreate ();
+	writer = dump.buffer[0] && dump.buffer[1] && dump.filled && dump.drained
+		? DbgWorkerCreate (DbgMemoryDumpWriter, &dump) : 0;
+	if (!writer) {
+		DbgDisplayError ("Unable to start dump");
+		dump.failed = TRUE;
+		goto cleanup;
+	}
+
+	start = DbgClockNow ();
+	for (offset = 0; offset < size && !dump.failed; ) {
+		size_t chunk = size - offset > DBG_MEMORY_CHUNK ? DBG_MEMORY_CHUNK : size - offset;
+
+		read += DbgMemoryFetch (session, address + (vaddr_t) offset, dump.buffer[k], chunk, 0);
+
+		/* wait until the writer is done with the other buffer, then hand this one over */
+		if (offset)
+			DbgNotifyWait (dump.drained, DBG_WAIT_INFINITE);
+		dump.current   = k;
+		dump.length[k] = chunk;
+		DbgNotifySignal (dump.filled);
+
+		offset += chunk;
+		k ^= 1;
+	}
+	if (offset)
+		DbgNotifyWait (dump.drained, DBG_WAIT_INFINITE);
+	dump.quit = TRUE;
+	DbgNotifySignal (dump.filled);
+	DbgWorkerJoin (writer);
+
+	if (fflush (dump.file))
+		dump.failed = TRUE;
+	seconds = (double) (DbgClockNow () - start) / 1000000000.0;
+
+	if (dump.failed)
+		DbgDisplayError ("Write to '%s' failed", path);
+	else
+		DbgDisplayMessage ("Wrote %lu bytes (%lu unreadable) to '%s' in %.3f s, %.1f MB/s",
+			(unsigned long) offset, (unsigned long) (offset - read), path, seconds,
+			seconds > 0.0 ? (double) offset / (1024.0 * 1024.0) / seconds : 0.0);
+
+cleanup:
+	fclose (dump.file);
+	free (dump.buffer[0]);
+	free (dump.buffer[1]);
+	if (dump.filled)
+		DbgNotifyFree (dump.filled);
+	if (dump.drained)
+		DbgNotifyFree (dump.drained);
+	return !dump.failed;
+}
@@ -0,0 +1,167 @@
+/********************************************
+*
+*	module.c - Module map
+*
+********************************************/
+
+/*
+	This component keeps the modules mapped into the target.
+
+	Modules are allocated from the process library pool and linked on
+	the library list in load order, like the other process objects. An
+	index of pointers sorted by base address sits next to the list, so
+	finding the module that contains an address, or the module unloaded
+	by an event, is one binary search. Processes that load and unload
+	thousands of libraries only pay for moving pointers in the index.
+
+	The map is updated from the load and unload events of the target and
+	from symbol loads. Must be called on the session thread.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+/**
+*	Initialize the module index of a session
+*	\param session Debug session
+*/
+void DbgModuleInit (IN dbgSession* session) {
+	vectorInit (&session->process.moduleIndex, sizeof (dbgSharedLibrary*));
+}
+
+/**
+*	Release the module index; the modules go with the library pool
+*	\param session Debug session
+*/
+void DbgModuleFree (IN dbgSession* session) {
+	vectorFree (&session->process.moduleIndex);
+}
+
+/**
+*	Index of the first module above an address
+*/
+static unsigned int DbgModuleUpper (IN vector* index, IN vaddr_t address) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (index);
+
+	while (low < high) {
+		unsigned int middle = low + (high - low) / 2;
+		if ((*(dbgSharedLibrary**) vectorAt (index, middle))->base <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/**
+*	Add a module, or update the module already mapped at the base
+*	\param session Debug session
+*	\param name Module path or 0 to keep the current name
+*	\param base Module base address
+*	\param size Image size or 0 if unknown
+*	\ret Module or 0 if out of memory
+*/
+dbgSharedLibrary* DbgModuleAdd (IN dbgSession* session, IN OPT const char* name, IN vaddr_t base, IN unsigned long size) {
+	vector*           index = &session->process.moduleIndex;
+	unsigned int      at    = DbgModuleUpper (index, base);
+	dbgSharedLibrary* module;
+
+	if (at && (module = *(dbgSharedLibrary**) vectorAt (index, at - 1))->base == base) {
+		if (name)
+			module->name = strtabIntern (&session->process.strings, name);
+		if (size)
+			module->size = size;
+		return module;
+	}
+
+	module = (dbgSharedLibrary*) poolAlloc (&session->process.libraryPool);
+	if (!module)
+		return 0;
+	module->name   = strtabIntern (&session->process.strings, name ? name : "");
+	module->base   = base;
+	module->size   = size;
+	module->memory = 0;
+
+	/* keep the index sorted; the new module goes where the search ended */
+	if (!vectorAdd (index, 0)) {
+		poolRelease (&session->process.libraryPool, module);
+		return 0;
+	}
+	memmove (vectorAt (index, at + 1), vectorAt (index, at), (size_t) (vectorSize (index) - at - 1) * sizeof (dbgSharedLibrary*));
+	*(dbgSharedLibrary**) vectorAt (index, at) = module;
+	ilistAppend (&session->process.libraryList, &module->node);
+	return module;
+}
+
+/**
+*	Unlink and release a module
+*	\param session Debug session
+*	\param module Module returned by DbgModuleAdd, DbgModuleFind or DbgModuleFromAddress
+*/
+void DbgModuleRemove (IN dbgSession* session, IN dbgSharedLibrary* module) {
+	vector*      index = &session->process.moduleIndex;
+	unsigned int at    = DbgModuleUpper (index, module->base);
+
+	if (at && *(dbgSharedLibrary**) vectorAt (index, at - 1) == module)
+		vectorRemove (at - 1, index);
+	ilistRemove (&session->process.libraryList, &module->node);
+	poolRelease (&session->process.libraryPool, module);
+}
+
+/**
+*	Locate the module mapped at a base address
+*	\param session Debug session
+*	\param base Module base address
+*	\ret Module or 0
+*/
+dbgSharedLibrary* DbgModuleFind (IN dbgSession* session, IN vaddr_t base) {
+	vector*      index = &session->process.moduleIndex;
+	unsigned int at    = DbgModuleUpper (index, base);
+
+	if (at && (*(dbgSharedLibrary**) vectorAt (index, at - 1))->base == base)
+		return *(dbgSharedLibrary**) vectorAt (index, at - 1);
+	return 0;
+}
+
+/**
+*	Locate the module containing an address. A module of unknown size
+*	ends where the next one starts.
+*	\param session Debug session
+*	\param address Address
+*	\ret Module or 0
+*/
+dbgSharedLibrary* DbgModuleFromAddress (IN dbgSession* session, IN vaddr_t address) {
+	vector*           index = &session->process.moduleIndex;
+	unsigned int      at    = DbgModuleUpper (index, address);
+	dbgSharedLibrary* module;
+
+	if (!at)
+		return 0;
+	module = *(dbgSharedLibrary**) vectorAt (index, at - 1);
+	if (module->size && address - module->base >= module->size)
+		return 0;
+	return module;
+}
+
+/**
+*	Read the image size from the PE header of a mapped module
+*	\param session Debug session
+*	\param base Module base address
+*	\ret SizeOfImage or 0 if the header cannot be read
+*/
+unsigned long DbgModuleImageSize (IN dbgSession* session, IN vaddr_t base) {
+	unsigned short magic  = 0;
+	unsigned long  header = 0;
+	unsigned long  size   = 0;
+
+	if (DbgProcessRequest (DBG_REQ_READ, session, (void*) base, &magic, 2) != 2 || magic != 0x5a4d)	/* MZ */
+		return 0;
+	if (DbgProcessRequest (DBG_REQ_READ, session, (void*) (base + 0x3c), &header, 4) != 4 || header > 0x1000)
+		return 0;
+	/* OptionalHeader.SizeOfImage follows the signature, the file header and 56 bytes of optional header */
+	if (DbgProcessRequest (DBG_REQ_READ, session, (void*) (base + header + 0x50), &size, 4) != 4)
+		return 0;
+	return size;
+}
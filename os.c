@@ -0,0 +1,561 @@
+/********************************************
+*
+*	os.c - Operating system services
+*
+********************************************/
+
+/*
+	This component implements the host thread, mutual exclusion
+	and event services declared in os.h for Win32 and POSIX hosts.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+#include <io.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+#include <string.h>
+#include "os.h"
+
+#ifdef _WIN32
+
+struct _dbgMutex {
+	CRITICAL_SECTION cs;
+};
+
+struct _dbgNotify {
+	HANDLE handle;
+};
+
+struct _dbgWorker {
+	HANDLE        handle;
+	DbgWorkerProc proc;
+	void*         arg;
+};
+
+static DWORD WINAPI DbgWorkerEntry (LPVOID arg) {
+	dbgWorker* worker = (dbgWorker*) arg;
+	return (DWORD) worker->proc (worker->arg);
+}
+
+/**
+*	Create host thread
+*	\param proc Thread entry point
+*	\param arg Argument passed to entry point
+*	\ret Worker handle or 0 on error
+*/
+dbgWorker* DbgWorkerCreate (DbgWorkerProc proc, void* arg) {
+	dbgWorker* worker = (dbgWorker*) malloc (sizeof (dbgWorker));
+	if (!worker)
+		return 0;
+	worker->proc = proc;
+	worker->arg  = arg;
+	worker->handle = CreateThread (0, 0, DbgWorkerEntry, worker, 0, 0);
+	if (!worker->handle) {
+		free (worker);
+		return 0;
+	}
+	return worker;
+}
+
+/**
+*	Wait for host thread to terminate and release it
+*	\param worker Worker handle
+*	\ret Thread exit code
+*/
+int DbgWorkerJoin (dbgWorker* worker) {
+	DWORD code = 0;
+	if (!worker)
+		return 0;
+	WaitForSingleObject (worker->handle, INFINITE);
+	GetExitCodeThread (worker->handle, &code);
+	CloseHandle (worker->handle);
+	free (worker);
+	return (int) code;
+}
+
+unsigned long DbgThreadCurrentId (void) {
+	return GetCurrentThreadId ();
+}
+
+void DbgThreadYield (void) {
+	SwitchToThread ();
+}
+
+void DbgSleep (unsigned int ms) {
+	Sleep (ms);
+}
+
+/**
+*	Set file position
+*	\param file stdio file
+*	\param offset 64 bit offset from the start of the file
+*	\ret 0 if success
+*/
+int DbgFileSeek (void* file, unsigned long long offset) {
+	return _fseeki64 ((FILE*) file, (long long) offset, SEEK_SET);
+}
+
+/**
+*	Mark file sparse so ranges that are seeked over take no disk space
+*	\param file stdio file
+*/
+void DbgFileSetSparse (void* file) {
+	DWORD bytes = 0;
+	fflush ((FILE*) file);
+	DeviceIoControl ((HANDLE) _get_osfhandle (_fileno ((FILE*) file)), FSCTL_SET_SPARSE, 0, 0, 0, 0, &bytes, 0);
+}
+
+/**
+*	Open file for read only mapping
+*	\param path File path
+*	\param size Output file size
+*	\ret File mapping or 0 on error
+*/
+dbgFileMap* DbgFileMapOpen (const char* path, unsigned long long* size) {
+	HANDLE        file;
+	HANDLE        mapping;
+	LARGE_INTEGER length;
+
+	file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	if (!GetFileSizeEx (file, &length) || !length.QuadPart) {
+		CloseHandle (file);
+		return 0;
+	}
+	mapping = CreateFileMappingA (file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle (file);
+	if (!mapping)
+		return 0;
+	*size = (unsigned long long) length.QuadPart;
+	return (dbgFileMap*) mapping;
+}
+
+/**
+*	Map view of part of a file
+*	\param map File mapping
+*	\param offset File offset of the view
+*	\param length Bytes to map
+*	\param view Output view descriptor for DbgFileMapUnview
+*	\ret Pointer to the byte at offset or 0 on error
+*/
+void* DbgFileMapView (dbgFileMap* map, unsigned long long offset, unsigned long length, dbgFileView* view) {
+	static DWORD       granularity;
+	unsigned long long start;
+
+	if (!granularity) {
+		SYSTEM_INFO info;
+		GetSystemInfo (&info);
+		granularity = info.dwAllocationGranularity;
+	}
+	/* views start on an allocation granularity boundary */
+	start        = offset - offset % granularity;
+	view->length = (unsigned long) (offset - start) + length;
+	view->base   = MapViewOfFile ((HANDLE) map, FILE_MAP_READ, (DWORD) (start >> 32), (DWORD) start, view->length);
+	if (!view->base)
+		return 0;
+	return (char*) view->base + (offset - start);
+}
+
+void DbgFileMapUnview (dbgFileView* view) {
+	if (view->base)
+		UnmapViewOfFile (view->base);
+	view->base = 0;
+}
+
+void DbgFileMapClose (dbgFileMap* map) {
+	CloseHandle ((HANDLE) map);
+}
+
+/**
+*	Call a procedure for each file of a directory
+*	\param path Directory
+*	\param proc Called with the path of each file
+*	\param arg Procedure argument
+*	\ret Number of files passed to proc or -1 if the directory cannot be read
+*/
+int DbgDirectoryEnum (const char* path, DbgDirectoryProc proc, void* arg) {
+	WIN32_FIND_DATAA find;
+	HANDLE           handle;
+	char             name[MAX_PATH];
+	int              count = 0;
+
+	if (strlen (path) + 3 > MAX_PATH)
+		return -1;
+#ifdef _MSC_VER
+	sprintf_s (name, sizeof (name), "%s\\*", path);
+#else
+	sprintf (name, "%s\\*", path);
+#endif
+	handle = FindFirstFileA (name, &find);
+	if (handle == INVALID_HANDLE_VALUE)
+		return -1;
+	do {
+		if (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		if (strlen (path) + strlen (find.cFileName) + 2 > MAX_PATH)
+			continue;
+#ifdef _MSC_VER
+		sprintf_s (name, sizeof (name), "%s\\%s", path, find.cFileName);
+#else
+		sprintf (name, "%s\\%s", path, find.cFileName);
+#endif
+		count++;
+		if (!proc (arg, name))
+			break;
+	} while (FindNextFileA (handle, &find));
+	FindClose (handle);
+	return count;
+}
+
+unsigned int DbgProcessorCount (void) {
+	SYSTEM_INFO info;
+	GetSystemInfo (&info);
+	return info.dwNumberOfProcessors ? (unsigned int) info.dwNumberOfProcessors : 1;
+}
+
+/**
+*	Resident memory of the debugger
+*	\ret Bytes, or 0 if unknown
+*/
+unsigned long long DbgProcessMemory (void) {
+	PROCESS_MEMORY_COUNTERS counters;
+	counters.cb = sizeof (counters);
+	if (!GetProcessMemoryInfo (GetCurrentProcess (), &counters, sizeof (counters)))
+		return 0;
+	return counters.WorkingSetSize;
+}
+
+/**
+*	Read monotonic clock
+*	\ret Nanoseconds since an unspecified starting point
+*/
+unsigned long long DbgClockNow (void) {
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER        count;
+
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency (&frequency);
+	QueryPerformanceCounter (&count);
+
+	/* split to avoid overflowing the multiply */
+	return (unsigned long long) (count.QuadPart / frequency.QuadPart) * 1000000000ULL
+		+ (unsigned long long) (count.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
+dbgMutex* DbgMutexCreate (void) {
+	dbgMutex* mutex = (dbgMutex*) malloc (sizeof (dbgMutex));
+	if (mutex)
+		InitializeCriticalSection (&mutex->cs);
+	return mutex;
+}
+
+void DbgMutexLock (dbgMutex* mutex) {
+	EnterCriticalSection (&mutex->cs);
+}
+
+int DbgMutexLockTry (dbgMutex* mutex) {
+	return TryEnterCriticalSection (&mutex->cs);
+}
+
+void DbgMutexUnlock (dbgMutex* mutex) {
+	LeaveCriticalSection (&mutex->cs);
+}
+
+void DbgMutexFree (dbgMutex* mutex) {
+	if (!mutex)
+		return;
+	DeleteCriticalSection (&mutex->cs);
+	free (mutex);
+}
+
+dbgNotify* DbgNotifyCreate (void) {
+	dbgNotify* event = (dbgNotify*) malloc (sizeof (dbgNotify));
+	if (!event)
+		return 0;
+	event->handle = CreateEvent (0, FALSE, FALSE, 0);
+	if (!event->handle) {
+		free (event);
+		return 0;
+	}
+	return event;
+}
+
+void DbgNotifySignal (dbgNotify* event) {
+	SetEvent (event->handle);
+}
+
+/**
+*	Wait for event
+*	\param event Event
+*	\param ms Timeout in milliseconds or DBG_WAIT_INFINITE
+*	\ret 1 if the event was signalled, 0 on timeout
+*/
+int DbgNotifyWait (dbgNotify* event, unsigned int ms) {
+	return WaitForSingleObject (event->handle, ms) == WAIT_OBJECT_0;
+}
+
+void DbgNotifyFree (dbgNotify* event) {
+	if (!event)
+		return;
+	CloseHandle (event->handle);
+	free (event);
+}
+
+#else
+
+struct _dbgMutex {
+	pthread_mutex_t m;
+};
+
+struct _dbgNotify {
+	pthread_mutex_t m;
+	pthread_cond_t  c;
+	int             signalled;
+};
+
+struct _dbgWorker {
+	pthread_t     handle;
+	DbgWorkerProc proc;
+	void*         arg;
+	int           code;
+};
+
+static void* DbgWorkerEntry (void* arg) {
+	dbgWorker* worker = (dbgWorker*) arg;
+	worker->code = worker->proc (worker->arg);
+	return 0;
+}
+
+dbgWorker* DbgWorkerCreate (DbgWorkerProc proc, void* arg) {
+	dbgWorker* worker = (dbgWorker*) malloc (sizeof (dbgWorker));
+	if (!worker)
+		return 0;
+	worker->proc = proc;
+	worker->arg  = arg;
+	worker->code = 0;
+	if (pthread_create (&worker->handle, 0, DbgWorkerEntry, worker) != 0) {
+		free (worker);
+		return 0;
+	}
+	return worker;
+}
+
+int DbgWorkerJoin (dbgWorker* worker) {
+	int code;
+	if (!worker)
+		return 0;
+	pthread_join (worker->handle, 0);
+	code = worker->code;
+	free (worker);
+	return code;
+}
+
+unsigned long DbgThreadCurrentId (void) {
+	return (unsigned long) pthread_self ();
+}
+
+void DbgThreadYield (void) {
+	sched_yield ();
+}
+
+void DbgSleep (unsigned int ms) {
+	struct timespec ts;
+	ts.tv_sec  = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep (&ts, 0);
+}
+
+int DbgFileSeek (void* file, unsigned long long offset) {
+	return fseeko ((FILE*) file, (off_t) offset, SEEK_SET);
+}
+
+/* files are sparse by default */
+void DbgFileSetSparse (void* file) {
+}
+
+struct _dbgFileMap {
+	int fd;
+};
+
+dbgFileMap* DbgFileMapOpen (const char* path, unsigned long long* size) {
+	dbgFileMap* map;
+	struct stat st;
+	int         fd = open (path, O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+	if (fstat (fd, &st) || !st.st_size || !(map = (dbgFileMap*) malloc (sizeof (dbgFileMap)))) {
+		close (fd);
+		return 0;
+	}
+	map->fd = fd;
+	*size   = (unsigned long long) st.st_size;
+	return map;
+}
+
+void* DbgFileMapView (dbgFileMap* map, unsigned long long offset, unsigned long length, dbgFileView* view) {
+	unsigned long long start = offset - offset % (unsigned long long) sysconf (_SC_PAGESIZE);
+
+	view->length = (unsigned long) (offset - start) + length;
+	view->base   = mmap (0, view->length, PROT_READ, MAP_PRIVATE, map->fd, (off_t) start);
+	if (view->base == MAP_FAILED) {
+		view->base = 0;
+		return 0;
+	}
+	return (char*) view->base + (offset - start);
+}
+
+void DbgFileMapUnview (dbgFileView* view) {
+	if (view->base)
+		munmap (view->base, view->length);
+	view->base = 0;
+}
+
+void DbgFileMapClose (dbgFileMap* map) {
+	close (map->fd);
+	free (map);
+}
+
+int DbgDirectoryEnum (const char* path, DbgDirectoryProc proc, void* arg) {
+	DIR*           dir = opendir (path);
+	struct dirent* entry;
+	struct stat    st;
+	char           name[4096];
+	int            count = 0;
+
+	if (!dir)
+		return -1;
+	while ((entry = readdir (dir)) != 0) {
+		if (strlen (path) + strlen (entry->d_name) + 2 > sizeof (name))
+			continue;
+		sprintf (name, "%s/%s", path, entry->d_name);
+		if (stat (name, &st) != 0 || !S_ISREG (st.st_mode))
+			continue;
+		count++;
+		if (!proc (arg, name))
+			break;
+	}
+	closedir (dir);
+	return count;
+}
+
+unsigned int DbgProcessorCount (void) {
+	long count = sysconf (_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (unsigned int) count : 1;
+}
+
+unsigned long long DbgProcessMemory (void) {
+	FILE*         file = fopen ("/proc/self/statm", "r");
+	unsigned long size;
+	unsigned long resident = 0;
+
+	if (!file)
+		return 0;
+	/* pages: total, then resident */
+	if (fscanf (file, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose (file);
+	return (unsigned long long) resident * (unsigned long long) sysconf (_SC_PAGESIZE);
+}
+
+unsigned long long DbgClockNow (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+dbgMutex* DbgMutexCreate (void) {
+	dbgMutex* mutex = (dbgMutex*) malloc (sizeof (dbgMutex));
+	if (mutex)
+		pthread_mutex_init (&mutex->m, 0);
+	return mutex;
+}
+
+void DbgMutexLock (dbgMutex* mutex) {
+	pthread_mutex_lock (&mutex->m);
+}
+
+int DbgMutexLockTry (dbgMutex* mutex) {
+	return pthread_mutex_trylock (&mutex->m) == 0;
+}
+
+void DbgMutexUnlock (dbgMutex* mutex) {
+	pthread_mutex_unlock (&mutex->m);
+}
+
+void DbgMutexFree (dbgMutex* mutex) {
+	if (!mutex)
+		return;
+	pthread_mutex_destroy (&mutex->m);
+	free (mutex);
+}
+
+dbgNotify* DbgNotifyCreate (void) {
+	dbgNotify* event = (dbgNotify*) malloc (sizeof (dbgNotify));
+	if (!event)
+		return 0;
+	pthread_mutex_init (&event->m, 0);
+	pthread_cond_init (&event->c, 0);
+	event->signalled = 0;
+	return event;
+}
+
+void DbgNotifySignal (dbgNotify* event) {
+	pthread_mutex_lock (&event->m);
+	event->signalled = 1;
+	pthread_cond_signal (&event->c);
+	pthread_mutex_unlock (&event->m);
+}
+
+int DbgNotifyWait (dbgNotify* event, unsigned int ms) {
+	struct timespec ts;
+	int result;
+
+	pthread_mutex_lock (&event->m);
+	if (ms != DBG_WAIT_INFINITE) {
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_sec  += ms / 1000;
+		ts.tv_nsec += (ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+	while (!event->signalled) {
+		if (ms == DBG_WAIT_INFINITE)
+			pthread_cond_wait (&event->c, &event->m);
+		else if (pthread_cond_timedwait (&event->c, &event->m, &ts) == ETIMEDOUT)
+			break;
+	}
+	result = event->signalled;
+	event->signalled = 0;
+	pthread_mutex_unlock (&event->m);
+	return result;
+}
+
+void DbgNotifyFree (dbgNotify* event) {
+	if (!event)
+		return;
+	pthread_cond_destroy (&event->c);
+	pthread_mutex_destroy (&event->m);
+	free (event);
+}
+
+#endif
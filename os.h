@@ -0,0 +1,144 @@
+/********************************************
+*
+*	os.h - Operating system services
+*
+********************************************/
+
+#ifndef OS_H
+#define OS_H
+
+/*
+	The following implements a small operating system independent
+	layer for threads, synchronization and atomic operations so the
+	rest of the debugger does not call the host operating system directly.
+*/
+
+/* mutual exclusion, events and host threads are opaque */
+typedef struct _dbgMutex  dbgMutex;
+typedef struct _dbgNotify dbgNotify;
+typedef struct _dbgWorker dbgWorker;
+typedef struct _dbgFileMap dbgFileMap;
+
+/* mapped view of part of a file */
+typedef struct _dbgFileView {
+	void*         base;
+	unsigned long length;
+}dbgFileView;
+
+/* host thread entry point */
+typedef int (*DbgWorkerProc) (void* arg);
+
+/* called with the path of each file in a directory; return 0 to stop */
+typedef int (*DbgDirectoryProc) (void* arg, const char* path);
+
+/* infinite timeout for DbgNotifyWait */
+#define DBG_WAIT_INFINITE 0xffffffff
+
+/* thread local storage */
+#ifdef _MSC_VER
+#define DBG_THREAD_LOCAL __declspec(thread)
+#else
+#define DBG_THREAD_LOCAL __thread
+#endif
+
+/*
+	Atomic operations. dbgAtomic is a 32 bit signed integer that
+	may be shared between threads. Loads have acquire semantics
+	and stores have release semantics.
+*/
+typedef volatile long dbgAtomic;
+
+#ifdef _MSC_VER
+#include <intrin.h>
+/* x86 MSVC: volatile accesses are acquire/release under /volatile:ms */
+#define DbgAtomicLoad(p)        (*(p))
+#define DbgAtomicStore(p,v)     (*(p) = (v))
+#define DbgAtomicInc(p)         _InterlockedIncrement(p)
+#define DbgAtomicDec(p)         _InterlockedDecrement(p)
+#define DbgAtomicAdd(p,v)       (_InterlockedExchangeAdd(p,v)+(v))
+#define DbgAtomicExchange(p,v)  _InterlockedExchange(p,v)
+#define DbgAtomicCas(p,cmp,xchg) (_InterlockedCompareExchange(p,xchg,cmp)==(cmp))
+#define DbgAtomicCasPtr(p,cmp,xchg) (_InterlockedCompareExchangePointer((void* volatile*)(p),xchg,cmp)==(cmp))
+#define DbgAtomicLoadPtr(p)     (*(p))
+#define DbgAtomicStorePtr(p,v)  (*(p) = (v))
+#define DbgAtomicFence()        _ReadWriteBarrier()
+#else
+#define DbgAtomicLoad(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define DbgAtomicStore(p,v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define DbgAtomicInc(p)         __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define DbgAtomicDec(p)         __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define DbgAtomicAdd(p,v)       __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST)
+#define DbgAtomicExchange(p,v)  __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define DbgAtomicCas(p,cmp,xchg) __sync_bool_compare_and_swap(p,cmp,xchg)
+#define DbgAtomicCasPtr(p,cmp,xchg) __sync_bool_compare_and_swap((void**)(p),cmp,xchg)
+#define DbgAtomicLoadPtr(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define DbgAtomicStorePtr(p,v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define DbgAtomicFence()        __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/*
+	os.c
+	Host threads
+*/
+extern dbgWorker*    DbgWorkerCreate      (DbgWorkerProc proc, void* arg);
+extern int           DbgWorkerJoin        (dbgWorker* worker);
+extern unsigned long DbgThreadCurrentId   (void);
+extern void          DbgThreadYield       (void);
+extern void          DbgSleep             (unsigned int ms);
+extern unsigned int  DbgProcessorCount    (void);
+
+/*
+	os.c
+	Resident memory of the host process in bytes
+*/
+extern unsigned long long DbgProcessMemory (void);
+
+/*
+	os.c
+	Monotonic clock in nanoseconds
+*/
+extern unsigned long long DbgClockNow     (void);
+
+/*
+	os.c
+	Host files. file is a stdio FILE*.
+*/
+extern int           DbgFileSeek          (void* file, unsigned long long offset);
+extern void          DbgFileSetSparse     (void* file);
+
+/*
+	os.c
+	Read only file mapping. Views may be mapped from any thread.
+*/
+extern dbgFileMap*   DbgFileMapOpen       (const char* path, unsigned long long* size);
+extern void*         DbgFileMapView       (dbgFileMap* map, unsigned long long offset, unsigned long length, dbgFileView* view);
+extern void          DbgFileMapUnview     (dbgFileView* view);
+extern void          DbgFileMapClose      (dbgFileMap* map);
+
+/*
+	os.c
+	Directory listing. Subdirectories are skipped.
+*/
+extern int           DbgDirectoryEnum     (const char* path, DbgDirectoryProc proc, void* arg);
+
+/*
+	os.c
+	Mutual exclusion
+*/
+extern dbgMutex*     DbgMutexCreate       (void);
+extern void          DbgMutexLock         (dbgMutex* mutex);
+extern int           DbgMutexLockTry      (dbgMutex* mutex);
+extern void          DbgMutexUnlock       (dbgMutex* mutex);
+extern void          DbgMutexFree         (dbgMutex* mutex);
+
+/*
+	os.c
+	Auto reset events. A signal wakes exactly one waiter; if there are
+	no waiters the event stays signalled until the next wait.
+*/
+extern dbgNotify*    DbgNotifyCreate      (void);
+extern void          DbgNotifySignal      (dbgNotify* event);
+extern int           DbgNotifyWait        (dbgNotify* event, unsigned int ms);
+extern void          DbgNotifyFree        (dbgNotify* event);
+
+#endif
@@ -0,0 +1,242 @@
+/********************************************
+*
+*	output.c - Debug output capture
+*
+********************************************/
+
+/*
+	This component buffers the debug strings sent by the target. Strings
+	are read into one batch buffer that is reused for the whole session,
+	so a string costs no allocation once the buffer has grown. The session
+	manager appends consecutive strings and flushes them as one batch either
+	to the debug core or straight to a file or pipe without any formatting.
+
+	Unlike the other session objects, the batch buffer and the thread table
+	stay on the heap. Both grow by doubling and the old block is released
+	each time; the process arena cannot release a block, so every growth
+	would stay allocated until the session ends.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_DEBUGOUT_THREADS   64			/* initial thread table size */
+#define DBG_DEBUGOUT_SINKBUF   (1024*1024)	/* stdio buffer of file sinks */
+
+/**
+*	Initialize debug output capture
+*	\param session Debug session
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgDebugOutInit (IN dbgSession* session) {
+	dbgDebugOut* out = &session->debugOut;
+
+	memset (out, 0, sizeof (dbgDebugOut));
+	out->capacity = DBG_DEBUGOUT_BATCH;
+	out->buffer   = (char*) malloc (out->capacity);
+	out->threads  = (dbgDebugOutThread*) calloc (DBG_DEBUGOUT_THREADS, sizeof (dbgDebugOutThread));
+	if (!out->buffer || !out->threads) {
+		DbgDebugOutFree (session);
+		return FALSE;
+	}
+	out->threadMask = DBG_DEBUGOUT_THREADS - 1;
+	return TRUE;
+}
+
+/**
+*	Release debug output capture
+*	\param session Debug session
+*/
+void DbgDebugOutFree (IN dbgSession* session) {
+	dbgDebugOut* out = &session->debugOut;
+
+	if (out->sink)
+		fclose ((FILE*) out->sink);
+	free (out->buffer);
+	free (out->threads);
+	memset (out, 0, sizeof (dbgDebugOut));
+}
+
+/**
+*	Reserve space for the next string in the batch
+*	\param session Debug session
+*	\param length Bytes needed including the 0 terminator
+*	\ret Pointer to reserved space or 0 on error
+*/
+char* DbgDebugOutReserve (IN dbgSession* session, IN size_t length) {
+	dbgDebugOut* out = &session->debugOut;
+
+	if (out->length + length > out->capacity) {
+		size_t capacity = out->capacity;
+		char*  buffer;
+		while (out->length + length > capacity)
+			capacity *= 2;
+		buffer = (char*) realloc (out->buffer, capacity);
+		if (!buffer)
+			return 0;
+		out->buffer   = buffer;
+		out->capacity = capacity;
+	}
+	return out->buffer + out->length;
+}
+
+/**
+*	Locate thread statistics record, adding it if needed
+*/
+static dbgDebugOutThread* DbgDebugOutThreadGet (IN dbgDebugOut* out, IN tid_t tid) {
+	unsigned int i;
+
+	/* keep the table at most half full */
+	if ((out->threadCount + 1) * 2 > out->threadMask + 1) {
+		unsigned int       mask = out->threadMask * 2 + 1;
+		dbgDebugOutThread* threads = (dbgDebugOutThread*) calloc (mask + 1, sizeof (dbgDebugOutThread));
+		if (!threads)
+			return 0;
+		for (i = 0; i <= out->threadMask; i++) {
+			unsigned int j;
+			if (!out->threads[i].messages)
+				continue;
+			for (j = out->threads[i].tid & mask; threads[j].messages; j = (j + 1) & mask)
+				;
+			threads[j] = out->threads[i];
+		}
+		free (out->threads);
+		out->threads    = threads;
+		out->threadMask = mask;
+	}
+
+	for (i = tid & out->threadMask; out->threads[i].messages; i = (i + 1) & out->threadMask) {
+		if (out->threads[i].tid == tid)
+			return &out->threads[i];
+	}
+	out->threads[i].tid = tid;
+	out->threadCount++;
+	return &out->threads[i];
+}
+
+/**
+*	Add reserved string to the batch
+*	\param session Debug session
+*	\param tid Thread that sent the string
+*	\param length String length not including the 0 terminator
+*/
+void DbgDebugOutCommit (IN dbgSession* session, IN tid_t tid, IN size_t length) {
+	dbgDebugOut*       out = &session->debugOut;
+	dbgDebugOutThread* thread;
+	unsigned long long now = DbgClockNow ();
+
+	out->buffer[out->length + length] = 0;
+	out->length += length + 1;
+	out->count++;
+
+	thread = DbgDebugOutThreadGet (out, tid);
+	if (thread) {
+		if (!thread->messages)
+			thread->first = now;
+		thread->last = now;
+		thread->messages++;
+		thread->bytes += length;
+	}
+}
+
+/**
+*	Test if batch should be flushed before reading more strings
+*/
+BOOL DbgDebugOutFull (IN dbgSession* session) {
+	return session->debugOut.length >= DBG_DEBUGOUT_BATCH;
+}
+
+/**
+*	Deliver batch and reset it
+*	\param session Debug session
+*	\ret Session state
+*/
+dbgSessionState DbgDebugOutFlush (IN dbgSession* session) {
+	dbgDebugOut*    out   = &session->debugOut;
+	dbgSessionState state = DBG_STATE_CONTINUE;
+
+	if (!out->count)
+		return state;
+
+	if (out->sink) {
+		/* raw stream: strings only, no prefix or colors */
+		char*        str = out->buffer;
+		unsigned int c;
+		for (c = 0; c < out->count; c++) {
+			size_t length = strlen (str);
+			fwrite (str, 1, length, (FILE*) out->sink);
+			str += length + 1;
+		}
+	}
+	else if (!out->quiet && session->proc) {
+		dbgEventDescr descr;
+		memset (&descr, 0, sizeof (dbgEventDescr));
+		descr.event = DBG_EVENT_PRINT;
+		descr.u.debugString.string = (vaddr_t) out->buffer;
+		descr.u.debugString.length = out->length;
+		descr.u.debugString.count  = out->count;
+		state = session->proc (session, &descr);
+	}
+
+	out->batches++;
+	out->length = 0;
+	out->count  = 0;
+	return state;
+}
+
+/**
+*	Select where debug output goes
+*	\param session Debug session
+*	\param path "console", "off", or path of a file or pipe to stream to
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgDebugOutSetSink (IN dbgSession* session, IN const char* path) {
+	dbgDebugOut* out = &session->debugOut;
+	FILE*        sink = 0;
+
+	DbgDebugOutFlush (session);
+
+	if (strcmp (path, "console") && strcmp (path, "off")) {
+#ifdef _MSC_VER
+		fopen_s (&sink, path, "wb");
+#else
+		sink = fopen (path, "wb");
+#endif
+		if (!sink) {
+			DbgDisplayError ("Unable to open '%s'", path);
+			return FALSE;
+		}
+		setvbuf (sink, 0, _IOFBF, DBG_DEBUGOUT_SINKBUF);
+	}
+
+	if (out->sink)
+		fclose ((FILE*) out->sink);
+	out->sink  = sink;
+	out->quiet = strcmp (path, "off") == 0;
+	return TRUE;
+}
+
+/**
+*	Display debug output statistics
+*	\param session Debug session
+*/
+void DbgDebugOutStats (IN dbgSession* session) {
+	dbgDebugOut*       out = &session->debugOut;
+	unsigned long long messages = 0;
+	unsigned int       i;
+
+	DbgDisplayMessage ("Thread      Messages         Bytes     Msg/sec");
+	for (i = 0; i <= out->threadMask; i++) {
+		dbgDebugOutThread* thread = &out->threads[i];
+		double seconds;
+		if (!thread->messages)
+			continue;
+		seconds = (double) (thread->last - thread->first) / 1000000000.0;
+		DbgDisplayMessage ("%-8u %11lu %13llu %11.0f", thread->tid, thread->messages, thread->bytes,
+			seconds > 0.0 ? (double) thread->messages / seconds : 0.0);
+		messages += thread->messages;
+	}
+	DbgDisplayMessage ("%llu messages in %lu batches", messages, out->batches);
+}
@@ -45,36 +45,36 @@ BOOL DbgSourceCodeFromPDB (IN PSRCCODEINFO LineInfo, OUT dbgSourceLine* out) {
 
 /**
 *	Converts a PDB source file descriptor to an NDBG descriptor
+*	\param proc NDBG process descriptor that owns the name and line table
 *	\param pdb PDB descriptor
 *	\param sym NDBG descriptor
 *	\ret TRUE is success, FALSE otherwise
 */
-BOOL DbgSourceFileFromPDB (IN PSOURCEFILE pSourceFile, OUT dbgSourceFile* out) {
+BOOL DbgSourceFileFromPDB (IN dbgProcess* proc, IN PSOURCEFILE pSourceFile, OUT dbgSourceFile* out) {
 	if (!out)
 		return FALSE;
 	if (!pSourceFile)
 		return FALSE;
 
 	out->modbase = (vaddr_t) pSourceFile->ModBase;
-	out->name    = (char*) malloc (strlen(pSourceFile->FileName)+1);
-#ifdef _MSC_VER
-	strcpy_s(out->name,strlen(pSourceFile->FileName)+1,pSourceFile->FileName);
-#else
-	strcpy(out->name,pSourceFile->FileName);
-#endif
-	listInit (&out->sourceLineList);
+	out->name    = strtabIntern (&proc->strings, pSourceFile->FileName);
+	if (!out->name)
+		return FALSE;
+	vectorInitArena (&out->sourceLineList, sizeof (dbgSourceLine), &proc->heap);
 	return TRUE;
 }
 
 /**
 *	Converts a PDB symbol descriptor to an NDBG descriptor
+*	\param proc NDBG process descriptor that owns the name
 *	\param pdb PDB descriptor
 *	\param sym NDBG descriptor
 *	\ret TRUE is success, FALSE otherwise
 */
-BOOL DbgSymbolFromPDB (IN SYMBOL_INFO* pdb, OUT dbgSymbol* sym) {
+BOOL DbgSymbolFromPDB (IN dbgProcess* proc, IN SYMBOL_INFO* pdb, OUT dbgSymbol* sym) {
 
-	sym->name    = pdb->Name;
+	/* PDB descriptor is released by the caller so the name is interned */
+	sym->name    = strtabIntern (&proc->strings, pdb->Name);
 	sym->addr    = (vaddr_t) pdb->Address;
 	sym->modbase = (vaddr_t) pdb->ModBase;
 	sym->value   = pdb->Value;
@@ -136,7 +136,8 @@ BOOL CALLBACK EnumLinesProcPDB (PSRCCODEINFO LineInfo, PVOID UserContext ) {
 	if (!sourceFile) {
 		return FALSE;
 	}
-	listAddElement (&sourceLine, sizeof(sourceLine), &sourceFile->sourceLineList);
+	if (!vectorAdd (&sourceFile->sourceLineList, &sourceLine))
+		return FALSE;
 	return TRUE;
 }
 
@@ -148,14 +149,19 @@ BOOL CALLBACK EnumLinesProcPDB (PSRCCODEINFO LineInfo, PVOID UserContext ) {
 */
 BOOL CALLBACK EnumSourceFilesProcPDB (PSOURCEFILE pSourceFile,PVOID UserContext) {
 	dbgProcess* proc;
-	dbgSourceFile sourceFile;
+	dbgSourceFile* sourceFile;
 	/*
 		Add source file to list in process descriptor
 	*/
-	DbgSourceFileFromPDB (pSourceFile, &sourceFile);
-	listInit (&sourceFile.sourceLineList);
 	proc = (dbgProcess*)UserContext;
-	listAddElement (&sourceFile, sizeof(dbgSourceFile), &proc->sourceFileList);
+	sourceFile = (dbgSourceFile*) poolAlloc (&proc->sourceFilePool);
+	if (!sourceFile)
+		return FALSE;
+	if (!DbgSourceFileFromPDB (proc, pSourceFile, sourceFile)) {
+		poolRelease (&proc->sourceFilePool, sourceFile);
+		return FALSE;
+	}
+	ilistAppend (&proc->sourceFileList, &sourceFile->node);
 	return TRUE;
 }
 
@@ -182,20 +188,31 @@ BOOL CALLBACK EnumSymbolsProcPDB (PSYMBOL_INFO pSymInfo, ULONG SymbolSize, PVOID
 	return 1;
 }
 
+/*
+	Stack walk callbacks. Target memory is read through the read cache of
+	the walk in progress; module and frame data come from the symbol handler.
+*/
+
+static dbgReadCache* _walkCache = 0;
+
 BOOL CALLBACK ReadProcessMemoryProc(HANDLE hProcess,DWORD64 lpBaseAddress,
 	PVOID lpBuffer,DWORD nSize, LPDWORD lpNumberOfBytesRead) {
-	return 0;
+	size_t read = _walkCache ? DbgReadCacheRead (_walkCache, (vaddr_t) lpBaseAddress, lpBuffer, nSize) : 0;
+	if (lpNumberOfBytesRead)
+		*lpNumberOfBytesRead = (DWORD) read;
+	return read == nSize;
 }
 
 PVOID CALLBACK FunctionTableAccessProc(HANDLE hProcess,DWORD64 AddrBase) {
-	return 0;
+	return SymFunctionTableAccess64 (GetCurrentProcess(), AddrBase);
 }
 
-DWORD WINAPI GetModuleBaseProc(HANDLE hProcess,DWORD dwAddr) {
-	return 0;
+DWORD64 CALLBACK GetModuleBaseProc(HANDLE hProcess,DWORD64 dwAddr) {
+	return SymGetModuleBase64 (GetCurrentProcess(), dwAddr);
 }
 
-DWORD CALLBACK TranslateAddressProc (HANDLE hProcess,HANDLE hThread,LPADDRESS lpaddr) {
+DWORD64 CALLBACK TranslateAddressProc (HANDLE hProcess,HANDLE hThread,LPADDRESS64 lpaddr) {
+	/* flat addresses only */
 	return 0;
 }
 
@@ -212,8 +229,7 @@ DWORD CALLBACK TranslateAddressProc (HANDLE hProcess,HANDLE hThread,LPADDRESS lp
 */
 BOOL DbgLoadSymbolsPDB (dbgProcess* proc) {
 	IMAGEHLP_MODULE mod;
-	listNode*       current;
-	size_t          c;
+	ilistNode*      current;
 	/*
 		Get module information
 	*/
@@ -246,11 +262,9 @@ BOOL DbgLoadSymbolsPDB (dbgProcess* proc) {
 			SymEnumSymbols     (GetCurrentProcess(), proc->base, 0,    EnumSymbolsProcPDB,     proc);
 			SymEnumTypes       (GetCurrentProcess(), proc->base,       EnumSymbolsProcPDB,     proc);
 
-			current = proc->sourceFileList.first;
-			for (c = 0;c < proc->sourceFileList.count; c++) {
-				dbgSourceFile* currentFile = (dbgSourceFile*) current->data;
+			for (current = proc->sourceFileList.first; current; current = current->next) {
+				dbgSourceFile* currentFile = (dbgSourceFile*) current;
 				SymEnumLines (GetCurrentProcess(), proc->base, 0, currentFile->name, EnumLinesProcPDB, currentFile);
-				current = current->next;
 			}
 
 			break; 
@@ -267,11 +281,12 @@ BOOL DbgLoadSymbolsPDB (dbgProcess* proc) {
 
 /**
 * Return symbol information from symbol address
+* \param proc NDBG process descriptor
 * \param address Address of symbol
 * \param sym Output symbol descriptor
 * \ret TRUE if success, FAIL otherwise
 */
-BOOL DbgSymbolFromAddressPDB (IN vaddr_t address, OUT dbgSymbol* sym) {
+BOOL DbgSymbolFromAddressPDB (IN dbgProcess* proc, IN vaddr_t address, OUT dbgSymbol* sym) {
 	SYMBOL_INFO *pSymbol;
 	DWORD res;
 	/*
@@ -293,7 +308,7 @@ BOOL DbgSymbolFromAddressPDB (IN vaddr_t address, OUT dbgSymbol* sym) {
 	/*
 		Convert PDB descriptor to NDBG descriptor
 	*/
-	res = DbgSymbolFromPDB(pSymbol, sym);
+	res = DbgSymbolFromPDB(proc, pSymbol, sym);
 	free(pSymbol);
 	if (!res)
 		return FALSE;
@@ -302,11 +317,12 @@ BOOL DbgSymbolFromAddressPDB (IN vaddr_t address, OUT dbgSymbol* sym) {
 
 /**
 * Return symbol information from symbol name
+* \param proc NDBG process descriptor
 * \param address Name of symbol
 * \param sym Output symbol descriptor
 * \ret TRUE if success, FAIL otherwise
 */
-BOOL DbgSymbolFromNamePDB (IN const char* name, OUT dbgSymbol* sym) {
+BOOL DbgSymbolFromNamePDB (IN dbgProcess* proc, IN const char* name, OUT dbgSymbol* sym) {
 	SYMBOL_INFO *pSymbol;
 	DWORD res;
 	/*
@@ -331,13 +347,185 @@ BOOL DbgSymbolFromNamePDB (IN const char* name, OUT dbgSymbol* sym) {
 	/*
 		Convert PDB descriptor to NDBG descriptor
 	*/
-	res = DbgSymbolFromPDB(pSymbol, sym);
+	res = DbgSymbolFromPDB(proc, pSymbol, sym);
 	free(pSymbol);
 	if (!res)
 		return FALSE;
 	return TRUE;
 }
 
+/**
+*	Return frame layout of the function containing an address
+*
+*	FPO records are used when the module has them. Otherwise a function
+*	with a symbol is assumed to build a standard ebp frame.
+*
+*	\param proc NDBG process descriptor
+*	\param pc Code address
+*	\param info Output frame layout
+*	\ret TRUE if success, FALSE if nothing is known about the address
+*/
+BOOL DbgUnwindInfoPDB (IN dbgProcess* proc, IN vaddr_t pc, OUT dbgUnwindInfo* info) {
+	FPO_DATA* fpo;
+	char      buffer[sizeof (SYMBOL_INFO) + 256];
+	SYMBOL_INFO* pSymbol = (SYMBOL_INFO*) buffer;
+
+	memset (info, 0, sizeof (dbgUnwindInfo));
+
+	fpo = (FPO_DATA*) SymFunctionTableAccess (GetCurrentProcess(), pc);
+	if (fpo) {
+		info->start        = (vaddr_t) SymGetModuleBase (GetCurrentProcess(), pc) + fpo->ulOffStart;
+		info->size         = fpo->cbProcSize;
+		info->locals       = fpo->cdwLocals;
+		info->regs         = fpo->cbRegs;
+		info->prolog       = fpo->cbProlog;
+		info->framePointer = fpo->fUseBP;
+		return pc - info->start < info->size;
+	}
+
+	memset (pSymbol, 0, sizeof (buffer));
+	pSymbol->SizeOfStruct = sizeof (SYMBOL_INFO);
+	pSymbol->MaxNameLen   = 256 - 1;
+	if (!SymFromAddr (GetCurrentProcess(), pc, 0, pSymbol) || !pSymbol->Size)
+		return FALSE;
+	info->start        = (vaddr_t) pSymbol->Address;
+	info->size         = pSymbol->Size;
+	info->prolog       = 3;		/* push ebp; mov ebp, esp */
+	info->framePointer = TRUE;
+	return pc - info->start < info->size;
+}
+
+/**
+*	Name of the symbol containing an address. Does not report errors.
+*	\param address Address
+*	\param name Output name
+*	\param size Size of name buffer
+*	\param offset Output offset of address from the symbol
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgSymbolNamePDB (IN vaddr_t address, OUT char* name, IN size_t size, OUT unsigned long* offset) {
+	char         buffer[sizeof (SYMBOL_INFO) + 256];
+	SYMBOL_INFO* pSymbol = (SYMBOL_INFO*) buffer;
+	DWORD64      displacement = 0;
+
+	memset (pSymbol, 0, sizeof (buffer));
+	pSymbol->SizeOfStruct = sizeof (SYMBOL_INFO);
+	pSymbol->MaxNameLen   = 256 - 1;
+	if (!size || !SymFromAddr (GetCurrentProcess(), address, &displacement, pSymbol))
+		return FALSE;
+#ifdef _MSC_VER
+	strncpy_s (name, size, pSymbol->Name, _TRUNCATE);
+#else
+	strncpy (name, pSymbol->Name, size - 1);
+	name[size - 1] = 0;
+#endif
+	*offset = (unsigned long) displacement;
+	return TRUE;
+}
+
+/* SymTagFunction; cvconst.h is not part of the platform headers */
+#define DBG_PDB_TAG_FUNCTION 5
+
+typedef struct _dbgEnumFunctionsPDB {
+	DbgSymbolEnumProc proc;
+	void*             arg;
+	unsigned int      count;
+}dbgEnumFunctionsPDB;
+
+static BOOL CALLBACK EnumFunctionsProcPDB (PSYMBOL_INFO pSymInfo, ULONG SymbolSize, PVOID UserContext) {
+	dbgEnumFunctionsPDB* enumerate = (dbgEnumFunctionsPDB*) UserContext;
+	if (pSymInfo->Tag != DBG_PDB_TAG_FUNCTION && !(pSymInfo->Flags & SYMFLAG_EXPORT))
+		return TRUE;
+	enumerate->count++;
+	return enumerate->proc (enumerate->arg, pSymInfo->Name, (vaddr_t) pSymInfo->Address);
+}
+
+/**
+*	Enumerate functions of all loaded modules
+*	\param mask Symbol handler mask, "module!name" with * and ? wildcards
+*	\param proc Callback
+*	\param arg Callback argument
+*	\ret Number of functions passed to the callback
+*/
+unsigned int DbgEnumFunctionsPDB (IN const char* mask, IN DbgSymbolEnumProc proc, IN void* arg) {
+	dbgEnumFunctionsPDB enumerate;
+	enumerate.proc  = proc;
+	enumerate.arg   = arg;
+	enumerate.count = 0;
+	SymEnumSymbols (GetCurrentProcess(), 0, mask, EnumFunctionsProcPDB, &enumerate);
+	return enumerate.count;
+}
+
+typedef struct _dbgFunctionTablePDB {
+	dbgProcess* proc;
+	vector*     table;
+}dbgFunctionTablePDB;
+
+static BOOL CALLBACK FunctionTableProcPDB (PSYMBOL_INFO pSymInfo, ULONG SymbolSize, PVOID UserContext) {
+	dbgFunctionTablePDB* collect = (dbgFunctionTablePDB*) UserContext;
+	dbgFunctionEntry     entry;
+
+	if (pSymInfo->Tag != DBG_PDB_TAG_FUNCTION && !(pSymInfo->Flags & SYMFLAG_EXPORT))
+		return TRUE;
+	entry.start = (vaddr_t) pSymInfo->Address;
+	entry.size  = pSymInfo->Size;
+	entry.name  = strtabIntern (&collect->proc->strings, pSymInfo->Name);
+	return entry.name && vectorAdd (collect->table, &entry);
+}
+
+/**
+*	Collect the functions of all loaded modules
+*	\param proc NDBG process descriptor that owns the names
+*	\param table Output dbgFunctionEntry vector, in symbol handler order
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgFunctionTablePDB (IN dbgProcess* proc, OUT vector* table) {
+	dbgFunctionTablePDB collect;
+	collect.proc  = proc;
+	collect.table = table;
+	return SymEnumSymbols (GetCurrentProcess(), 0, "*!*", FunctionTableProcPDB, &collect);
+}
+
+/**
+*	Walk a stack with the symbol handler
+*	\param cache Read cache of the target
+*	\param thread Thread handle
+*	\param context Registers of the thread
+*	\param frames Output return addresses, starting with the current pc
+*	\param max Size of frames
+*	\ret Number of frames
+*/
+unsigned int DbgStackWalkPDB (IN dbgReadCache* cache, IN handle_t thread, IN const dbgContext* context,
+                              OUT vaddr_t* frames, IN unsigned int max) {
+	STACKFRAME64 frame;
+	CONTEXT      win32;
+	unsigned int count = 0;
+
+	memset (&frame, 0, sizeof (STACKFRAME64));
+	frame.AddrPC.Offset    = context->eip;
+	frame.AddrPC.Mode      = AddrModeFlat;
+	frame.AddrFrame.Offset = context->regs.ebp;
+	frame.AddrFrame.Mode   = AddrModeFlat;
+	frame.AddrStack.Offset = context->regs.esp;
+	frame.AddrStack.Mode   = AddrModeFlat;
+
+	memset (&win32, 0, sizeof (CONTEXT));
+	win32.ContextFlags = CONTEXT_FULL;
+	win32.Eip = context->eip;
+	win32.Esp = context->regs.esp;
+	win32.Ebp = context->regs.ebp;
+
+	_walkCache = cache;
+	while (count < max && StackWalk64 (IMAGE_FILE_MACHINE_I386, GetCurrentProcess(), (HANDLE) thread, &frame, &win32,
+		ReadProcessMemoryProc, FunctionTableAccessProc, GetModuleBaseProc, TranslateAddressProc)) {
+		if (!frame.AddrPC.Offset)
+			break;
+		frames[count++] = (vaddr_t) frame.AddrPC.Offset;
+	}
+	_walkCache = 0;
+	return count;
+}
+
 /**
 *	Initialize symbol handler
 *	\param proc NDBG process descriptor
@@ -362,7 +550,8 @@ BOOL DbgInitializePDB (dbgProcess* proc) {
 *	\param proc NDBG process descriptor
 */
 void DbgFreePDB (dbgProcess* proc) {
-	SymCleanup((HANDLE) proc->process);
+	/* the handler was initialized for the debugger's own process */
+	SymCleanup (GetCurrentProcess());
 }
 
 /**
@@ -376,4 +565,74 @@ unsigned long long DbgLoadSymbolTablePDB (char* name, vaddr_t base) {
 	return SymLoadModule (GetCurrentProcess(), 0, name, 0, base, 0);
 }
 
+/*
+
+	The following functions replay a recorded symbol table through the
+	symbol handler and the callbacks above, as if it had been read from
+	a PDB file. They are used by the symbol benchmarks.
+
+*/
+
+/**
+*	Create a module without an image file
+*	\param name Module name
+*	\param base Base address
+*	\param size Size of the module image
+*	\ret Base address or 0 on error
+*/
+vaddr_t DbgLoadVirtualModulePDB (IN const char* name, IN vaddr_t base, IN unsigned long size) {
+	return (vaddr_t) SymLoadModuleEx (GetCurrentProcess(), 0, name, name, base, size, 0, SLMFLAG_VIRTUAL);
+}
+
+/**
+*	Unload a module
+*	\param base Base address
+*/
+void DbgUnloadModulePDB (IN vaddr_t base) {
+	SymUnloadModule64 (GetCurrentProcess(), base);
+}
+
+/**
+*	Add a function to a module
+*	\param modbase Base address of the module
+*	\param name Function name
+*	\param address Function address
+*	\param size Size of the function code
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgAddSymbolPDB (IN vaddr_t modbase, IN const char* name, IN vaddr_t address, IN unsigned long size) {
+	return SymAddSymbol (GetCurrentProcess(), modbase, name, address, size, 0);
+}
+
+/**
+*	Add a source file to the process as SymEnumSourceFiles would
+*	\param proc NDBG process descriptor
+*	\param modbase Base address of the module
+*	\param name File name
+*	\ret Source file descriptor or 0 on error
+*/
+dbgSourceFile* DbgAddSourceFilePDB (IN dbgProcess* proc, IN vaddr_t modbase, IN const char* name) {
+	SOURCEFILE file;
+	file.ModBase  = modbase;
+	file.FileName = (char*) name;
+	if (!EnumSourceFilesProcPDB (&file, proc))
+		return 0;
+	return (dbgSourceFile*) proc->sourceFileList.last;
+}
+
+/**
+*	Add a line row to a source file as SymEnumLines would
+*	\param file Source file descriptor
+*	\param line Line number
+*	\param address Address of the first instruction of the line
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgAddSourceLinePDB (IN dbgSourceFile* file, IN unsigned long line, IN vaddr_t address) {
+	SRCCODEINFO info;
+	info.ModBase    = file->modbase;
+	info.LineNumber = line;
+	info.Address    = address;
+	return EnumLinesProcPDB (&info, file);
+}
+
 #endif
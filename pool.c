@@ -0,0 +1,163 @@
+/************************************************************************
+*
+*	pool.c - Pool allocator and intrusive list
+*
+************************************************************************/
+
+#include <string.h>
+#include <malloc.h>
+#include "pool.h"
+#include "arena.h"
+
+/* slab header; objects follow */
+typedef struct _poolSlab {
+	struct _poolSlab* next;
+	void*             align;
+}poolSlab;
+
+/**
+* Initialize pool
+* \arg root Pool
+* \arg elementSize Object size in bytes
+* \arg perSlab Objects allocated at once when the pool grows
+*/
+pool* poolInit (pool* root, unsigned int elementSize, unsigned int perSlab) {
+
+	/* free objects store the free list link in place */
+	if (elementSize < sizeof (void*))
+		elementSize = sizeof (void*);
+	root->elementSize = (elementSize + sizeof (void*) - 1) & ~(sizeof (void*) - 1);
+	root->perSlab = perSlab ? perSlab : 1;
+	root->count = 0;
+	root->freeList = 0;
+	root->slabs = 0;
+	root->heap = 0;
+	return root;
+}
+
+/**
+* Initialize pool that takes its slabs from an arena. The slabs
+* are released with the arena; poolFree only forgets them.
+*/
+pool* poolInitArena (pool* root, unsigned int elementSize, unsigned int perSlab, struct _arena* heap) {
+
+	poolInit (root, elementSize, perSlab);
+	root->heap = heap;
+	return root;
+}
+
+/**
+* Allocates object
+* \ret Object or 0 on error. Contents are undefined.
+*/
+void* poolAlloc (pool* root) {
+
+	void* object;
+
+	if (!root->freeList) {
+
+		poolSlab*    slab;
+		char*        objects;
+		unsigned int i;
+
+		if (root->heap)
+			slab = (poolSlab*) arenaAlloc (root->heap, sizeof (poolSlab) + (unsigned long) root->elementSize * root->perSlab);
+		else
+			slab = (poolSlab*) malloc (sizeof (poolSlab) + (size_t) root->elementSize * root->perSlab);
+		if (!slab)
+			return 0;
+		slab->next = (poolSlab*) root->slabs;
+		root->slabs = slab;
+
+		// thread new objects onto the free list
+		objects = (char*) (slab + 1);
+		for (i = 0; i < root->perSlab; i++) {
+			void** link = (void**) (objects + (size_t) i * root->elementSize);
+			*link = root->freeList;
+			root->freeList = link;
+		}
+	}
+
+	object = root->freeList;
+	root->freeList = *(void**) object;
+	root->count++;
+	return object;
+}
+
+/**
+*	returns object to pool
+*/
+void poolRelease (pool* root, void* object) {
+
+	if (!object)
+		return;
+	*(void**) object = root->freeList;
+	root->freeList = object;
+	root->count--;
+}
+
+/**
+*	frees all slabs. Every object allocated from the pool is released.
+*/
+void poolFree (pool* root) {
+
+	poolSlab* slab = root->heap ? 0 : (poolSlab*) root->slabs;
+	while (slab) {
+		poolSlab* next = slab->next;
+		free (slab);
+		slab = next;
+	}
+	root->slabs = 0;
+	root->freeList = 0;
+	root->count = 0;
+}
+
+/**
+* Initialize intrusive list
+*/
+ilist* ilistInit (ilist* root) {
+	root->first = root->last = 0;
+	root->count = 0;
+	return root;
+}
+
+/**
+* Adds node to end of list
+*/
+void ilistAppend (ilist* root, ilistNode* node) {
+
+	node->next = 0;
+	node->prev = root->last;
+	if (root->last)
+		root->last->next = node;
+	else
+		root->first = node;
+	root->last = node;
+	root->count++;
+}
+
+/**
+* Removes node from list in O(1)
+*/
+void ilistRemove (ilist* root, ilistNode* node) {
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		root->first = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		root->last = node->prev;
+	node->next = node->prev = 0;
+	root->count--;
+}
+
+/**
+*	returns size of list
+*/
+unsigned int ilistSize (ilist* root) {
+	if (root)
+		return root->count;
+	return 0;
+}
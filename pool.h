@@ -0,0 +1,72 @@
+/************************************************************************
+*
+*	pool.h - Pool allocator and intrusive list
+*
+************************************************************************/
+
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+struct _arena;
+
+/**
+*	fixed size object pool. Objects are carved from slabs and
+*	released objects are kept on a free list for reuse, so
+*	allocation and release are O(1) and never call malloc
+*	once the pool has grown.
+*/
+typedef struct _pool {
+	unsigned int elementSize;
+	unsigned int perSlab;
+	unsigned int count;		/* live objects */
+	void*        freeList;
+	void*        slabs;
+	struct _arena* heap;	/* slabs come from this arena if set */
+}pool;
+
+extern
+pool* poolInit (pool* root, unsigned int elementSize, unsigned int perSlab);
+
+extern
+pool* poolInitArena (pool* root, unsigned int elementSize, unsigned int perSlab, struct _arena* heap);
+
+extern
+void* poolAlloc (pool* root);
+
+extern
+void poolRelease (pool* root, void* object);
+
+extern
+void poolFree (pool* root);
+
+/**
+*	intrusive list node. Embed as the first member of the
+*	object so a node pointer is also the object pointer.
+*/
+typedef struct _ilistNode {
+	struct _ilistNode* next;
+	struct _ilistNode* prev;
+}ilistNode;
+
+/**
+*	intrusive doubly linked list
+*/
+typedef struct _ilist {
+	unsigned int count;
+	ilistNode*   first;
+	ilistNode*   last;
+}ilist;
+
+extern
+ilist* ilistInit (ilist* root);
+
+extern
+void ilistAppend (ilist* root, ilistNode* node);
+
+extern
+void ilistRemove (ilist* root, ilistNode* node);
+
+extern
+unsigned int ilistSize (ilist* root);
+
+#endif
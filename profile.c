@@ -0,0 +1,417 @@
+/********************************************
+*
+*	profile.c - Sampling profiler
+*
+********************************************/
+
+/*
+	This component samples the stacks of a running target at a fixed
+	rate. The session thread takes the samples between debug events:
+	each thread is suspended just long enough to read its registers and
+	unwind its stack with the cached unwind plans, then resumed. Only
+	raw return addresses are stored while the target runs.
+
+	When profiling stops, every distinct address is symbolized once and
+	the samples are folded into one line per distinct stack, the format
+	read by flame graph tools, and a top-N report of the hottest
+	functions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_PROFILE_DEPTH       64		/* deepest stack recorded */
+#define DBG_PROFILE_CACHE_LINES 8		/* stack pages cached per sample */
+#define DBG_PROFILE_LINE        4096	/* longest folded stack */
+#define DBG_PROFILE_NAME        128
+
+struct _dbgProfile {
+	unsigned long long interval;	/* ns between samples */
+	unsigned long long next;		/* clock of the next sample */
+	unsigned long long started;
+	unsigned long long spent;		/* ns spent taking samples */
+	unsigned long      ticks;		/* sampling rounds */
+	unsigned long      missed;		/* rounds skipped because the session was late */
+	unsigned long      samples;		/* thread stacks recorded */
+	vector             stacks;		/* vaddr_t: depth, then depth addresses, leaf first */
+	dbgReadCache       cache;
+	dbgFrame*          frames;
+};
+
+/* per function counts of the report */
+typedef struct _dbgProfileFunction {
+	const char*   name;			/* interned */
+	unsigned long self;
+	unsigned long total;
+	unsigned long seen;			/* last sample counted in total */
+}dbgProfileFunction;
+
+/* symbolized address */
+typedef struct _dbgProfileSymbol {
+	vaddr_t     pc;
+	const char* name;			/* interned */
+}dbgProfileSymbol;
+
+static int DbgProfileCompareAddress (const void* a, const void* b) {
+	vaddr_t x = *(const vaddr_t*) a;
+	vaddr_t y = *(const vaddr_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+static int DbgProfileComparePointer (const void* a, const void* b) {
+	const char* x = *(const char* const*) a;
+	const char* y = *(const char* const*) b;
+	return x < y ? -1 : x > y;
+}
+
+static int DbgProfileCompareSelf (const void* a, const void* b) {
+	const dbgProfileFunction* x = (const dbgProfileFunction*) a;
+	const dbgProfileFunction* y = (const dbgProfileFunction*) b;
+	if (x->self != y->self)
+		return x->self > y->self ? -1 : 1;
+	return x->total > y->total ? -1 : x->total < y->total;
+}
+
+/**
+*	Release profiler state
+*	\param session Debug session
+*/
+void DbgProfileFree (IN dbgSession* session) {
+	dbgProfile* profile = session->profile;
+	if (!profile)
+		return;
+	vectorFree (&profile->stacks);
+	DbgReadCacheFree (&profile->cache);
+	free (profile->frames);
+	free (profile);
+	session->profile = 0;
+}
+
+/**
+*	Start sampling and let the target run
+*	\param session Debug session
+*	\param rate Samples per second
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgProfileStart (IN dbgSession* session, IN unsigned int rate) {
+	dbgProfile* profile;
+
+	if (session->type != DBG_SESSION_LIVE) {
+		DbgDisplayError ("Profiling needs a live target");
+		return FALSE;
+	}
+	if (session->profile) {
+		DbgDisplayError ("Profiler is already running");
+		return FALSE;
+	}
+	if (!rate || rate > 1000) {
+		DbgDisplayError ("Rate must be between 1 and 1000 samples per second");
+		return FALSE;
+	}
+
+	profile = (dbgProfile*) calloc (1, sizeof (dbgProfile));
+	if (!profile)
+		return FALSE;
+	session->profile = profile;
+	vectorInit (&profile->stacks, sizeof (vaddr_t));
+	profile->frames = (dbgFrame*) malloc (DBG_PROFILE_DEPTH * sizeof (dbgFrame));
+	if (!profile->frames || !DbgReadCacheInit (&profile->cache, session, DBG_PROFILE_CACHE_LINES)) {
+		DbgProfileFree (session);
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+	profile->interval = 1000000000ULL / rate;
+	profile->started  = DbgClockNow ();
+	profile->next     = profile->started + profile->interval;
+
+	DbgProcessRequest (DBG_REQ_CONTINUE, session, 0, 0, 0);
+	DbgDisplayMessage ("Profiling at %u samples per second", rate);
+	return TRUE;
+}
+
+/**
+*	Time until the next sample
+*	\param session Debug session
+*	\ret Milliseconds the session may wait for debug events
+*/
+unsigned int DbgProfileWait (IN dbgSession* session) {
+	unsigned long long now = DbgClockNow ();
+	if (now >= session->profile->next)
+		return 0;
+	/* round up; waking early would only spin until the sample is due */
+	return (unsigned int) ((session->profile->next - now + 999999) / 1000000);
+}
+
+/**
+*	Record the stack of one thread
+*/
+static void DbgProfileSample (IN dbgSession* session, IN dbgProfile* profile, IN handle_t thread) {
+	dbgContext   context;
+	unsigned int count = 0;
+	unsigned int i;
+	vaddr_t      depth;
+
+	if (!DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) thread, 0, 0))
+		return;
+	if (DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread, &context, sizeof (dbgContext))) {
+		/* the stack changed since the last sample; nothing cached is valid */
+		DbgReadCacheClear (&profile->cache);
+		count = DbgUnwind (session, &profile->cache, &context, profile->frames, DBG_PROFILE_DEPTH);
+	}
+	DbgProcessRequest (DBG_REQ_RESUME, session, (void*) thread, 0, 0);
+
+	if (!count)
+		return;
+	depth = count;
+	vectorAdd (&profile->stacks, &depth);
+	for (i = 0; i < count; i++)
+		vectorAdd (&profile->stacks, &profile->frames[i].pc);
+	profile->samples++;
+}
+
+/**
+*	Take a sample of every thread if one is due
+*	\param session Debug session
+*/
+void DbgProfileTick (IN dbgSession* session) {
+	dbgProfile*        profile = session->profile;
+	unsigned long long now     = DbgClockNow ();
+	ilistNode*         cur;
+
+	if (now < profile->next || session->state != DBG_STATE_CONTINUE)
+		return;
+
+	for (cur = session->process.threadList.first; cur; cur = cur->next)
+		DbgProfileSample (session, profile, ((dbgThread*) cur)->thread);
+	profile->ticks++;
+
+	/* keep the rate; rounds the session was too late for are dropped */
+	profile->next += profile->interval;
+	if (profile->next <= now) {
+		profile->missed += (unsigned long) ((now - profile->next) / profile->interval) + 1;
+		profile->next    = now + profile->interval;
+	}
+	profile->spent += DbgClockNow () - now;
+}
+
+/**
+*	Locate symbolized address
+*/
+static const char* DbgProfileName (IN vector* symbols, IN vaddr_t pc) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (symbols);
+	while (low < high) {
+		unsigned int      mid    = (low + high) / 2;
+		dbgProfileSymbol* symbol = (dbgProfileSymbol*) vectorAt (symbols, mid);
+		if (symbol->pc == pc)
+			return symbol->name;
+		if (symbol->pc < pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return "?";
+}
+
+/**
+*	Locate function counters by interned name
+*/
+static dbgProfileFunction* DbgProfileFunctionFind (IN vector* functions, IN const char* name) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (functions);
+	while (low < high) {
+		unsigned int        mid      = (low + high) / 2;
+		dbgProfileFunction* function = (dbgProfileFunction*) vectorAt (functions, mid);
+		if (function->name == name)
+			return function;
+		if (function->name < name)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return 0;
+}
+
+/**
+*	Stop sampling and report
+*	\param session Debug session
+*	\param path Optional output file for folded stacks
+*	\param top Number of functions in the report
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgProfileStop (IN dbgSession* session, IN OPT const char* path, IN unsigned int top) {
+	dbgProfile*        profile = session->profile;
+	unsigned long long stopped = DbgClockNow ();
+	unsigned long long start;
+	arena              heap;
+	strtab             names;
+	vector             addresses;	/* vaddr_t, distinct */
+	vector             symbols;		/* dbgProfileSymbol sorted by pc */
+	vector             functions;	/* dbgProfileFunction sorted by name pointer */
+	vector             folded;		/* const char*: function names, then one stack per sample */
+	dbgSymbolization*  results;
+	char*              line;
+	size_t             at;
+	unsigned long      sample;
+	unsigned int       i;
+	double             seconds;
+
+	if (!profile) {
+		DbgDisplayError ("Profiler is not running");
+		return FALSE;
+	}
+	line = (char*) malloc (DBG_PROFILE_LINE);
+	if (!line) {
+		DbgProfileFree (session);
+		return FALSE;
+	}
+	arenaInit (&heap, 64*1024);
+	strtabInit (&names, &heap);
+	vectorInit (&addresses, sizeof (vaddr_t));
+	vectorInit (&symbols,   sizeof (dbgProfileSymbol));
+	vectorInit (&functions, sizeof (dbgProfileFunction));
+	vectorInit (&folded,    sizeof (const char*));
+
+	/* distinct addresses */
+	start = DbgClockNow ();
+	for (at = 0; at < vectorSize (&profile->stacks); ) {
+		vaddr_t depth = *(vaddr_t*) vectorAt (&profile->stacks, at);
+		for (i = 1; i <= depth; i++)
+			vectorAdd (&addresses, vectorAt (&profile->stacks, at + i));
+		at += depth + 1;
+	}
+	qsort (addresses.data, vectorSize (&addresses), sizeof (vaddr_t), DbgProfileCompareAddress);
+
+	/* symbolize each once, in one batch */
+	for (i = 0, at = 0; i < vectorSize (&addresses); i++) {
+		vaddr_t pc = *(vaddr_t*) vectorAt (&addresses, i);
+		if (!at || pc != *(vaddr_t*) vectorAt (&addresses, at - 1))
+			*(vaddr_t*) vectorAt (&addresses, at++) = pc;
+	}
+	addresses.count = (unsigned int) at;
+	results = (dbgSymbolization*) malloc ((at ? at : 1) * sizeof (dbgSymbolization));
+	if (results && !DbgSymbolizeBatch (session, (vaddr_t*) addresses.data, (unsigned int) at, results)) {
+		free (results);
+		results = 0;
+	}
+	for (i = 0; i < vectorSize (&addresses); i++) {
+		dbgProfileSymbol symbol;
+		char             name[DBG_PROFILE_NAME];
+		symbol.pc = *(vaddr_t*) vectorAt (&addresses, i);
+		if (results && results[i].function)
+			symbol.name = strtabIntern (&names, results[i].function);
+		else {
+#ifdef _MSC_VER
+			sprintf_s (name, sizeof (name), "0x%08x", symbol.pc);
+#else
+			sprintf (name, "0x%08x", symbol.pc);
+#endif
+			symbol.name = strtabIntern (&names, name);
+		}
+		vectorAdd (&symbols, &symbol);
+	}
+	free (results);
+
+	/* one counter per function */
+	for (i = 0; i < vectorSize (&symbols); i++)
+		vectorAdd (&folded, &((dbgProfileSymbol*) vectorAt (&symbols, i))->name);
+	qsort (folded.data, vectorSize (&folded), sizeof (const char*), DbgProfileComparePointer);
+	for (i = 0; i < vectorSize (&folded); i++) {
+		dbgProfileFunction function;
+		function.name = *(const char**) vectorAt (&folded, i);
+		if (i && *(const char**) vectorAt (&folded, i - 1) == function.name)
+			continue;
+		function.self  = 0;
+		function.total = 0;
+		function.seen  = 0;
+		vectorAdd (&functions, &function);
+	}
+	vectorClear (&folded);
+
+	/* fold each sample, root first, and count functions */
+	for (at = 0, sample = 1; at < vectorSize (&profile->stacks); sample++) {
+		vaddr_t     depth = *(vaddr_t*) vectorAt (&profile->stacks, at);
+		vaddr_t*    pcs   = (vaddr_t*) vectorAt (&profile->stacks, at + 1);
+		size_t      used  = 0;
+		const char* stack;
+
+		for (i = depth; i > 0; i--) {
+			const char*         name     = DbgProfileName (&symbols, pcs[i - 1]);
+			dbgProfileFunction* function = DbgProfileFunctionFind (&functions, name);
+			size_t              length   = strlen (name);
+			if (function && function->seen != sample) {
+				function->seen = sample;
+				function->total++;
+			}
+			if (function && i == 1)
+				function->self++;
+			if (used + length + 2 < DBG_PROFILE_LINE) {
+				if (used)
+					line[used++] = ';';
+				memcpy (line + used, name, length);
+				used += length;
+			}
+		}
+		line[used] = 0;
+		stack = strtabIntern (&names, line);
+		vectorAdd (&folded, &stack);
+		at += depth + 1;
+	}
+	qsort (folded.data, vectorSize (&folded), sizeof (const char*), DbgProfileComparePointer);
+
+	if (path) {
+		FILE* file;
+#ifdef _MSC_VER
+		if (fopen_s (&file, path, "w"))
+			file = 0;
+#else
+		file = fopen (path, "w");
+#endif
+		if (!file)
+			DbgDisplayError ("Unable to open '%s'", path);
+		else {
+			unsigned long count = 0;
+			for (i = 0; i < vectorSize (&folded); i++) {
+				const char* stack = *(const char**) vectorAt (&folded, i);
+				count++;
+				if (i + 1 == vectorSize (&folded) || *(const char**) vectorAt (&folded, i + 1) != stack) {
+					fprintf (file, "%s %lu\n", stack, count);
+					count = 0;
+				}
+			}
+			fclose (file);
+			DbgDisplayMessage ("Folded stacks written to %s", path);
+		}
+	}
+
+	/* report */
+	qsort (functions.data, vectorSize (&functions), sizeof (dbgProfileFunction), DbgProfileCompareSelf);
+	DbgDisplayMessage ("  Self%%  Total%%  Samples  Function");
+	for (i = 0; i < top && i < vectorSize (&functions); i++) {
+		dbgProfileFunction* function = (dbgProfileFunction*) vectorAt (&functions, i);
+		DbgDisplayMessage ("%6.1f  %6.1f  %7lu  %s",
+			100.0 * function->self / profile->samples, 100.0 * function->total / profile->samples,
+			function->self, function->name);
+	}
+
+	seconds = (double) (stopped - profile->started) / 1000000000.0;
+	DbgDisplayMessage ("%lu samples of %lu rounds in %.1f s (%.1f rounds/s, %lu late rounds dropped)",
+		profile->samples, profile->ticks, seconds, seconds > 0 ? profile->ticks / seconds : 0.0, profile->missed);
+	if (profile->samples)
+		DbgDisplayMessage ("Sampling cost %.1f us per thread sample, %.2f%% of the run; %lu distinct addresses symbolized in %.1f ms",
+			(double) profile->spent / 1000.0 / profile->samples,
+			seconds > 0 ? (double) profile->spent / 10000000.0 / seconds : 0.0,
+			(unsigned long) vectorSize (&symbols), (double) (DbgClockNow () - start) / 1000000.0);
+
+	vectorFree (&addresses);
+	vectorFree (&symbols);
+	vectorFree (&functions);
+	vectorFree (&folded);
+	strtabFree (&names);
+	arenaFree (&heap);
+	free (line);
+	DbgProfileFree (session);
+	return TRUE;
+}
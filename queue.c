@@ -0,0 +1,163 @@
+/************************************************************************
+*
+*	queue.c - Bounded lock-free queue
+*
+************************************************************************/
+
+#include <string.h>
+#include <malloc.h>
+#include "queue.h"
+
+/* cell layout: sequence number followed by element data */
+#define QUEUE_CELL_SEQ(root,pos) ((dbgAtomic*) ((root)->cells + ((pos) & (root)->mask) * (root)->cellSize))
+#define QUEUE_CELL_DATA(seq)     ((char*) (seq) + sizeof (dbgAtomic))
+
+/**
+* Initialize queue
+* \arg root Queue
+* \arg elementSize Size of each element in bytes
+* \arg capacity Number of elements, rounded up to a power of 2
+*/
+queue* queueInit (queue* root, unsigned int elementSize, unsigned int capacity) {
+
+	unsigned int size = 2;
+	unsigned int i;
+
+	while (size < capacity)
+		size <<= 1;
+
+	root->mask        = size - 1;
+	root->elementSize = elementSize;
+	root->cellSize    = (sizeof (dbgAtomic) + elementSize + sizeof (dbgAtomic) - 1) & ~(sizeof (dbgAtomic) - 1);
+	root->cells       = (char*) malloc (root->cellSize * size);
+	if (!root->cells)
+		return 0;
+
+	for (i = 0; i < size; i++)
+		*QUEUE_CELL_SEQ (root, i) = (long) i;
+	root->enqueuePos = 0;
+	root->dequeuePos = 0;
+	return root;
+}
+
+/**
+* Adds element to queue
+* \ret 1 on success, 0 if the queue is full
+*/
+int queuePush (queue* root, const void* data) {
+
+	dbgAtomic* seq;
+	unsigned long pos = (unsigned long) DbgAtomicLoad (&root->enqueuePos);
+
+	while (1) {
+
+		long diff;
+		seq  = QUEUE_CELL_SEQ (root, pos);
+		diff = (long) ((unsigned long) DbgAtomicLoad (seq) - pos);
+
+		// cell is free, try to claim it
+		if (diff == 0) {
+			if (DbgAtomicCas (&root->enqueuePos, (long) pos, (long) (pos + 1)))
+				break;
+			pos = (unsigned long) DbgAtomicLoad (&root->enqueuePos);
+		}
+		// cell still holds an element from the previous lap, queue is full
+		else if (diff < 0)
+			return 0;
+		else
+			pos = (unsigned long) DbgAtomicLoad (&root->enqueuePos);
+	}
+
+	memcpy (QUEUE_CELL_DATA (seq), data, root->elementSize);
+	DbgAtomicStore (seq, (long) (pos + 1));
+	return 1;
+}
+
+/**
+* Adds consecutive elements to queue. The cells are claimed together,
+* so elements pushed by other producers never fall between them.
+* \arg data Array of count elements
+* \ret 1 on success, 0 if the queue has no room for all of them
+*/
+int queuePushMany (queue* root, const void* data, unsigned int count) {
+
+	unsigned long pos;
+	unsigned int i;
+
+	if (!count || count > root->mask + 1)
+		return 0;
+
+	while (1) {
+
+		pos = (unsigned long) DbgAtomicLoad (&root->enqueuePos);
+
+		// every cell of the range must have been claimed by a consumer on the previous lap
+		if ((long) (pos + count - (root->mask + 1) - (unsigned long) DbgAtomicLoad (&root->dequeuePos)) > 0)
+			return 0;
+		if (DbgAtomicCas (&root->enqueuePos, (long) pos, (long) (pos + count)))
+			break;
+	}
+
+	for (i = 0; i < count; i++) {
+
+		dbgAtomic* seq = QUEUE_CELL_SEQ (root, pos + i);
+
+		// a consumer may still be copying the element of the previous lap out
+		while (DbgAtomicLoad (seq) != (long) (pos + i))
+			;
+		memcpy (QUEUE_CELL_DATA (seq), (const char*) data + (size_t) i * root->elementSize, root->elementSize);
+		DbgAtomicStore (seq, (long) (pos + i + 1));
+	}
+	return 1;
+}
+
+/**
+* Removes element from queue
+* \ret 1 on success, 0 if the queue is empty
+*/
+int queuePop (queue* root, void* data) {
+
+	dbgAtomic* seq;
+	unsigned long pos = (unsigned long) DbgAtomicLoad (&root->dequeuePos);
+
+	while (1) {
+
+		long diff;
+		seq  = QUEUE_CELL_SEQ (root, pos);
+		diff = (long) ((unsigned long) DbgAtomicLoad (seq) - (pos + 1));
+
+		// cell is full, try to claim it
+		if (diff == 0) {
+			if (DbgAtomicCas (&root->dequeuePos, (long) pos, (long) (pos + 1)))
+				break;
+			pos = (unsigned long) DbgAtomicLoad (&root->dequeuePos);
+		}
+		// producer has not published this cell yet, queue is empty
+		else if (diff < 0)
+			return 0;
+		else
+			pos = (unsigned long) DbgAtomicLoad (&root->dequeuePos);
+	}
+
+	memcpy (data, QUEUE_CELL_DATA (seq), root->elementSize);
+	DbgAtomicStore (seq, (long) (pos + root->mask + 1));
+	return 1;
+}
+
+/**
+*	returns nonzero if queue has no elements
+*/
+int queueEmpty (queue* root) {
+	return DbgAtomicLoad (&root->enqueuePos) == DbgAtomicLoad (&root->dequeuePos);
+}
+
+/**
+*	frees queue storage
+*/
+void queueFree (queue* root) {
+
+	if (root->cells)
+		free (root->cells);
+	root->cells = 0;
+	root->mask = 0;
+}
@@ -0,0 +1,48 @@
+/************************************************************************
+*
+*	queue.h - Bounded lock-free queue
+*
+************************************************************************/
+
+#ifndef QUEUE_H_INCLUDED
+#define QUEUE_H_INCLUDED
+
+#include "os.h"
+
+/**
+*	bounded multi producer, multi consumer queue of fixed size
+*	elements. Each cell carries a sequence number that tells
+*	producers and consumers whether the cell is free or full,
+*	so neither side ever takes a lock.
+*/
+typedef struct _queue {
+	unsigned int mask;
+	unsigned int elementSize;
+	unsigned int cellSize;
+	char*        cells;
+	char         pad0[64];
+	dbgAtomic    enqueuePos;
+	char         pad1[64];
+	dbgAtomic    dequeuePos;
+	char         pad2[64];
+}queue;
+
+extern
+queue* queueInit (queue* root, unsigned int elementSize, unsigned int capacity);
+
+extern
+int queuePush (queue* root, const void* data);
+
+extern
+int queuePushMany (queue* root, const void* data, unsigned int count);
+
+extern
+int queuePop (queue* root, void* data);
+
+extern
+int queueEmpty (queue* root);
+
+extern
+void queueFree (queue* root);
+
+#endif
@@ -0,0 +1,302 @@
+/********************************************
+*
+*	regex.c - Regular expressions
+*
+********************************************/
+
+/*
+	This component matches names against the small regular expression
+	language used by "rb": literals, ".", bracket classes with ranges
+	and negation, the \d \w \s classes, the *, + and ? repeats and the
+	^ and $ anchors. Groups and alternation are not supported.
+
+	A pattern compiles to a list of 256 bit character sets, each with a
+	repeat count, and is matched by backtracking. The longest run of
+	characters every match must contain is kept with the pattern, and
+	names that do not contain it are rejected with one strstr before the
+	matcher runs; most names of a large symbol table never get further.
+
+	Compiled patterns are only read while matching, so one pattern may be
+	used by several threads at once.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_REGEX_LITERAL 64	/* longest prefilter run kept */
+
+typedef enum _dbgRegexRepeat {
+	DBG_REGEX_ONE,
+	DBG_REGEX_STAR,
+	DBG_REGEX_PLUS,
+	DBG_REGEX_QUEST
+}dbgRegexRepeat;
+
+typedef struct _dbgRegexToken {
+	unsigned char  set[32];	/* one bit per character */
+	dbgRegexRepeat repeat;
+}dbgRegexToken;
+
+struct _dbgRegex {
+	dbgRegexToken* tokens;
+	unsigned int   count;
+	BOOL           begin;		/* ^ */
+	BOOL           end;			/* $ */
+	char           literal[DBG_REGEX_LITERAL];	/* every match contains this */
+};
+
+#define DBG_REGEX_IN(token,c) ((token)->set[(unsigned char) (c) >> 3] & (1 << ((unsigned char) (c) & 7)))
+
+static void DbgRegexSet (IN OUT dbgRegexToken* token, IN unsigned int first, IN unsigned int last) {
+	for (; first <= last; first++)
+		token->set[first >> 3] |= (unsigned char) (1 << (first & 7));
+}
+
+/**
+*	Add a \d \w \s class, or the escaped character itself
+*/
+static void DbgRegexEscape (IN OUT dbgRegexToken* token, IN unsigned char c) {
+	switch (c) {
+		case 'd':
+			DbgRegexSet (token, '0', '9');
+			break;
+		case 'w':
+			DbgRegexSet (token, '0', '9');
+			DbgRegexSet (token, 'A', 'Z');
+			DbgRegexSet (token, 'a', 'z');
+			DbgRegexSet (token, '_', '_');
+			break;
+		case 's':
+			DbgRegexSet (token, ' ', ' ');
+			DbgRegexSet (token, '\t', '\r');
+			break;
+		default:
+			DbgRegexSet (token, c, c);
+	}
+}
+
+/**
+*	Parse a bracket class
+*	\param pattern Character after the [
+*	\ret Character after the ], or 0 if the class is not closed
+*/
+static const char* DbgRegexClass (IN const char* pattern, OUT dbgRegexToken* token) {
+	const char* start  = pattern;
+	BOOL        negate = FALSE;
+	unsigned int i;
+
+	if (*pattern == '^') {
+		negate = TRUE;
+		start  = ++pattern;
+	}
+	/* a ] right after the [ or [^ is a member */
+	while (*pattern && (*pattern != ']' || pattern == start)) {
+		unsigned char first = (unsigned char) *pattern++;
+		unsigned char last;
+
+		if (first == '\\') {
+			if (!*pattern)
+				return 0;
+			DbgRegexEscape (token, (unsigned char) *pattern++);
+			continue;
+		}
+		last = first;
+		if (pattern[0] == '-' && pattern[1] && pattern[1] != ']') {
+			last = (unsigned char) pattern[1];
+			pattern += 2;
+		}
+		if (first <= last)
+			DbgRegexSet (token, first, last);
+	}
+	if (!*pattern)
+		return 0;
+	if (negate) {
+		for (i = 0; i < sizeof (token->set); i++)
+			token->set[i] = (unsigned char) ~token->set[i];
+	}
+	/* names never contain the terminator */
+	token->set[0] &= 0xfe;
+	return pattern + 1;
+}
+
+/**
+*	Character of a token that matches exactly one character, or 0
+*/
+static unsigned char DbgRegexSingle (IN const dbgRegexToken* token) {
+	unsigned int c;
+	unsigned int found = 0;
+
+	for (c = 1; c < 256; c++) {
+		if (!DBG_REGEX_IN (token, c))
+			continue;
+		if (found)
+			return 0;
+		found = c;
+	}
+	return (unsigned char) found;
+}
+
+/**
+*	Keep the longest run of single characters that every match contains
+*/
+static void DbgRegexPrefilter (IN OUT dbgRegex* regex) {
+	char         run[DBG_REGEX_LITERAL];
+	size_t       length = 0;
+	unsigned int i;
+
+	for (i = 0; i <= regex->count; i++) {
+		dbgRegexToken* token = i < regex->count ? &regex->tokens[i] : 0;
+		unsigned char  c     = token ? DbgRegexSingle (token) : 0;
+
+		if (c && token->repeat != DBG_REGEX_STAR && token->repeat != DBG_REGEX_QUEST
+			&& length + 1 < DBG_REGEX_LITERAL) {
+			run[length++] = (char) c;
+			/* x+ needs one x; what follows may come after more of them */
+			if (token->repeat == DBG_REGEX_ONE)
+				continue;
+		}
+		if (length > strlen (regex->literal)) {
+			memcpy (regex->literal, run, length);
+			regex->literal[length] = 0;
+		}
+		length = 0;
+	}
+}
+
+/**
+*	Compile a pattern
+*	\param pattern Regular expression
+*	\ret Compiled pattern to be released with DbgRegexFree, or 0 if it is not valid
+*/
+dbgRegex* DbgRegexCompile (IN const char* pattern) {
+	dbgRegex* regex;
+	size_t    length = strlen (pattern);
+
+	regex = (dbgRegex*) calloc (1, sizeof (dbgRegex) + (length + 1) * sizeof (dbgRegexToken));
+	if (!regex)
+		return 0;
+	regex->tokens = (dbgRegexToken*) (regex + 1);
+
+	if (*pattern == '^') {
+		regex->begin = TRUE;
+		pattern++;
+	}
+	while (*pattern) {
+		dbgRegexToken* token = &regex->tokens[regex->count];
+		unsigned char  c     = (unsigned char) *pattern++;
+
+		switch (c) {
+			case '*':
+			case '+':
+			case '?':
+				if (!regex->count || regex->tokens[regex->count - 1].repeat != DBG_REGEX_ONE) {
+					DbgDisplayError ("Nothing to repeat before '%c'", c);
+					DbgRegexFree (regex);
+					return 0;
+				}
+				regex->tokens[regex->count - 1].repeat = c == '*' ? DBG_REGEX_STAR : c == '+' ? DBG_REGEX_PLUS : DBG_REGEX_QUEST;
+				continue;
+			case '(':
+			case ')':
+			case '|':
+				DbgDisplayError ("Groups and alternation are not supported; use \\%c for the character", c);
+				DbgRegexFree (regex);
+				return 0;
+			case '$':
+				if (!*pattern) {
+					regex->end = TRUE;
+					continue;
+				}
+				DbgRegexSet (token, c, c);
+				break;
+			case '.':
+				DbgRegexSet (token, 1, 255);
+				break;
+			case '[':
+				pattern = DbgRegexClass (pattern, token);
+				if (!pattern) {
+					DbgDisplayError ("Unterminated [ in regular expression");
+					DbgRegexFree (regex);
+					return 0;
+				}
+				break;
+			case '\\':
+				if (!*pattern) {
+					DbgDisplayError ("Trailing \\ in regular expression");
+					DbgRegexFree (regex);
+					return 0;
+				}
+				DbgRegexEscape (token, (unsigned char) *pattern++);
+				break;
+			default:
+				DbgRegexSet (token, c, c);
+		}
+		token->repeat = DBG_REGEX_ONE;
+		regex->count++;
+	}
+	DbgRegexPrefilter (regex);
+	return regex;
+}
+
+/**
+*	Match tokens from the given one on at a position
+*/
+static BOOL DbgRegexHere (IN const dbgRegex* regex, IN unsigned int t, IN const char* text) {
+	for (; t < regex->count; t++) {
+		const dbgRegexToken* token = &regex->tokens[t];
+		size_t               most;
+		size_t               least;
+		size_t               n = 0;
+
+		if (token->repeat == DBG_REGEX_ONE) {
+			if (!DBG_REGEX_IN (token, *text))
+				return FALSE;
+			text++;
+			continue;
+		}
+		/* greedy; give characters back until the rest matches */
+		least = token->repeat == DBG_REGEX_PLUS;
+		most  = token->repeat == DBG_REGEX_QUEST ? 1 : (size_t) -1;
+		while (n < most && DBG_REGEX_IN (token, text[n]))
+			n++;
+		for (; n >= least; n--) {
+			if (DbgRegexHere (regex, t + 1, text + n))
+				return TRUE;
+			if (!n)
+				break;
+		}
+		return FALSE;
+	}
+	return !regex->end || !*text;
+}
+
+/**
+*	Test whether a pattern matches anywhere in a string
+*	\param regex Compiled pattern
+*	\param text String
+*	\ret TRUE if it matches
+*/
+BOOL DbgRegexMatch (IN const dbgRegex* regex, IN const char* text) {
+	if (regex->literal[0] && !strstr (text, regex->literal))
+		return FALSE;
+	if (regex->begin)
+		return DbgRegexHere (regex, 0, text);
+	for (;; text++) {
+		/* skip starts the first token rejects */
+		if (!regex->count || regex->tokens[0].repeat != DBG_REGEX_ONE || DBG_REGEX_IN (&regex->tokens[0], *text)) {
+			if (DbgRegexHere (regex, 0, text))
+				return TRUE;
+		}
+		if (!*text)
+			return FALSE;
+	}
+}
+
+/**
+*	Release a compiled pattern
+*	\param regex Compiled pattern or 0
+*/
+void DbgRegexFree (IN dbgRegex* regex) {
+	free (regex);
+}
@@ -0,0 +1,494 @@
+/********************************************
+*
+*	search.c - Memory search
+*
+********************************************/
+
+/*
+	This component searches the readable memory of the target for a byte
+	pattern. Adjacent readable regions are merged into runs and split into
+	work items that worker threads claim in turn. Each worker reads its
+	item in large chunks into a private buffer and scans it with AVX2 or
+	SSE2 kernels, depending on what the compiler targets. Hits are
+	displayed as they are found.
+
+	Patterns may mask individual nibbles. The scanner looks for one fully
+	specified anchor byte and verifies the rest of the pattern at each
+	candidate. Pointer values are matched on aligned dwords only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#if defined(__AVX2__)
+#define DBG_SEARCH_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DBG_SEARCH_SSE2
+#include <emmintrin.h>
+#endif
+
+#define DBG_SEARCH_PATTERN_MAX 256
+#define DBG_SEARCH_ITEM        (16*1024*1024)	/* largest work item */
+#define DBG_SEARCH_CHUNK       (1024*1024)		/* read size */
+#define DBG_SEARCH_WORKERS     8
+#define DBG_SEARCH_USER_END    0x80000000ULL	/* end of the user address space */
+
+typedef struct _dbgSearchItem {
+	vaddr_t            base;
+	unsigned long      size;
+	unsigned long long end;		/* end of the readable run; matches may extend past the item */
+}dbgSearchItem;
+
+typedef struct _dbgSearch {
+	dbgSession*   session;
+	unsigned char bytes[DBG_SEARCH_PATTERN_MAX];	/* pattern with masked bits cleared */
+	unsigned char mask[DBG_SEARCH_PATTERN_MAX];
+	size_t        length;
+	size_t        anchor;		/* offset of a fully specified byte; length if there is none */
+	BOOL          pointer;		/* pattern is a dword matched on aligned addresses only */
+	vector        items;		/* dbgSearchItem */
+	dbgAtomic     next;			/* items claimed so far */
+	dbgAtomic     hits;
+	dbgAtomic     stopped;		/* set once memory is left unscanned for the limit */
+	long          limit;
+}dbgSearch;
+
+typedef struct _dbgSearchWorker {
+	dbgSearch*         search;
+	dbgWorker*         worker;
+	unsigned long long scanned;
+}dbgSearchWorker;
+
+/**
+*	Index of the lowest set bit; bits must not be 0
+*/
+static unsigned int DbgSearchLowBit (unsigned int bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward (&index, bits);
+	return index;
+#else
+	return (unsigned int) __builtin_ctz (bits);
+#endif
+}
+
+/**
+*	Report a hit
+*	\ret FALSE if the hit limit has been reached
+*/
+static BOOL DbgSearchHit (IN dbgSearch* search, IN vaddr_t address) {
+	if (DbgAtomicInc (&search->hits) > search->limit) {
+		DbgAtomicStore (&search->stopped, 1);
+		return FALSE;
+	}
+	DbgDisplayMessage ("0x%08x", address);
+	return TRUE;
+}
+
+/**
+*	Verify the full pattern at a candidate
+*/
+static BOOL DbgSearchMatch (IN dbgSearch* search, IN const unsigned char* at) {
+	size_t i;
+	for (i = 0; i < search->length; i++) {
+		if ((at[i] & search->mask[i]) != search->bytes[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Scan buffer for a byte pattern
+*	\param search Search descriptor
+*	\param data Buffer
+*	\param length Bytes in buffer
+*	\param starts Only matches starting before this offset are reported
+*	\param base Address of the buffer
+*	\ret FALSE if the search should stop
+*/
+static BOOL DbgSearchScanBytes (IN dbgSearch* search, IN const unsigned char* data, IN size_t length,
+                                IN size_t starts, IN vaddr_t base) {
+	size_t        anchor = search->anchor;
+	size_t        end;
+	size_t        j = 0;
+
+	if (length < search->length)
+		return TRUE;
+	end = length - search->length + 1;
+	if (end > starts)
+		end = starts;
+
+	/* no fully specified byte; every offset is a candidate */
+	if (anchor == search->length) {
+		for (; j < end; j++) {
+			if (DbgSearchMatch (search, data + j) && !DbgSearchHit (search, base + (vaddr_t) j))
+				return FALSE;
+		}
+		return TRUE;
+	}
+
+#if defined(DBG_SEARCH_AVX2)
+	{
+		__m256i needle = _mm256_set1_epi8 ((char) search->bytes[anchor]);
+		for (; j + 32 <= end; j += 32) {
+			unsigned int bits = (unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (
+				_mm256_loadu_si256 ((const __m256i*) (data + j + anchor)), needle));
+			while (bits) {
+				unsigned int k = DbgSearchLowBit (bits);
+				bits &= bits - 1;
+				if (DbgSearchMatch (search, data + j + k) && !DbgSearchHit (search, base + (vaddr_t) (j + k)))
+					return FALSE;
+			}
+		}
+	}
+#elif defined(DBG_SEARCH_SSE2)
+	{
+		__m128i needle = _mm_set1_epi8 ((char) search->bytes[anchor]);
+		for (; j + 16 <= end; j += 16) {
+			unsigned int bits = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+				_mm_loadu_si128 ((const __m128i*) (data + j + anchor)), needle));
+			while (bits) {
+				unsigned int k = DbgSearchLowBit (bits);
+				bits &= bits - 1;
+				if (DbgSearchMatch (search, data + j + k) && !DbgSearchHit (search, base + (vaddr_t) (j + k)))
+					return FALSE;
+			}
+		}
+	}
+#endif
+
+	for (; j < end; j++) {
+		if (data[j + anchor] == search->bytes[anchor] && DbgSearchMatch (search, data + j)
+			&& !DbgSearchHit (search, base + (vaddr_t) j))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Scan buffer for an aligned dword; buffer and base must be dword aligned
+*	\ret FALSE if the search should stop
+*/
+static BOOL DbgSearchScanPointer (IN dbgSearch* search, IN const unsigned char* data, IN size_t length,
+                                  IN size_t starts, IN vaddr_t base) {
+	unsigned int value;
+	size_t       end;
+	size_t       j = 0;
+
+	if (length < 4)
+		return TRUE;
+	memcpy (&value, search->bytes, 4);
+	end = length - 3;
+	if (end > starts)
+		end = starts;
+
+#if defined(DBG_SEARCH_AVX2)
+	{
+		__m256i needle = _mm256_set1_epi32 ((int) value);
+		for (; j + 32 <= length && j < end; j += 32) {
+			unsigned int bits = (unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi32 (
+				_mm256_loadu_si256 ((const __m256i*) (data + j)), needle)) & 0x11111111;
+			while (bits) {
+				unsigned int k = DbgSearchLowBit (bits);
+				bits &= bits - 1;
+				if (j + k < end && !DbgSearchHit (search, base + (vaddr_t) (j + k)))
+					return FALSE;
+			}
+		}
+	}
+#elif defined(DBG_SEARCH_SSE2)
+	{
+		__m128i needle = _mm_set1_epi32 ((int) value);
+		for (; j + 16 <= length && j < end; j += 16) {
+			unsigned int bits = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi32 (
+				_mm_loadu_si128 ((const __m128i*) (data + j)), needle)) & 0x1111;
+			while (bits) {
+				unsigned int k = DbgSearchLowBit (bits);
+				bits &= bits - 1;
+				if (j + k < end && !DbgSearchHit (search, base + (vaddr_t) (j + k)))
+					return FALSE;
+			}
+		}
+	}
+#endif
+
+	for (; j < end; j += 4) {
+		if (memcmp (data + j, &value, 4) == 0 && !DbgSearchHit (search, base + (vaddr_t) j))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Search worker thread entry point
+*/
+static int DbgSearchWorkerEntry (void* arg) {
+	dbgSearchWorker* worker = (dbgSearchWorker*) arg;
+	dbgSearch*       search = worker->search;
+	unsigned char*   buffer;
+	long             index;
+
+	buffer = (unsigned char*) malloc (DBG_SEARCH_CHUNK + DBG_SEARCH_PATTERN_MAX);
+	if (!buffer)
+		return 0;
+
+	while ((index = DbgAtomicInc (&search->next) - 1) < (long) vectorSize (&search->items)) {
+		dbgSearchItem* item = (dbgSearchItem*) vectorAt (&search->items, index);
+		unsigned long  offset;
+		unsigned long  chunk;
+
+		for (offset = 0; offset < item->size; offset += chunk) {
+			vaddr_t        at   = item->base + offset;
+			unsigned char* data = 0;
+			size_t         read;
+			BOOL           more;
+
+			chunk = item->size - offset > DBG_SEARCH_CHUNK ? DBG_SEARCH_CHUNK : item->size - offset;
+
+			/* overlap the next chunk so matches crossing the boundary are found */
+			read = chunk + search->length - 1;
+			if (at + (unsigned long long) read > item->end)
+				read = (size_t) (item->end - at);
+
+			if (DbgAtomicLoad (&search->hits) >= search->limit) {
+				DbgAtomicStore (&search->stopped, 1);
+				break;
+			}
+
+			/* scan mapped memory in place; copy it otherwise */
+			DbgProcessRequest (DBG_REQ_PEEK, search->session, (void*) at, &data, read);
+			if (!data) {
+				if (DbgProcessRequest (DBG_REQ_READ, search->session, (void*) at, buffer, read) != read)
+					continue;	/* region changed since it was enumerated */
+				data = buffer;
+			}
+
+			worker->scanned += chunk;
+			more = search->pointer
+				? DbgSearchScanPointer (search, data, read, chunk, at)
+				: DbgSearchScanBytes (search, data, read, chunk, at);
+			if (data != buffer)
+				DbgProcessRequest (DBG_REQ_UNPEEK, search->session, (void*) at, data, read);
+			if (!more)
+				break;
+		}
+	}
+
+	free (buffer);
+	return 0;
+}
+
+/**
+*	Build work items from the readable regions of the target
+*	\ret Number of bytes to scan
+*/
+static unsigned long long DbgSearchRegions (IN dbgSearch* search) {
+	unsigned long long at    = 0;
+	unsigned long long run   = 0;	/* start of current readable run */
+	unsigned long long total = 0;
+	BOOL               inRun = FALSE;
+
+	while (at < DBG_SEARCH_USER_END) {
+		dbgMemoryRegion    region;
+		unsigned long long begin = at;
+		unsigned long long end;
+		BOOL               readable = FALSE;
+
+		if (DbgProcessRequest (DBG_REQ_QUERY, search->session, (void*) (vaddr_t) at, &region, sizeof (region))) {
+			end      = (unsigned long long) region.base + region.size;
+			readable = region.readable;
+		}
+		else
+			end = DBG_SEARCH_USER_END;
+		if (end <= at)
+			break;
+
+		if (readable && !inRun) {
+			run   = at;
+			inRun = TRUE;
+		}
+		at = end;
+
+		/* close the run at the first unreadable region or at the end */
+		if (inRun && (!readable || at >= DBG_SEARCH_USER_END)) {
+			unsigned long long runEnd = readable ? at : begin;
+			unsigned long long base;
+			for (base = run; base < runEnd; base += DBG_SEARCH_ITEM) {
+				dbgSearchItem item;
+				item.base = (vaddr_t) base;
+				item.size = (unsigned long) (runEnd - base > DBG_SEARCH_ITEM ? DBG_SEARCH_ITEM : runEnd - base);
+				item.end  = runEnd;
+				vectorAdd (&search->items, &item);
+			}
+			total += runEnd - run;
+			inRun  = FALSE;
+		}
+	}
+	return total;
+}
+
+/**
+*	Convert a hex digit
+*	\ret Digit value or -1 if it is not a hex digit
+*/
+static int DbgSearchHexDigit (IN char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+*	Build search pattern
+*	\param search Search descriptor
+*	\param mode Pattern type
+*	\param pattern Pattern text
+*	\ret TRUE if success, FALSE otherwise
+*/
+static BOOL DbgSearchParse (IN dbgSearch* search, IN dbgSearchMode mode, IN const char* pattern) {
+	size_t length = strlen (pattern);
+	size_t i;
+
+	switch (mode) {
+		case DBG_SEARCH_BYTES:
+			/* hex digits; '?' matches any nibble */
+			if (!length || length % 2 || length / 2 > DBG_SEARCH_PATTERN_MAX)
+				return FALSE;
+			for (i = 0; i < length; i++) {
+				int digit = DbgSearchHexDigit (pattern[i]);
+				int shift = i % 2 ? 0 : 4;
+				if (pattern[i] == '?')
+					continue;
+				if (digit < 0)
+					return FALSE;
+				search->bytes[i/2] |= (unsigned char) (digit << shift);
+				search->mask[i/2]  |= (unsigned char) (0x0f << shift);
+			}
+			search->length = length / 2;
+			break;
+		case DBG_SEARCH_ASCII:
+			if (!length || length > DBG_SEARCH_PATTERN_MAX)
+				return FALSE;
+			memcpy (search->bytes, pattern, length);
+			memset (search->mask, 0xff, length);
+			search->length = length;
+			break;
+		case DBG_SEARCH_UNICODE:
+			/* UTF-16LE; pattern is ASCII */
+			if (!length || length * 2 > DBG_SEARCH_PATTERN_MAX)
+				return FALSE;
+			for (i = 0; i < length; i++)
+				search->bytes[i*2] = (unsigned char) pattern[i];
+			memset (search->mask, 0xff, length * 2);
+			search->length = length * 2;
+			break;
+		case DBG_SEARCH_POINTER: {
+			vaddr_t value = (vaddr_t) strtoul (pattern, 0, 16);
+			memcpy (search->bytes, &value, sizeof (vaddr_t));
+			memset (search->mask, 0xff, sizeof (vaddr_t));
+			search->length  = sizeof (vaddr_t);
+			search->pointer = TRUE;
+			break;
+		}
+		default:
+			return FALSE;
+	}
+
+	/* prefer an anchor byte that is unlikely to be common in memory */
+	search->anchor = search->length;
+	for (i = 0; i < search->length; i++) {
+		if (search->mask[i] != 0xff)
+			continue;
+		if (search->anchor == search->length)
+			search->anchor = i;
+		if (search->bytes[i] != 0x00 && search->bytes[i] != 0xff) {
+			search->anchor = i;
+			break;
+		}
+	}
+	for (i = 0; i < search->length; i++) {
+		if (search->mask[i])
+			return TRUE;
+	}
+	return FALSE;	/* pattern matches everything */
+}
+
+/**
+*	Search target memory for a pattern and display each hit
+*	\param session Debug session
+*	\param mode Pattern type
+*	\param pattern Pattern text
+*	\param limit Stop after this many hits
+*	\ret TRUE if success, FALSE otherwise
+*/
+BOOL DbgSearch (IN dbgSession* session, IN dbgSearchMode mode, IN const char* pattern, IN unsigned long limit) {
+	dbgSearch*         search;
+	dbgSearchWorker    workers[DBG_SEARCH_WORKERS];
+	unsigned int       count;
+	unsigned int       i;
+	unsigned long long total;
+	unsigned long long scanned = 0;
+	unsigned long long start;
+	double             seconds;
+	long               hits;
+
+	search = (dbgSearch*) calloc (1, sizeof (dbgSearch));
+	if (!search)
+		return FALSE;
+	search->session = session;
+	search->limit   = (long) limit;
+	if (!DbgSearchParse (search, mode, pattern)) {
+		DbgDisplayError ("Invalid search pattern '%s'", pattern);
+		free (search);
+		return FALSE;
+	}
+
+	start = DbgClockNow ();
+	vectorInit (&search->items, sizeof (dbgSearchItem));
+	total = DbgSearchRegions (search);
+
+	count = DbgProcessorCount ();
+	if (count > DBG_SEARCH_WORKERS)
+		count = DBG_SEARCH_WORKERS;
+	if (count > vectorSize (&search->items))
+		count = vectorSize (&search->items);
+
+	for (i = 0; i < count; i++) {
+		workers[i].search  = search;
+		workers[i].scanned = 0;
+		workers[i].worker  = DbgWorkerCreate (DbgSearchWorkerEntry, &workers[i]);
+	}
+	/* scan on this thread too; it covers the search if no worker could start */
+	{
+		dbgSearchWorker self;
+		self.search  = search;
+		self.scanned = 0;
+		DbgSearchWorkerEntry (&self);
+		scanned += self.scanned;
+	}
+	for (i = 0; i < count; i++) {
+		if (!workers[i].worker)
+			continue;
+		DbgWorkerJoin (workers[i].worker);
+		scanned += workers[i].scanned;
+	}
+	seconds = (double) (DbgClockNow () - start) / 1000000000.0;
+
+	hits = DbgAtomicLoad (&search->hits);
+	if (DbgAtomicLoad (&search->stopped))
+		DbgDisplayMessage ("Stopped at the limit of %li hits", search->limit);
+	DbgDisplayMessage ("%li hits, %llu of %llu MB scanned in %.3f s, %.1f MB/s",
+		hits > search->limit ? search->limit : hits,
+		scanned / (1024*1024), total / (1024*1024), seconds,
+		seconds > 0.0 ? (double) scanned / (1024.0 * 1024.0) / seconds : 0.0);
+
+	vectorFree (&search->items);
+	free (search);
+	return TRUE;
+}
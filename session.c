@@ -11,6 +11,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <dbghelp.h>
+#include <psapi.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,7 +19,16 @@
 #include "list.h"
 
 /* current session */
-static dbgSession*	_currentSession = 0;
+static dbgSession* volatile _currentSession = 0;
+
+/* process arena chunk size */
+#define DBG_SESSION_ARENA_CHUNK (256*1024)
+
+/* how long the session thread waits for a debug event before serving commands */
+#define DBG_SESSION_POLL_MS 50
+
+/* per thread completion notification used by DbgSessionCall */
+static DBG_THREAD_LOCAL dbgNotify* _sessionCallNotify = 0;
 
 INLINE char* DbgSessionGetProcessName (dbgSession* session) {
 	return session->process.name;
@@ -52,6 +62,14 @@ dbgSession* DbgSessionNew (char* command, pid_t pid, tid_t tid, handle_t process
 	dbgSession* session = (dbgSession*) malloc (sizeof (dbgSession));   
 	if (!session)
 		return 0;
+	session->type = DBG_SESSION_LIVE;
+	session->core = 0;
+	session->sim = 0;
+	session->profile = 0;
+	session->coverage = 0;
+	session->fuzz = 0;
+	session->created = DbgClockNow ();
+	session->stopped = 0;
 	session->process.name = command;
 	session->process.id.pid = pid;
 	session->process.id.tid = tid;
@@ -59,44 +77,83 @@ dbgSession* DbgSessionNew (char* command, pid_t pid, tid_t tid, handle_t process
 	session->process.thread = thread;
 	session->state = DBG_STATE_CONTINUE;
 	session->proc = 0;
-	listInit (&session->process.libraryList);
-	listInit (&session->process.threadList);
-	listInit (&session->process.sourceFileList);
-	listInit (&session->process.breakPointList);
-	listInit (&session->process.watchPointList);
+	session->owner = DbgThreadCurrentId ();
+	session->wake = DbgNotifyCreate ();
+	if (!session->wake || !queueInit (&session->commands, sizeof (dbgSessionCommand), DBG_SESSION_QUEUE_SIZE)) {
+		DbgNotifyFree (session->wake);
+		free (session);
+		return 0;
+	}
+	if (!DbgDebugOutInit (session)) {
+		queueFree (&session->commands);
+		DbgNotifyFree (session->wake);
+		free (session);
+		return 0;
+	}
+	DbgHistoryInit (session);
+	DbgFilterInit (session);
+	memset (&session->batch, 0, sizeof (dbgEventBatch));
+	vectorInit (&session->batch.stops, sizeof (dbgBatchStop));
+	vectorInit (&session->batch.held,  sizeof (handle_t));
+	ilistInit (&session->process.libraryList);
+	ilistInit (&session->process.threadList);
+	ilistInit (&session->process.sourceFileList);
+	ilistInit (&session->process.breakPointList);
+	ilistInit (&session->process.watchPointList);
+	memset (&session->process.breakPointIndex, 0, sizeof (dbgBreakpointIndex));
+	arenaInit (&session->process.heap, DBG_SESSION_ARENA_CHUNK);
+	strtabInit (&session->process.strings, &session->process.heap);
+	poolInitArena (&session->process.libraryPool,    sizeof (dbgSharedLibrary), 64,  &session->process.heap);
+	poolInitArena (&session->process.threadPool,     sizeof (dbgThread),        64,  &session->process.heap);
+	poolInitArena (&session->process.sourceFilePool, sizeof (dbgSourceFile),    256, &session->process.heap);
+	poolInitArena (&session->process.breakPointPool, sizeof (dbgBreakpoint),    256, &session->process.heap);
+	poolInitArena (&session->process.watchPointPool, sizeof (dbgWatchpoint),    16,  &session->process.heap);
+	DbgModuleInit (session);
+	DbgUnwindInit (session);
+	DbgSymbolizeInit (session);
 	return session;
 }
 
 void DbgSessionDeleteProc (dbgSession* session) {
-	listNode* current;
-	size_t    c;
-
-	listFreeAll(&session->process.libraryList);
-	listFreeAll(&session->process.threadList);
-	current = session->process.sourceFileList.first;
-	for (c=0; c<session->process.sourceFileList.count; c++) {
-		dbgSourceFile* sourceFile;
 
-		sourceFile = (dbgSourceFile*) current->data;
-		free (sourceFile->name);
-		sourceFile->name = 0;
-
-		listFreeAll (&sourceFile->sourceLineList);
-		current = current->next;
-	}
-	listFreeAll(&session->process.sourceFileList);
+	/* objects, names and line tables live in the process arena; releasing it releases them all */
+	poolFree (&session->process.libraryPool);
+	poolFree (&session->process.threadPool);
+	poolFree (&session->process.sourceFilePool);
+	poolFree (&session->process.breakPointPool);
+	poolFree (&session->process.watchPointPool);
+	ilistInit (&session->process.libraryList);
+	ilistInit (&session->process.threadList);
+	ilistInit (&session->process.sourceFileList);
+	ilistInit (&session->process.breakPointList);
+	ilistInit (&session->process.watchPointList);
+	DbgModuleFree (session);
+	vectorFree (&session->process.unwindPlans);
+	DbgSymbolizeFree (session);
+	DbgBreakpointIndexFree (session);
+	strtabFree (&session->process.strings);
+	arenaFree (&session->process.heap);
 }
 
 void DbgSessionDelete (dbgSession* session) {
 	if (!session)
 		return;
-	if (session->process.id.pid)
+	if (session->type == DBG_SESSION_LIVE && session->process.id.pid)
 		DebugActiveProcessStop (session->process.id.pid);
-	if (session->process.thread)
+	if (session->type == DBG_SESSION_LIVE && session->process.thread)
 		CloseHandle ((HANDLE)session->process.thread);
-	if (session->process.process)
+	if (session->type == DBG_SESSION_LIVE && session->process.process)
 		CloseHandle ((HANDLE)session->process.process);
+	DbgHistoryFree (session);
+	DbgProfileFree (session);
+	DbgCoverageFree (session);
+	DbgFuzzFree (session);
+	vectorFree (&session->batch.stops);
+	vectorFree (&session->batch.held);
 	DbgSessionDeleteProc (session);
+	queueFree (&session->commands);
+	DbgNotifyFree (session->wake);
+	DbgDebugOutFree (session);
 }
 
 //FlushInstructionCache(m_cProcessInfo.hProcess,(void*)dwStartAddress,1);
@@ -180,9 +237,47 @@ void DbgContextFromWin32 (IN CONTEXT* in, OUT dbgContext* out) {
 }
 
 /**
-*	Process session request
+*	Hold a stop that arrived after another stop of the same batch
+*	\param session Debug session
+*	\param tid Thread that stopped
+*	\param record Exception
+*	\ret Session state
+*/
+static dbgSessionState DbgSessionHoldStop (dbgSession* session, tid_t tid, dbgExceptionDescr* record) {
+	ilistNode*   cur;
+	dbgBatchStop stop;
+
+	for (cur = session->process.threadList.first; cur; cur = cur->next) {
+		dbgThread* thread = (dbgThread*) cur;
+		if (thread->id != tid)
+			continue;
+		/* keep it at the stop until the target is continued */
+		if (DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) thread->thread, 0, 0))
+			vectorAdd (&session->batch.held, &thread->thread);
+		break;
+	}
+	stop.tid         = tid;
+	stop.address     = record->address;
+	stop.code        = record->code;
+	stop.firstChance = record->firstChance;
+	vectorAdd (&session->batch.stops, &stop);
+	return DBG_STATE_SUSPEND;
+}
+
+/**
+*	Resume every thread held at a stop, in one pass
+*	\param session Debug session
+*/
+static void DbgSessionReleaseHeld (dbgSession* session) {
+	unsigned int i;
+	for (i = 0; i < vectorSize (&session->batch.held); i++)
+		DbgProcessRequest (DBG_REQ_RESUME, session, (void*) *(handle_t*) vectorAt (&session->batch.held, i), 0, 0);
+	vectorClear (&session->batch.held);
+}
+
+/**
+*	Process session request on the session thread
 *
-*	This service implements the OS independent API for sending requests to the environment.
 *	This session is Windows specific and so will call the operating system. The NDBG executive
 *	session manager would send requests over PIPE to NDBG executive debugger server instead.
 *
@@ -192,11 +287,13 @@ void DbgContextFromWin32 (IN CONTEXT* in, OUT dbgContext* out) {
 *	\param data Optional data buffer
 *	\param size Optional data buffer size
 *	\ret The number of bytes read or written OR TRUE on success, FALSE on failure depending on request
-*
 */
-unsigned long DbgProcessRequest (IN dbgProcessReq request, IN dbgSession* session,
+static unsigned long DbgProcessRequestNative (IN dbgProcessReq request, IN dbgSession* session,
 	IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size) {
 
+	if (session->type == DBG_SESSION_SIM && request != DBG_REQ_CONTINUE)
+		return DbgSimRequest (request, session, addr, data, size);
+
 	switch(request) {
 		case DBG_REQ_READ: {
 			unsigned long bytesRead = 0;
@@ -212,27 +309,90 @@ unsigned long DbgProcessRequest (IN dbgProcessReq request, IN dbgSession* sessio
 				DbgDisplayError("Unable to write process memory. Error code: 0x%x", GetLastError());
 			return bytesRead;
 		}
+		case DBG_REQ_QUERY: {
+			MEMORY_BASIC_INFORMATION info;
+			dbgMemoryRegion*         region = (dbgMemoryRegion*) data;
+			if (!VirtualQueryEx ((HANDLE)session->process.process, (LPCVOID) addr, &info, sizeof (info)))
+				return FALSE;
+			region->base     = (vaddr_t) info.BaseAddress;
+			region->size     = (unsigned long) info.RegionSize;
+			region->readable = info.State == MEM_COMMIT && !(info.Protect & (PAGE_NOACCESS | PAGE_GUARD));
+			region->mapped   = info.State == MEM_COMMIT && (info.Type == MEM_IMAGE || info.Type == MEM_MAPPED);
+			region->protect  = 0;
+			if (region->readable)
+				region->protect |= DBG_MEMORY_PROT_READ;
+			if (info.Protect & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+				region->protect |= DBG_MEMORY_PROT_WRITE;
+			if (info.Protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+				region->protect |= DBG_MEMORY_PROT_EXEC;
+			return TRUE;
+		}
+		case DBG_REQ_PROTECT: {
+			unsigned int* protect = (unsigned int*) data;
+			DWORD         old     = 0;
+			DWORD         access  = PAGE_NOACCESS;
+			if (*protect & DBG_MEMORY_PROT_EXEC)
+				access = *protect & DBG_MEMORY_PROT_WRITE ? PAGE_EXECUTE_READWRITE : PAGE_EXECUTE_READ;
+			else if (*protect & DBG_MEMORY_PROT_WRITE)
+				access = PAGE_READWRITE;
+			else if (*protect & DBG_MEMORY_PROT_READ)
+				access = PAGE_READONLY;
+			if (!VirtualProtectEx ((HANDLE)session->process.process, addr, size, access, &old))
+				return FALSE;
+			*protect = 0;
+			if (!(old & (PAGE_NOACCESS | PAGE_GUARD)))
+				*protect |= DBG_MEMORY_PROT_READ;
+			if (old & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+				*protect |= DBG_MEMORY_PROT_WRITE;
+			if (old & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+				*protect |= DBG_MEMORY_PROT_EXEC;
+			return TRUE;
+		}
+		case DBG_REQ_ALLOCATE: {
+			*(vaddr_t*) data = (vaddr_t) VirtualAllocEx ((HANDLE)session->process.process, 0, size,
+				MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			return *(vaddr_t*) data != 0;
+		}
+		case DBG_REQ_MAPPEDNAME: {
+			return GetMappedFileNameA ((HANDLE)session->process.process, addr, (LPSTR) data, (DWORD) size);
+		}
+		case DBG_REQ_SUSPEND: {
+			return SuspendThread ((HANDLE)addr) != (DWORD) -1;
+		}
+		case DBG_REQ_RESUME: {
+			return ResumeThread ((HANDLE)addr) != (DWORD) -1;
+		}
 		case DBG_REQ_GETCONTEXT: {
 			CONTEXT context;
 			context.ContextFlags = CONTEXT_ALL;
 
-			if (! GetThreadContext ((HANDLE)session->process.thread, &context))
+			if (! GetThreadContext (addr ? (HANDLE)addr : (HANDLE)session->process.thread, &context))
 				return FALSE;
 
 			DbgContextFromWin32 (&context, (dbgContext*)data);
 			return TRUE;
 		}
 		case DBG_REQ_SETCONTEXT: {
-			return SetThreadContext ((HANDLE)session->process.thread, (LPCONTEXT)data);
+			CONTEXT context;
+			DbgWin32ContextFromDbg ((dbgContext*)data, &context);
+			return SetThreadContext (addr ? (HANDLE)addr : (HANDLE)session->process.thread, &context);
 		}
 		case DBG_REQ_CONTINUE: {
-			if (ResumeThread ((HANDLE)session->process.thread) == -1)
+			DbgSessionReleaseHeld (session);
+			if (session->type == DBG_SESSION_LIVE && ResumeThread ((HANDLE)session->process.thread) == -1)
 				return FALSE;
+			session->state = DBG_STATE_CONTINUE;
 			return TRUE;
 		}
 		case DBG_REQ_BREAK: {
 			return DebugBreakProcess ((HANDLE)session->process.process);
 		}
+		case DBG_REQ_PEEK:
+			/* live memory is only reachable by copying */
+			*(void**) data = 0;
+			return 0;
+		case DBG_REQ_UNPEEK:
+			return TRUE;
 		case DBG_REQ_STOP:
 		default:
 			printf ("\nDBG_REQ_STOP Not implemented");
@@ -240,6 +400,222 @@ unsigned long DbgProcessRequest (IN dbgProcessReq request, IN dbgSession* sessio
 	};
 }
 
+/**
+*	Test if the caller is the session thread
+*	\param session Debug session
+*	\ret TRUE if called from the session thread
+*/
+BOOL DbgSessionIsOwner (IN dbgSession* session) {
+	return session->owner == DbgThreadCurrentId ();
+}
+
+/**
+*	Post command to session thread
+*	\param session Debug session
+*	\param command Command descriptor. The queue is bounded so this
+*	yields until the session thread has made room.
+*/
+static void DbgSessionPost (IN dbgSession* session, IN dbgSessionCommand* command) {
+	while (!queuePush (&session->commands, command)) {
+		DbgNotifySignal (session->wake);
+		DbgThreadYield ();
+	}
+	DbgNotifySignal (session->wake);
+}
+
+/**
+*	Run command on the session thread and wait for its result
+*	\param session Debug session
+*	\param command Command descriptor
+*	\ret Command result
+*/
+unsigned long DbgSessionCall (IN dbgSession* session, IN dbgSessionCommand* command) {
+	dbgCompletion completion;
+
+	if (!_sessionCallNotify)
+		_sessionCallNotify = DbgNotifyCreate ();
+	if (!_sessionCallNotify)
+		return 0;
+
+	completion.notify = _sessionCallNotify;
+	completion.result = 0;
+	command->completion = &completion;
+	DbgTraceBegin ("transport", "session call", command->type);
+	DbgSessionPost (session, command);
+	DbgNotifyWait (completion.notify, DBG_WAIT_INFINITE);
+	DbgTraceEnd ("transport", "session call");
+	return completion.result;
+}
+
+/**
+*	Run procedure on the session thread and wait for its result
+*	\param session Debug session
+*	\param proc Procedure
+*	\param arg Procedure argument
+*	\ret Procedure result
+*/
+unsigned long DbgSessionRun (IN dbgSession* session, IN DbgSessionCommandProc proc, IN void* arg) {
+	dbgSessionCommand command;
+
+	if (!session)
+		return 0;
+	if (DbgSessionIsOwner (session))
+		return proc (session, arg);
+
+	command.type = DBG_COMMAND_PROC;
+	command.proc = proc;
+	command.arg  = arg;
+	return DbgSessionCall (session, &command);
+}
+
+/**
+*	Process session request
+*
+*	This service implements the OS independent API for sending requests to the environment.
+*	Requests that change target state are always executed by the session thread; callers
+*	on any other thread are marshalled through the session command queue. Memory reads
+*	and region queries are safe from any thread on this session type and are executed in place.
+*
+*	\param request Session request
+*	\param session Debug session
+*	\param addr Optional data address
+*	\param data Optional data buffer
+*	\param size Optional data buffer size
+*	\ret The number of bytes read or written OR TRUE on success, FALSE on failure depending on request
+*
+*/
+unsigned long DbgProcessRequest (IN dbgProcessReq request, IN dbgSession* session,
+	IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size) {
+
+	dbgSessionCommand  command;
+	unsigned long long start;
+	unsigned long      result;
+
+	if (!session)
+		return 0;
+	start = DbgClockNow ();
+	DbgTraceBegin ("request", DbgStatsRequestName (request), (unsigned long) size);
+	if (session->type == DBG_SESSION_CORE)
+		result = DbgCoreFileRequest (request, session, addr, data, size);
+	else if (request == DBG_REQ_READ || request == DBG_REQ_QUERY || request == DBG_REQ_PEEK || request == DBG_REQ_UNPEEK || DbgSessionIsOwner (session))
+		result = DbgProcessRequestNative (request, session, addr, data, size);
+	else {
+		command.type    = DBG_COMMAND_REQUEST;
+		command.request = request;
+		command.addr    = addr;
+		command.data    = data;
+		command.size    = size;
+		result = DbgSessionCall (session, &command);
+	}
+	DbgStatsRequest (request, request == DBG_REQ_READ || request == DBG_REQ_WRITE ? result : 0, DbgClockNow () - start);
+	DbgTraceEnd ("request", DbgStatsRequestName (request));
+	return result;
+}
+
+/**
+*	Track a new thread of the target
+*	\param session Debug session
+*	\param thread Thread handle; owned by the system
+*	\param id Thread id
+*	\param entry Thread entry point
+*/
+static void DbgSessionAddThread (dbgSession* session, HANDLE thread, DWORD id, vaddr_t entry) {
+	dbgThread* descr = (dbgThread*) poolAlloc (&session->process.threadPool);
+	if (!descr)
+		return;
+	descr->thread = (handle_t) thread;
+	descr->id     = (tid_t) id;
+	descr->entry  = entry;
+	descr->rearm  = 0;
+	ilistAppend (&session->process.threadList, &descr->node);
+}
+
+/**
+*	Stop tracking a thread that exited
+*	\param session Debug session
+*	\param id Thread id
+*/
+static void DbgSessionRemoveThread (dbgSession* session, DWORD id) {
+	ilistNode* cur;
+	for (cur = session->process.threadList.first; cur; cur = cur->next) {
+		dbgThread* descr = (dbgThread*) cur;
+		if (descr->id == (tid_t) id) {
+			ilistRemove (&session->process.threadList, cur);
+			poolRelease (&session->process.threadPool, descr);
+			return;
+		}
+	}
+}
+
+/**
+*	Append debug string to the session debug output batch
+*
+*	The string is located in the process address space so it is read
+*	directly into the batch buffer; no memory is allocated per string.
+*
+*	\param session Debug session
+*	\param e OUTPUT_DEBUG_STRING_EVENT descriptor
+*/
+static void DbgSessionReadDebugString (dbgSession* session, DEBUG_EVENT* e) {
+	size_t length = e->u.DebugString.nDebugStringLength;
+	char*  str;
+
+	if (!length)
+		return;
+	str = DbgDebugOutReserve (session, length);
+	if (!str)
+		return;
+	if (!DbgProcessRequest (DBG_REQ_READ, session, e->u.DebugString.lpDebugStringData, str, length))
+		return;
+	DbgDebugOutCommit (session, e->dwThreadId, length - 1);
+}
+
+/**
+*	Read the path of a module from a load event. lpImageName points to a
+*	pointer to the path in the target; either may be 0.
+*	\param session Debug session
+*	\param load Load event
+*	\param path Output path, empty if it cannot be read
+*	\param size Size of the output buffer
+*/
+static void DbgSessionReadImageName (dbgSession* session, LOAD_DLL_DEBUG_INFO* load, char* path, size_t size) {
+	unsigned char image[MAX_PATH * 2];
+	vaddr_t       name  = 0;
+	size_t        unit  = load->fUnicode ? 2 : 1;
+	size_t        bytes = (size - 1) * unit;
+	size_t        first;
+	size_t        i;
+
+	path[0] = 0;
+	if (bytes > sizeof (image))
+		bytes = sizeof (image);
+	if (!load->lpImageName || !DbgProcessRequest (DBG_REQ_READ, session, load->lpImageName, &name, 4) || !name)
+		return;
+
+	/* the name may end just before an unmapped page; read up to the page end first */
+	memset (image, 0, sizeof (image));
+	first = DBG_MEMORY_PAGE - (name & (DBG_MEMORY_PAGE - 1));
+	if (first > bytes)
+		first = bytes;
+	if (!DbgProcessRequest (DBG_REQ_READ, session, (void*) name, image, first))
+		return;
+	for (i = 0; i + unit <= first; i += unit) {
+		if (!image[i] && (unit == 1 || !image[i + 1]))
+			break;
+	}
+	if (i + unit > first && first < bytes)
+		DbgProcessRequest (DBG_REQ_READ, session, (void*) (name + first), image + first, bytes - first);
+
+	/* paths are narrowed to ASCII */
+	for (i = 0; i < size - 1 && i * unit < bytes; i++) {
+		unsigned int c = unit == 1 ? image[i] : image[i * 2] | (image[i * 2 + 1] << 8);
+		if (!c)
+			break;
+		path[i] = c < 0x80 ? (char) c : '?';
+	}
+	path[i] = 0;
+}
+
 /**
 *	Process session event
 *
@@ -259,6 +635,7 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 	/* clear event descriptor */
 	dbgEventDescr descr;
 	memset (&descr,0,sizeof(dbgEventDescr));
+	session->pass = FALSE;
 
 	/* process debug event */
 	switch (e->dwDebugEventCode) {
@@ -267,8 +644,11 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 		*/
 		case CREATE_PROCESS_DEBUG_EVENT: {
 			unsigned long long base = 0;
-
 			dbgCreateProcessDescr* record;
+
+			DbgSessionAddThread (session, e->u.CreateProcessInfo.hThread, e->dwThreadId,
+				(vaddr_t) e->u.CreateProcessInfo.lpStartAddress);
+
 			record      = &descr.u.createProcess;
 			descr.event = DBG_EVENT_CREATEPROCESS;
 			record->entry     = (vaddr_t) e->u.CreateProcessInfo.lpStartAddress;
@@ -284,6 +664,7 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 			record = &descr.u.createThread;
 			descr.event = DBG_EVENT_CREATETHREAD;
 			record->entry = (vaddr_t) e->u.CreateThread.lpStartAddress;
+			DbgSessionAddThread (session, e->u.CreateThread.hThread, e->dwThreadId, record->entry);
 			return session->proc (session, &descr);
 		}
 		/*
@@ -354,9 +735,40 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 					break;
 				case DBG_CONTROL_C:
 					printf ("\n\rCtrl+c event not currently implemented.");
+					descr.u.exception.code = DBG_EXCEPTION_SOFTWARE;
+					break;
+				default:
+					descr.u.exception.code = DBG_EXCEPTION_SOFTWARE;
 					break;
 			}
+			record->native  = e->u.Exception.ExceptionRecord.ExceptionCode;
 			record->address = (vaddr_t) e->u.Exception.ExceptionRecord.ExceptionAddress;
+			record->data    = 0;
+			record->write   = FALSE;
+			if (record->code == DBG_EXCEPTION_SEGMENT && e->u.Exception.ExceptionRecord.NumberParameters >= 2) {
+				record->write = e->u.Exception.ExceptionRecord.ExceptionInformation[0] == 1;
+				record->data  = (vaddr_t) e->u.Exception.ExceptionRecord.ExceptionInformation[1];
+			}
+
+			/* counting breakpoints and the steps that re-arm them never stop the target */
+			if (record->code == DBG_EXCEPTION_BREAKPOINT && DbgBreakpointTrap (session, (tid_t) e->dwThreadId, record->address))
+				return DBG_STATE_CONTINUE;
+			if (record->code == DBG_EXCEPTION_SINGLE_STEP && DbgBreakpointStep (session, (tid_t) e->dwThreadId))
+				return DBG_STATE_CONTINUE;
+			if (session->fuzz && DbgFuzzException (session, (tid_t) e->dwThreadId, record))
+				return DBG_STATE_CONTINUE;
+
+			/* policy table; ignored and printed exceptions never reach the front end */
+			if (DbgFilterApply (session, (tid_t) e->dwThreadId, record) != DBG_FILTER_STOP)
+				return DBG_STATE_CONTINUE;
+
+			/* stops passed while replaying towards an earlier stop are not reported */
+			if (DbgHistoryStop (session, record))
+				return DBG_STATE_CONTINUE;
+
+			/* another thread already stopped in this batch; report this stop with it */
+			if (session->state == DBG_STATE_SUSPEND)
+				return DbgSessionHoldStop (session, (tid_t) e->dwThreadId, record);
 			return session->proc (session, &descr);
 		}
 		/*
@@ -367,6 +779,11 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 			record = &descr.u.exitProcess;
 			descr.event = DBG_EVENT_EXITPROCESS;
 			record->exitCode = e->u.ExitProcess.dwExitCode;
+			DbgCoverageFinish (session);
+			if (session->fuzz) {
+				DbgDisplayError ("Target exited while fuzzing");
+				DbgFuzzFree (session);
+			}
 			return session->proc (session, &descr);
 		}
 		/*
@@ -377,31 +794,15 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 			record = &descr.u.exitThread;
 			descr.event = DBG_EVENT_EXITTHREAD;
 			record->exitCode = e->u.ExitThread.dwExitCode;
+			DbgSessionRemoveThread (session, e->dwThreadId);
 			return session->proc (session, &descr);
 		}
 		/*
 			Output string
 		*/
 		case OUTPUT_DEBUG_STRING_EVENT: {
-			dbgDebugStringDescr* record;		
-			char* str = 0;
-			dbgSessionState state = DBG_STATE_CONTINUE;
-
-			/* create record */
-			record = &descr.u.debugString;
-			descr.event = DBG_EVENT_PRINT;
-			record->length = e->u.DebugString.nDebugStringLength;
-
-			/* string located in process address space so we buffer it */
-			str = (char*)malloc(record->length);
-			DbgProcessRequest (DBG_REQ_READ,session, e->u.DebugString.lpDebugStringData,str,record->length);
-			record->string = (vaddr_t) str;
-			str[record->length-1] = 0; /* 0 terminate */
-
-			/* process event and release memory */
-			state = session->proc (session, &descr);
-			free(str);
-			return state;
+			DbgSessionReadDebugString (session, e);
+			return DbgDebugOutFlush (session);
 		}
 
 		/*
@@ -413,33 +814,18 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 			Load DLL
 		*/
 		case LOAD_DLL_DEBUG_EVENT: {
-			dbgSharedLibrary* libraryDescr;
-			char path[64];
-			memset (path,0,64);
-			/*
-				lpImageName is a pointer in the process address space
-				that contains a pointer to the real string in that address space.
-			*/
-			if (e->u.LoadDll.lpImageName) {
-				vaddr_t imageName = 0;
-				DbgProcessRequest (DBG_REQ_READ,session, e->u.LoadDll.lpImageName,&imageName,4);
-				if (imageName) {
-					wchar_t image[128];
-					memset (image,128,0);
-					DbgProcessRequest (DBG_REQ_READ,session,(void*)imageName,image,127);
-#ifdef _MSC_VER
-					{
-						size_t numConverted = 0;
-						wcstombs_s (&numConverted, path, 64, image,63);
-					}
-#else
-					wcstombs (path,image,63);
-#endif
-				}
-			}
+			vaddr_t           base = (vaddr_t) e->u.LoadDll.lpBaseOfDll;
+			dbgSharedLibrary* module;
+			char              path[MAX_PATH];
+
+			DbgSessionReadImageName (session, &e->u.LoadDll, path, sizeof (path));
+			if (!path[0])
+				DbgProcessRequest (DBG_REQ_MAPPEDNAME, session, (void*) base, path, sizeof (path) - 1);
+			module = DbgModuleAdd (session, path[0] ? path : 0, base, DbgModuleImageSize (session, base));
 
 			/* there is no debug event for this since its Windows specific */
-			DbgDisplayMessage ("(%i) Loaded '%s'", session->process.id.pid, path);
+			DbgDisplayMessage ("(%i) Loaded '%s' at 0x%08x", session->process.id.pid,
+				module ? module->name : path, base);
 			break;
 		}
 		/*
@@ -454,32 +840,18 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 			Unload DLL
 		*/
 		case UNLOAD_DLL_DEBUG_EVENT: {
-			/*
-				Locate library object
-			*/
-			dbgSharedLibrary* descr = 0;
-			listNode* cur = session->process.libraryList.first;
-			size_t c;
-			for (c = 0; c < session->process.libraryList.count; c++) {
-				descr = (dbgSharedLibrary*) cur->data;
-				if (descr->base == (vaddr_t) e->u.UnloadDll.lpBaseOfDll)
-					break;
-				cur = cur->next;
-			}
-			/*
-				Display library and unload it
-			*/
-			if (cur) {
-				DbgDisplayMessage("(%i) Unloaded '%s'",
-					session->process.id.pid,
-					descr->name);
-				free (descr->name);
-				listRemoveElement(c, &session->process.libraryList);
-			}
-			else
-				DbgDisplayMessage ("(%i) Unloaded unknown DLL", session->process.id.pid);
+			dbgSharedLibrary* module = DbgModuleFind (session, (vaddr_t) e->u.UnloadDll.lpBaseOfDll);
 
 			/* there is no debug event for this since its Windows specific */
+			if (!module) {
+				DbgDisplayMessage ("(%i) Unloaded unknown DLL", session->process.id.pid);
+				break;
+			}
+			DbgDisplayMessage ("(%i) Unloaded '%s'", session->process.id.pid, module->name);
+			DbgModuleRemove (session, module);
+			/* plans and symbol tables may describe code of the library */
+			DbgUnwindFlush (session);
+			DbgSymbolizeFlush (session);
 			break;
 		}
 	}
@@ -496,6 +868,21 @@ dbgSessionState DbgSessionProcessEvent (dbgSession* session, DEBUG_EVENT* e) {
 */
 void DbgSessionSendEvent (IN dbgSession* in, IN dbgSessionEvent request, IN dbgSessionEventSource source) {
 	dbgEventDescr descr;
+
+	if (!in)
+		return;
+
+	/* session state belongs to the session thread */
+	if (!DbgSessionIsOwner (in)) {
+		dbgSessionCommand command;
+		command.type       = DBG_COMMAND_EVENT;
+		command.event      = request;
+		command.source     = source;
+		command.completion = 0;
+		DbgSessionPost (in, &command);
+		return;
+	}
+
 	switch (request) {
 		case DBG_SESSION_QUIT: {
 			descr.event = DBG_EVENT_QUIT;
@@ -511,24 +898,277 @@ void DbgSessionSendEvent (IN dbgSession* in, IN dbgSessionEvent request, IN dbgS
 			break;
 		}
 		case DBG_SESSION_CONTINUE: {
-			in->state = DBG_SESSION_CONTINUE;
+			DbgSessionReleaseHeld (in);
+			in->state = DBG_STATE_CONTINUE;
 			break;
 		}
 	};
 }
 
+/**
+*	Run all commands posted to the session thread
+*	\param session Debug session
+*/
+static void DbgSessionDrainCommands (IN dbgSession* session) {
+	dbgSessionCommand command;
+	unsigned long     result;
+
+	while (queuePop (&session->commands, &command)) {
+		result = 0;
+		DbgTraceBegin ("transport", "command", command.type);
+		switch (command.type) {
+			case DBG_COMMAND_REQUEST:
+				result = DbgProcessRequestNative (command.request, session,
+					command.addr, command.data, command.size);
+				break;
+			case DBG_COMMAND_EVENT:
+				DbgSessionSendEvent (session, command.event, command.source);
+				result = TRUE;
+				break;
+			case DBG_COMMAND_PROC:
+				result = command.proc (session, command.arg);
+				break;
+		}
+		DbgTraceEnd ("transport", "command");
+		if (command.completion) {
+			command.completion->result = result;
+			DbgNotifySignal (command.completion->notify);
+		}
+	}
+}
+
+/**
+*	Wait for the next debug event of the target
+*	\param session Debug session
+*	\param e Output event
+*	\param ms Longest wait in milliseconds
+*	\ret TRUE if an event arrived, FALSE on timeout
+*/
+static BOOL DbgSessionWaitEvent (dbgSession* session, DEBUG_EVENT* e, unsigned int ms) {
+	if (session->type == DBG_SESSION_SIM)
+		return DbgSimWaitEvent (session->sim, e, ms);
+	return WaitForDebugEvent (e, ms);
+}
+
+/**
+*	Let the target run past a debug event
+*	\param session Debug session
+*	\param e Event
+*	\param status DBG_CONTINUE or DBG_EXCEPTION_NOT_HANDLED
+*/
+static void DbgSessionContinueEvent (dbgSession* session, DEBUG_EVENT* e, DWORD status) {
+	if (session->type == DBG_SESSION_SIM)
+		DbgSimContinue (session->sim, status);
+	else
+		ContinueDebugEvent (e->dwProcessId, e->dwThreadId, status);
+}
+
+/**
+*	Trace span name of a debug event code
+*/
+static const char* DbgSessionEventName (DWORD code) {
+	static const char* names[] = {"event", "exception", "create thread", "create process", "exit thread",
+		"exit process", "load dll", "unload dll", "debug string", "rip"};
+	return code < sizeof (names) / sizeof (names[0]) ? names[code] : names[0];
+}
+
+/**
+*	Handle a debug event and every event already pending behind it
+*
+*	Threads that trap together queue their events in the system; they are
+*	drained here before the console is woken, so counting breakpoints and
+*	ignored exceptions of the whole batch are absorbed without a stop and
+*	several stops are reported once.
+*
+*	\param session Debug session
+*	\param dbgEvent First event; reused for the following ones
+*/
+static void DbgSessionProcessBatch (dbgSession* session, DEBUG_EVENT* dbgEvent) {
+	unsigned long long start   = DbgClockNow ();
+	unsigned long      events  = 0;
+	BOOL               pending = TRUE;
+	unsigned long long elapsed;
+	unsigned int       bucket;
+	unsigned int       i;
+
+	DbgTraceBegin ("session", "batch", 0);
+	while (pending) {
+
+		/* coalesce back to back debug strings */
+		while (pending && dbgEvent->dwDebugEventCode == OUTPUT_DEBUG_STRING_EVENT) {
+			DbgSessionReadDebugString (session, dbgEvent);
+			DbgSessionContinueEvent (session, dbgEvent, DBG_CONTINUE);
+			events++;
+			pending = !DbgDebugOutFull (session) && DbgSessionWaitEvent (session, dbgEvent, 0);
+		}
+		if (session->state == DBG_STATE_CONTINUE)
+			session->state = DbgDebugOutFlush (session);
+		else
+			DbgDebugOutFlush (session);
+
+		if (pending) {
+
+			/* process event */
+			unsigned long long begin = DbgClockNow ();
+			dbgSessionState    state;
+			DbgTraceBegin ("session", DbgSessionEventName (dbgEvent->dwDebugEventCode), dbgEvent->dwThreadId);
+			state = DbgSessionProcessEvent (session, dbgEvent);
+			DbgTraceEnd ("session", DbgSessionEventName (dbgEvent->dwDebugEventCode));
+			DbgStatsTime (DBG_TIMER_EVENT, DbgClockNow () - begin);
+			if (session->state == DBG_STATE_CONTINUE)
+				session->state = state;
+
+			/* continue execution; passed exceptions go to the target's own handlers */
+			DbgSessionContinueEvent (session, dbgEvent, session->pass ? DBG_EXCEPTION_NOT_HANDLED : DBG_CONTINUE);
+			events++;
+			pending = session->state != DBG_STATE_QUIT && events < DBG_BATCH_EVENTS && DbgSessionWaitEvent (session, dbgEvent, 0);
+		}
+	}
+
+	/* one report for every stop of the batch */
+	if (vectorSize (&session->batch.stops)) {
+		DbgDisplayMessage ("%u more threads stopped in the same batch:", vectorSize (&session->batch.stops));
+		for (i = 0; i < vectorSize (&session->batch.stops); i++) {
+			dbgBatchStop* stop = (dbgBatchStop*) vectorAt (&session->batch.stops, i);
+			DbgDisplayMessage ("  thread %-6u %s chance %s at 0x%08x", stop->tid,
+				stop->firstChance ? "first" : "second", DbgExceptionName (stop->code), stop->address);
+		}
+		vectorClear (&session->batch.stops);
+	}
+
+	elapsed = DbgClockNow () - start;
+	if (session->state == DBG_STATE_SUSPEND) {
+		DbgStatsTime (DBG_TIMER_STOP, elapsed);
+		if (!session->stopped)
+			session->stopped = start + elapsed;
+	}
+	for (bucket = 0; bucket < DBG_BATCH_BUCKETS - 1 && (elapsed / 1000) >> bucket; bucket++)
+		;
+	session->batch.latency[bucket]++;
+	session->batch.batches++;
+	session->batch.events += events;
+	if (events > session->batch.largest)
+		session->batch.largest = events;
+	if (elapsed > session->batch.worst)
+		session->batch.worst = elapsed;
+	DbgTraceEnd ("session", "batch");
+}
+
+/**
+*	Latency percentile from the batch histogram
+*	\ret Upper bound of the bucket in microseconds
+*/
+static unsigned long DbgSessionBatchPercentile (dbgSession* session, unsigned int percent) {
+	unsigned long long need = ((unsigned long long) session->batch.batches * percent + 99) / 100;
+	unsigned long long seen = 0;
+	unsigned int       bucket;
+
+	for (bucket = 0; bucket < DBG_BATCH_BUCKETS; bucket++) {
+		seen += session->batch.latency[bucket];
+		if (seen >= need)
+			break;
+	}
+	return bucket ? 1UL << bucket : 1;
+}
+
+/**
+*	Display debug event batch statistics. Must be called on the session thread.
+*	\param session Debug session
+*/
+void DbgSessionBatchStats (IN dbgSession* session) {
+	if (!session->batch.batches)
+		return;
+	DbgDisplayMessage ("%lu debug events in %lu batches (largest %lu); batch latency p50 <%lu us, p99 <%lu us, max %.1f us",
+		session->batch.events, session->batch.batches, session->batch.largest,
+		DbgSessionBatchPercentile (session, 50), DbgSessionBatchPercentile (session, 99),
+		(double) session->batch.worst / 1000.0);
+}
+
+/**
+*	Run the target until it stops. Must be called on the session thread.
+*
+*	For tools that drive the target themselves; events are handled as in
+*	the event loop but posted commands wait until the tool returns.
+*
+*	\param session Debug session
+*	\param ms Longest run in milliseconds
+*	\ret TRUE if the target stopped, FALSE on timeout or error
+*/
+BOOL DbgSessionRunToStop (IN dbgSession* session, IN unsigned int ms) {
+	unsigned long long deadline = DbgClockNow () + ms * 1000000ULL;
+	DEBUG_EVENT        dbgEvent;
+
+	if (session->state != DBG_STATE_CONTINUE && !DbgProcessRequest (DBG_REQ_CONTINUE, session, 0, 0, 0))
+		return FALSE;
+	while (session->state == DBG_STATE_CONTINUE) {
+		unsigned long long now = DbgClockNow ();
+		unsigned int       wait;
+		if (now >= deadline)
+			return FALSE;
+		wait = (unsigned int) ((deadline - now) / 1000000);
+		if (DbgSessionWaitEvent (session, &dbgEvent, wait < DBG_SESSION_POLL_MS ? wait : DBG_SESSION_POLL_MS))
+			DbgSessionProcessBatch (session, &dbgEvent);
+	}
+	return session->state == DBG_STATE_SUSPEND;
+}
+
+/**
+*	Serve commands and debug events until the session is closed
+*	\param session Debug session
+*/
+static void DbgSessionEventLoop (dbgSession* session) {
+	DEBUG_EVENT dbgEvent;
+
+	while (TRUE) {
+
+		/* serve requests posted by the console and other threads */
+		DbgSessionDrainCommands (session);
+
+		if (session->state == DBG_STATE_QUIT)
+			break;
+
+		if (session->state == DBG_STATE_CONTINUE && !session->proc) {
+
+			/* the front end has not registered its event procedure yet */
+			DbgNotifyWait (session->wake, DBG_SESSION_POLL_MS);
+		}
+		else if (session->state == DBG_STATE_CONTINUE) {
+
+			/* wait for debug event from process; wake early when a profile sample is due */
+			unsigned int wait = DBG_SESSION_POLL_MS;
+			if (session->profile && DbgProfileWait (session) < wait)
+				wait = DbgProfileWait (session);
+			if (DbgSessionWaitEvent (session, &dbgEvent, wait))
+				DbgSessionProcessBatch (session, &dbgEvent);
+			if (session->profile)
+				DbgProfileTick (session);
+			if (session->fuzz)
+				DbgFuzzTick (session);
+		}
+		else {
+
+			/* target is stopped; sleep until a command arrives */
+			DbgNotifyWait (session->wake, DBG_WAIT_INFINITE);
+		}
+	}
+}
+
 /**
 *	Session entry point
 *	\param command Command line
 *	\ret Error code
 */
-int __stdcall DbgSessionThreadEntry (char* command) {
+int DbgSessionThreadEntry (void* arg) {
+	char*               command = (char*) arg;
 	dbgSession*         session;
-	DEBUG_EVENT         dbgEvent;
 	PROCESS_INFORMATION process;
 	STARTUPINFO         startup;
+	unsigned long long  launched;
+
+	DbgTraceThread ("session");
 
 	/* start process */
+	launched = DbgClockNow ();
 	memset (&process, 0, sizeof(PROCESS_INFORMATION));
 	memset (&startup, 0, sizeof(STARTUPINFO));
 
@@ -547,6 +1187,8 @@ int __stdcall DbgSessionThreadEntry (char* command) {
 		return EXIT_FAILURE;
 	}
 
+	session->created = launched;
+
 	/* attempt to enumerate symbol information */
 	if (!DbgSymbolEnumerate (session))
 		DbgDisplayError ("*** Unable to load symbols");
@@ -557,36 +1199,101 @@ int __stdcall DbgSessionThreadEntry (char* command) {
 	DbgSetCurrentSession (session);
 
 	/* session thread event loop */
-	while (TRUE) {
+	DbgSessionEventLoop (session);
 
-		if (session->state == DBG_STATE_QUIT)
-			break;
+	/* free session */
+	DbgSessionDelete (session);
 
-		if (session->state == DBG_STATE_CONTINUE) {
+	/* free symbols */
+	DbgSymbolFree (session);
 
-			/* wait for debug event from process */
-	//		if (WaitForDebugEvent (&dbgEvent, INFINITE)) {
-			if (WaitForDebugEvent (&dbgEvent, 1000)) {
+	/* clear current session, release resources and return */
+	if (DbgGetCurrentSession() == session)
+		DbgSetCurrentSession (0);
 
-				/* process event */
-				session->state = DbgSessionProcessEvent (session, &dbgEvent);
+	free (session);
+	return EXIT_SUCCESS;
+}
 
-				/* continue execution */
-				ContinueDebugEvent (dbgEvent.dwProcessId,dbgEvent.dwThreadId, DBG_CONTINUE);
-			}
-		}
+/**
+*	Core file session entry point
+*
+*	A core file session has no debug events to wait for. The session
+*	thread only serves commands until the session is closed.
+*
+*	\param arg Open core file
+*	\ret Error code
+*/
+int DbgSessionCoreThreadEntry (void* arg) {
+	dbgCoreFile* core = (dbgCoreFile*) arg;
+	dbgSession*  session;
+
+	DbgTraceThread ("session");
+	session = DbgSessionNew (DbgCoreFileName (core), DbgCoreFilePid (core), 0, 0, 0);
+	if (!session) {
+		fprintf(stderr, "Error: Unable to create session.\n\r");
+		DbgCoreFileClose (core);
+		return EXIT_FAILURE;
 	}
+	session->type  = DBG_SESSION_CORE;
+	session->core  = core;
+	session->state = DBG_STATE_SUSPEND;
 
-	/* free session */
-	DbgSessionDelete (session);
+	/* threads, modules and symbols come from the core */
+	DbgCoreFileAttach (session);
+	DbgDisplayMessage ("Core file %s: process %u, %u threads", session->process.name, session->process.id.pid,
+		ilistSize (&session->process.threadList));
 
-	/* free symbols */
-	DbgSymbolFree (session);
+	DbgSetCurrentSession (session);
 
-	/* clear current session, release resources and return */
+	while (TRUE) {
+		DbgSessionDrainCommands (session);
+		if (session->state == DBG_STATE_QUIT)
+			break;
+		DbgNotifyWait (session->wake, DBG_WAIT_INFINITE);
+	}
+
+	DbgSessionDelete (session);
+	DbgSymbolFree (session);
 	if (DbgGetCurrentSession() == session)
 		DbgSetCurrentSession (0);
+	DbgCoreFileClose (core);
+	free (session);
+	return EXIT_SUCCESS;
+}
+
+/**
+*	Simulated target session entry point
+*
+*	The session runs the same event loop as a live one; events come
+*	from the script of the simulated target instead of the system.
+*
+*	\param arg Open simulated target
+*	\ret Error code
+*/
+int DbgSessionSimThreadEntry (void* arg) {
+	dbgSimTarget* sim = (dbgSimTarget*) arg;
+	dbgSession*   session;
 
+	DbgTraceThread ("session");
+	/* the first simulated thread has handle 1 */
+	session = DbgSessionNew (DbgSimName (sim), DbgSimPid (sim), DbgSimTid (sim), 0, 1);
+	if (!session) {
+		fprintf(stderr, "Error: Unable to create session.\n\r");
+		DbgSimClose (sim);
+		return EXIT_FAILURE;
+	}
+	session->type = DBG_SESSION_SIM;
+	session->sim  = sim;
+
+	DbgSetCurrentSession (session);
+	DbgSessionEventLoop (session);
+
+	DbgSessionDelete (session);
+	DbgSymbolFree (session);
+	if (DbgGetCurrentSession() == session)
+		DbgSetCurrentSession (0);
+	DbgSimClose (sim);
 	free (session);
 	return EXIT_SUCCESS;
 }
@@ -597,15 +1304,68 @@ int __stdcall DbgSessionThreadEntry (char* command) {
 */
 void DbgCreateSession (char* path) {   
 	if (DbgGetCurrentSession()) {
-		printf ("\nAttempt to create more then one debug session");
+		DbgDisplayError ("Attempt to create more then one debug session");
 		return;
 	}
 	/* create new thread for debug session */
-	CreateThread (0, 0, (LPTHREAD_START_ROUTINE)DbgSessionThreadEntry, path, 0,0);
+	if (!DbgWorkerCreate (DbgSessionThreadEntry, path))
+		DbgDisplayError ("Unable to create session thread");
+}
+
+/**
+*	Create core file session
+*
+*	The core file is opened by the caller so that a bad file is
+*	reported before any session exists.
+*
+*	\param path Core file path
+*	\ret TRUE if the session thread was started, FALSE on error
+*/
+BOOL DbgCreateCoreSession (char* path) {
+	dbgCoreFile* core;
+
+	if (DbgGetCurrentSession()) {
+		DbgDisplayError ("Attempt to create more then one debug session");
+		return FALSE;
+	}
+	core = DbgCoreFileOpen (path);
+	if (!core)
+		return FALSE;
+	if (!DbgWorkerCreate (DbgSessionCoreThreadEntry, core)) {
+		DbgDisplayError ("Unable to create session thread");
+		DbgCoreFileClose (core);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	Create simulated target session
+*	\param path Script path
+*	\ret TRUE if the session thread was started, FALSE on error
+*/
+BOOL DbgCreateSimSession (char* path) {
+	dbgSimTarget* sim;
+
+	if (DbgGetCurrentSession()) {
+		DbgDisplayError ("Attempt to create more then one debug session");
+		return FALSE;
+	}
+	sim = DbgSimOpen (path);
+	if (!sim)
+		return FALSE;
+	if (!DbgWorkerCreate (DbgSessionSimThreadEntry, sim)) {
+		DbgDisplayError ("Unable to create session thread");
+		DbgSimClose (sim);
+		return FALSE;
+	}
+	return TRUE;
 }
 
 /* flush instruction cache. Should this be a SESSION message? */
 void DbgFlushInstructionCache (dbgSession* in, vaddr_t addr, uint32_t size) {
 
-	FlushInstructionCache(in->process.process,addr,size);
+	if (in->type == DBG_SESSION_LIVE)
+		FlushInstructionCache(in->process.process,addr,size);
 }
+
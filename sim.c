@@ -0,0 +1,1059 @@
+/********************************************
+*
+*	sim.c - Simulated target
+*
+********************************************/
+
+/*
+	This component implements a session backend for a simulated target
+	described by a script. Its address space lives in debugger memory,
+	its threads start from scripted registers and its debug events come
+	from a seeded generator, so a script produces the same events in the
+	same order on every run. The breakpoint, symbol, stepping and console
+	layers run on top of it unchanged, with no process or kernel in the
+	measurements.
+
+	Simulated threads move between the code sites named by the script.
+	A site passes silently unless its first byte is an int3, in which
+	case a breakpoint exception is raised there. A thread continued with
+	the trap flag set steps over one byte first. Faults, software
+	exceptions, thread and module churn and debug strings are mixed in
+	by weight. A pace limits the event rate; without one events come as
+	fast as the debugger takes them.
+
+	First chance exceptions passed to the target come back as second
+	chance exceptions, except software exceptions, which the target is
+	taken to catch. A second chance exception passed to the target ends
+	the process.
+
+	Requests are served in place under one lock, on any thread.
+
+	Script lines; numbers are decimal or 0x hex, # starts a comment:
+
+		name    text                     process name
+		seed    n                        generator seed
+		events  n                        events before the process exits; 0 runs until quit
+		pace    n                        events per second; 0 is unthrottled
+		memory  base size [rwx] [file]   zero filled region, read/write by default
+		bytes   address hh hh ...        initial contents
+		thread  id [reg=value ...]       eip esp ebp eax ebx ecx edx esi edi flags
+		site    address                  code address threads pass through
+		module  base name                shared library loaded at startup
+		string  text                     debug string
+		mix     kind=weight ...          site fault software thread module string
+*/
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_SIM_PID          0x5100
+#define DBG_SIM_TID          0x5104		/* first id given to threads created by the generator */
+#define DBG_SIM_SCRATCH      0x7ffd0000	/* loader breakpoint, module names and strings */
+#define DBG_SIM_SCRATCH_SIZE 0x10000
+#define DBG_SIM_ALLOCATE     0x60000000	/* DBG_REQ_ALLOCATE hands out memory from here */
+#define DBG_SIM_USER_END     0x80000000ULL
+#define DBG_SIM_STACK        0x10000		/* stack spacing of created threads */
+#define DBG_SIM_SILENT       4096			/* sites passed before a wait gives up */
+#define DBG_SIM_LINE         512
+#define DBG_SIM_TRAP_FLAG    0x100
+#define DBG_SIM_CPP          0xe06d7363		/* Visual C++ exception */
+
+typedef enum _dbgSimKind {
+	DBG_SIM_SITE,
+	DBG_SIM_FAULT,
+	DBG_SIM_SOFTWARE,
+	DBG_SIM_THREAD,
+	DBG_SIM_MODULE,
+	DBG_SIM_STRING,
+	DBG_SIM_KINDS
+}dbgSimKind;
+
+static const char* _dbgSimKinds[DBG_SIM_KINDS] = {"site", "fault", "software", "thread", "module", "string"};
+
+typedef struct _dbgSimRegion {
+	vaddr_t        base;
+	unsigned long  size;
+	unsigned char* data;
+	unsigned char* protect;		/* DBG_MEMORY_PROT_xxx of each page */
+	char*          file;		/* mapped file or 0 */
+}dbgSimRegion;
+
+typedef struct _dbgSimThread {
+	tid_t        id;
+	dbgContext   context;
+	unsigned int suspend;
+	unsigned int site;			/* index of the next site */
+	BOOL         live;
+}dbgSimThread;
+
+typedef struct _dbgSimModule {
+	vaddr_t base;
+	vaddr_t name;				/* pointer to the UTF-16 name, as LOAD_DLL_DEBUG_EVENT expects */
+	BOOL    loaded;
+}dbgSimModule;
+
+typedef struct _dbgSimString {
+	vaddr_t      address;
+	unsigned int length;		/* with the terminator */
+}dbgSimString;
+
+struct _dbgSimTarget {
+	char               name[81];
+	dbgMutex*          lock;
+	vector             regions;		/* dbgSimRegion sorted by base */
+	vector             threads;		/* dbgSimThread; the handle of a thread is its index + 1 */
+	vector             modules;		/* dbgSimModule */
+	vector             sites;		/* vaddr_t */
+	vector             strings;		/* dbgSimString */
+	vector             pending;		/* DEBUG_EVENT delivered before generated ones */
+	unsigned int       pendingAt;
+	unsigned int       weights[DBG_SIM_KINDS];
+	unsigned int       total;
+	unsigned int       random;
+	unsigned long      limit;
+	unsigned long      pace;
+	vaddr_t            scratch;		/* next free byte of scratch memory */
+	vaddr_t            allocate;	/* next DBG_REQ_ALLOCATE address */
+	tid_t              nextTid;
+	DEBUG_EVENT        last;		/* event waiting to be continued */
+	BOOL               breakIn;
+	BOOL               exited;
+	BOOL               idle;		/* no thread can run */
+	unsigned long      events;
+	unsigned long      counts[DBG_SIM_KINDS];
+	unsigned long      passed;		/* sites passed without an event */
+	unsigned long long start;		/* clock of the first event */
+};
+
+static int DbgSimCompareRegion (const void* a, const void* b) {
+	const dbgSimRegion* x = (const dbgSimRegion*) a;
+	const dbgSimRegion* y = (const dbgSimRegion*) b;
+	return x->base < y->base ? -1 : x->base > y->base;
+}
+
+/**
+*	Locate region containing an address, or the first one above it
+*	\param sim Simulated target
+*	\param address Address
+*	\param above Output first region above address if none contains it
+*	\ret Region or 0
+*/
+static dbgSimRegion* DbgSimFind (IN dbgSimTarget* sim, IN vaddr_t address, OUT OPT dbgSimRegion** above) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (&sim->regions);
+
+	while (low < high) {
+		unsigned int  mid    = (low + high) / 2;
+		dbgSimRegion* region = (dbgSimRegion*) vectorAt (&sim->regions, mid);
+		if (address < region->base)
+			high = mid;
+		else if (address - region->base >= region->size)
+			low = mid + 1;
+		else
+			return region;
+	}
+	if (above)
+		*above = low < vectorSize (&sim->regions) ? (dbgSimRegion*) vectorAt (&sim->regions, low) : 0;
+	return 0;
+}
+
+/**
+*	Add a region of zero filled memory; regions must not overlap
+*	\ret TRUE if success, FALSE on error
+*/
+static BOOL DbgSimMap (IN dbgSimTarget* sim, IN vaddr_t base, IN unsigned long size,
+                       IN unsigned int protect, IN OPT const char* file) {
+	dbgSimRegion region;
+	unsigned int i;
+
+	size = (size + DBG_MEMORY_PAGE - 1) & ~(DBG_MEMORY_PAGE - 1);
+	if (!size || base & (DBG_MEMORY_PAGE - 1) || base + (unsigned long long) size > DBG_SIM_USER_END)
+		return FALSE;
+	for (i = 0; i < vectorSize (&sim->regions); i++) {
+		dbgSimRegion* other = (dbgSimRegion*) vectorAt (&sim->regions, i);
+		if (base < other->base + other->size && other->base < base + size)
+			return FALSE;
+	}
+	memset (&region, 0, sizeof (dbgSimRegion));
+	region.base    = base;
+	region.size    = size;
+	region.data    = (unsigned char*) calloc (1, size);
+	region.protect = (unsigned char*) malloc (size / DBG_MEMORY_PAGE);
+	if (file) {
+		region.file = (char*) malloc (strlen (file) + 1);
+		if (region.file) {
+#ifdef _MSC_VER
+			strcpy_s (region.file, strlen (file) + 1, file);
+#else
+			strcpy (region.file, file);
+#endif
+		}
+	}
+	if (!region.data || !region.protect || (file && !region.file) || !vectorAdd (&sim->regions, &region)) {
+		free (region.data);
+		free (region.protect);
+		free (region.file);
+		return FALSE;
+	}
+	memset (region.protect, protect, size / DBG_MEMORY_PAGE);
+	qsort (sim->regions.data, vectorSize (&sim->regions), sizeof (dbgSimRegion), DbgSimCompareRegion);
+	return TRUE;
+}
+
+/**
+*	Copy between debugger and target memory
+*	\param sim Simulated target
+*	\param address Target address
+*	\param data Debugger buffer
+*	\param size Bytes
+*	\param write TRUE to copy into the target
+*	\param need Page protection required; 0 for none
+*	\ret Bytes copied before the first unmapped or inaccessible page
+*/
+static size_t DbgSimCopy (IN dbgSimTarget* sim, IN vaddr_t address, IN OUT void* data, IN size_t size,
+                          IN BOOL write, IN unsigned int need) {
+	size_t done = 0;
+
+	while (done < size) {
+		dbgSimRegion* region = DbgSimFind (sim, address + (vaddr_t) done, 0);
+		unsigned long at;
+		size_t        run;
+		if (!region)
+			break;
+		at = address + (vaddr_t) done - region->base;
+		if (need && !(region->protect[at / DBG_MEMORY_PAGE] & need))
+			break;
+		/* to the end of the page */
+		run = DBG_MEMORY_PAGE - (at & (DBG_MEMORY_PAGE - 1));
+		if (run > size - done)
+			run = size - done;
+		if (write)
+			memcpy (region->data + at, (const char*) data + done, run);
+		else
+			memcpy ((char*) data + done, region->data + at, run);
+		done += run;
+	}
+	return done;
+}
+
+/**
+*	Copy data to scratch memory
+*	\param sim Simulated target
+*	\param data Data
+*	\param size Bytes
+*	\ret Target address or 0 if scratch memory is full
+*/
+static vaddr_t DbgSimScratch (IN dbgSimTarget* sim, IN const void* data, IN size_t size) {
+	vaddr_t at = sim->scratch;
+
+	if (at + (unsigned long long) size > DBG_SIM_SCRATCH + DBG_SIM_SCRATCH_SIZE)
+		return 0;
+	DbgSimCopy (sim, at, (void*) data, size, TRUE, 0);
+	sim->scratch = (vaddr_t) ((at + size + 3) & ~3);
+	return at;
+}
+
+/**
+*	Parse "reg=value" into a context
+*	\ret TRUE if the register is known
+*/
+static BOOL DbgSimRegister (IN OUT dbgContext* context, IN const char* text) {
+	static const char* names[] = {"eip", "esp", "ebp", "eax", "ebx", "ecx", "edx", "esi", "edi"};
+	uint32_t*          regs[9];
+	const char*        value = strchr (text, '=');
+	unsigned int       i;
+
+	regs[0] = &context->eip;
+	regs[1] = &context->regs.esp;
+	regs[2] = &context->regs.ebp;
+	regs[3] = &context->regs.eax;
+	regs[4] = &context->regs.ebx;
+	regs[5] = &context->regs.ecx;
+	regs[6] = &context->regs.edx;
+	regs[7] = &context->regs.esi;
+	regs[8] = &context->regs.edi;
+	if (!value)
+		return FALSE;
+	if (value - text == 5 && strncmp (text, "flags", 5) == 0) {
+		context->flags = strtoul (value + 1, 0, 0);
+		return TRUE;
+	}
+	for (i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+		if (value - text == 3 && strncmp (text, names[i], 3) == 0) {
+			*regs[i] = (uint32_t) strtoul (value + 1, 0, 0);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+*	Parse one script line
+*	\param sim Simulated target
+*	\param line Line without its end of line; modified
+*	\ret TRUE if success, FALSE if the line is malformed
+*/
+static BOOL DbgSimParse (IN dbgSimTarget* sim, IN char* line) {
+	char* argv[64];
+	char* rest;
+	int   argc = 0;
+	char* token;
+#ifdef _MSC_VER
+	char* context;
+#endif
+
+	token = strchr (line, '#');
+	if (token)
+		*token = 0;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (!*line)
+		return TRUE;
+
+	/* name and string take the rest of the line */
+	rest = line + strcspn (line, " \t");
+	if (*rest)
+		*rest++ = 0;
+	while (*rest == ' ' || *rest == '\t')
+		rest++;
+	if (strcmp (line, "name") == 0 && *rest) {
+#ifdef _MSC_VER
+		strncpy_s (sim->name, sizeof (sim->name), rest, _TRUNCATE);
+#else
+		strncpy (sim->name, rest, sizeof (sim->name) - 1);
+#endif
+		return TRUE;
+	}
+	if (strcmp (line, "string") == 0 && *rest) {
+		dbgSimString string;
+		string.address = DbgSimScratch (sim, rest, strlen (rest) + 1);
+		string.length  = (unsigned int) strlen (rest) + 1;
+		return string.address && vectorAdd (&sim->strings, &string);
+	}
+
+#ifdef _MSC_VER
+	for (token = strtok_s (rest, " \t", &context); token && argc < 64; token = strtok_s (0, " \t", &context))
+#else
+	for (token = strtok (rest, " \t"); token && argc < 64; token = strtok (0, " \t"))
+#endif
+		argv[argc++] = token;
+
+	if (strcmp (line, "seed") == 0 && argc == 1)
+		sim->random = strtoul (argv[0], 0, 0) | 1;
+	else if (strcmp (line, "events") == 0 && argc == 1)
+		sim->limit = strtoul (argv[0], 0, 0);
+	else if (strcmp (line, "pace") == 0 && argc == 1)
+		sim->pace = strtoul (argv[0], 0, 0);
+	else if (strcmp (line, "memory") == 0 && argc >= 2 && argc <= 4) {
+		unsigned int protect = DBG_MEMORY_PROT_READ | DBG_MEMORY_PROT_WRITE;
+		if (argc >= 3) {
+			protect = (strchr (argv[2], 'r') ? DBG_MEMORY_PROT_READ  : 0)
+			        | (strchr (argv[2], 'w') ? DBG_MEMORY_PROT_WRITE : 0)
+			        | (strchr (argv[2], 'x') ? DBG_MEMORY_PROT_EXEC  : 0);
+		}
+		return DbgSimMap (sim, strtoul (argv[0], 0, 0), strtoul (argv[1], 0, 0), protect, argc == 4 ? argv[3] : 0);
+	}
+	else if (strcmp (line, "bytes") == 0 && argc >= 2) {
+		vaddr_t address = strtoul (argv[0], 0, 0);
+		int     i;
+		for (i = 1; i < argc; i++) {
+			unsigned char byte = (unsigned char) strtoul (argv[i], 0, 16);
+			if (!DbgSimCopy (sim, address + i - 1, &byte, 1, TRUE, 0))
+				return FALSE;
+		}
+	}
+	else if (strcmp (line, "thread") == 0 && argc >= 1) {
+		dbgSimThread thread;
+		int          i;
+		memset (&thread, 0, sizeof (dbgSimThread));
+		thread.id   = strtoul (argv[0], 0, 0);
+		thread.live = TRUE;
+		for (i = 1; i < argc; i++) {
+			if (!DbgSimRegister (&thread.context, argv[i]))
+				return FALSE;
+		}
+		return vectorAdd (&sim->threads, &thread) != 0;
+	}
+	else if (strcmp (line, "site") == 0 && argc == 1) {
+		vaddr_t site = strtoul (argv[0], 0, 0);
+		return vectorAdd (&sim->sites, &site) != 0;
+	}
+	else if (strcmp (line, "module") == 0 && argc == 2) {
+		dbgSimModule   module;
+		unsigned short wide[DBG_SIM_LINE];
+		vaddr_t        name;
+		size_t         i;
+		for (i = 0; i <= strlen (argv[1]); i++)
+			wide[i] = (unsigned char) argv[1][i];
+		module.base   = strtoul (argv[0], 0, 0);
+		module.loaded = FALSE;
+		name          = DbgSimScratch (sim, wide, i * sizeof (wide[0]));
+		module.name   = name ? DbgSimScratch (sim, &name, sizeof (name)) : 0;
+		return module.name && vectorAdd (&sim->modules, &module) != 0;
+	}
+	else if (strcmp (line, "mix") == 0 && argc >= 1) {
+		int i;
+		memset (sim->weights, 0, sizeof (sim->weights));
+		for (i = 0; i < argc; i++) {
+			char*        value = strchr (argv[i], '=');
+			unsigned int kind;
+			if (!value)
+				return FALSE;
+			*value++ = 0;
+			for (kind = 0; kind < DBG_SIM_KINDS && strcmp (argv[i], _dbgSimKinds[kind]); kind++)
+				;
+			if (kind == DBG_SIM_KINDS)
+				return FALSE;
+			sim->weights[kind] = strtoul (value, 0, 0);
+		}
+	}
+	else
+		return FALSE;
+	return TRUE;
+}
+
+/**
+*	Next value of the event generator
+*/
+static unsigned int DbgSimRandom (IN dbgSimTarget* sim) {
+	unsigned int x = sim->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->random = x;
+	return x;
+}
+
+/**
+*	Queue an event to be delivered before generated ones
+*/
+static void DbgSimPush (IN dbgSimTarget* sim, IN DWORD code, IN dbgSimThread* thread) {
+	DEBUG_EVENT e;
+	memset (&e, 0, sizeof (DEBUG_EVENT));
+	e.dwDebugEventCode = code;
+	e.dwProcessId      = DBG_SIM_PID;
+	e.dwThreadId       = thread->id;
+	vectorAdd (&sim->pending, &e);
+}
+
+/**
+*	Fill in an exception event
+*/
+static void DbgSimException (OUT DEBUG_EVENT* e, IN dbgSimThread* thread, IN DWORD code,
+                             IN vaddr_t address, IN BOOL firstChance) {
+	memset (e, 0, sizeof (DEBUG_EVENT));
+	e->dwDebugEventCode = EXCEPTION_DEBUG_EVENT;
+	e->dwProcessId      = DBG_SIM_PID;
+	e->dwThreadId       = thread->id;
+	e->u.Exception.dwFirstChance                     = firstChance;
+	e->u.Exception.ExceptionRecord.ExceptionCode     = code;
+	e->u.Exception.ExceptionRecord.ExceptionAddress  = (PVOID) (size_t) address;
+}
+
+/**
+*	Region of the executable: the first one backed by a file
+*/
+static dbgSimRegion* DbgSimImage (IN dbgSimTarget* sim) {
+	unsigned int i;
+	for (i = 0; i < vectorSize (&sim->regions); i++) {
+		dbgSimRegion* region = (dbgSimRegion*) vectorAt (&sim->regions, i);
+		if (region->file)
+			return region;
+	}
+	return (dbgSimRegion*) vectorAt (&sim->regions, 0);
+}
+
+/**
+*	Open a simulated target
+*
+*	The script is read and the startup events are queued: process and
+*	thread creation, a load for every module and the loader breakpoint.
+*
+*	\param path Script path
+*	\ret Simulated target or 0 on error
+*/
+dbgSimTarget* DbgSimOpen (IN const char* path) {
+	dbgSimTarget* sim;
+	FILE*         file;
+	char          line[DBG_SIM_LINE];
+	unsigned int  number = 0;
+	unsigned int  i;
+
+	sim = (dbgSimTarget*) calloc (1, sizeof (dbgSimTarget));
+	if (!sim)
+		return 0;
+	vectorInit (&sim->regions, sizeof (dbgSimRegion));
+	vectorInit (&sim->threads, sizeof (dbgSimThread));
+	vectorInit (&sim->modules, sizeof (dbgSimModule));
+	vectorInit (&sim->sites,   sizeof (vaddr_t));
+	vectorInit (&sim->strings, sizeof (dbgSimString));
+	vectorInit (&sim->pending, sizeof (DEBUG_EVENT));
+	sim->lock     = DbgMutexCreate ();
+	sim->random   = 1;
+	sim->scratch  = DBG_SIM_SCRATCH;
+	sim->allocate = DBG_SIM_ALLOCATE;
+	sim->nextTid  = DBG_SIM_TID;
+	sim->weights[DBG_SIM_SITE] = 1;
+	if (!sim->lock || !DbgSimMap (sim, DBG_SIM_SCRATCH, DBG_SIM_SCRATCH_SIZE, DBG_MEMORY_PROT_READ | DBG_MEMORY_PROT_EXEC, 0)) {
+		DbgSimClose (sim);
+		return 0;
+	}
+
+	/* loader breakpoint */
+	line[0] = (char) 0xcc;
+	DbgSimScratch (sim, line, 1);
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "r"))
+		file = 0;
+#else
+	file = fopen (path, "r");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		DbgSimClose (sim);
+		return 0;
+	}
+	while (fgets (line, sizeof (line), file)) {
+		number++;
+		line[strcspn (line, "\r\n")] = 0;
+		if (!DbgSimParse (sim, line)) {
+			DbgDisplayError ("%s(%u): bad script line", path, number);
+			fclose (file);
+			DbgSimClose (sim);
+			return 0;
+		}
+	}
+	fclose (file);
+	if (!vectorSize (&sim->threads)) {
+		DbgDisplayError ("%s: the script has no thread", path);
+		DbgSimClose (sim);
+		return 0;
+	}
+	if (!sim->name[0]) {
+#ifdef _MSC_VER
+		strncpy_s (sim->name, sizeof (sim->name), path, _TRUNCATE);
+#else
+		strncpy (sim->name, path, sizeof (sim->name) - 1);
+#endif
+	}
+	for (i = 0; i < DBG_SIM_KINDS; i++)
+		sim->total += sim->weights[i];
+
+	/* startup events */
+	for (i = 0; i < vectorSize (&sim->threads); i++) {
+		dbgSimThread* thread = (dbgSimThread*) vectorAt (&sim->threads, i);
+		DEBUG_EVENT*  e;
+		thread->site = vectorSize (&sim->sites) ? thread->id % vectorSize (&sim->sites) : 0;
+		if (thread->id >= sim->nextTid)
+			sim->nextTid = thread->id + 1;
+		DbgSimPush (sim, i ? CREATE_THREAD_DEBUG_EVENT : CREATE_PROCESS_DEBUG_EVENT, thread);
+		e = (DEBUG_EVENT*) vectorAt (&sim->pending, i);
+		if (i) {
+			e->u.CreateThread.hThread        = (HANDLE) (size_t) (i + 1);
+			e->u.CreateThread.lpStartAddress = (LPTHREAD_START_ROUTINE) (size_t) thread->context.eip;
+		}
+		else {
+			dbgSimRegion* image = DbgSimImage (sim);
+			e->u.CreateProcessInfo.hThread        = (HANDLE) 1;
+			e->u.CreateProcessInfo.lpStartAddress = (LPTHREAD_START_ROUTINE) (size_t) thread->context.eip;
+			e->u.CreateProcessInfo.lpBaseOfImage  = (LPVOID) (size_t) image->base;
+		}
+	}
+	for (i = 0; i < vectorSize (&sim->modules); i++) {
+		dbgSimModule* module = (dbgSimModule*) vectorAt (&sim->modules, i);
+		DEBUG_EVENT*  e;
+		DbgSimPush (sim, LOAD_DLL_DEBUG_EVENT, (dbgSimThread*) vectorAt (&sim->threads, 0));
+		e = (DEBUG_EVENT*) vectorAt (&sim->pending, vectorSize (&sim->pending) - 1);
+		e->u.LoadDll.lpBaseOfDll = (LPVOID) (size_t) module->base;
+		e->u.LoadDll.lpImageName = (LPVOID) (size_t) module->name;
+		e->u.LoadDll.fUnicode    = 1;
+		module->loaded = TRUE;
+	}
+	sim->breakIn = TRUE;
+	return sim;
+}
+
+/**
+*	Close simulated target and release its memory
+*/
+void DbgSimClose (IN dbgSimTarget* sim) {
+	unsigned int i;
+
+	for (i = 0; i < vectorSize (&sim->regions); i++) {
+		dbgSimRegion* region = (dbgSimRegion*) vectorAt (&sim->regions, i);
+		free (region->data);
+		free (region->protect);
+		free (region->file);
+	}
+	if (sim->lock)
+		DbgMutexFree (sim->lock);
+	vectorFree (&sim->regions);
+	vectorFree (&sim->threads);
+	vectorFree (&sim->modules);
+	vectorFree (&sim->sites);
+	vectorFree (&sim->strings);
+	vectorFree (&sim->pending);
+	free (sim);
+}
+
+char* DbgSimName (IN dbgSimTarget* sim) {
+	return sim->name;
+}
+
+pid_t DbgSimPid (IN dbgSimTarget* sim) {
+	return DBG_SIM_PID;
+}
+
+tid_t DbgSimTid (IN dbgSimTarget* sim) {
+	return ((dbgSimThread*) vectorAt (&sim->threads, 0))->id;
+}
+
+/**
+*	Pick a thread that is running
+*	\ret Thread or 0 if every thread is suspended
+*/
+static dbgSimThread* DbgSimRunnable (IN dbgSimTarget* sim) {
+	unsigned int count = vectorSize (&sim->threads);
+	unsigned int first = DbgSimRandom (sim) % count;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		dbgSimThread* thread = (dbgSimThread*) vectorAt (&sim->threads, (first + i) % count);
+		if (thread->live && !thread->suspend)
+			return thread;
+	}
+	return 0;
+}
+
+/**
+*	Create or end a thread
+*/
+static void DbgSimChurn (IN dbgSimTarget* sim, OUT DEBUG_EVENT* e) {
+	dbgSimThread* first = (dbgSimThread*) vectorAt (&sim->threads, 0);
+	unsigned int  count = vectorSize (&sim->threads);
+	unsigned int  live  = 0;
+	unsigned int  spare = count;
+	unsigned int  i;
+
+	for (i = 1; i < count; i++) {
+		dbgSimThread* thread = (dbgSimThread*) vectorAt (&sim->threads, i);
+		if (thread->live)
+			live++;
+		else if (spare == count)
+			spare = i;
+	}
+	memset (e, 0, sizeof (DEBUG_EVENT));
+	e->dwProcessId = DBG_SIM_PID;
+
+	/* the first thread lives as long as the process */
+	if (live && DbgSimRandom (sim) & 1) {
+		unsigned int end = DbgSimRandom (sim) % live;
+		for (i = 1; i < count; i++) {
+			dbgSimThread* thread = (dbgSimThread*) vectorAt (&sim->threads, i);
+			if (thread->live && !end--) {
+				thread->live         = FALSE;
+				e->dwDebugEventCode  = EXIT_THREAD_DEBUG_EVENT;
+				e->dwThreadId        = thread->id;
+				return;
+			}
+		}
+	}
+	else {
+		dbgSimThread  thread;
+		dbgSimThread* slot;
+		memset (&thread, 0, sizeof (dbgSimThread));
+		thread.id      = sim->nextTid++;
+		thread.live    = TRUE;
+		thread.context = first->context;
+		thread.context.flags    &= ~DBG_SIM_TRAP_FLAG;
+		thread.context.regs.esp -= DBG_SIM_STACK * spare;
+		thread.site    = vectorSize (&sim->sites) ? thread.id % vectorSize (&sim->sites) : 0;
+		/* handles of ended threads are reused */
+		if (spare < count)
+			slot = (dbgSimThread*) vectorAt (&sim->threads, spare);
+		else
+			slot = (dbgSimThread*) vectorAdd (&sim->threads, &thread);
+		if (!slot)
+			return;
+		*slot = thread;
+		e->dwDebugEventCode = CREATE_THREAD_DEBUG_EVENT;
+		e->dwThreadId       = thread.id;
+		e->u.CreateThread.hThread        = (HANDLE) (size_t) (slot - (dbgSimThread*) sim->threads.data + 1);
+		e->u.CreateThread.lpStartAddress = (LPTHREAD_START_ROUTINE) (size_t) thread.context.eip;
+	}
+}
+
+/**
+*	Produce the next event
+*	\param sim Simulated target
+*	\param e Output event
+*	\ret TRUE if an event was produced, FALSE if the target is idle
+*/
+static BOOL DbgSimNext (IN dbgSimTarget* sim, OUT DEBUG_EVENT* e) {
+	dbgSimThread* thread;
+	unsigned int  silent;
+
+	if (sim->exited)
+		return FALSE;
+	if (sim->pendingAt < vectorSize (&sim->pending)) {
+		*e = *(DEBUG_EVENT*) vectorAt (&sim->pending, sim->pendingAt++);
+		if (sim->pendingAt == vectorSize (&sim->pending)) {
+			vectorClear (&sim->pending);
+			sim->pendingAt = 0;
+		}
+		if (e->dwDebugEventCode == EXIT_PROCESS_DEBUG_EVENT)
+			sim->exited = TRUE;
+		return TRUE;
+	}
+	if (sim->limit && sim->events >= sim->limit) {
+		memset (e, 0, sizeof (DEBUG_EVENT));
+		e->dwDebugEventCode = EXIT_PROCESS_DEBUG_EVENT;
+		e->dwProcessId      = DBG_SIM_PID;
+		e->dwThreadId       = DbgSimTid (sim);
+		sim->exited = TRUE;
+		return TRUE;
+	}
+	if (sim->breakIn) {
+		thread = (dbgSimThread*) vectorAt (&sim->threads, 0);
+		DbgSimException (e, thread, EXCEPTION_BREAKPOINT, DBG_SIM_SCRATCH, TRUE);
+		sim->breakIn = FALSE;
+		return TRUE;
+	}
+
+	for (silent = 0; silent < DBG_SIM_SILENT; silent++) {
+		unsigned int pick;
+		dbgSimKind   kind;
+
+		thread = DbgSimRunnable (sim);
+		sim->idle = !thread;
+		if (!thread)
+			return FALSE;
+
+		/* a thread continued with the trap flag steps first */
+		if (thread->context.flags & DBG_SIM_TRAP_FLAG) {
+			thread->context.flags &= ~DBG_SIM_TRAP_FLAG;
+			thread->context.eip++;
+			DbgSimException (e, thread, EXCEPTION_SINGLE_STEP, thread->context.eip, TRUE);
+			return TRUE;
+		}
+
+		pick = sim->total ? DbgSimRandom (sim) % sim->total : 0;
+		for (kind = DBG_SIM_SITE; kind < DBG_SIM_KINDS - 1 && pick >= sim->weights[kind]; kind++)
+			pick -= sim->weights[kind];
+		if ((kind == DBG_SIM_MODULE && !vectorSize (&sim->modules)) || (kind == DBG_SIM_STRING && !vectorSize (&sim->strings)))
+			kind = DBG_SIM_SITE;
+		sim->counts[kind]++;
+
+		switch (kind) {
+			case DBG_SIM_SITE: {
+				vaddr_t       site;
+				unsigned char byte = 0;
+				if (!vectorSize (&sim->sites)) {
+					sim->passed++;
+					continue;
+				}
+				site = *(vaddr_t*) vectorAt (&sim->sites, thread->site);
+				thread->site = (thread->site + 1) % vectorSize (&sim->sites);
+				thread->context.eip = site;
+				DbgSimCopy (sim, site, &byte, 1, FALSE, 0);
+				if (byte != 0xcc) {
+					sim->passed++;
+					continue;
+				}
+				thread->context.eip = site + 1;
+				DbgSimException (e, thread, EXCEPTION_BREAKPOINT, site, TRUE);
+				return TRUE;
+			}
+			case DBG_SIM_FAULT:
+				DbgSimException (e, thread, EXCEPTION_ACCESS_VIOLATION, thread->context.eip, TRUE);
+				e->u.Exception.ExceptionRecord.NumberParameters        = 2;
+				e->u.Exception.ExceptionRecord.ExceptionInformation[0] = DbgSimRandom (sim) & 1;
+				e->u.Exception.ExceptionRecord.ExceptionInformation[1] = DbgSimRandom (sim) & 0xffc;
+				return TRUE;
+			case DBG_SIM_SOFTWARE:
+				DbgSimException (e, thread, DBG_SIM_CPP, thread->context.eip, TRUE);
+				return TRUE;
+			case DBG_SIM_THREAD:
+				DbgSimChurn (sim, e);
+				return TRUE;
+			case DBG_SIM_MODULE: {
+				dbgSimModule* module = (dbgSimModule*) vectorAt (&sim->modules, DbgSimRandom (sim) % vectorSize (&sim->modules));
+				memset (e, 0, sizeof (DEBUG_EVENT));
+				e->dwProcessId = DBG_SIM_PID;
+				e->dwThreadId  = thread->id;
+				if (module->loaded) {
+					e->dwDebugEventCode      = UNLOAD_DLL_DEBUG_EVENT;
+					e->u.UnloadDll.lpBaseOfDll = (LPVOID) (size_t) module->base;
+				}
+				else {
+					e->dwDebugEventCode      = LOAD_DLL_DEBUG_EVENT;
+					e->u.LoadDll.lpBaseOfDll = (LPVOID) (size_t) module->base;
+					e->u.LoadDll.lpImageName = (LPVOID) (size_t) module->name;
+					e->u.LoadDll.fUnicode    = 1;
+				}
+				module->loaded = !module->loaded;
+				return TRUE;
+			}
+			case DBG_SIM_STRING: {
+				dbgSimString* string = (dbgSimString*) vectorAt (&sim->strings, DbgSimRandom (sim) % vectorSize (&sim->strings));
+				memset (e, 0, sizeof (DEBUG_EVENT));
+				e->dwDebugEventCode = OUTPUT_DEBUG_STRING_EVENT;
+				e->dwProcessId      = DBG_SIM_PID;
+				e->dwThreadId       = thread->id;
+				e->u.DebugString.lpDebugStringData  = (LPSTR) (size_t) string->address;
+				e->u.DebugString.nDebugStringLength = (WORD) string->length;
+				return TRUE;
+			}
+			default:
+				break;
+		}
+	}
+	return FALSE;
+}
+
+/**
+*	Wait for the next event of a simulated target
+*	\param sim Simulated target
+*	\param e Output event
+*	\param ms Longest wait in milliseconds
+*	\ret TRUE if an event was produced, FALSE on timeout
+*/
+BOOL DbgSimWaitEvent (IN dbgSimTarget* sim, OUT DEBUG_EVENT* e, IN unsigned int ms) {
+	BOOL produced;
+
+	if (sim->pace && sim->start) {
+		unsigned long long due = sim->start + (unsigned long long) sim->events * 1000000000ULL / sim->pace;
+		unsigned long long now = DbgClockNow ();
+		if (now < due) {
+			unsigned long long wait = (due - now + 999999) / 1000000;
+			if (wait > ms) {
+				DbgSleep (ms);
+				return FALSE;
+			}
+			DbgSleep ((unsigned int) wait);
+		}
+	}
+	DbgMutexLock (sim->lock);
+	produced = DbgSimNext (sim, e);
+	if (produced) {
+		if (!sim->events)
+			sim->start = DbgClockNow ();
+		sim->events++;
+		sim->last = *e;
+		if (sim->exited) {
+			double elapsed = (double) (DbgClockNow () - sim->start) / 1e9;
+			DbgDisplayMessage ("Simulated %lu events in %.3f s (%.0f events/s); %lu sites passed without an event",
+				sim->events, elapsed, elapsed > 0 ? sim->events / elapsed : 0.0, sim->passed);
+		}
+	}
+	DbgMutexUnlock (sim->lock);
+	/* a busy target only passed silent sites; an idle one has nothing to run */
+	if (!produced && ms && (sim->exited || sim->idle))
+		DbgSleep (ms);
+	return produced;
+}
+
+/**
+*	Continue the last event of a simulated target
+*	\param sim Simulated target
+*	\param status DBG_CONTINUE or DBG_EXCEPTION_NOT_HANDLED
+*/
+void DbgSimContinue (IN dbgSimTarget* sim, IN DWORD status) {
+	DEBUG_EVENT* last = &sim->last;
+	unsigned int i;
+
+	/* the request path writes the last event under the lock */
+	DbgMutexLock (sim->lock);
+	if (last->dwDebugEventCode != EXCEPTION_DEBUG_EVENT || status != DBG_EXCEPTION_NOT_HANDLED
+		|| (last->u.Exception.ExceptionRecord.ExceptionCode == DBG_SIM_CPP && last->u.Exception.dwFirstChance)) {
+		DbgMutexUnlock (sim->lock);
+		return;
+	}
+	for (i = 0; i < vectorSize (&sim->threads); i++) {
+		dbgSimThread* thread = (dbgSimThread*) vectorAt (&sim->threads, i);
+		if (!thread->live || thread->id != last->dwThreadId)
+			continue;
+		if (last->u.Exception.dwFirstChance) {
+			/* nobody handles it */
+			DbgSimPush (sim, EXCEPTION_DEBUG_EVENT, thread);
+			((DEBUG_EVENT*) vectorAt (&sim->pending, vectorSize (&sim->pending) - 1))->u.Exception = last->u.Exception;
+			((DEBUG_EVENT*) vectorAt (&sim->pending, vectorSize (&sim->pending) - 1))->u.Exception.dwFirstChance = 0;
+		}
+		else {
+			DbgSimPush (sim, EXIT_PROCESS_DEBUG_EVENT, thread);
+			((DEBUG_EVENT*) vectorAt (&sim->pending, vectorSize (&sim->pending) - 1))->u.ExitProcess.dwExitCode =
+				last->u.Exception.ExceptionRecord.ExceptionCode;
+		}
+		break;
+	}
+	DbgMutexUnlock (sim->lock);
+}
+
+/**
+*	Thread of a handle; 0 selects the first thread
+*/
+static dbgSimThread* DbgSimThread (IN dbgSimTarget* sim, IN void* handle) {
+	unsigned int  index = handle ? (unsigned int) (size_t) handle - 1 : 0;
+	dbgSimThread* thread;
+
+	if (index >= vectorSize (&sim->threads))
+		return 0;
+	thread = (dbgSimThread*) vectorAt (&sim->threads, index);
+	return thread->live ? thread : 0;
+}
+
+/**
+*	Serve session request from the simulated target
+*	\param request Session request
+*	\param session Debug session
+*	\param addr Optional data address
+*	\param data Optional data buffer
+*	\param size Optional data buffer size
+*	\ret The number of bytes read or written OR TRUE on success, FALSE on failure depending on request
+*/
+unsigned long DbgSimRequest (IN dbgProcessReq request, IN dbgSession* session,
+                             IN OPT void* addr, IN OUT OPT void* data, IN OPT size_t size) {
+	dbgSimTarget* sim     = session->sim;
+	vaddr_t       address = (vaddr_t) (size_t) addr;
+	unsigned long result  = 0;
+
+	DbgMutexLock (sim->lock);
+	switch (request) {
+		case DBG_REQ_READ:
+			result = (unsigned long) DbgSimCopy (sim, address, data, size, FALSE, DBG_MEMORY_PROT_READ);
+			break;
+		case DBG_REQ_WRITE:
+			/* like WriteProcessMemory, debugger writes ignore page protection */
+			result = (unsigned long) DbgSimCopy (sim, address, data, size, TRUE, 0);
+			break;
+		case DBG_REQ_PEEK: {
+			dbgSimRegion* region = DbgSimFind (sim, address, 0);
+			*(void**) data = 0;
+			if (region && address - region->base + (unsigned long long) size <= region->size) {
+				*(void**) data = region->data + (address - region->base);
+				result = (unsigned long) size;
+			}
+			break;
+		}
+		case DBG_REQ_UNPEEK:
+			/* regions stay put until the session ends */
+			result = TRUE;
+			break;
+		case DBG_REQ_QUERY: {
+			dbgMemoryRegion* out   = (dbgMemoryRegion*) data;
+			dbgSimRegion*    above = 0;
+			dbgSimRegion*    region = DbgSimFind (sim, address, &above);
+			memset (out, 0, sizeof (dbgMemoryRegion));
+			if (!region) {
+				/* gap up to the next region */
+				out->base = address & ~(DBG_MEMORY_PAGE - 1);
+				out->size = (unsigned long) ((above ? above->base : DBG_SIM_USER_END) - out->base);
+				result = out->size != 0;
+			}
+			else {
+				/* run of pages with the same protection */
+				unsigned int  pages = region->size / DBG_MEMORY_PAGE;
+				unsigned int  page  = (address - region->base) / DBG_MEMORY_PAGE;
+				unsigned int  first = page;
+				unsigned int  last  = page;
+				unsigned char protect = region->protect[page];
+				while (first && region->protect[first - 1] == protect)
+					first--;
+				while (last + 1 < pages && region->protect[last + 1] == protect)
+					last++;
+				out->base     = region->base + first * DBG_MEMORY_PAGE;
+				out->size     = (last - first + 1) * DBG_MEMORY_PAGE;
+				out->readable = (protect & DBG_MEMORY_PROT_READ) != 0;
+				out->mapped   = region->file != 0;
+				out->protect  = protect;
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_PROTECT: {
+			dbgSimRegion* region = DbgSimFind (sim, address, 0);
+			unsigned int* protect = (unsigned int*) data;
+			if (region && size && address - region->base + (unsigned long long) size <= region->size) {
+				unsigned int first = (address - region->base) / DBG_MEMORY_PAGE;
+				unsigned int last  = (address - region->base + (unsigned long) size - 1) / DBG_MEMORY_PAGE;
+				unsigned int old   = region->protect[first];
+				memset (region->protect + first, (unsigned char) *protect, last - first + 1);
+				*protect = old;
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_ALLOCATE: {
+			unsigned long bytes = ((unsigned long) size + DBG_MEMORY_PAGE - 1) & ~(DBG_MEMORY_PAGE - 1);
+			*(vaddr_t*) data = 0;
+			if (DbgSimMap (sim, sim->allocate, bytes, DBG_MEMORY_PROT_READ | DBG_MEMORY_PROT_WRITE, 0)) {
+				*(vaddr_t*) data = sim->allocate;
+				/* leave a guard page between allocations */
+				sim->allocate += bytes + DBG_MEMORY_PAGE;
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_MAPPEDNAME: {
+			dbgSimRegion* region = DbgSimFind (sim, address, 0);
+			size_t        length;
+			if (!region || !region->file || !size)
+				break;
+			length = strlen (region->file);
+			if (length > size - 1)
+				length = size - 1;
+			memcpy (data, region->file, length);
+			((char*) data)[length] = 0;
+			result = (unsigned long) length;
+			break;
+		}
+		case DBG_REQ_GETCONTEXT: {
+			dbgSimThread* thread = DbgSimThread (sim, addr);
+			if (thread) {
+				memcpy (data, &thread->context, sizeof (dbgContext));
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_SETCONTEXT: {
+			dbgSimThread* thread = DbgSimThread (sim, addr);
+			if (thread) {
+				memcpy (&thread->context, data, sizeof (dbgContext));
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_SUSPEND: {
+			dbgSimThread* thread = DbgSimThread (sim, addr);
+			if (thread) {
+				thread->suspend++;
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_RESUME: {
+			dbgSimThread* thread = DbgSimThread (sim, addr);
+			if (thread) {
+				if (thread->suspend)
+					thread->suspend--;
+				result = TRUE;
+			}
+			break;
+		}
+		case DBG_REQ_BREAK:
+			sim->breakIn = TRUE;
+			result = TRUE;
+			break;
+		default:
+			DbgDisplayError ("Request not supported by simulated targets");
+			break;
+	}
+	DbgMutexUnlock (sim->lock);
+	return result;
+}
@@ -0,0 +1,368 @@
+/********************************************
+*
+*	stats.c - Performance counters
+*
+********************************************/
+
+/*
+	This component keeps always-on counters and latency histograms of
+	the debugger itself.
+
+	Every thread that records anything gets its own block of counters on
+	first use, so recording is a few plain increments with no locks or
+	atomic instructions. Blocks are pushed onto a global list with one
+	compare and swap and live until the debugger exits. A report sums the
+	blocks of all threads; a value being written while it is read is off
+	by at most one update.
+
+	Latencies go into log2 nanosecond histograms, which is enough to
+	tell the median from the tail.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_STATS_BUCKETS 40		/* 1 ns to 18 minutes */
+
+typedef struct _dbgStatsHistogram {
+	unsigned long      count;
+	unsigned long long total;		/* ns */
+	unsigned long long max;
+	unsigned long      buckets[DBG_STATS_BUCKETS];	/* bucket b counts values below 2^b ns */
+}dbgStatsHistogram;
+
+typedef struct _dbgStatsBlock {
+	struct _dbgStatsBlock* next;
+	unsigned long          thread;
+	unsigned long          counters[DBG_STAT_COUNT];
+	unsigned long long     bytes[DBG_REQ_COUNT];
+	dbgStatsHistogram      requests[DBG_REQ_COUNT];
+	dbgStatsHistogram      timers[DBG_TIMER_COUNT];
+}dbgStatsBlock;
+
+static DBG_THREAD_LOCAL dbgStatsBlock* _statsLocal = 0;
+static dbgStatsBlock* volatile         _statsBlocks = 0;
+static dbgStatsBlock                   _statsShared;	/* used when a block cannot be allocated */
+
+static const char* _dbgRequestNames[DBG_REQ_COUNT] = {
+	"read", "write", "getcontext", "setcontext", "continue", "break", "stop",
+	"attach", "detach", "readphys", "writephys", "translate", "query",
+	"mappedname", "suspend", "resume", "peek", "protect", "allocate",
+	"unpeek"
+};
+
+/**
+*	Short name of a session request
+*	\param request Request
+*	\ret Name
+*/
+const char* DbgStatsRequestName (IN dbgProcessReq request) {
+	return request < DBG_REQ_COUNT ? _dbgRequestNames[request] : "unknown";
+}
+
+static const char* _dbgTimerNames[DBG_TIMER_COUNT] = {
+	"event", "stop", "trap", "symbol"
+};
+
+static const char* _dbgCounterNames[DBG_STAT_COUNT] = {
+	"symbol_misses", "unwind_plan_hits", "unwind_plan_misses",
+	"read_cache_hits", "read_cache_misses"
+};
+
+/**
+*	Counter block of the calling thread
+*/
+static dbgStatsBlock* DbgStatsLocal (void) {
+	dbgStatsBlock* block = _statsLocal;
+
+	if (block)
+		return block;
+	block = (dbgStatsBlock*) calloc (1, sizeof (dbgStatsBlock));
+	if (!block)
+		return &_statsShared;
+	block->thread = DbgThreadCurrentId ();
+	do {
+		block->next = _statsBlocks;
+	} while (!DbgAtomicCasPtr (&_statsBlocks, block->next, block));
+	_statsLocal = block;
+	return block;
+}
+
+/**
+*	Add a value to a histogram
+*/
+static void DbgStatsRecord (IN dbgStatsHistogram* histogram, IN unsigned long long ns) {
+	unsigned int bucket = 0;
+
+	while (bucket < DBG_STATS_BUCKETS - 1 && ns >> bucket)
+		bucket++;
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->total += ns;
+	if (ns > histogram->max)
+		histogram->max = ns;
+}
+
+/**
+*	Add to a counter of the calling thread
+*	\param counter Counter
+*	\param n Amount
+*/
+void DbgStatsCount (IN dbgStatCounter counter, IN unsigned long n) {
+	DbgStatsLocal ()->counters[counter] += n;
+}
+
+/**
+*	Record a latency in the calling thread
+*	\param timer Timer
+*	\param ns Nanoseconds
+*/
+void DbgStatsTime (IN dbgStatTimer timer, IN unsigned long long ns) {
+	DbgStatsRecord (&DbgStatsLocal ()->timers[timer], ns);
+}
+
+/**
+*	Record one session request in the calling thread
+*	\param request Request
+*	\param bytes Bytes transferred
+*	\param ns Nanoseconds, including the trip to the session thread
+*/
+void DbgStatsRequest (IN dbgProcessReq request, IN size_t bytes, IN unsigned long long ns) {
+	dbgStatsBlock* block = DbgStatsLocal ();
+	if (request >= DBG_REQ_COUNT)
+		return;
+	block->bytes[request] += bytes;
+	DbgStatsRecord (&block->requests[request], ns);
+}
+
+/**
+*	Sum the blocks of every thread
+*	\ret Number of threads
+*/
+static unsigned int DbgStatsMerge (OUT dbgStatsBlock* total) {
+	dbgStatsBlock* block;
+	unsigned int   threads = 0;
+	unsigned int   i;
+	unsigned int   b;
+
+	memcpy (total, &_statsShared, sizeof (dbgStatsBlock));
+	for (block = (dbgStatsBlock*) DbgAtomicLoadPtr (&_statsBlocks); block; block = block->next, threads++) {
+		for (i = 0; i < DBG_STAT_COUNT; i++)
+			total->counters[i] += block->counters[i];
+		for (i = 0; i < DBG_REQ_COUNT + DBG_TIMER_COUNT; i++) {
+			dbgStatsHistogram* from = i < DBG_REQ_COUNT ? &block->requests[i] : &block->timers[i - DBG_REQ_COUNT];
+			dbgStatsHistogram* to   = i < DBG_REQ_COUNT ? &total->requests[i] : &total->timers[i - DBG_REQ_COUNT];
+			if (i < DBG_REQ_COUNT)
+				total->bytes[i] += block->bytes[i];
+			to->count += from->count;
+			to->total += from->total;
+			if (from->max > to->max)
+				to->max = from->max;
+			for (b = 0; b < DBG_STATS_BUCKETS; b++)
+				to->buckets[b] += from->buckets[b];
+		}
+	}
+	return threads;
+}
+
+/**
+*	Percentile of a histogram
+*	\ret Upper bound of the bucket holding the percentile, at most the maximum, in ns
+*/
+static unsigned long long DbgStatsPercentile (IN const dbgStatsHistogram* histogram, IN unsigned int percent) {
+	unsigned long long need = ((unsigned long long) histogram->count * percent + 99) / 100;
+	unsigned long long seen = 0;
+	unsigned int       b;
+
+	for (b = 0; b < DBG_STATS_BUCKETS; b++) {
+		seen += histogram->buckets[b];
+		if (seen >= need)
+			break;
+	}
+	if (b >= DBG_STATS_BUCKETS)
+		b = DBG_STATS_BUCKETS - 1;
+	return (1ULL << b) < histogram->max ? 1ULL << b : histogram->max;
+}
+
+/* memory held by one subsystem of the session */
+typedef struct _dbgStatsMemory {
+	const char*   name;
+	unsigned long bytes;
+}dbgStatsMemory;
+
+/**
+*	Measure memory held by each subsystem of a session
+*	\ret Number of entries
+*/
+static unsigned int DbgStatsMemory (IN dbgSession* session, OUT dbgStatsMemory* memory) {
+	dbgProcess*  process = &session->process;
+	unsigned int n = 0;
+
+	memory[n].name  = "session_arena";
+	memory[n].bytes = process->heap.reserved;
+	n++;
+	memory[n].name  = "interned_strings";
+	memory[n].bytes = process->strings.bytes + (process->strings.mask + 1) * (sizeof (char*) + sizeof (unsigned int));
+	n++;
+	memory[n].name  = "breakpoints";
+	memory[n].bytes = process->breakPointPool.count * process->breakPointPool.elementSize
+		+ (process->breakPointIndex.slots ? (process->breakPointIndex.mask + 1) * sizeof (dbgBreakpoint*) : 0);
+	n++;
+	memory[n].name  = "unwind_plans";
+	memory[n].bytes = process->unwindPlans.capacity * process->unwindPlans.elementSize;
+	n++;
+	memory[n].name  = "checkpoints";
+	memory[n].bytes = session->history.pages.count * session->history.pages.elementSize
+		+ session->history.stops.capacity * session->history.stops.elementSize;
+	n++;
+	memory[n].name  = "debug_output";
+	memory[n].bytes = (unsigned long) session->debugOut.capacity
+		+ (session->debugOut.threads ? (session->debugOut.threadMask + 1) * sizeof (dbgDebugOutThread) : 0);
+	n++;
+	memory[n].name  = "event_batch";
+	memory[n].bytes = session->batch.stops.capacity * session->batch.stops.elementSize
+		+ session->batch.held.capacity * session->batch.held.elementSize;
+	n++;
+	return n;
+}
+
+#define DBG_STATS_MEMORY_MAX 8
+
+/**
+*	Display one histogram line
+*/
+static void DbgStatsLine (IN const char* name, IN const dbgStatsHistogram* histogram, IN unsigned long long bytes) {
+	if (!histogram->count)
+		return;
+	DbgDisplayMessage ("  %-12s %10lu %12llu %10.2f %10.2f %10.2f %10.2f", name, histogram->count, bytes,
+		(double) histogram->total / histogram->count / 1000.0,
+		(double) DbgStatsPercentile (histogram, 50) / 1000.0,
+		(double) DbgStatsPercentile (histogram, 99) / 1000.0,
+		(double) histogram->max / 1000.0);
+}
+
+/**
+*	Display counters of every thread
+*	\param session Debug session whose memory is reported; 0 for counters only
+*/
+void DbgStatsReport (IN OPT dbgSession* session) {
+	dbgStatsBlock* total = (dbgStatsBlock*) malloc (sizeof (dbgStatsBlock));
+	dbgStatsMemory memory[DBG_STATS_MEMORY_MAX];
+	unsigned int   threads;
+	unsigned int   count;
+	unsigned int   i;
+
+	if (!total) {
+		DbgDisplayError ("Out of memory");
+		return;
+	}
+	threads = DbgStatsMerge (total);
+
+	DbgDisplayMessage ("Counters from %u threads; times in microseconds, percentiles are bucket upper bounds", threads);
+	DbgDisplayMessage ("  %-12s %10s %12s %10s %10s %10s %10s", "request", "calls", "bytes", "mean", "p50", "p99", "max");
+	for (i = 0; i < DBG_REQ_COUNT; i++)
+		DbgStatsLine (_dbgRequestNames[i], &total->requests[i], total->bytes[i]);
+	DbgDisplayMessage ("  %-12s %10s %12s %10s %10s %10s %10s", "timer", "count", "", "mean", "p50", "p99", "max");
+	for (i = 0; i < DBG_TIMER_COUNT; i++)
+		DbgStatsLine (_dbgTimerNames[i], &total->timers[i], 0);
+
+	for (i = 0; i < DBG_STAT_COUNT; i++)
+		DbgDisplayMessage ("  %-20s %10lu", _dbgCounterNames[i], total->counters[i]);
+	if (total->timers[DBG_TIMER_SYMBOL].count)
+		DbgDisplayMessage ("  symbol lookups found %.1f%%", 100.0 -
+			100.0 * total->counters[DBG_STAT_SYMBOL_MISSES] / total->timers[DBG_TIMER_SYMBOL].count);
+	if (total->counters[DBG_STAT_UNWIND_HITS] + total->counters[DBG_STAT_UNWIND_MISSES])
+		DbgDisplayMessage ("  unwind plan cache hits %.1f%%", 100.0 * total->counters[DBG_STAT_UNWIND_HITS] /
+			(total->counters[DBG_STAT_UNWIND_HITS] + total->counters[DBG_STAT_UNWIND_MISSES]));
+	if (total->counters[DBG_STAT_READ_CACHE_HITS] + total->counters[DBG_STAT_READ_CACHE_MISSES])
+		DbgDisplayMessage ("  read cache hits %.1f%%", 100.0 * total->counters[DBG_STAT_READ_CACHE_HITS] /
+			(total->counters[DBG_STAT_READ_CACHE_HITS] + total->counters[DBG_STAT_READ_CACHE_MISSES]));
+
+	if (session) {
+		if (session->process.strings.lookups)
+			DbgDisplayMessage ("  string intern hits %.1f%%",
+				100.0 * session->process.strings.hits / session->process.strings.lookups);
+		count = DbgStatsMemory (session, memory);
+		DbgDisplayMessage ("  %-20s %10s", "memory", "KB");
+		for (i = 0; i < count; i++)
+			DbgDisplayMessage ("  %-20s %10lu", memory[i].name, memory[i].bytes / 1024);
+	}
+	free (total);
+}
+
+/**
+*	Write one histogram as a JSON object
+*/
+static void DbgStatsJsonHistogram (IN FILE* file, IN const char* name, IN const dbgStatsHistogram* histogram,
+                                   IN unsigned long long bytes, IN BOOL last) {
+	unsigned int b;
+	unsigned int top = 0;
+
+	for (b = 0; b < DBG_STATS_BUCKETS; b++) {
+		if (histogram->buckets[b])
+			top = b + 1;
+	}
+	fprintf (file, "    \"%s\": {\"count\": %lu, \"bytes\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, "
+		"\"p50_ns\": %llu, \"p99_ns\": %llu, \"log2_ns_buckets\": [",
+		name, histogram->count, bytes, histogram->total, histogram->max,
+		histogram->count ? DbgStatsPercentile (histogram, 50) : 0ULL,
+		histogram->count ? DbgStatsPercentile (histogram, 99) : 0ULL);
+	for (b = 0; b < top; b++)
+		fprintf (file, b ? ", %lu" : "%lu", histogram->buckets[b]);
+	fprintf (file, "]}%s\n", last ? "" : ",");
+}
+
+/**
+*	Write counters of every thread as JSON
+*	\param session Debug session whose memory is reported; 0 for counters only
+*	\param path Output file
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgStatsDump (IN OPT dbgSession* session, IN const char* path) {
+	dbgStatsBlock* total = (dbgStatsBlock*) malloc (sizeof (dbgStatsBlock));
+	dbgStatsMemory memory[DBG_STATS_MEMORY_MAX];
+	FILE*          file;
+	unsigned int   threads;
+	unsigned int   count = 0;
+	unsigned int   i;
+
+	if (!total) {
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "w"))
+		file = 0;
+#else
+	file = fopen (path, "w");
+#endif
+	if (!file) {
+		free (total);
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	threads = DbgStatsMerge (total);
+	if (session)
+		count = DbgStatsMemory (session, memory);
+
+	fprintf (file, "{\n  \"threads\": %u,\n  \"requests\": {\n", threads);
+	for (i = 0; i < DBG_REQ_COUNT; i++)
+		DbgStatsJsonHistogram (file, _dbgRequestNames[i], &total->requests[i], total->bytes[i], i == DBG_REQ_COUNT - 1);
+	fprintf (file, "  },\n  \"timers\": {\n");
+	for (i = 0; i < DBG_TIMER_COUNT; i++)
+		DbgStatsJsonHistogram (file, _dbgTimerNames[i], &total->timers[i], 0, i == DBG_TIMER_COUNT - 1);
+	fprintf (file, "  },\n  \"counters\": {\n");
+	for (i = 0; i < DBG_STAT_COUNT; i++)
+		fprintf (file, "    \"%s\": %lu%s\n", _dbgCounterNames[i], total->counters[i], i == DBG_STAT_COUNT - 1 ? "" : ",");
+	fprintf (file, "  },\n  \"memory\": {\n");
+	for (i = 0; i < count; i++)
+		fprintf (file, "    \"%s\": %lu%s\n", memory[i].name, memory[i].bytes, i == count - 1 ? "" : ",");
+	fprintf (file, "  }\n}\n");
+
+	fclose (file);
+	free (total);
+	DbgDisplayMessage ("Counters written to %s", path);
+	return TRUE;
+}
@@ -0,0 +1,494 @@
+/********************************************
+*
+*	symbench.c - Symbol benchmarks
+*
+********************************************/
+
+/*
+	This component measures symbol startup cost and lookup latency with
+	synthetic symbol tables, so that results can be shared without the
+	programs they came from.
+
+	A fixture records what the PDB path reports for a set of modules:
+	the modules, their source files, functions and line rows. Fixtures
+	are written by a generator with any number of each and replayed
+	through the same conversions that load a real PDB file. Functions
+	are added to virtual modules of the symbol handler, so name and
+	address lookups go through DbgSymbolFromName and DbgSymbolFromAddress
+	exactly as they do for a target.
+
+	Fixture format, one record per line:
+
+		fixture <functions> <files> <rows> <modules>
+		module <name> <base> <size>
+		file <name>
+		function <name> <address> <size> <first line>
+
+	A file belongs to the module above it and a function to the file
+	above it. Each function has <rows> line rows spread over its code.
+
+	The benchmark owns the symbol handler of the debugger, so it only
+	runs while no session is open.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_SYMBENCH_BASE     0x10000000	/* base of the first module */
+#define DBG_SYMBENCH_LIMIT    0x70000000	/* bytes of address space for all modules */
+#define DBG_SYMBENCH_HEADER   0x1000		/* module bytes before the first function */
+#define DBG_SYMBENCH_ALIGN    0x10000		/* module alignment */
+#define DBG_SYMBENCH_FUNCTION 32			/* bytes of code per function */
+#define DBG_SYMBENCH_SAMPLES  10000			/* lookups of each kind */
+#define DBG_SYMBENCH_NAME     256
+
+/* sscanf_s takes the size of every string it stores */
+#ifdef _MSC_VER
+#define DBG_SYMBENCH_SCAN           sscanf_s
+#define DBG_SYMBENCH_STRING(buffer) buffer, (unsigned int) sizeof (buffer)
+#else
+#define DBG_SYMBENCH_SCAN           sscanf
+#define DBG_SYMBENCH_STRING(buffer) buffer
+#endif
+
+typedef enum _dbgSymbenchMetric {
+	DBG_SYMBENCH_LOAD,
+	DBG_SYMBENCH_GROWTH,
+	DBG_SYMBENCH_TABLES,
+	DBG_SYMBENCH_NAME_MEAN,
+	DBG_SYMBENCH_NAME_P99,
+	DBG_SYMBENCH_ADDRESS_MEAN,
+	DBG_SYMBENCH_ADDRESS_P99,
+	DBG_SYMBENCH_METRICS
+}dbgSymbenchMetric;
+
+static const char* _dbgSymbenchMetrics[DBG_SYMBENCH_METRICS] = {
+	"load_ms",
+	"rss_growth_mb",
+	"table_memory_mb",
+	"name_lookup_ns",
+	"name_lookup_p99_ns",
+	"address_lookup_ns",
+	"address_lookup_p99_ns"
+};
+
+/* words of generated function names */
+static const char* _dbgSymbenchWords[16] = {
+	"parse", "update", "render", "alloc", "visit", "emit", "lookup", "flush",
+	"resolve", "compare", "insert", "decode", "encode", "scan", "merge", "reset"
+};
+
+typedef struct _dbgSymbenchSample {
+	char    name[DBG_SYMBENCH_NAME];
+	vaddr_t address;
+}dbgSymbenchSample;
+
+typedef struct _dbgSymbenchRun {
+	const char*   fixture;
+	unsigned long functions;
+	unsigned long files;
+	unsigned long rows;
+	unsigned long modules;
+	double        results[DBG_SYMBENCH_METRICS];
+	unsigned long wrong;		/* lookups that returned another symbol */
+}dbgSymbenchRun;
+
+/**
+*	Write a fixture
+*	\param path Fixture file
+*	\param functions Number of functions
+*	\param files Number of source files, at most one per function
+*	\param rows Line rows per function
+*	\param modules Number of modules, at most one per source file
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgSymbolFixtureWrite (IN const char* path, IN unsigned long functions, IN unsigned long files,
+                            IN unsigned int rows, IN unsigned int modules) {
+	FILE*         file;
+	vaddr_t       base = DBG_SYMBENCH_BASE;
+	unsigned int  m;
+
+	if (!functions || !files || files > functions || !modules || modules > files
+		|| !rows || rows > DBG_SYMBENCH_FUNCTION
+		|| functions > (DBG_SYMBENCH_LIMIT - modules * (DBG_SYMBENCH_HEADER + DBG_SYMBENCH_ALIGN)) / DBG_SYMBENCH_FUNCTION) {
+		DbgDisplayError ("Fixture shape out of range");
+		return FALSE;
+	}
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "w"))
+		file = 0;
+#else
+	file = fopen (path, "w");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	fprintf (file, "fixture %lu %lu %u %u\n", functions, files, rows, modules);
+	for (m = 0; m < modules; m++) {
+		unsigned long firstFile = (unsigned long) ((unsigned long long) files * m / modules);
+		unsigned long lastFile  = (unsigned long) ((unsigned long long) files * (m + 1) / modules);
+		unsigned long first     = (unsigned long) ((unsigned long long) functions * firstFile / files);
+		unsigned long last      = (unsigned long) ((unsigned long long) functions * lastFile / files);
+		unsigned long size      = DBG_SYMBENCH_HEADER + (last - first) * DBG_SYMBENCH_FUNCTION;
+		unsigned long f;
+		unsigned long u;
+
+		size = (size + DBG_SYMBENCH_ALIGN - 1) & ~(DBG_SYMBENCH_ALIGN - 1);
+		fprintf (file, "module synth%u.dll 0x%08x 0x%lx\n", m, base, size);
+		for (u = firstFile; u < lastFile; u++) {
+			unsigned long begin = (unsigned long) ((unsigned long long) functions * u / files);
+			unsigned long end   = (unsigned long) ((unsigned long long) functions * (u + 1) / files);
+
+			fprintf (file, "file c:\\src\\synth%u\\unit%lu.c\n", m, u);
+			for (f = begin; f < end; f++) {
+				/* names of varying length and shared prefixes, like real code */
+				unsigned int hash = (unsigned int) f * 2654435761u;
+				fprintf (file, "function %s_%s_%lu 0x%08lx %u %lu\n",
+					_dbgSymbenchWords[hash >> 28], _dbgSymbenchWords[(hash >> 24) & 15], f,
+					(unsigned long) base + DBG_SYMBENCH_HEADER + (f - first) * DBG_SYMBENCH_FUNCTION,
+					DBG_SYMBENCH_FUNCTION, 10 + (f - begin) * (rows + 2));
+			}
+		}
+		base += size;
+	}
+	if (fclose (file) != 0) {
+		DbgDisplayError ("Unable to write '%s'", path);
+		return FALSE;
+	}
+	DbgDisplayMessage ("Fixture %s: %lu functions in %lu files and %u modules, %u line rows each",
+		path, functions, files, modules, rows);
+	return TRUE;
+}
+
+/**
+*	Replay a fixture into the symbol handler and the process tables
+*	\param session Scratch session
+*	\param path Fixture file
+*	\param run Output counts
+*	\param samples Output functions to look up
+*	\ret TRUE if success, FALSE on error
+*/
+static BOOL DbgSymbenchLoad (IN dbgSession* session, IN const char* path, OUT dbgSymbenchRun* run, OUT vector* samples) {
+	FILE*          file;
+	char           line[DBG_SYMBENCH_NAME + 64];
+	char           name[DBG_SYMBENCH_NAME];
+	vaddr_t        modbase = 0;
+	dbgSourceFile* source  = 0;
+	unsigned long  stride  = 1;
+	unsigned long  rows    = 1;
+	unsigned long  records = 0;
+	BOOL           result  = TRUE;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "r"))
+		file = 0;
+#else
+	file = fopen (path, "r");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	while (result && fgets (line, sizeof (line), file)) {
+		unsigned long a, b, c, d;
+
+		records++;
+		if (DBG_SYMBENCH_SCAN (line, "function %255s %lx %lu %lu", DBG_SYMBENCH_STRING (name), &a, &b, &c) == 4) {
+			unsigned long r;
+			if (!modbase || !DbgAddSymbolPDB (modbase, name, (vaddr_t) a, b)) {
+				result = FALSE;
+				break;
+			}
+			for (r = 0; source && r < rows; r++) {
+				if (!DbgAddSourceLinePDB (source, c + r, (vaddr_t) (a + r * b / rows))) {
+					result = FALSE;
+					break;
+				}
+			}
+			if (run->functions++ % stride == 0) {
+				dbgSymbenchSample sample;
+#ifdef _MSC_VER
+				strcpy_s (sample.name, sizeof (sample.name), name);
+#else
+				strcpy (sample.name, name);
+#endif
+				sample.address = (vaddr_t) a;
+				if (!vectorAdd (samples, &sample))
+					result = FALSE;
+			}
+			run->rows += rows;
+		}
+		else if (DBG_SYMBENCH_SCAN (line, "file %255s", DBG_SYMBENCH_STRING (name)) == 1) {
+			source = modbase ? DbgAddSourceFilePDB (&session->process, modbase, name) : 0;
+			if (!source)
+				result = FALSE;
+			run->files++;
+		}
+		else if (DBG_SYMBENCH_SCAN (line, "module %255s %lx %lx", DBG_SYMBENCH_STRING (name), &a, &b) == 3) {
+			dbgSharedLibrary* module;
+			modbase = DbgLoadVirtualModulePDB (name, (vaddr_t) a, b);
+			module  = modbase ? DbgModuleAdd (session, name, modbase, b) : 0;
+			if (!module) {
+				result = FALSE;
+				break;
+			}
+			source = 0;
+			run->modules++;
+		}
+		else if (DBG_SYMBENCH_SCAN (line, "fixture %lu %lu %lu %lu", &a, &b, &c, &d) == 4) {
+			stride = a / DBG_SYMBENCH_SAMPLES ? a / DBG_SYMBENCH_SAMPLES : 1;
+			rows   = c ? c : 1;
+		}
+		else if (line[0] != '#' && line[0] != '\n')
+			result = FALSE;
+	}
+	fclose (file);
+	if (!result)
+		DbgDisplayError ("%s: unable to load record %lu", path, records);
+	return result;
+}
+
+static int DbgSymbenchCompare (const void* a, const void* b) {
+	unsigned long long x = *(const unsigned long long*) a;
+	unsigned long long y = *(const unsigned long long*) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+*	Time a lookup of every sample
+*	\param byName TRUE to look up names, FALSE to look up addresses inside the functions
+*	\param mean Output mean latency in nanoseconds
+*	\param p99 Output 99th percentile latency in nanoseconds
+*	\ret Number of lookups that failed or found another symbol
+*/
+static unsigned long DbgSymbenchLookup (IN dbgSession* session, IN vector* samples, IN BOOL byName,
+                                        OUT double* mean, OUT double* p99) {
+	unsigned int        count = vectorSize (samples);
+	unsigned long long* times = (unsigned long long*) malloc ((count ? count : 1) * sizeof (unsigned long long));
+	unsigned long long  total = 0;
+	unsigned long       wrong = 0;
+	unsigned int        i;
+
+	*mean = 0;
+	*p99  = 0;
+	if (!times)
+		return count;
+	for (i = 0; i < count; i++) {
+		dbgSymbenchSample* sample = (dbgSymbenchSample*) vectorAt (samples, i);
+		dbgSymbol          symbol;
+		unsigned long long start = DbgClockNow ();
+		BOOL               found;
+
+		if (byName)
+			found = DbgSymbolFromName (session, sample->name, &symbol);
+		else
+			found = DbgSymbolFromAddress (session, sample->address + DBG_SYMBENCH_FUNCTION / 2, &symbol);
+		times[i] = DbgClockNow () - start;
+		total   += times[i];
+		if (!found || symbol.addr != sample->address)
+			wrong++;
+	}
+	if (count) {
+		qsort (times, count, sizeof (unsigned long long), DbgSymbenchCompare);
+		*mean = (double) total / count;
+		*p99  = (double) times[(unsigned long long) count * 99 / 100];
+	}
+	free (times);
+	return wrong;
+}
+
+/**
+*	Load a fixture into a scratch session and time lookups
+*	\param path Fixture file
+*	\param run Output results
+*	\ret TRUE if success, FALSE on error
+*/
+static BOOL DbgSymbenchRun (IN const char* path, OUT dbgSymbenchRun* run) {
+	static char        name[] = "symbench";
+	dbgSession*        session;
+	vector             samples;
+	ilistNode*         current;
+	unsigned long      used;
+	unsigned long long resident;
+	unsigned long long start;
+	unsigned int       random = 2463534242u;
+	unsigned int       i;
+	BOOL               result;
+
+	memset (run, 0, sizeof (dbgSymbenchRun));
+	run->fixture = path;
+	session = DbgSessionNew (name, 0, 0, 0, 0);
+	if (!session)
+		return FALSE;
+	vectorInit (&samples, sizeof (dbgSymbenchSample));
+
+	/* load time covers what DbgSymbolEnumerate does for a target */
+	resident = DbgProcessMemory ();
+	start    = DbgClockNow ();
+	used     = arenaUsed (&session->process.heap);
+	result = DbgInitializePDB (&session->process) && DbgSymbenchLoad (session, path, run, &samples);
+	run->results[DBG_SYMBENCH_LOAD]   = (double) (DbgClockNow () - start) / 1e6;
+	run->results[DBG_SYMBENCH_TABLES] = (double) (arenaUsed (&session->process.heap) - used) / (1024.0 * 1024.0);
+
+	if (result) {
+		/* look up in random order so neighbouring symbols do not share cache lines */
+		for (i = vectorSize (&samples); i > 1; i--) {
+			dbgSymbenchSample swap;
+			unsigned int      j;
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			j = random % i;
+			swap = *(dbgSymbenchSample*) vectorAt (&samples, i - 1);
+			*(dbgSymbenchSample*) vectorAt (&samples, i - 1) = *(dbgSymbenchSample*) vectorAt (&samples, j);
+			*(dbgSymbenchSample*) vectorAt (&samples, j) = swap;
+		}
+		run->wrong  = DbgSymbenchLookup (session, &samples, TRUE,
+			&run->results[DBG_SYMBENCH_NAME_MEAN], &run->results[DBG_SYMBENCH_NAME_P99]);
+		run->wrong += DbgSymbenchLookup (session, &samples, FALSE,
+			&run->results[DBG_SYMBENCH_ADDRESS_MEAN], &run->results[DBG_SYMBENCH_ADDRESS_P99]);
+		/* what this run holds; the peak of the process would include earlier runs */
+		resident = DbgProcessMemory () - resident;
+		run->results[DBG_SYMBENCH_GROWTH] = (long long) resident > 0 ? (double) resident / (1024.0 * 1024.0) : 0.0;
+		if (run->wrong)
+			DbgDisplayError ("%s: %lu lookups failed or found the wrong symbol", path, run->wrong);
+	}
+
+	for (current = session->process.libraryList.first; current; current = current->next)
+		DbgUnloadModulePDB (((dbgSharedLibrary*) current)->base);
+	vectorFree (&samples);
+	DbgSymbolFree (session);
+	DbgSessionDelete (session);
+	free (session);
+	return result && !run->wrong;
+}
+
+/**
+*	Display the results of a run
+*/
+static void DbgSymbenchDisplay (IN dbgSymbenchRun* run) {
+	unsigned int i;
+
+	DbgDisplayMessage ("Symbols of %s: %lu functions, %lu files, %lu line rows, %lu modules",
+		run->fixture, run->functions, run->files, run->rows, run->modules);
+	for (i = 0; i < DBG_SYMBENCH_METRICS; i++)
+		DbgDisplayMessage ("  %-26s %14.3f", _dbgSymbenchMetrics[i], run->results[i]);
+}
+
+/**
+*	Write results as JSON
+*/
+static BOOL DbgSymbenchWrite (IN const char* path, IN dbgSymbenchRun* runs, IN unsigned int count) {
+	FILE*        file;
+	unsigned int r;
+	unsigned int i;
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, path, "w"))
+		file = 0;
+#else
+	file = fopen (path, "w");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", path);
+		return FALSE;
+	}
+	fprintf (file, "{\n  \"runs\": [");
+	for (r = 0; r < count; r++) {
+		fprintf (file, "%s\n    {\n      \"fixture\": \"", r ? "," : "");
+		for (i = 0; runs[r].fixture[i]; i++) {
+			if (runs[r].fixture[i] == '"' || runs[r].fixture[i] == '\\')
+				fputc ('\\', file);
+			fputc (runs[r].fixture[i], file);
+		}
+		fprintf (file, "\",\n      \"functions\": %lu,\n      \"files\": %lu,\n      \"rows\": %lu,\n      \"modules\": %lu,\n      \"results\": {",
+			runs[r].functions, runs[r].files, runs[r].rows, runs[r].modules);
+		for (i = 0; i < DBG_SYMBENCH_METRICS; i++)
+			fprintf (file, "%s\n        \"%s\": %.3f", i ? "," : "", _dbgSymbenchMetrics[i], runs[r].results[i]);
+		fprintf (file, "\n      }\n    }");
+	}
+	fprintf (file, "\n  ]\n}\n");
+	fclose (file);
+	DbgDisplayMessage ("Symbol benchmark results written to %s", path);
+	return TRUE;
+}
+
+/**
+*	Run the symbol benchmark on fixtures. No session may be open.
+*	\param fixtures Fixture files
+*	\param count Number of fixtures
+*	\param path JSON results file or 0
+*	\ret TRUE if every fixture loaded and every lookup found its symbol
+*/
+BOOL DbgSymbolBench (IN const char** fixtures, IN unsigned int count, IN OPT const char* path) {
+	dbgSymbenchRun* runs;
+	unsigned int    i;
+	BOOL            result = TRUE;
+
+	if (DbgGetCurrentSession ()) {
+		DbgDisplayError ("The symbol benchmark uses the symbol handler of the session; close the session first");
+		return FALSE;
+	}
+	runs = (dbgSymbenchRun*) calloc (count ? count : 1, sizeof (dbgSymbenchRun));
+	if (!runs)
+		return FALSE;
+	for (i = 0; i < count && result; i++) {
+		DbgTraceBegin ("symbol", "benchmark", i);
+		result = DbgSymbenchRun (fixtures[i], &runs[i]);
+		DbgTraceEnd ("symbol", "benchmark");
+		DbgSymbenchDisplay (&runs[i]);
+	}
+	if (path && !DbgSymbenchWrite (path, runs, i))
+		result = FALSE;
+	free (runs);
+	return result;
+}
+
+/**
+*	Run the symbol benchmark on generated fixtures of 10 thousand to 10
+*	million functions. No session may be open. Each fixture is deleted
+*	once it has been measured.
+*	\param directory Directory for the fixtures
+*	\param path JSON results file or 0
+*	\ret TRUE if every run succeeded
+*/
+BOOL DbgSymbolBenchSweep (IN const char* directory, IN OPT const char* path) {
+	static const unsigned long sizes[] = {10000, 100000, 1000000, 10000000};
+	dbgSymbenchRun runs[sizeof (sizes) / sizeof (sizes[0])];
+	char           names[sizeof (sizes) / sizeof (sizes[0])][DBG_SYMBENCH_NAME];
+	unsigned int   count;
+	BOOL           result = TRUE;
+
+	if (DbgGetCurrentSession ()) {
+		DbgDisplayError ("The symbol benchmark uses the symbol handler of the session; close the session first");
+		return FALSE;
+	}
+	if (strlen (directory) + 32 > DBG_SYMBENCH_NAME)
+		return FALSE;
+	for (count = 0; count < sizeof (sizes) / sizeof (sizes[0]) && result; count++) {
+		unsigned long functions = sizes[count];
+
+		/* 50 functions per file and a module per 100 thousand functions */
+#ifdef _MSC_VER
+		sprintf_s (names[count], sizeof (names[count]), "%s/symbench-%lu.fix", directory, functions);
+#else
+		sprintf (names[count], "%s/symbench-%lu.fix", directory, functions);
+#endif
+		memset (&runs[count], 0, sizeof (dbgSymbenchRun));
+		runs[count].fixture = names[count];
+		result = DbgSymbolFixtureWrite (names[count], functions, functions / 50, 4, (unsigned int) (functions / 100000 + 1));
+		if (result) {
+			DbgTraceBegin ("symbol", "benchmark", count);
+			result = DbgSymbenchRun (names[count], &runs[count]);
+			DbgTraceEnd ("symbol", "benchmark");
+			DbgSymbenchDisplay (&runs[count]);
+		}
+		remove (names[count]);
+	}
+	if (path && !DbgSymbenchWrite (path, runs, count))
+		result = FALSE;
+	return result;
+}
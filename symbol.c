@@ -8,33 +8,151 @@
 	This component implements the symbol table API.
 */
 
+#include <string.h>
 #include "defs.h"
 
 /*
 	NDBG Symbol services
 */
 
+/**
+*	Count one lookup
+*/
+static BOOL DbgSymbolLookup (IN unsigned long long start, IN BOOL found) {
+	DbgStatsTime (DBG_TIMER_SYMBOL, DbgClockNow () - start);
+	if (!found)
+		DbgStatsCount (DBG_STAT_SYMBOL_MISSES, 1);
+	return found;
+}
+
 BOOL DbgSymbolFromName (IN dbgSession* in, IN const char* name, OUT dbgSymbol* symbol) {
-	return DbgSymbolFromNamePDB (name, symbol);
+	unsigned long long start = DbgClockNow ();
+	return DbgSymbolLookup (start, DbgSymbolFromNamePDB (&in->process, name, symbol));
 }
 
 BOOL DbgSymbolFromAddress (IN dbgSession* in, IN vaddr_t address, OUT dbgSymbol* symbol) {
-	return DbgSymbolFromAddressPDB (address, symbol);
+	unsigned long long start = DbgClockNow ();
+	return DbgSymbolLookup (start, DbgSymbolFromAddressPDB (&in->process, address, symbol));
 }
 
-BOOL DbgSymbolEnumerate (IN dbgSession* in) {
-	vaddr_t modbase;
+BOOL DbgSymbolName (IN dbgSession* in, IN vaddr_t address, OUT char* name, IN size_t size, OUT unsigned long* offset) {
+	unsigned long long start = DbgClockNow ();
+	return DbgSymbolLookup (start, DbgSymbolNamePDB (address, name, size, offset));
+}
+
+BOOL DbgSymbolUnwindInfo (IN dbgSession* in, IN vaddr_t pc, OUT dbgUnwindInfo* info) {
+	unsigned long long start = DbgClockNow ();
+	return DbgSymbolLookup (start, DbgUnwindInfoPDB (&in->process, pc, info));
+}
+
+unsigned int DbgSymbolStackWalk (IN dbgSession* in, IN dbgReadCache* cache, IN handle_t thread,
+                                 IN const dbgContext* context, OUT vaddr_t* frames, IN unsigned int max) {
+	return DbgStackWalkPDB (cache, thread, context, frames, max);
+}
+
+/**
+*	Enumerate functions matching a pattern
+*	\param in Debug session
+*	\param pattern Name with * and ? wildcards, optionally prefixed by "module!"
+*	\param proc Callback
+*	\param arg Callback argument
+*	\ret Number of functions passed to the callback
+*/
+unsigned int DbgSymbolEnumFunctions (IN dbgSession* in, IN const char* pattern, IN DbgSymbolEnumProc proc, IN void* arg) {
+	char         mask[256];
+	const char*  search = pattern;
+	unsigned int count;
+
+	/* every module unless one is named */
+	if (!strchr (pattern, '!')) {
+		if (strlen (pattern) + 3 > sizeof (mask))
+			return 0;
+		mask[0] = '*';
+		mask[1] = '!';
+#ifdef _MSC_VER
+		strcpy_s (mask + 2, sizeof (mask) - 2, pattern);
+#else
+		strcpy (mask + 2, pattern);
+#endif
+		search = mask;
+	}
+	DbgTraceBegin ("symbol", "enumerate functions", 0);
+	count = DbgEnumFunctionsPDB (search, proc, arg);
+	DbgTraceEnd ("symbol", "enumerate functions");
+	return count;
+}
 
+BOOL DbgSymbolEnumerate (IN dbgSession* in) {
+	BOOL result;
+	DbgTraceBegin ("symbol", "enumerate", 0);
 	DbgInitializePDB (&in->process);
 	DbgDisplayMessage("Loading symbols for : %s", in->process.name);
+	result = DbgSymbolLoadModule (in, in->process.name, 0, TRUE);
+	DbgTraceEnd ("symbol", "enumerate");
+	return result;
+}
+
+/**
+*	Load symbol table of a module and record it in the library list
+*	\param in Debug session
+*	\param name Module path; the module is searched for by file name if the path does not exist
+*	\param base Module base address or 0 to use the preferred base
+*	\param full TRUE to load source files, symbols and lines; the module becomes the process image
+*	\ret TRUE on success, FALSE on failure
+*/
+BOOL DbgSymbolLoadModule (IN dbgSession* in, IN const char* name, IN vaddr_t base, IN BOOL full) {
+	vaddr_t           modbase;
+	unsigned long     used;
+	dbgSharedLibrary* module;
+	BOOL              result = TRUE;
 
-	modbase = (vaddr_t) DbgLoadSymbolTablePDB (in->process.name, 0);
-	in->process.base = (vaddr_t) modbase;
+	DbgTraceBegin ("symbol", "load module", base);
+	modbase = (vaddr_t) DbgLoadSymbolTablePDB ((char*) name, base);
+	if (!modbase) {
+		const char* file = strrchr (name, '\\');
+		if (file)
+			modbase = (vaddr_t) DbgLoadSymbolTablePDB ((char*) file + 1, base);
+	}
+	if (full)
+		in->process.base = modbase;
+	if (!modbase) {
+		DbgTraceEnd ("symbol", "load module");
+		return FALSE;
+	}
+
+	/* charge arena growth while loading to the module */
+	used = arenaUsed (&in->process.heap);
+	if (full)
+		result = DbgLoadSymbolsPDB (&in->process);
+	DbgSymbolizeFlush (in);
+
+	/* the module may already be mapped by a load event */
+	module = DbgModuleAdd (in, name, modbase, 0);
+	if (module) {
+		module->memory = arenaUsed (&in->process.heap) - used;
+		DbgDisplayMessage ("%s: %lu KB symbol memory", module->name, module->memory / 1024);
+	}
+	DbgTraceEnd ("symbol", "load module");
+	return result;
+}
+
+/**
+*	Display symbol memory used by each module and the session totals
+*	\param in Debug session
+*/
+void DbgSymbolMemoryStats (IN dbgSession* in) {
+	unsigned int i;
 
-	if (modbase) {
-		return DbgLoadSymbolsPDB (&in->process);
+	DbgDisplayMessage ("Base        Size        Memory (KB)  Module");
+	for (i = 0; i < vectorSize (&in->process.moduleIndex); i++) {
+		dbgSharedLibrary* module = *(dbgSharedLibrary**) vectorAt (&in->process.moduleIndex, i);
+		DbgDisplayMessage ("0x%08x  0x%08lx  %11lu  %s", module->base, module->size, module->memory / 1024, module->name);
 	}
-	return FALSE;
+	DbgDisplayMessage ("Session arena: %lu KB used, %lu KB reserved",
+		arenaUsed (&in->process.heap) / 1024, in->process.heap.reserved / 1024);
+	DbgDisplayMessage ("Interned strings: %u unique (%lu KB), %lu of %lu lookups were duplicates",
+		in->process.strings.count, in->process.strings.bytes / 1024,
+		in->process.strings.hits, in->process.strings.lookups);
 }
 
 BOOL DbgSymbolFree (IN dbgSession* in) {
@@ -0,0 +1,403 @@
+/********************************************
+*
+*	symbolize.c - Batch symbolization
+*
+********************************************/
+
+/*
+	This component resolves many addresses at once to function, offset,
+	source file and line, for backtraces, profiles and log files.
+
+	The functions of all loaded modules and the line rows of all source
+	files are copied once into two tables sorted by address. A batch is
+	sorted as well and resolved in one sweep that only moves forward
+	through both tables, so n addresses cost a sort and n + m steps
+	instead of n searches of the symbol handler.
+
+	Addresses the tables do not cover are tried once with the symbol
+	handler. Those it cannot resolve either go into a sorted negative
+	cache, so every later batch skips them. The tables and the cache are
+	dropped when modules are loaded or unloaded and rebuilt on next use.
+
+	Large batches are split into ranges of the sorted input, one per
+	processor, and swept in parallel; the tables are only read while the
+	workers run. "ndbg symbolize <binary>" streams addresses from standard
+	input through this path.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_SYMBOLIZE_MISSES   (1024*1024)	/* most addresses in the negative cache */
+#define DBG_SYMBOLIZE_PARALLEL 16384		/* fewest addresses given to a worker */
+#define DBG_SYMBOLIZE_WORKERS  64
+#define DBG_SYMBOLIZE_CHUNK    65536		/* fewest addresses read from the stream per batch */
+#define DBG_SYMBOLIZE_NAME     256
+
+typedef struct _dbgSymbolizeRequest {
+	vaddr_t      address;
+	unsigned int index;		/* position in the caller's arrays */
+}dbgSymbolizeRequest;
+
+typedef struct _dbgSymbolizeSweep {
+	dbgProcess*          proc;
+	dbgSymbolizeRequest* requests;
+	unsigned int         count;
+	dbgSymbolization*    out;
+}dbgSymbolizeSweep;
+
+/**
+*	Initialize the tables of a session
+*	\param session Debug session
+*/
+void DbgSymbolizeInit (IN dbgSession* session) {
+	session->process.symbolTables = FALSE;
+	vectorInit (&session->process.functionTable, sizeof (dbgFunctionEntry));
+	vectorInit (&session->process.lineTable,     sizeof (dbgLineEntry));
+	vectorInit (&session->process.symbolMisses,  sizeof (vaddr_t));
+}
+
+/**
+*	Drop the tables and the negative cache; called when modules are loaded or unloaded
+*	\param session Debug session
+*/
+void DbgSymbolizeFlush (IN dbgSession* session) {
+	session->process.symbolTables = FALSE;
+	vectorClear (&session->process.functionTable);
+	vectorClear (&session->process.lineTable);
+	vectorClear (&session->process.symbolMisses);
+}
+
+/**
+*	Release the tables of a session
+*	\param session Debug session
+*/
+void DbgSymbolizeFree (IN dbgSession* session) {
+	session->process.symbolTables = FALSE;
+	vectorFree (&session->process.functionTable);
+	vectorFree (&session->process.lineTable);
+	vectorFree (&session->process.symbolMisses);
+}
+
+/* every table is sorted by its leading vaddr_t */
+static int DbgSymbolizeCompare (const void* a, const void* b) {
+	vaddr_t x = *(const vaddr_t*) a;
+	vaddr_t y = *(const vaddr_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+*	Index of the first entry above an address in a table sorted by its leading vaddr_t
+*/
+static unsigned int DbgSymbolizeUpper (IN vector* table, IN vaddr_t address) {
+	unsigned int low  = 0;
+	unsigned int high = vectorSize (table);
+
+	while (low < high) {
+		unsigned int middle = low + (high - low) / 2;
+		if (*(vaddr_t*) vectorAt (table, middle) <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/**
+*	Build the function and line tables if they were dropped
+*/
+static BOOL DbgSymbolizeBuild (IN dbgProcess* proc) {
+	ilistNode*   current;
+	unsigned int rows = 0;
+
+	if (proc->symbolTables)
+		return TRUE;
+	DbgTraceBegin ("symbol", "build tables", 0);
+	vectorClear (&proc->functionTable);
+	vectorClear (&proc->lineTable);
+
+	/* fails when no module is loaded; the table is then empty */
+	DbgFunctionTablePDB (proc, &proc->functionTable);
+	qsort (proc->functionTable.data, vectorSize (&proc->functionTable), sizeof (dbgFunctionEntry), DbgSymbolizeCompare);
+
+	for (current = proc->sourceFileList.first; current; current = current->next)
+		rows += vectorSize (&((dbgSourceFile*) current)->sourceLineList);
+	if (!vectorReserve (&proc->lineTable, rows)) {
+		DbgTraceEnd ("symbol", "build tables");
+		return FALSE;
+	}
+	for (current = proc->sourceFileList.first; current; current = current->next) {
+		dbgSourceFile* file = (dbgSourceFile*) current;
+		unsigned int   i;
+		for (i = 0; i < vectorSize (&file->sourceLineList); i++) {
+			dbgSourceLine* row = (dbgSourceLine*) vectorAt (&file->sourceLineList, i);
+			dbgLineEntry   entry;
+			entry.addr = row->addr;
+			entry.line = row->lineNumber;
+			entry.file = file->name;
+			vectorAdd (&proc->lineTable, &entry);
+		}
+	}
+	qsort (proc->lineTable.data, vectorSize (&proc->lineTable), sizeof (dbgLineEntry), DbgSymbolizeCompare);
+	proc->symbolTables = TRUE;
+	DbgTraceEnd ("symbol", "build tables");
+	return TRUE;
+}
+
+/**
+*	Function table of all loaded modules, built if it was dropped
+*	\param session Debug session
+*	\ret dbgFunctionEntry vector sorted by start, valid until modules change, or 0 on error
+*/
+vector* DbgSymbolizeFunctions (IN dbgSession* session) {
+	if (!DbgSymbolizeBuild (&session->process))
+		return 0;
+	return &session->process.functionTable;
+}
+
+/**
+*	Resolve a range of sorted requests against the tables. Runs on a worker.
+*/
+static int DbgSymbolizeSweepEntry (void* arg) {
+	dbgSymbolizeSweep* sweep     = (dbgSymbolizeSweep*) arg;
+	dbgProcess*        proc      = sweep->proc;
+	dbgFunctionEntry*  functions = (dbgFunctionEntry*) proc->functionTable.data;
+	dbgLineEntry*      lines     = (dbgLineEntry*) proc->lineTable.data;
+	unsigned int       nf        = vectorSize (&proc->functionTable);
+	unsigned int       nl        = vectorSize (&proc->lineTable);
+	unsigned int       f;
+	unsigned int       l;
+	unsigned int       i;
+
+	if (!sweep->count)
+		return 0;
+
+	/* cursors stop at the first entry above the address */
+	f = DbgSymbolizeUpper (&proc->functionTable, sweep->requests[0].address);
+	l = DbgSymbolizeUpper (&proc->lineTable,     sweep->requests[0].address);
+	for (i = 0; i < sweep->count; i++) {
+		vaddr_t           address = sweep->requests[i].address;
+		dbgSymbolization* result  = &sweep->out[sweep->requests[i].index];
+		dbgFunctionEntry* function;
+		vaddr_t           end;
+
+		memset (result, 0, sizeof (dbgSymbolization));
+		while (f < nf && functions[f].start <= address)
+			f++;
+		while (l < nl && lines[l].addr <= address)
+			l++;
+		if (!f)
+			continue;
+		function = &functions[f - 1];
+		if (function->size)
+			end = function->start + function->size;
+		else
+			end = f < nf ? functions[f].start : function->start + 1;
+		if (address >= end)
+			continue;
+		result->function = function->name;
+		result->offset   = address - function->start;
+		if (l && lines[l - 1].addr >= function->start) {
+			result->file = lines[l - 1].file;
+			result->line = lines[l - 1].line;
+		}
+	}
+	return 0;
+}
+
+/**
+*	Try the symbol handler for addresses the tables did not resolve and
+*	remember those it cannot resolve either
+*	\ret Number of addresses left unresolved
+*/
+static unsigned long DbgSymbolizeFallback (IN dbgProcess* proc, IN dbgSymbolizeRequest* requests,
+                                           IN unsigned int count, IN OUT dbgSymbolization* out) {
+	vector        found;		/* vaddr_t, new misses in order */
+	vaddr_t*      misses = (vaddr_t*) proc->symbolMisses.data;
+	unsigned int  nm     = vectorSize (&proc->symbolMisses);
+	unsigned int  m      = 0;
+	unsigned long left   = 0;
+	unsigned int  i;
+
+	vectorInit (&found, sizeof (vaddr_t));
+	for (i = 0; i < count; i++) {
+		vaddr_t           address = requests[i].address;
+		dbgSymbolization* result  = &out[requests[i].index];
+		char              name[DBG_SYMBOLIZE_NAME];
+		unsigned long     offset;
+
+		if (result->function)
+			continue;
+		if (i && requests[i - 1].address == address) {
+			*result = out[requests[i - 1].index];
+			continue;
+		}
+		while (m < nm && misses[m] < address)
+			m++;
+		if (m < nm && misses[m] == address)
+			continue;
+		if (DbgSymbolNamePDB (address, name, sizeof (name), &offset)) {
+			result->function = strtabIntern (&proc->strings, name);
+			result->offset   = offset;
+		}
+		else
+			vectorAdd (&found, &address);
+	}
+	for (i = 0; i < count; i++)
+		left += out[i].function == 0;
+
+	/* merge; new misses are sorted and not yet cached */
+	if (vectorSize (&found)) {
+		if (vectorSize (&proc->symbolMisses) + vectorSize (&found) > DBG_SYMBOLIZE_MISSES)
+			vectorClear (&proc->symbolMisses);
+		for (i = 0; i < vectorSize (&found) && i < DBG_SYMBOLIZE_MISSES; i++)
+			vectorAdd (&proc->symbolMisses, vectorAt (&found, i));
+		qsort (proc->symbolMisses.data, vectorSize (&proc->symbolMisses), sizeof (vaddr_t), DbgSymbolizeCompare);
+	}
+	vectorFree (&found);
+	return left;
+}
+
+/**
+*	Resolve a batch of addresses. Misses are not reported.
+*	\param session Debug session
+*	\param addresses Addresses in any order
+*	\param count Number of addresses
+*	\param out Output results, one per address in the same order
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgSymbolizeBatch (IN dbgSession* session, IN const vaddr_t* addresses, IN unsigned int count,
+                        OUT dbgSymbolization* out) {
+	dbgProcess*          proc = &session->process;
+	dbgSymbolizeRequest* requests;
+	dbgSymbolizeSweep    sweeps[DBG_SYMBOLIZE_WORKERS];
+	dbgWorker*           workers[DBG_SYMBOLIZE_WORKERS];
+	unsigned int         parts = DbgProcessorCount ();
+	unsigned long long   start = DbgClockNow ();
+	unsigned int         i;
+
+	if (!count)
+		return TRUE;
+	if (!DbgSymbolizeBuild (proc))
+		return FALSE;
+	requests = (dbgSymbolizeRequest*) malloc ((size_t) count * sizeof (dbgSymbolizeRequest));
+	if (!requests)
+		return FALSE;
+	DbgTraceBegin ("symbol", "symbolize", count);
+	for (i = 0; i < count; i++) {
+		requests[i].address = addresses[i];
+		requests[i].index   = i;
+	}
+	qsort (requests, count, sizeof (dbgSymbolizeRequest), DbgSymbolizeCompare);
+
+	/* contiguous ranges of the sorted input; the first runs on this thread */
+	if (parts > DBG_SYMBOLIZE_WORKERS)
+		parts = DBG_SYMBOLIZE_WORKERS;
+	if (parts > count / DBG_SYMBOLIZE_PARALLEL)
+		parts = count / DBG_SYMBOLIZE_PARALLEL ? count / DBG_SYMBOLIZE_PARALLEL : 1;
+	for (i = 0; i < parts; i++) {
+		unsigned int first = (unsigned int) ((unsigned long long) count * i / parts);
+		sweeps[i].proc     = proc;
+		sweeps[i].requests = requests + first;
+		sweeps[i].count    = (unsigned int) ((unsigned long long) count * (i + 1) / parts) - first;
+		sweeps[i].out      = out;
+		workers[i]         = i ? DbgWorkerCreate (DbgSymbolizeSweepEntry, &sweeps[i]) : 0;
+	}
+	DbgSymbolizeSweepEntry (&sweeps[0]);
+	for (i = 1; i < parts; i++) {
+		if (workers[i])
+			DbgWorkerJoin (workers[i]);
+		else
+			DbgSymbolizeSweepEntry (&sweeps[i]);
+	}
+
+	DbgStatsCount (DBG_STAT_SYMBOL_MISSES, DbgSymbolizeFallback (proc, requests, count, out));
+	DbgStatsTime (DBG_TIMER_SYMBOL, DbgClockNow () - start);
+	DbgTraceEnd ("symbol", "symbolize");
+	free (requests);
+	return TRUE;
+}
+
+/**
+*	Read addresses from standard input and write "function+offset file:line"
+*	lines to standard output until the input ends. Results are written per
+*	block, which is large enough to give every processor a worker's share
+*	of DBG_SYMBOLIZE_PARALLEL addresses. No session may be open.
+*	\param binary Program or module whose symbols are used
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgSymbolizeStream (IN const char* binary) {
+	dbgSession*       session;
+	vaddr_t*          addresses;
+	dbgSymbolization* results;
+	char              line[256];
+	unsigned int      chunk  = DbgProcessorCount ();
+	unsigned long     total  = 0;
+	BOOL              result = TRUE;
+
+	if (DbgGetCurrentSession ()) {
+		DbgDisplayError ("Symbolizing uses the symbol handler of the session; close the session first");
+		return FALSE;
+	}
+	session = DbgSessionNew ((char*) binary, 0, 0, 0, 0);
+	if (!session)
+		return FALSE;
+
+	/* one share per worker so a full block runs on every processor */
+	if (chunk > DBG_SYMBOLIZE_WORKERS)
+		chunk = DBG_SYMBOLIZE_WORKERS;
+	chunk *= DBG_SYMBOLIZE_PARALLEL;
+	if (chunk < DBG_SYMBOLIZE_CHUNK)
+		chunk = DBG_SYMBOLIZE_CHUNK;
+	addresses = (vaddr_t*) malloc ((size_t) chunk * sizeof (vaddr_t));
+	results   = (dbgSymbolization*) malloc ((size_t) chunk * sizeof (dbgSymbolization));
+	if (!addresses || !results || !DbgInitializePDB (&session->process)
+		|| !DbgSymbolLoadModule (session, binary, 0, TRUE)) {
+		DbgDisplayError ("Unable to load symbols of %s", binary);
+		result = FALSE;
+	}
+
+	while (result) {
+		unsigned int count = 0;
+		unsigned int i;
+
+		while (count < chunk && fgets (line, sizeof (line), stdin)) {
+			/* skip the rest of an overlong line */
+			if (!strchr (line, '\n')) {
+				int c;
+				while ((c = fgetc (stdin)) != EOF && c != '\n')
+					;
+			}
+			addresses[count++] = (vaddr_t) strtoul (line, 0, 16);
+		}
+		if (!count)
+			break;
+		if (!DbgSymbolizeBatch (session, addresses, count, results)) {
+			result = FALSE;
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			if (results[i].function)
+				printf ("%s+0x%lx", results[i].function, results[i].offset);
+			else
+				printf ("??");
+			if (results[i].file)
+				printf (" %s:%u\n", results[i].file, results[i].line);
+			else
+				printf (" ??:0\n");
+		}
+		fflush (stdout);
+		total += count;
+	}
+	if (result)
+		DbgDisplayMessage ("%lu addresses symbolized", total);
+
+	free (addresses);
+	free (results);
+	DbgSymbolFree (session);
+	DbgSessionDelete (session);
+	free (session);
+	return result;
+}
@@ -0,0 +1,260 @@
+/********************************************
+*
+*	trace.c - Timeline tracing
+*
+********************************************/
+
+/*
+	This component records begin and end events of spans in the debugger
+	and writes them as a Chrome trace (chrome://tracing, Perfetto).
+
+	Tracing is off unless started. The DbgTraceBegin and DbgTraceEnd
+	macros test one global before calling in, so a disabled span costs
+	a load and a branch.
+
+	Each thread appends to its own buffer, a list of fixed size chunks
+	that are never moved, so recording takes no lock. A chunk publishes
+	its event count after the event is written, which lets the writer
+	read buffers while their threads keep recording.
+
+	Every start begins a new generation. A thread releases the chunks
+	of an older generation itself, the next time it records, and the
+	writer skips buffers that have not caught up, so no chunk is freed
+	under a thread that is still appending to it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_TRACE_CHUNK      4096	/* events per chunk */
+#define DBG_TRACE_CHUNKS_MAX 256	/* chunks per thread; later events are dropped */
+
+typedef struct _dbgTraceEvent {
+	unsigned long long time;
+	const char*        category;	/* static strings */
+	const char*        name;
+	unsigned long      arg;
+	char               phase;		/* 'B' or 'E' */
+}dbgTraceEvent;
+
+typedef struct _dbgTraceChunk {
+	struct _dbgTraceChunk* volatile next;
+	dbgAtomic                       count;
+	dbgTraceEvent                   events[DBG_TRACE_CHUNK];
+}dbgTraceChunk;
+
+typedef struct _dbgTraceBuffer {
+	struct _dbgTraceBuffer* next;
+	unsigned long           thread;
+	const char*             threadName;
+	dbgTraceChunk*          first;
+	dbgTraceChunk*          last;
+	unsigned int            chunks;
+	unsigned long           dropped;
+	dbgAtomic               generation;	/* trace the chunks belong to */
+}dbgTraceBuffer;
+
+dbgAtomic _dbgTraceOn = 0;
+
+static DBG_THREAD_LOCAL dbgTraceBuffer* _traceLocal      = 0;
+static DBG_THREAD_LOCAL const char*     _traceThreadName = 0;
+static dbgTraceBuffer* volatile         _traceBuffers    = 0;
+static unsigned long long               _traceStart      = 0;
+static char*                            _tracePath       = 0;
+static dbgAtomic                        _traceGeneration = 0;
+
+/**
+*	Name the calling thread in traces. Safe to call with tracing off.
+*	\param name Static string
+*/
+void DbgTraceThread (IN const char* name) {
+	_traceThreadName = name;
+	if (_traceLocal)
+		_traceLocal->threadName = name;
+}
+
+/**
+*	Buffer of the calling thread
+*/
+static dbgTraceBuffer* DbgTraceLocal (void) {
+	dbgTraceBuffer* buffer = _traceLocal;
+
+	if (buffer)
+		return buffer;
+	buffer = (dbgTraceBuffer*) calloc (1, sizeof (dbgTraceBuffer));
+	if (!buffer)
+		return 0;
+	buffer->thread     = DbgThreadCurrentId ();
+	buffer->threadName = _traceThreadName;
+	do {
+		buffer->next = _traceBuffers;
+	} while (!DbgAtomicCasPtr (&_traceBuffers, buffer->next, buffer));
+	_traceLocal = buffer;
+	return buffer;
+}
+
+/**
+*	Record one event in the calling thread. Use DbgTraceBegin and DbgTraceEnd.
+*	\param category Static string
+*	\param name Static string
+*	\param phase 'B' or 'E'
+*	\param arg Value shown with the span
+*/
+void DbgTraceRecord (IN const char* category, IN const char* name, IN char phase, IN unsigned long arg) {
+	dbgTraceBuffer* buffer = DbgTraceLocal ();
+	dbgTraceChunk*  chunk;
+	dbgTraceEvent*  event;
+
+	if (!buffer)
+		return;
+	if (DbgAtomicLoad (&buffer->generation) != DbgAtomicLoad (&_traceGeneration)) {
+		/* events of an earlier trace; start over */
+		while (buffer->first) {
+			chunk = buffer->first;
+			buffer->first = chunk->next;
+			free (chunk);
+		}
+		buffer->last    = 0;
+		buffer->chunks  = 0;
+		buffer->dropped = 0;
+		DbgAtomicStore (&buffer->generation, DbgAtomicLoad (&_traceGeneration));
+	}
+	chunk = buffer->last;
+	if (!chunk || chunk->count == DBG_TRACE_CHUNK) {
+		if (buffer->chunks == DBG_TRACE_CHUNKS_MAX || !(chunk = (dbgTraceChunk*) malloc (sizeof (dbgTraceChunk)))) {
+			buffer->dropped++;
+			return;
+		}
+		chunk->next  = 0;
+		chunk->count = 0;
+		if (buffer->last)
+			DbgAtomicStorePtr (&buffer->last->next, chunk);
+		else
+			DbgAtomicStorePtr (&buffer->first, chunk);
+		buffer->last = chunk;
+		buffer->chunks++;
+	}
+	event = &chunk->events[chunk->count];
+	event->time     = DbgClockNow ();
+	event->category = category;
+	event->name     = name;
+	event->arg      = arg;
+	event->phase    = phase;
+	DbgAtomicStore (&chunk->count, chunk->count + 1);
+}
+
+/**
+*	Start recording
+*	\param path Chrome trace file written by DbgTraceStop or at exit
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgTraceStart (IN const char* path) {
+	char* copy;
+
+	if (_dbgTraceOn) {
+		DbgDisplayError ("Already tracing to %s", _tracePath);
+		return FALSE;
+	}
+	copy = (char*) malloc (strlen (path) + 1);
+	if (!copy)
+		return FALSE;
+#ifdef _MSC_VER
+	strcpy_s (copy, strlen (path) + 1, path);
+#else
+	strcpy (copy, path);
+#endif
+	free (_tracePath);
+	_tracePath  = copy;
+	_traceStart = DbgClockNow ();
+	DbgAtomicInc (&_traceGeneration);
+	DbgAtomicStore (&_dbgTraceOn, 1);
+	return TRUE;
+}
+
+/**
+*	Write a string as a JSON string body
+*/
+static void DbgTraceString (IN FILE* file, IN const char* str) {
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc ('\\', file);
+		if ((unsigned char) *str >= 0x20)
+			fputc (*str, file);
+	}
+}
+
+/**
+*	Stop recording and write the trace. Events recorded before the
+*	trace was started are left out.
+*	\ret TRUE if success, FALSE on error or if not tracing
+*/
+BOOL DbgTraceStop (void) {
+	dbgTraceBuffer* buffer;
+	FILE*           file;
+	unsigned long   events  = 0;
+	unsigned long   dropped = 0;
+	BOOL            first   = TRUE;
+
+	if (!_dbgTraceOn)
+		return FALSE;
+	DbgAtomicStore (&_dbgTraceOn, 0);
+
+#ifdef _MSC_VER
+	if (fopen_s (&file, _tracePath, "w"))
+		file = 0;
+#else
+	file = fopen (_tracePath, "w");
+#endif
+	if (!file) {
+		DbgDisplayError ("Unable to open '%s'", _tracePath);
+		return FALSE;
+	}
+	fprintf (file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	for (buffer = (dbgTraceBuffer*) DbgAtomicLoadPtr (&_traceBuffers); buffer; buffer = buffer->next) {
+		dbgTraceChunk* chunk;
+
+		/* the thread has not recorded in this trace; its chunks are stale */
+		if (DbgAtomicLoad (&buffer->generation) != DbgAtomicLoad (&_traceGeneration))
+			continue;
+		if (buffer->threadName) {
+			fprintf (file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %lu, \"args\": {\"name\": \"%s\"}}",
+				first ? "" : ",\n", buffer->thread, buffer->threadName);
+			first = FALSE;
+		}
+		for (chunk = (dbgTraceChunk*) DbgAtomicLoadPtr (&buffer->first); chunk; chunk = (dbgTraceChunk*) DbgAtomicLoadPtr (&chunk->next)) {
+			long count = DbgAtomicLoad (&chunk->count);
+			long i;
+			for (i = 0; i < count; i++) {
+				dbgTraceEvent* event = &chunk->events[i];
+				if (event->time < _traceStart)
+					continue;
+				fprintf (file, "%s{\"name\": \"", first ? "" : ",\n");
+				DbgTraceString (file, event->name);
+				fprintf (file, "\", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %lu",
+					event->category, event->phase, (double) (event->time - _traceStart) / 1000.0, buffer->thread);
+				if (event->phase == 'B')
+					fprintf (file, ", \"args\": {\"value\": %lu}", event->arg);
+				fprintf (file, "}");
+				first = FALSE;
+				events++;
+			}
+		}
+		dropped += buffer->dropped;
+	}
+	fprintf (file, "\n]}\n");
+	fclose (file);
+	DbgDisplayMessage ("%lu trace events written to %s; %lu dropped", events, _tracePath, dropped);
+	return TRUE;
+}
+
+/**
+*	Write the trace if one is being recorded. Called at exit.
+*/
+void DbgTraceFinish (void) {
+	if (_dbgTraceOn)
+		DbgTraceStop ();
+	free (_tracePath);
+	_tracePath = 0;
+}
@@ -0,0 +1,297 @@
+/********************************************
+*
+*	unwind.c - Stack unwinding
+*
+********************************************/
+
+/*
+	This component walks the stacks of target threads.
+
+	The frame layout of each function is looked up once through the
+	symbol manager and compiled into a small unwind plan that says where
+	the return address lives relative to esp or ebp. Plans are kept per
+	process, sorted by address, so unwinding a frame in a function seen
+	before costs one binary search. Frames without a plan are unwound
+	through the ebp chain when it looks valid.
+
+	Stack memory is read through a read cache, so the many small reads of
+	one walk fetch each stack page from the target only once.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define DBG_UNWIND_CACHE_LINES 256				/* pages held by the read cache */
+#define DBG_UNWIND_STACK_MAX   (16*1024*1024)	/* largest plausible frame */
+
+typedef enum _dbgUnwindKind {
+	DBG_UNWIND_FRAME,		/* ebp frame; return address at ebp+4 after the prolog */
+	DBG_UNWIND_FPO,			/* no frame pointer; return address at esp+frame after the prolog */
+	DBG_UNWIND_UNKNOWN		/* nothing known about the address; follow the ebp chain */
+}dbgUnwindKind;
+
+typedef struct _dbgUnwindPlan {
+	vaddr_t       start;
+	vaddr_t       end;
+	unsigned int  frame;	/* bytes between esp and the return address */
+	unsigned char prolog;
+	unsigned char kind;		/* dbgUnwindKind */
+}dbgUnwindPlan;
+
+/**
+*	Locate the plan covering an address, compiling it on first use
+*	\param session Debug session
+*	\param pc Code address
+*	\ret Plan or 0 if out of memory
+*/
+static dbgUnwindPlan* DbgUnwindPlan (IN dbgSession* session, IN vaddr_t pc) {
+	vector*       plans = &session->process.unwindPlans;
+	unsigned int  low   = 0;
+	unsigned int  high  = vectorSize (plans);
+	dbgUnwindInfo info;
+	dbgUnwindPlan plan;
+
+	/* last plan starting at or below pc */
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		if (((dbgUnwindPlan*) vectorAt (plans, mid))->start <= pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low && pc < ((dbgUnwindPlan*) vectorAt (plans, low - 1))->end) {
+		DbgStatsCount (DBG_STAT_UNWIND_HITS, 1);
+		return (dbgUnwindPlan*) vectorAt (plans, low - 1);
+	}
+	DbgStatsCount (DBG_STAT_UNWIND_MISSES, 1);
+
+	if (DbgSymbolUnwindInfo (session, pc, &info)) {
+		plan.start  = info.start;
+		plan.end    = info.start + info.size;
+		plan.prolog = (unsigned char) (info.prolog > 255 ? 255 : info.prolog);
+		plan.kind   = (unsigned char) (info.framePointer ? DBG_UNWIND_FRAME : DBG_UNWIND_FPO);
+		plan.frame  = (info.locals + info.regs) * 4;
+	}
+	else {
+		/* remember the miss; the same return address tends to show up on many stacks */
+		memset (&plan, 0, sizeof (dbgUnwindPlan));
+		plan.start = pc;
+		plan.end   = pc + 1;
+		plan.kind  = DBG_UNWIND_UNKNOWN;
+	}
+
+	/* keep the plans sorted; the new plan goes where the search ended */
+	if (!vectorAdd (plans, &plan))
+		return 0;
+	memmove (vectorAt (plans, low + 1), vectorAt (plans, low), (size_t) (vectorSize (plans) - low - 1) * sizeof (dbgUnwindPlan));
+	memcpy (vectorAt (plans, low), &plan, sizeof (dbgUnwindPlan));
+	return (dbgUnwindPlan*) vectorAt (plans, low);
+}
+
+/**
+*	Initialize unwind plan cache of a session
+*	\param session Debug session
+*/
+void DbgUnwindInit (IN dbgSession* session) {
+	vectorInit (&session->process.unwindPlans, sizeof (dbgUnwindPlan));
+}
+
+/**
+*	Drop compiled plans; called when modules are unloaded
+*	\param session Debug session
+*/
+void DbgUnwindFlush (IN dbgSession* session) {
+	vectorClear (&session->process.unwindPlans);
+}
+
+/**
+*	Read one dword of the target
+*/
+static BOOL DbgUnwindRead (IN dbgReadCache* cache, IN vaddr_t address, OUT vaddr_t* value) {
+	return DbgReadCacheRead (cache, address, value, sizeof (vaddr_t)) == sizeof (vaddr_t);
+}
+
+/**
+*	Unwind one frame through the ebp chain
+*/
+static BOOL DbgUnwindFramePointer (IN dbgReadCache* cache, IN const dbgFrame* frame, OUT dbgFrame* caller) {
+	if (frame->fp < frame->sp || frame->fp - frame->sp > DBG_UNWIND_STACK_MAX || (frame->fp & 3))
+		return FALSE;
+	if (!DbgUnwindRead (cache, frame->fp, &caller->fp) || !DbgUnwindRead (cache, frame->fp + 4, &caller->pc))
+		return FALSE;
+	caller->sp = frame->fp + 8;
+	return TRUE;
+}
+
+/**
+*	Unwind one frame
+*	\param session Debug session
+*	\param cache Read cache
+*	\param frame Frame to unwind
+*	\param caller Output frame of the caller
+*	\ret TRUE if the caller frame is valid
+*/
+static BOOL DbgUnwindStep (IN dbgSession* session, IN dbgReadCache* cache, IN const dbgFrame* frame, OUT dbgFrame* caller) {
+	dbgUnwindPlan* plan = DbgUnwindPlan (session, frame->pc);
+	unsigned long  offset;
+	unsigned int   frameSize;
+
+	if (!plan || plan->kind == DBG_UNWIND_UNKNOWN)
+		return DbgUnwindFramePointer (cache, frame, caller);
+
+	offset = frame->pc - plan->start;
+
+	if (plan->kind == DBG_UNWIND_FRAME) {
+		if (offset >= 3 || offset >= plan->prolog)
+			return DbgUnwindFramePointer (cache, frame, caller);
+		if (offset == 0) {
+			/* nothing pushed yet */
+			caller->fp = frame->fp;
+			caller->sp = frame->sp + 4;
+			return DbgUnwindRead (cache, frame->sp, &caller->pc);
+		}
+		if (offset == 1) {
+			/* ebp pushed but not yet loaded */
+			caller->sp = frame->sp + 8;
+			return DbgUnwindRead (cache, frame->sp, &caller->fp) && DbgUnwindRead (cache, frame->sp + 4, &caller->pc);
+		}
+		/* ebp loaded; the chain is valid */
+		return DbgUnwindFramePointer (cache, frame, caller);
+	}
+
+	/* frame pointer omitted; inside the prolog only the entry point is certain */
+	if (offset && offset < plan->prolog)
+		return DbgUnwindFramePointer (cache, frame, caller);
+	frameSize  = offset ? plan->frame : 0;
+	caller->fp = frame->fp;
+	caller->sp = frame->sp + frameSize + 4;
+	return DbgUnwindRead (cache, frame->sp + frameSize, &caller->pc);
+}
+
+/**
+*	Unwind the stack of a thread
+*	\param session Debug session
+*	\param cache Read cache of the target
+*	\param context Registers of the thread
+*	\param frames Output frames, starting with the current one
+*	\param max Size of frames
+*	\ret Number of frames
+*/
+unsigned int DbgUnwind (IN dbgSession* session, IN dbgReadCache* cache, IN const dbgContext* context,
+                        OUT dbgFrame* frames, IN unsigned int max) {
+	unsigned int count = 0;
+
+	if (!max)
+		return 0;
+	frames[0].pc = context->eip;
+	frames[0].sp = context->regs.esp;
+	frames[0].fp = context->regs.ebp;
+
+	for (count = 1; count < max && frames[count - 1].pc; count++) {
+		if (!DbgUnwindStep (session, cache, &frames[count - 1], &frames[count]))
+			break;
+		/* the stack only grows towards lower addresses */
+		if (frames[count].sp <= frames[count - 1].sp || !frames[count].pc)
+			break;
+	}
+	return count;
+}
+
+/**
+*	Display one frame
+*/
+static void DbgBacktraceFrame (IN dbgSession* session, IN unsigned int index, IN vaddr_t pc) {
+	char              name[128];
+	unsigned long     offset;
+	dbgSharedLibrary* module;
+
+	if (DbgSymbolName (session, pc, name, sizeof (name), &offset))
+		DbgDisplayMessage ("  #%-3u 0x%08x  %s+0x%lx", index, pc, name, offset);
+	else if ((module = DbgModuleFromAddress (session, pc)) != 0) {
+		/* no symbols; name the module like a symbol */
+		const char* file = strrchr (module->name, '\\');
+		DbgDisplayMessage ("  #%-3u 0x%08x  %s+0x%x", index, pc, file ? file + 1 : module->name, pc - module->base);
+	}
+	else
+		DbgDisplayMessage ("  #%-3u 0x%08x", index, pc);
+}
+
+/**
+*	Display the stack of one thread
+*/
+static unsigned int DbgBacktraceThread (IN dbgSession* session, IN dbgReadCache* cache, IN handle_t thread,
+                                        IN tid_t id, IN BOOL dbghelp, IN dbgFrame* frames, IN vaddr_t* pcs) {
+	dbgContext   context;
+	unsigned int count;
+	unsigned int i;
+
+	if (!DbgProcessRequest (DBG_REQ_GETCONTEXT, session, (void*) thread, &context, sizeof (dbgContext))) {
+		DbgDisplayMessage ("Thread %u: registers unavailable", id);
+		return 0;
+	}
+	if (dbghelp)
+		count = DbgSymbolStackWalk (session, cache, thread, &context, pcs, DBG_UNWIND_FRAMES);
+	else {
+		count = DbgUnwind (session, cache, &context, frames, DBG_UNWIND_FRAMES);
+		for (i = 0; i < count; i++)
+			pcs[i] = frames[i].pc;
+	}
+
+	DbgDisplayMessage ("Thread %u:", id);
+	for (i = 0; i < count; i++)
+		DbgBacktraceFrame (session, i, pcs[i]);
+	return count;
+}
+
+/**
+*	Display backtraces
+*	\param session Debug session
+*	\param all TRUE for every thread, FALSE for the current thread
+*	\param dbghelp TRUE to walk with the symbol handler instead of unwind plans
+*	\ret TRUE if success, FALSE on error
+*/
+BOOL DbgBacktrace (IN dbgSession* session, IN BOOL all, IN BOOL dbghelp) {
+	dbgReadCache       cache;
+	dbgFrame*          frames;
+	vaddr_t*           pcs;
+	ilistNode*         cur;
+	unsigned long long start = DbgClockNow ();
+	unsigned long      threads = 0;
+	unsigned long      total   = 0;
+	unsigned int       plans   = vectorSize (&session->process.unwindPlans);
+
+	frames = (dbgFrame*) malloc (DBG_UNWIND_FRAMES * sizeof (dbgFrame));
+	pcs    = (vaddr_t*) malloc (DBG_UNWIND_FRAMES * sizeof (vaddr_t));
+	if (!frames || !pcs || !DbgReadCacheInit (&cache, session, DBG_UNWIND_CACHE_LINES)) {
+		free (frames);
+		free (pcs);
+		DbgDisplayError ("Out of memory");
+		return FALSE;
+	}
+
+	if (!all) {
+		total   = DbgBacktraceThread (session, &cache, session->process.thread, session->process.id.tid, dbghelp, frames, pcs);
+		threads = 1;
+	}
+	else {
+		/* registers and stacks must not change while they are read */
+		for (cur = session->process.threadList.first; cur; cur = cur->next)
+			DbgProcessRequest (DBG_REQ_SUSPEND, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+		for (cur = session->process.threadList.first; cur; cur = cur->next, threads++) {
+			dbgThread* thread = (dbgThread*) cur;
+			total += DbgBacktraceThread (session, &cache, thread->thread, thread->id, dbghelp, frames, pcs);
+		}
+		for (cur = session->process.threadList.first; cur; cur = cur->next)
+			DbgProcessRequest (DBG_REQ_RESUME, session, (void*) ((dbgThread*) cur)->thread, 0, 0);
+	}
+
+	DbgDisplayMessage ("%lu threads, %lu frames in %.1f ms; %u new unwind plans, %lu of %lu page reads cached",
+		threads, total, (double) (DbgClockNow () - start) / 1000000.0,
+		vectorSize (&session->process.unwindPlans) - plans, cache.hits, cache.hits + cache.misses);
+
+	DbgReadCacheFree (&cache);
+	free (frames);
+	free (pcs);
+	return TRUE;
+}
@@ -0,0 +1,121 @@
+/************************************************************************
+*
+*	vector.c - Growable array
+*
+************************************************************************/
+
+#include <string.h>
+#include <malloc.h>
+#include "vector.h"
+#include "arena.h"
+
+#define VECTOR_MIN_CAPACITY 8
+
+/**
+* Initialize vector
+* \arg root Vector
+* \arg elementSize Size of each element in bytes
+*/
+vector* vectorInit (vector* root, unsigned int elementSize) {
+	root->count = 0;
+	root->capacity = 0;
+	root->elementSize = elementSize;
+	root->data = 0;
+	root->heap = 0;
+	return root;
+}
+
+/**
+* Initialize vector that takes its storage from an arena. Storage
+* is released with the arena; vectorFree only forgets it.
+*/
+vector* vectorInitArena (vector* root, unsigned int elementSize, struct _arena* heap) {
+	vectorInit (root, elementSize);
+	root->heap = heap;
+	return root;
+}
+
+/**
+* Grow storage to hold at least capacity elements
+* \ret 1 on success, 0 on error
+*/
+int vectorReserve (vector* root, unsigned int capacity) {
+
+	char* data;
+
+	if (capacity <= root->capacity)
+		return 1;
+	if (root->heap) {
+		// old storage stays in the arena; growth doubles so waste is bounded
+		data = (char*) arenaAlloc (root->heap, (unsigned long) capacity * root->elementSize);
+		if (data && root->count)
+			memcpy (data, root->data, (size_t) root->count * root->elementSize);
+	}
+	else
+		data = (char*) realloc (root->data, (size_t) capacity * root->elementSize);
+	if (!data)
+		return 0;
+	root->data = data;
+	root->capacity = capacity;
+	return 1;
+}
+
+/**
+* Adds element to end of vector
+* \arg data Element to copy or 0 to leave it uninitialized
+* \ret Pointer to new element or 0 on error
+*/
+void* vectorAdd (vector* root, const void* data) {
+
+	void* element;
+
+	if (root->count == root->capacity) {
+		unsigned int capacity = root->capacity ? root->capacity * 2 : VECTOR_MIN_CAPACITY;
+		if (!vectorReserve (root, capacity))
+			return 0;
+	}
+	element = vectorAt (root, root->count);
+	if (data)
+		memcpy (element, data, root->elementSize);
+	root->count++;
+	return element;
+}
+
+/**
+*	returns size of vector
+*/
+unsigned int vectorSize (vector* root) {
+	if (root)
+		return root->count;
+	return 0;
+}
+
+/**
+*	removes element, keeping the order of the remaining elements
+*/
+void vectorRemove (unsigned int index, vector* root) {
+
+	if (index >= root->count)
+		return;
+	memmove (vectorAt (root, index), vectorAt (root, index + 1),
+		(size_t) (root->count - index - 1) * root->elementSize);
+	root->count--;
+}
+
+/**
+*	removes all elements but keeps storage
+*/
+void vectorClear (vector* root) {
+	root->count = 0;
+}
+
+/**
+*	frees vector storage
+*/
+void vectorFree (vector* root) {
+	if (root->data && !root->heap)
+		free (root->data);
+	root->data = 0;
+	root->count = 0;
+	root->capacity = 0;
+}
@@ -0,0 +1,50 @@
+/************************************************************************
+*
+*	vector.h - Growable array
+*
+************************************************************************/
+
+#ifndef VECTOR_H_INCLUDED
+#define VECTOR_H_INCLUDED
+
+struct _arena;
+
+/**
+*	contiguous array of fixed size elements
+*/
+typedef struct _vector {
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int elementSize;
+	char*        data;
+	struct _arena* heap;	/* storage comes from this arena if set */
+}vector;
+
+/* element at index; index must be less than count */
+#define vectorAt(root,index) ((void*) ((root)->data + (size_t) (index) * (root)->elementSize))
+
+extern
+vector* vectorInit (vector* root, unsigned int elementSize);
+
+extern
+vector* vectorInitArena (vector* root, unsigned int elementSize, struct _arena* heap);
+
+extern
+int vectorReserve (vector* root, unsigned int capacity);
+
+extern
+void* vectorAdd (vector* root, const void* data);
+
+extern
+unsigned int vectorSize (vector* root);
+
+extern
+void vectorRemove (unsigned int index, vector* root);
+
+extern
+void vectorClear (vector* root);
+
+extern
+void vectorFree (vector* root);
+
+#endif